@@ -0,0 +1,235 @@
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QImage>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QOffscreenSurface>
+#include <QOpenGLContext>
+#include <QOpenGLFramebufferObject>
+#include <QOpenGLFunctions>
+#include <QProcess>
+#include <QProcessEnvironment>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+
+#include "batch_renderer.h"
+#include "renderer.h"
+#include "software_renderer.h"
+#include "trace.h"
+
+BatchRenderer::BatchRenderer() {
+  loader.interactive = false;
+  output_dir = ".";
+  size = 512;
+  software = false;
+}
+
+/**
+  * Read the jobs from a spec file
+  * {"output": "thumbnails", "size": 512, "jobs": [{"model": "bolt.stl",
+  *  "views": [[pitch, yaw, roll], ...], "turntable": 12, "alpha": 1.0,
+  *  "colorization": false, "edges": false, "sorting": false}]}
+  * An optional "renderer": "software" rasterizes on the CPU
+  * Angles are in degrees, a turntable adds views rotated around the y axis
+  * in equal steps. Relative paths are resolved against the spec's folder
+  * Input: const QString - path to the spec file
+  * Output: void, throws std::runtime_error on errors
+  */
+void BatchRenderer::loadSpec(const QString &path) {
+  QFile spec_file(path);
+  if (!spec_file.open(QIODevice::ReadOnly)) {
+    throw std::runtime_error("Failed to open batch spec " + path.toStdString());
+  }
+  QJsonDocument document(QJsonDocument::fromJson(spec_file.readAll()));
+  if (!document.isObject() || !document.object()["jobs"].isArray()) {
+    throw std::runtime_error("Batch spec has no list of jobs");
+  }
+  QJsonObject spec = document.object();
+  QDir folder = QFileInfo(path).absoluteDir();
+  output_dir = folder.absoluteFilePath(spec["output"].toString("."));
+  size = spec["size"].toInt(512);
+  software = software || spec["renderer"].toString() == "software";
+  if (size <= 0) {
+    throw std::runtime_error("Image size must be positive");
+  }
+  jobs.clear();
+  for (const QJsonValue &value : spec["jobs"].toArray()) {
+    QJsonObject object = value.toObject();
+    if (!object["model"].isString()) {
+      throw std::runtime_error("Missing field 'model' in batch job");
+    }
+    BatchJob job;
+    job.model = folder.absoluteFilePath(object["model"].toString());
+    job.name = object["name"].toString(QFileInfo(job.model).completeBaseName());
+    job.alpha = object["alpha"].toDouble(1.0);
+    job.colorization = object["colorization"].toBool(false);
+    job.draw_edges = object["edges"].toBool(false);
+    job.zsorting = object["sorting"].toBool(false);
+    for (const QJsonValue &angles : object["views"].toArray()) {
+      QJsonArray euler = angles.toArray();
+      if (euler.count() != 3) {
+        throw std::runtime_error("A view needs 3 angles");
+      }
+      job.views.push_back(QQuaternion::fromEulerAngles(euler.at(0).toDouble(), euler.at(1).toDouble(),
+                                                       euler.at(2).toDouble()));
+    }
+    int steps = object["turntable"].toInt(0);
+    for (int i = 0; i < steps; i++) {
+      job.views.push_back(QQuaternion::fromAxisAndAngle(0.0f, 1.0f, 0.0f, 360.0f * i / steps));
+    }
+    if (job.views.empty()) {
+      job.views.push_back(QQuaternion());
+    }
+    jobs.push_back(job);
+  }
+}
+
+/**
+  * Render every slices-th job, starting with job number slice
+  * Input: int - index of this process' slice
+  *        int - number of slices
+  * Output: int - number of images written
+  */
+int BatchRenderer::render(int slice, int slices) {
+  if (software) {
+    SoftwareRenderer renderer;
+    return renderJobs(slice, slices, [&](Scene &scene, const RenderSettings &settings) {
+      return renderer.render(scene, settings, size, size);
+    });
+  }
+  QOffscreenSurface surface;
+  surface.create();
+  QOpenGLContext context;
+  if (!context.create() || !context.makeCurrent(&surface)) {
+    throw std::runtime_error("Failed to create an offscreen OpenGL context");
+  }
+  int images = 0;
+  {
+    QOpenGLFramebufferObjectFormat format;
+    format.setAttachment(QOpenGLFramebufferObject::Depth);
+    format.setSamples(4);
+    QOpenGLFramebufferObject fbo(size, size, format);
+    SceneRenderer renderer;
+    fbo.bind();
+    renderer.initialize();
+    images = renderJobs(slice, slices, [&](Scene &scene, const RenderSettings &settings) {
+      // toImage() resolves through a temporary framebuffer
+      fbo.bind();
+      context.functions()->glViewport(0, 0, size, size);
+      renderer.render(scene, settings);
+      return fbo.toImage();
+    });
+    fbo.release();
+  }
+  context.doneCurrent();
+  return images;
+}
+
+/**
+  * Load the models of a slice of the jobs and save their views
+  * Each model is centred and scaled to fit the image. Images are written
+  * to <output>/<name>_<view>.png, failing jobs are reported and skipped
+  * Input: int - index of the slice
+  *        int - number of slices
+  *        std::function - draws a scene with the given settings
+  * Output: int - number of images written
+  */
+int BatchRenderer::renderJobs(int slice, int slices,
+                              const std::function<QImage(Scene &, const RenderSettings &)> &draw) {
+  QDir().mkpath(output_dir);
+  int images = 0;
+  for (int i = slice; i < (int)jobs.size(); i += slices) {
+    const BatchJob &job = jobs[i];
+    Scene scene;
+    try {
+      loader.colorization = job.colorization;
+      loader.upload_buffers = !software;
+      loader.addModel(scene, job.model, QMatrix4x4());
+      // The software renderer only rasterizes faces held in memory
+      if (software && (!scene.paged_models.empty() || !scene.point_clouds.empty())) {
+        throw std::runtime_error("Paged models and point clouds need the OpenGL renderer");
+      }
+    }
+    catch (const std::exception &e) {
+      std::cerr << job.model.toStdString() << ": " << e.what() << std::endl;
+      continue;
+    }
+    RenderSettings settings;
+    settings.alpha = job.alpha;
+    settings.colorization = job.colorization;
+    settings.draw_edges = job.draw_edges;
+    settings.zsorting = job.zsorting;
+    // Centre the model and fit its bounding sphere into the image
+    QVector3D low, high;
+    if (scene.bounds(low, high)) {
+      // A job adds a single model, as an instance, a paged model or a point cloud
+      QMatrix4x4 *transform = nullptr;
+      if (!scene.instances.empty()) {
+        transform = &scene.instances[0].transform;
+      }
+      else if (!scene.paged_models.empty()) {
+        transform = &scene.paged_models[0]->transform;
+      }
+      else if (!scene.point_clouds.empty()) {
+        transform = &scene.point_clouds[0]->transform;
+      }
+      if (transform) {
+        transform->translate(-(low + high) / 2);
+      }
+      float radius = (high - low).length() / 2;
+      settings.scale = radius > 0 ? 1 / radius : 1.0f;
+    }
+    for (int view = 0; view < (int)job.views.size(); view++) {
+      settings.rotation = job.views[view];
+      QString file = QString("%1/%2_%3.png").arg(output_dir).arg(job.name).arg(view, 3, 10, QChar('0'));
+      QImage image = draw(scene, settings);
+      TRACE_SCOPE("save image");
+      if (!image.save(file)) {
+        std::cerr << "Failed to write " << file.toStdString() << std::endl;
+        continue;
+      }
+      images++;
+    }
+    // Buffers of the hardware renderer belong to the current context
+    scene.clear();
+  }
+  return images;
+}
+
+/**
+  * Render the jobs in several processes
+  * Software GL rasterizes one context per process, so each process renders
+  * a slice of the jobs with a single rasterizer thread
+  * Input: int - number of processes
+  *        const QString - the executable to start
+  *        const QStringList - arguments selecting the spec and the options
+  * Output: int - number of images written by all processes
+  */
+int BatchRenderer::renderParallel(int processes, const QString &program, const QStringList &arguments) {
+  QProcessEnvironment environment = QProcessEnvironment::systemEnvironment();
+  environment.insert("LP_NUM_THREADS", "1");
+  std::vector<std::unique_ptr<QProcess>> workers;
+  for (int slice = 0; slice < processes; slice++) {
+    std::unique_ptr<QProcess> worker(new QProcess());
+    worker->setProcessEnvironment(environment);
+    worker->setProcessChannelMode(QProcess::ForwardedErrorChannel);
+    worker->start(program, QStringList(arguments) << "--slice" << QString::number(slice)
+                                                  << "--slices" << QString::number(processes));
+    workers.push_back(std::move(worker));
+  }
+  int images = 0;
+  for (std::unique_ptr<QProcess> &worker : workers) {
+    worker->waitForFinished(-1);
+    // Workers report "Rendered <n> images ..." on the last line
+    QList<QByteArray> words = worker->readAllStandardOutput().trimmed().split('\n').last().split(' ');
+    if (worker->exitStatus() != QProcess::NormalExit || words.size() < 2 || words[0] != "Rendered") {
+      std::cerr << "A batch worker failed" << std::endl;
+      continue;
+    }
+    images += words[1].toInt();
+  }
+  return images;
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <QImage>
+#include <QQuaternion>
+#include <QString>
+#include <QStringList>
+#include <functional>
+#include <vector>
+
+#include "model_loader.h"
+#include "renderer.h"
+
+/**
+  * A model and the views to render it from
+  */
+class BatchJob {
+public:
+  BatchJob() : alpha(1.0), colorization(false), draw_edges(false), zsorting(false) {}
+
+  QString model;
+  QString name;
+  std::vector<QQuaternion> views;
+  double alpha;
+  bool colorization;
+  bool draw_edges;
+  bool zsorting;
+};
+
+/**
+  * Renders models to PNG images without a window
+  * A spec file lists the jobs, each process renders every n-th job
+  * through an offscreen context with the same SceneRenderer as the viewer,
+  * or with the SoftwareRenderer on all cores of a single process
+  */
+class BatchRenderer {
+public:
+  BatchRenderer();
+  void loadSpec(const QString &path);
+  int render(int slice, int slices);
+  int renderParallel(int processes, const QString &program, const QStringList &arguments);
+
+  ModelLoader loader;
+  QString output_dir;
+  int size;
+  bool software;
+  std::vector<BatchJob> jobs;
+
+protected:
+  int renderJobs(int slice, int slices, const std::function<QImage(Scene &, const RenderSettings &)> &draw);
+};
@@ -0,0 +1,668 @@
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QMatrix4x4>
+#include <QTemporaryDir>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "bvh.h"
+#include "decompression.h"
+#include "deviation.h"
+#include "face.h"
+#include "mass_properties.h"
+#include "mesh_order.h"
+#include "model_loader.h"
+#include "normals.h"
+#include "occlusion.h"
+#include "point_cloud.h"
+#include "renderer.h"
+#include "scene.h"
+
+#ifndef BASELINE_PATH
+#define BASELINE_PATH "baseline.json"
+#endif
+
+static const double MIN_TIME = 0.5;   // seconds spent on each measurement
+static const int MIN_REPEATS = 3;
+static const double DEFAULT_THRESHOLD = 0.2;
+
+/**
+  * Throughput of one routine on one input size
+  */
+struct BenchmarkResult {
+  std::string name;
+  size_t faces;     // faces, triangles or normals processed per run
+  size_t bytes;     // input bytes per run, 0 if the input isn't a file
+  double seconds;   // fastest run
+  double facesPerSecond() const { return faces / seconds; }
+  double megabytesPerSecond() const { return bytes / seconds / 1e6; }
+};
+
+void usage(char **argv) {
+  std::cerr << "Usage: " << argv[0] << " [--baseline <file>] [--threshold <fraction>] [--filter <text>] [--update] [--strict]" << std::endl;
+  std::cerr << "  --baseline <file>       results to compare against (default " << BASELINE_PATH << ")" << std::endl;
+  std::cerr << "  --threshold <fraction>  allowed slowdown before failing, overrides the baseline file" << std::endl;
+  std::cerr << "  --filter <text>         only run benchmarks whose name contains the text" << std::endl;
+  std::cerr << "  --update                write the results to the baseline file instead of comparing" << std::endl;
+  std::cerr << "  --strict                fail for results that have no baseline" << std::endl;
+  exit(EXIT_FAILURE);
+}
+
+/**
+  * Generate closed, curved faces, a row of tori with
+  * 2 triangles per quad, so several components and all
+  * normal directions are present
+  * Input: int - approximate number of faces
+  * Output: std::vector<Face> - triangles with face normals
+  */
+std::vector<Face> generateFaces(int count) {
+  const int tori = 4;
+  int rings = std::max(3, (int)std::sqrt(count / (2.0 * tori)));
+  int sides = std::max(3, count / (2 * tori * rings));
+  std::vector<Face> faces;
+  faces.reserve(2 * tori * rings * sides);
+  auto point = [&](int torus, int ring, int side) {
+    double u = 2 * M_PI * (ring % rings) / rings, v = 2 * M_PI * (side % sides) / sides;
+    double radius = 2.0 + 0.75 * std::cos(v);
+    return QVector3D(torus * 6.0 + radius * std::cos(u), radius * std::sin(u), 0.75 * std::sin(v));
+  };
+  for (int torus = 0; torus < tori; torus++) {
+    for (int ring = 0; ring < rings; ring++) {
+      for (int side = 0; side < sides; side++) {
+        QVector3D a = point(torus, ring, side), b = point(torus, ring + 1, side);
+        QVector3D c = point(torus, ring + 1, side + 1), d = point(torus, ring, side + 1);
+        for (const std::vector<QVector3D> &corners : {std::vector<QVector3D>{a, b, c}, std::vector<QVector3D>{a, c, d}}) {
+          Face face;
+          face.vertices = corners;
+          face.normal.push_back(QVector3D::normal(corners[0], corners[1], corners[2]));
+          face.normals = true;
+          face.c = 1;
+          face.label = 0;
+          faces.push_back(face);
+        }
+      }
+    }
+  }
+  return faces;
+}
+
+/**
+  * Write faces in the STL dialect read by ModelLoader::loadStl
+  */
+void writeStl(const QString &path, const std::vector<Face> &faces) {
+  std::ofstream out(path.toStdString());
+  out << "solid Onshape\n";
+  for (const Face &face : faces) {
+    const QVector3D &n = face.normal[0];
+    out << "  facet normal " << n.x() << " " << n.y() << " " << n.z() << "\n";
+    out << "    outer loop\n";
+    for (const QVector3D &v : face.vertices)
+      out << "      vertex " << v.x() << " " << v.y() << " " << v.z() << "\n";
+    out << "    endloop\n";
+    out << "  endfacet\n";
+  }
+  out << "endsolid Onshape\n";
+}
+
+/**
+  * Write faces as an OBJ file with shared vertices and face normals
+  */
+void writeObj(const QString &path, const std::vector<Face> &faces) {
+  std::ofstream out(path.toStdString());
+  std::map<std::vector<float>, int> indices;
+  std::vector<std::vector<int>> corners;
+  for (const Face &face : faces) {
+    std::vector<int> face_corners;
+    for (const QVector3D &v : face.vertices) {
+      std::vector<float> key = {v.x(), v.y(), v.z()};
+      auto found = indices.find(key);
+      if (found == indices.end()) {
+        found = indices.insert(std::make_pair(key, (int)indices.size() + 1)).first;
+        out << "v " << v.x() << " " << v.y() << " " << v.z() << "\n";
+      }
+      face_corners.push_back(found->second);
+    }
+    corners.push_back(face_corners);
+  }
+  for (const Face &face : faces) {
+    const QVector3D &n = face.normal[0];
+    out << "vn " << n.x() << " " << n.y() << " " << n.z() << "\n";
+  }
+  for (size_t f = 0; f < faces.size(); f++) {
+    out << "f";
+    for (int corner : corners[f])
+      out << " " << corner << "//" << f + 1;
+    out << "\n";
+  }
+}
+
+/**
+  * Write faces in the viewer's JSON format
+  */
+void writeJson(const QString &path, const std::vector<Face> &faces) {
+  QJsonArray array;
+  for (const Face &face : faces)
+    array.append(face.toJson());
+  QFile file(path);
+  file.open(QIODevice::WriteOnly);
+  file.write(QJsonDocument(array).toJson(QJsonDocument::Compact));
+}
+
+#ifdef HAVE_ZSTD
+/**
+  * Compress a file into a single zstd frame with the library defaults,
+  * which write no checksum. The contents are padded to a size that isn't
+  * a multiple of the 1 MiB output chunks of DecompressingBuffer, so the
+  * decoder has to flush a partial chunk at the end of the input
+  * Input: const QString - path of the file to compress
+  *        const QString - path of the compressed file
+  * Output: QByteArray - the contents that were compressed
+  */
+QByteArray writeZstd(const QString &path, const QString &compressed_path) {
+  QFile file(path);
+  file.open(QIODevice::ReadOnly);
+  QByteArray contents = file.readAll();
+  if (contents.size() % (1 << 20) == 0)
+    contents.append('\n');
+  std::vector<char> compressed(ZSTD_compressBound(contents.size()));
+  size_t size = ZSTD_compress(compressed.data(), compressed.size(), contents.data(), contents.size(), 3);
+  if (ZSTD_isError(size))
+    throw std::runtime_error(std::string("zstd compression failed: ") + ZSTD_getErrorName(size));
+  QFile output(compressed_path);
+  output.open(QIODevice::WriteOnly);
+  output.write(compressed.data(), size);
+  return contents;
+}
+#endif
+
+/**
+  * Decompress a file and compare it with its original contents
+  * Input: const QString - path of the compressed file
+  *        const QByteArray - the original contents
+  * Output: void, throws std::runtime_error if they differ
+  */
+void checkRoundTrip(const QString &path, const QByteArray &original) {
+  std::unique_ptr<std::istream> input = openInputStream(path);
+  std::vector<char> contents;
+  char block[1 << 16];
+  while (input->read(block, sizeof(block)) || input->gcount() > 0)
+    contents.insert(contents.end(), block, block + input->gcount());
+  if (contents.size() != (size_t)original.size() || !std::equal(contents.begin(), contents.end(), original.data()))
+    throw std::runtime_error("Decompressing " + path.toStdString() + " gave " + std::to_string(contents.size()) +
+                             " bytes that differ from the " + std::to_string(original.size()) + " original bytes");
+}
+
+/**
+  * Time a routine, repeating it until enough time has passed
+  * The fastest run is kept, it is the least disturbed by other processes
+  * Input: std::function<void()> - the routine, after one warm-up run
+  * Output: double - seconds of the fastest run
+  */
+double measure(const std::function<void()> &run) {
+  run();
+  double best = 1e30, total = 0;
+  QElapsedTimer timer;
+  for (int repeat = 0; repeat < MIN_REPEATS || total < MIN_TIME; repeat++) {
+    timer.start();
+    run();
+    double seconds = timer.nsecsElapsed() / 1e9;
+    best = std::min(best, seconds);
+    total += seconds;
+  }
+  return best;
+}
+
+/**
+  * Runs the benchmarks, a benchmark is skipped if
+  * its name doesn't match the filter
+  */
+class BenchmarkSuite {
+public:
+  BenchmarkSuite(const std::string &filter) : filter(filter) {
+    loader.interactive = false;
+  }
+
+  void run();
+
+  std::vector<BenchmarkResult> results;
+
+protected:
+  bool selected(const std::string &name) const {
+    return name.find(filter) != std::string::npos;
+  }
+  void add(const std::string &name, size_t faces, size_t bytes, double seconds);
+  void benchmarkLoaders(int size);
+  void benchmarkColorize(int size);
+  void benchmarkMassProperties(int size);
+  void benchmarkDeviations(int size);
+  void benchmarkPointCloud(int size);
+  void benchmarkOcclusion(int size);
+  void benchmarkMeshOrder(int size);
+  void benchmarkSorting(int size);
+  void benchmarkFacing(int size);
+
+  std::string filter;
+  ModelLoader loader;
+  QTemporaryDir directory;
+};
+
+void BenchmarkSuite::add(const std::string &name, size_t faces, size_t bytes, double seconds) {
+  BenchmarkResult result = {name, faces, bytes, seconds};
+  results.push_back(result);
+  std::printf("%-28s %10.3f ms %12.0f faces/s", name.c_str(), seconds * 1e3, result.facesPerSecond());
+  if (bytes > 0)
+    std::printf(" %9.1f MB/s", result.megabytesPerSecond());
+  std::printf("\n");
+  std::fflush(stdout);
+}
+
+void BenchmarkSuite::run() {
+  for (int size : {1000, 10000, 100000}) {
+    benchmarkLoaders(size);
+    benchmarkSorting(size);
+  }
+  for (int size : {100000, 1000000}) {
+    benchmarkMassProperties(size);
+    benchmarkDeviations(size);
+    benchmarkOcclusion(size);
+    benchmarkMeshOrder(size);
+  }
+  // Labelling compares every pair of faces, larger inputs take minutes
+  for (int size : {1000, 4000})
+    benchmarkColorize(size);
+  for (int size : {100000, 1000000})
+    benchmarkFacing(size);
+  for (int size : {1000000, 10000000})
+    benchmarkPointCloud(size);
+}
+
+/**
+  * Parse generated STL, OBJ and JSON files, and decompress a zstd
+  * compressed STL file in builds with zstd
+  * Input: int - approximate number of faces
+  * Output: void
+  */
+void BenchmarkSuite::benchmarkLoaders(int size) {
+  std::string suffix = "/" + std::to_string(size);
+  std::vector<Face> faces = generateFaces(size);
+  QString stl = directory.filePath("model.stl"), obj = directory.filePath("model.obj");
+  QString json = directory.filePath("model.json");
+  if (selected("loadStl" + suffix)) {
+    writeStl(stl, faces);
+    double seconds = measure([&]() { loader.loadStl(stl); });
+    add("loadStl" + suffix, faces.size(), QFileInfo(stl).size(), seconds);
+  }
+  if (selected("loadObj" + suffix)) {
+    writeObj(obj, faces);
+    double seconds = measure([&]() { loader.loadObj(obj); });
+    add("loadObj" + suffix, faces.size(), QFileInfo(obj).size(), seconds);
+  }
+#ifdef HAVE_ZSTD
+  // Checks the decompressed contents as well, the run fails if they differ
+  if (selected("decompressZstd" + suffix)) {
+    writeStl(stl, faces);
+    QString zst = directory.filePath("model.stl.zst");
+    QByteArray original = writeZstd(stl, zst);
+    double seconds = measure([&]() { checkRoundTrip(zst, original); });
+    add("decompressZstd" + suffix, faces.size(), original.size(), seconds);
+  }
+#endif
+  if (selected("loadJson" + suffix) || selected("fromJson" + suffix)) {
+    writeJson(json, faces);
+    size_t bytes = QFileInfo(json).size();
+    if (selected("loadJson" + suffix)) {
+      double seconds = measure([&]() { loader.loadJson(json); });
+      add("loadJson" + suffix, faces.size(), bytes, seconds);
+    }
+    if (selected("fromJson" + suffix)) {
+      QFile file(json);
+      file.open(QIODevice::ReadOnly);
+      QJsonArray array = QJsonDocument::fromJson(file.readAll()).array();
+      double seconds = measure([&]() {
+        FaceCollection collection;
+        collection.fromJson(array);
+      });
+      add("fromJson" + suffix, faces.size(), bytes, seconds);
+    }
+  }
+}
+
+/**
+  * Label the connected components of a triangulated mesh
+  * Input: int - approximate number of faces
+  * Output: void
+  */
+void BenchmarkSuite::benchmarkColorize(int size) {
+  std::string name = "colorize/" + std::to_string(size);
+  if (!selected(name))
+    return;
+  FaceCollection mesh;
+  mesh.faces = generateFaces(size);
+  mesh.triangulate();
+  // Resetting the labels is negligible next to the pairwise search
+  double seconds = measure([&]() {
+    for (Face &face : mesh.faces)
+      face.label = 0;
+    mesh.colorize();
+  });
+  add(name, mesh.faces.size(), 0, seconds);
+}
+
+/**
+  * Compute the mass properties of every component and of the model
+  * Input: int - approximate number of faces
+  * Output: void
+  */
+void BenchmarkSuite::benchmarkMassProperties(int size) {
+  std::string name = "massProperties/" + std::to_string(size);
+  if (!selected(name))
+    return;
+  FaceCollection mesh;
+  mesh.faces = generateFaces(size);
+  mesh.triangulate();
+  std::vector<MassProperties> components;
+  MassProperties total;
+  double seconds = measure([&]() { computeMassProperties(mesh, components, total); });
+  add(name, mesh.faces.size(), 0, seconds);
+}
+
+/**
+  * Build the hierarchy of a reference and measure the distance of
+  * every vertex of a slightly larger copy to it
+  * Input: int - approximate number of faces of both models
+  * Output: void
+  */
+void BenchmarkSuite::benchmarkDeviations(int size) {
+  std::string name = "deviations/" + std::to_string(size);
+  if (!selected(name))
+    return;
+  FaceCollection reference, mesh;
+  reference.faces = generateFaces(size);
+  reference.triangulate();
+  mesh.faces = reference.faces;
+  for (Face &face : mesh.faces)
+    for (QVector3D &vertex : face.vertices)
+      vertex *= 1.001f;
+  mesh.triangulate();
+  std::vector<float> deviations;
+  DeviationStatistics statistics;
+  double seconds = measure([&]() {
+    TriangleBvh bvh(reference);
+    computeDeviations(mesh, bvh, false, deviations, statistics);
+  });
+  add(name, mesh.faces.size(), 0, seconds);
+}
+
+/**
+  * Build the octree of a point cloud sampled from the surface of a
+  * sphere, the point counts play the role of faces
+  * Input: int - number of points
+  * Output: void
+  */
+void BenchmarkSuite::benchmarkPointCloud(int size) {
+  std::string name = "pointCloud/" + std::to_string(size);
+  if (!selected(name))
+    return;
+  std::vector<QVector3D> points(size);
+  for (int i = 0; i < size; i++) {
+    // Fibonacci sphere, evenly spread points
+    double z = 1 - 2 * (i + 0.5) / size, r = std::sqrt(1 - z * z), phi = i * 2.399963229728653;
+    points[i] = QVector3D(r * std::cos(phi), r * std::sin(phi), z);
+  }
+  double seconds = measure([&]() {
+    std::vector<QVector3D> copy(points);
+    std::vector<float> colors;
+    PointCloud cloud(copy, colors, false);
+  });
+  add(name, size, 0, seconds);
+}
+
+/**
+  * Choose the clusters of a frame of eight copies of a model behind
+  * each other, the occluders are rasterized and the rest is tested
+  * Input: int - approximate number of faces of the model
+  * Output: void
+  */
+void BenchmarkSuite::benchmarkOcclusion(int size) {
+  std::string name = "occlusion/" + std::to_string(size);
+  if (!selected(name))
+    return;
+  FaceCollection mesh;
+  mesh.faces = generateFaces(size);
+  mesh.triangulate();
+  Scene scene;
+  int model = scene.addModel("generated", QByteArray(), mesh);
+  Model &generated = *scene.models[model];
+  buildClusters(generated.faces, generated.cluster_triangles, generated.clusters);
+  scene.addInstance(model, QMatrix4x4());
+  QVector3D low, high;
+  scene.bounds(low, high);
+  for (int i = 1; i < 8; i++) {
+    QMatrix4x4 transform;
+    transform.translate(0, 0, i * (high.z() - low.z()));
+    scene.addInstance(model, transform);
+  }
+  scene.bounds(low, high);
+  QVector3D extent = high - low;
+  QMatrix4x4 view_projection;
+  view_projection.scale(2 / std::max(extent.x(), extent.y()), 2 / std::max(extent.x(), extent.y()), 2 / extent.z());
+  view_projection.translate(-(low + high) / 2);
+  OcclusionCuller culler;
+  std::vector<ClusterDraw> occluders, visible;
+  double seconds = measure([&]() { culler.cull(scene, view_projection, 1024, 1024, occluders, visible); });
+  add(name, scene.instances.size() * generated.faces.triangleCount(), 0, seconds);
+}
+
+/**
+  * Reorder the triangles and vertices of a model for the vertex cache
+  * and less overdraw, the model is copied first, like a load copies it
+  * out of the file
+  * Input: int - approximate number of faces
+  * Output: void
+  */
+void BenchmarkSuite::benchmarkMeshOrder(int size) {
+  std::string name = "meshOrder/" + std::to_string(size);
+  if (!selected(name))
+    return;
+  FaceCollection mesh;
+  mesh.faces = generateFaces(size);
+  mesh.triangulate();
+  generateNormals(mesh, 30.0f);
+  double seconds = measure([&]() {
+    FaceCollection copy;
+    copy.positions = mesh.positions;
+    copy.face_offsets = mesh.face_offsets;
+    copy.face_corners = mesh.face_corners;
+    copy.triangles = mesh.triangles;
+    copy.triangle_faces = mesh.triangle_faces;
+    copy.vertex_normals = mesh.vertex_normals;
+    copy.corner_normals = mesh.corner_normals;
+    optimizeMeshOrder(copy);
+  });
+  add(name, mesh.triangleCount(), 0, seconds);
+}
+
+/**
+  * Compute depth keys of the visible triangles and sort them,
+  * the z-sorting stage of every frame
+  * Input: int - approximate number of faces
+  * Output: void
+  */
+void BenchmarkSuite::benchmarkSorting(int size) {
+  std::string name = "sortTriangles/" + std::to_string(size);
+  if (!selected(name))
+    return;
+  FaceCollection mesh;
+  mesh.faces = generateFaces(size);
+  mesh.triangulate();
+  Scene scene;
+  scene.addInstance(scene.addModel("generated", QByteArray(), mesh), QMatrix4x4());
+  RenderSettings settings;
+  settings.rotation = QQuaternion::fromEulerAngles(30, 45, 0);
+  QMatrix4x4 view = settings.viewMatrix();
+  std::vector<SortedTriangle> order;
+  double seconds = measure([&]() { SceneRenderer::sortTriangles(scene, view, order); });
+  add(name, mesh.triangleCount(), 0, seconds);
+}
+
+/**
+  * Classify normals as facing the camera or not
+  * Input: int - number of normals
+  * Output: void
+  */
+void BenchmarkSuite::benchmarkFacing(int size) {
+  std::string name = "isFacingCamera/" + std::to_string(size);
+  if (!selected(name))
+    return;
+  std::vector<QVector3D> normals(size);
+  for (int i = 0; i < size; i++) {
+    double u = 2 * M_PI * i / size, v = M_PI * ((i * 7919) % size) / size;
+    normals[i] = QVector3D(std::cos(u) * std::sin(v), std::sin(u) * std::sin(v), std::cos(v));
+  }
+  volatile int facing = 0;
+  double seconds = measure([&]() {
+    int count = 0;
+    for (const QVector3D &normal : normals)
+      count += SceneRenderer::isFacingCamera(normal);
+    facing = count;
+  });
+  add(name, size, 0, seconds);
+}
+
+/**
+  * Read the baseline throughputs
+  * Input: const QString - path to the baseline file
+  *        double - output, the threshold stored in the file
+  * Output: std::map<std::string, double> - faces per second by benchmark name
+  */
+std::map<std::string, double> readBaseline(const QString &path, double &threshold) {
+  std::map<std::string, double> baseline;
+  QFile file(path);
+  if (!file.open(QIODevice::ReadOnly))
+    return baseline;
+  QJsonObject json = QJsonDocument::fromJson(file.readAll()).object();
+  if (json.contains("threshold"))
+    threshold = json["threshold"].toDouble();
+  QJsonObject results = json["results"].toObject();
+  for (auto it = results.begin(); it != results.end(); ++it)
+    baseline[it.key().toStdString()] = it.value().toDouble();
+  return baseline;
+}
+
+/**
+  * Write the throughputs as the new baseline, results of
+  * benchmarks that weren't run are kept
+  * Input: const QString - path to the baseline file
+  *        double - allowed slowdown
+  *        const std::vector<BenchmarkResult> - the results
+  * Output: bool - false if the file can't be written
+  */
+bool writeBaseline(const QString &path, double threshold, const std::vector<BenchmarkResult> &results) {
+  double stored_threshold = threshold;
+  std::map<std::string, double> baseline = readBaseline(path, stored_threshold);
+  for (const BenchmarkResult &result : results)
+    baseline[result.name] = std::round(result.facesPerSecond());
+  QJsonObject json_results;
+  for (const auto &entry : baseline)
+    json_results[QString::fromStdString(entry.first)] = entry.second;
+  QJsonObject json;
+  json["threshold"] = threshold;
+  json["results"] = json_results;
+  QFile file(path);
+  if (!file.open(QIODevice::WriteOnly))
+    return false;
+  file.write(QJsonDocument(json).toJson());
+  return true;
+}
+
+int main(int argc, char **argv) {
+  QCoreApplication app(argc, argv);
+  QString baseline_path = BASELINE_PATH;
+  double threshold = -1;
+  std::string filter;
+  bool update = false, strict = false;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "--baseline" && i + 1 < argc)
+      baseline_path = argv[++i];
+    else if (arg == "--threshold" && i + 1 < argc)
+      threshold = std::atof(argv[++i]);
+    else if (arg == "--filter" && i + 1 < argc)
+      filter = argv[++i];
+    else if (arg == "--update")
+      update = true;
+    else if (arg == "--strict")
+      strict = true;
+    else
+      usage(argv);
+  }
+
+  BenchmarkSuite suite(filter);
+  try {
+    suite.run();
+  }
+  catch (const std::exception &e) {
+    std::cerr << e.what() << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  double stored_threshold = DEFAULT_THRESHOLD;
+  std::map<std::string, double> baseline = readBaseline(baseline_path, stored_threshold);
+  if (threshold < 0)
+    threshold = stored_threshold;
+  if (update) {
+    if (!writeBaseline(baseline_path, threshold, suite.results)) {
+      std::cerr << "Failed to write " << baseline_path.toStdString() << std::endl;
+      return EXIT_FAILURE;
+    }
+    std::cout << "Baseline written to " << baseline_path.toStdString() << std::endl;
+    return EXIT_SUCCESS;
+  }
+
+  // A benchmark regresses if its throughput drops below the baseline
+  // by more than the threshold, with --strict one without a baseline
+  // fails as well
+  int regressions = 0, missing = 0;
+  std::printf("\nCompared to %s (threshold %.0f%%):\n", baseline_path.toStdString().c_str(), threshold * 100);
+  for (const BenchmarkResult &result : suite.results) {
+    auto found = baseline.find(result.name);
+    if (found == baseline.end() || found->second <= 0) {
+      std::printf("%-28s no baseline\n", result.name.c_str());
+      missing++;
+      continue;
+    }
+    double ratio = result.facesPerSecond() / found->second;
+    bool regressed = ratio < 1 - threshold;
+    regressions += regressed;
+    std::printf("%-28s %+7.1f%%%s\n", result.name.c_str(), (ratio - 1) * 100, regressed ? "  REGRESSION" : "");
+  }
+  if (missing > 0) {
+    std::printf("%s: %d benchmarks have no baseline, record them with --update\n", strict ? "Error" : "Warning",
+                missing);
+  }
+  if (regressions > 0) {
+    std::printf("%d benchmarks regressed\n", regressions);
+  }
+  if (regressions > 0 || (strict && missing > 0)) {
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,20 @@
+QT_VERSION = 5
+QMAKE_CXXFLAGS += -std=c++11
+
+# Build with "qmake -qt=qt5 ../benchmarks && make" from a build folder,
+# run "./benchmarks --update" on the reference machine to record a new baseline
+TARGET = benchmarks
+CONFIG += console
+CONFIG -= app_bundle
+INCLUDEPATH += ..
+DEFINES += BASELINE_PATH=\\\"$$PWD/baseline.json\\\"
+
+HEADERS = ../bvh.h ../decompression.h ../deviation.h ../face.h ../mass_properties.h ../memory_budget.h ../mesh_order.h ../model_loader.h ../normals.h ../occlusion.h ../paged_model.h ../parallel.h ../ply.h ../point_cloud.h ../quantization.h ../renderer.h ../scene.h ../source_chunks.h ../trace.h ../triangulation.h
+SOURCES = benchmarks.cpp ../bvh.cpp ../decompression.cpp ../deviation.cpp ../face.cpp ../mass_properties.cpp ../memory_budget.cpp ../mesh_order.cpp ../model_loader.cpp ../normals.cpp ../occlusion.cpp ../paged_model.cpp ../parallel.cpp ../ply.cpp ../point_cloud.cpp ../quantization.cpp ../renderer.cpp ../scene.cpp ../source_chunks.cpp ../trace.cpp ../triangulation.cpp
+QT     += opengl widgets
+LIBS   += -lz
+
+zstd {
+  DEFINES += HAVE_ZSTD
+  LIBS += -lzstd
+}
@@ -0,0 +1,269 @@
+#include "bvh.h"
+#include "parallel.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+static const unsigned int LEAF_TRIANGLES = 4;
+static const size_t BVH_GRAIN = 1 << 14;
+static const int MAX_DEPTH = 64;
+
+/**
+  * Squared distance from a point to a box, 0 inside of it
+  */
+static float boxDistance(const BvhNode &node, const float point[3]) {
+  float distance = 0;
+  for (int dim = 0; dim < 3; dim++) {
+    float outside = std::max(std::max(node.low[dim] - point[dim], point[dim] - node.high[dim]), 0.0f);
+    distance += outside * outside;
+  }
+  return distance;
+}
+
+/**
+  * Point of a triangle nearest to a point, found from the Voronoi
+  * region of the triangle the point lies in
+  */
+static QVector3D closestOnTriangle(const QVector3D &p, const QVector3D &a, const QVector3D &b, const QVector3D &c) {
+  QVector3D ab = b - a, ac = c - a, ap = p - a;
+  float d1 = QVector3D::dotProduct(ab, ap), d2 = QVector3D::dotProduct(ac, ap);
+  if (d1 <= 0 && d2 <= 0) {
+    return a;
+  }
+  QVector3D bp = p - b;
+  float d3 = QVector3D::dotProduct(ab, bp), d4 = QVector3D::dotProduct(ac, bp);
+  if (d3 >= 0 && d4 <= d3) {
+    return b;
+  }
+  float vc = d1 * d4 - d3 * d2;
+  if (vc <= 0 && d1 >= 0 && d3 <= 0) {
+    return a + ab * (d1 / (d1 - d3));
+  }
+  QVector3D cp = p - c;
+  float d5 = QVector3D::dotProduct(ab, cp), d6 = QVector3D::dotProduct(ac, cp);
+  if (d6 >= 0 && d5 <= d6) {
+    return c;
+  }
+  float vb = d5 * d2 - d1 * d6;
+  if (vb <= 0 && d2 >= 0 && d6 <= 0) {
+    return a + ac * (d2 / (d2 - d6));
+  }
+  float va = d3 * d6 - d5 * d4;
+  if (va <= 0 && d4 - d3 >= 0 && d5 - d6 >= 0) {
+    return b + (c - b) * ((d4 - d3) / ((d4 - d3) + (d5 - d6)));
+  }
+  float sum = va + vb + vc;
+  if (sum <= 0) {
+    return a;  // degenerate triangle
+  }
+  return a + ab * (vb / sum) + ac * (vc / sum);
+}
+
+/**
+  * Build the hierarchy by splitting the triangles at the median of
+  * their centroids along the longest axis, down to a few triangles per
+  * leaf. The tree is balanced, so its depth stays logarithmic for any
+  * input. Nodes are stored depth first, the first child of an inner
+  * node follows it
+  * Input: const FaceCollection - triangulated mesh in either storage
+  * Output: throws MemoryBudgetExceeded
+  */
+TriangleBvh::TriangleBvh(const FaceCollection &mesh) : memory(ACCELERATION_MEMORY) {
+  TRACE_SCOPE("build bvh");
+  size_t n_triangles = mesh.triangleCount();
+  size_t n_nodes = 2 * (n_triangles / LEAF_TRIANGLES + 1);
+  // The centroids and boxes are only needed while building
+  memory.resize(n_triangles * (9 * sizeof(float) + sizeof(unsigned int) + 9 * sizeof(float)) +
+                n_nodes * sizeof(BvhNode));
+  if (n_triangles == 0) {
+    return;
+  }
+  std::vector<float> boxes(n_triangles * 9);  // low, high and centroid of every triangle
+  triangles.resize(n_triangles);
+  parallelChunks(n_triangles, BVH_GRAIN, [&](size_t, size_t begin, size_t end) {
+    for (size_t t = begin; t < end; t++) {
+      triangles[t] = t;
+      float *box = &boxes[t * 9];
+      for (int k = 0; k < 3; k++) {
+        QVector3D p = mesh.position(mesh.triangles[t * 3 + k]);
+        for (int dim = 0; dim < 3; dim++) {
+          box[dim] = k == 0 ? p[dim] : std::min(box[dim], p[dim]);
+          box[3 + dim] = k == 0 ? p[dim] : std::max(box[3 + dim], p[dim]);
+          box[6 + dim] = (k == 0 ? 0 : box[6 + dim]) + p[dim] / 3;
+        }
+      }
+    }
+  });
+
+  struct Range {
+    unsigned int parent;  // whose second child this is, or the node itself for the root
+    unsigned int begin, end;
+  };
+  std::vector<Range> stack;
+  Range root = {0, 0, (unsigned int)n_triangles};
+  stack.push_back(root);
+  nodes.reserve(n_nodes);
+  while (!stack.empty()) {
+    Range range = stack.back();
+    stack.pop_back();
+    unsigned int index = nodes.size();
+    if (index > 0 && range.parent + 1 != index) {
+      nodes[range.parent].first = index;
+    }
+    BvhNode node;
+    float centroid_low[3], centroid_high[3];
+    for (int dim = 0; dim < 3; dim++) {
+      node.low[dim] = centroid_low[dim] = std::numeric_limits<float>::max();
+      node.high[dim] = centroid_high[dim] = -std::numeric_limits<float>::max();
+    }
+    for (unsigned int i = range.begin; i < range.end; i++) {
+      const float *box = &boxes[triangles[i] * 9];
+      for (int dim = 0; dim < 3; dim++) {
+        node.low[dim] = std::min(node.low[dim], box[dim]);
+        node.high[dim] = std::max(node.high[dim], box[3 + dim]);
+        centroid_low[dim] = std::min(centroid_low[dim], box[6 + dim]);
+        centroid_high[dim] = std::max(centroid_high[dim], box[6 + dim]);
+      }
+    }
+    unsigned int count = range.end - range.begin;
+    if (count <= LEAF_TRIANGLES) {
+      node.first = range.begin;
+      node.count = count;
+      nodes.push_back(node);
+      continue;
+    }
+    int axis = 0;
+    for (int dim = 1; dim < 3; dim++) {
+      if (centroid_high[dim] - centroid_low[dim] > centroid_high[axis] - centroid_low[axis]) {
+        axis = dim;
+      }
+    }
+    unsigned int middle = range.begin + count / 2;
+    std::nth_element(triangles.begin() + range.begin, triangles.begin() + middle, triangles.begin() + range.end,
+                     [&](unsigned int a, unsigned int b) { return boxes[a * 9 + 6 + axis] < boxes[b * 9 + 6 + axis]; });
+    node.first = 0;  // set when the second child is added
+    node.count = 0;
+    nodes.push_back(node);
+    Range second = {index, middle, range.end};
+    Range first = {index, range.begin, middle};
+    stack.push_back(second);
+    stack.push_back(first);
+  }
+  std::vector<float>().swap(boxes);
+
+  corners.resize(n_triangles * 9);
+  parallelChunks(n_triangles, BVH_GRAIN, [&](size_t, size_t begin, size_t end) {
+    for (size_t i = begin; i < end; i++) {
+      for (int k = 0; k < 3; k++) {
+        QVector3D p = mesh.position(mesh.triangles[triangles[i] * 3 + k]);
+        for (int dim = 0; dim < 3; dim++) {
+          corners[i * 9 + k * 3 + dim] = p[dim];
+        }
+      }
+    }
+  });
+  memory.update(memoryUsage());
+}
+
+/**
+  * Find the point of the surface nearest to a point
+  * Children are visited nearest first and boxes farther than the best
+  * point so far are skipped. Among triangles at the same distance, e.g.
+  * at an edge, the one facing the point most directly gives the sign
+  * Input: const QVector3D - the query point
+  *        unsigned int - in and output, the leaf triangle found by the
+  *        previous query; nearby queries start from its distance
+  * Output: ClosestPoint - distance is infinite if the hierarchy is empty
+  */
+ClosestPoint TriangleBvh::closestPoint(const QVector3D &query, unsigned int &hint) const {
+  ClosestPoint result;
+  result.distance = std::numeric_limits<float>::infinity();
+  result.triangle = 0;
+  if (triangles.empty()) {
+    return result;
+  }
+  const float point[3] = {query.x(), query.y(), query.z()};
+  float best = std::numeric_limits<float>::infinity();
+  float best_alignment = 0;
+  unsigned int best_triangle = 0;
+  QVector3D best_point;
+  auto test = [&](unsigned int i) {
+    const float *p = &corners[i * 9];
+    QVector3D a(p[0], p[1], p[2]), b(p[3], p[4], p[5]), c(p[6], p[7], p[8]);
+    QVector3D nearest = closestOnTriangle(query, a, b, c);
+    float distance = (query - nearest).lengthSquared();
+    if (distance > best * (1 + 1e-5f)) {
+      return;
+    }
+    QVector3D normal = QVector3D::crossProduct(b - a, c - a);
+    float length = normal.length() * std::sqrt(distance);
+    float alignment = length > 0 ? std::fabs(QVector3D::dotProduct(query - nearest, normal)) / length : 0;
+    if (distance < best * (1 - 1e-5f) || alignment > best_alignment) {
+      best = std::min(best, distance);
+      best_alignment = alignment;
+      best_triangle = i;
+      best_point = nearest;
+    }
+  };
+  if (hint < triangles.size()) {
+    test(hint);
+  }
+
+  struct Entry {
+    unsigned int node;
+    float distance;
+  };
+  Entry stack[MAX_DEPTH];
+  int top = 0;
+  Entry current = {0, boxDistance(nodes[0], point)};
+  while (true) {
+    if (current.distance <= best) {
+      const BvhNode &node = nodes[current.node];
+      if (node.count > 0) {
+        for (unsigned int i = node.first; i < node.first + node.count; i++) {
+          test(i);
+        }
+      }
+      else {
+        Entry near = {current.node + 1, boxDistance(nodes[current.node + 1], point)};
+        Entry far = {node.first, boxDistance(nodes[node.first], point)};
+        if (far.distance < near.distance) {
+          std::swap(near, far);
+        }
+        if (far.distance <= best) {
+          stack[top++] = far;
+        }
+        current = near;
+        continue;
+      }
+    }
+    if (top == 0) {
+      break;
+    }
+    current = stack[--top];
+  }
+
+  const float *p = &corners[best_triangle * 9];
+  QVector3D normal = QVector3D::crossProduct(QVector3D(p[3] - p[0], p[4] - p[1], p[5] - p[2]),
+                                             QVector3D(p[6] - p[0], p[7] - p[1], p[8] - p[2]));
+  result.point = best_point;
+  result.distance = std::sqrt(best);
+  if (QVector3D::dotProduct(query - best_point, normal) < 0) {
+    result.distance = -result.distance;
+  }
+  result.triangle = triangles[best_triangle];
+  hint = best_triangle;
+  return result;
+}
+
+/**
+  * Bytes held by the hierarchy
+  * Input: void
+  * Output: size_t - nodes, corners and triangle indices
+  */
+size_t TriangleBvh::memoryUsage() const {
+  return nodes.capacity() * sizeof(BvhNode) + corners.capacity() * sizeof(float) +
+         triangles.capacity() * sizeof(unsigned int);
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <QVector3D>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "face.h"
+#include "memory_budget.h"
+
+/**
+  * A box of the hierarchy, either splitting into two children or
+  * holding a run of triangles
+  */
+struct BvhNode {
+  float low[3];
+  float high[3];
+  uint32_t first;  // first triangle of a leaf, second child of an inner node
+  uint32_t count;  // triangles of a leaf, 0 for inner nodes whose first child follows them
+};
+
+/**
+  * The point of a surface nearest to a query point
+  */
+struct ClosestPoint {
+  QVector3D point;
+  float distance;         // signed, negative behind the triangle
+  unsigned int triangle;  // of the mesh the hierarchy was built from
+};
+
+/**
+  * Bounding volume hierarchy over the triangles of a mesh for
+  * nearest point queries
+  * The triangle corners are copied in leaf order, so a query doesn't
+  * touch the mesh and the hierarchy can outlive it. Queries only read
+  * the hierarchy and can run on all cores at once
+  */
+class TriangleBvh {
+public:
+  TriangleBvh(const FaceCollection &mesh);
+
+  bool empty() const { return triangles.empty(); }
+  ClosestPoint closestPoint(const QVector3D &query, unsigned int &hint) const;
+  size_t memoryUsage() const;
+
+  std::vector<BvhNode> nodes;
+  std::vector<float> corners;           // nine floats per triangle in leaf order
+  std::vector<unsigned int> triangles;  // mesh triangle of every leaf triangle
+
+protected:
+  MemoryReservation memory;
+};
@@ -0,0 +1,285 @@
+#include "decompression.h"
+#include "trace.h"
+
+#include <QFile>
+#include <cstring>
+#include <zlib.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+static const size_t INPUT_CHUNK = 1 << 18;
+static const size_t OUTPUT_CHUNK = 1 << 20;
+static const size_t QUEUED_CHUNKS = 4;
+
+DecompressingBuffer::DecompressingBuffer(const std::string &path, Compression compression)
+  : input(path.c_str(), std::ios::binary), compression(compression), finished(false), stopping(false) {
+  setg(0, 0, 0);
+  worker = std::thread(&DecompressingBuffer::run, this);
+}
+
+DecompressingBuffer::~DecompressingBuffer() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  changed.notify_all();
+  worker.join();
+}
+
+/**
+  * Hand the current chunk back to the worker and wait for the next one
+  * Input: void
+  * Output: int_type - the next character or end of file
+  */
+DecompressingBuffer::int_type DecompressingBuffer::underflow() {
+  if (gptr() < egptr()) {
+    return traits_type::to_int_type(*gptr());
+  }
+  std::unique_lock<std::mutex> lock(mutex);
+  if (!current.empty()) {
+    free_chunks.push_back(std::vector<char>());
+    free_chunks.back().swap(current);
+    changed.notify_all();
+  }
+  changed.wait(lock, [this](){ return !ready.empty() || finished; });
+  if (ready.empty()) {
+    if (!error.empty()) {
+      throw DecompressionError(error);
+    }
+    return traits_type::eof();
+  }
+  current.swap(ready.front());
+  ready.pop_front();
+  changed.notify_all();
+  setg(current.data(), current.data(), current.data() + current.size());
+  return traits_type::to_int_type(*gptr());
+}
+
+/**
+  * Get an empty chunk, waiting while the reader is behind
+  * Input: std::vector<char> - output, the chunk
+  * Output: bool - false if the reader is gone
+  */
+bool DecompressingBuffer::takeFreeChunk(std::vector<char> &chunk) {
+  std::unique_lock<std::mutex> lock(mutex);
+  changed.wait(lock, [this](){ return stopping || ready.size() < QUEUED_CHUNKS; });
+  if (stopping) {
+    return false;
+  }
+  if (!free_chunks.empty()) {
+    chunk.swap(free_chunks.back());
+    free_chunks.pop_back();
+  }
+  chunk.resize(OUTPUT_CHUNK);
+  return true;
+}
+
+/**
+  * Queue a filled chunk for the reader
+  * Input: std::vector<char> - the chunk, resized to its contents
+  * Output: bool - false if the reader is gone
+  */
+bool DecompressingBuffer::pushChunk(std::vector<char> &chunk) {
+  std::lock_guard<std::mutex> lock(mutex);
+  if (stopping) {
+    return false;
+  }
+  if (!chunk.empty()) {
+    ready.push_back(std::vector<char>());
+    ready.back().swap(chunk);
+    changed.notify_all();
+  }
+  return true;
+}
+
+/**
+  * Worker loop, decompresses the whole file into queued chunks
+  */
+void DecompressingBuffer::run() {
+  setTraceThreadName("decompression");
+  TRACE_SCOPE("decompress");
+  try {
+    if (!input) {
+      throw DecompressionError("File not found");
+    }
+    if (compression == GZIP_COMPRESSION) {
+      inflateGzip();
+    }
+    else {
+      decompressZstd();
+    }
+  }
+  catch (const DecompressionError &e) {
+    std::lock_guard<std::mutex> lock(mutex);
+    error = e.what();
+  }
+  std::lock_guard<std::mutex> lock(mutex);
+  finished = true;
+  changed.notify_all();
+}
+
+/**
+  * Read the next block of compressed input
+  * Input: std::vector<char> - buffer for the block
+  * Output: size_t - number of bytes read, 0 at the end of the file
+  */
+static size_t readInput(std::ifstream &input, std::vector<char> &block){
+  input.read(block.data(), block.size());
+  return input.gcount();
+}
+
+/**
+  * Inflate gzip data, concatenated gzip members are read one after another
+  */
+void DecompressingBuffer::inflateGzip() {
+  z_stream stream;
+  stream.zalloc = Z_NULL;
+  stream.zfree = Z_NULL;
+  stream.opaque = Z_NULL;
+  stream.next_in = Z_NULL;
+  stream.avail_in = 0;
+  // 32 selects automatic detection of the gzip or zlib header
+  if (inflateInit2(&stream, 15 + 32) != Z_OK) {
+    throw DecompressionError("Failed to initialize zlib");
+  }
+  std::vector<char> in(INPUT_CHUNK), out;
+  bool member_ended = false, input_ended = false;
+  while (!input_ended && takeFreeChunk(out)) {
+    stream.next_out = (Bytef *)out.data();
+    stream.avail_out = out.size();
+    while (stream.avail_out > 0) {
+      if (stream.avail_in == 0) {
+        stream.avail_in = readInput(input, in);
+        stream.next_in = (Bytef *)in.data();
+        if (stream.avail_in == 0) {
+          input_ended = true;
+          break;
+        }
+      }
+      if (member_ended) {
+        inflateReset(&stream);
+        member_ended = false;
+      }
+      int status = inflate(&stream, Z_NO_FLUSH);
+      if (status == Z_STREAM_END) {
+        member_ended = true;
+      }
+      else if (status != Z_OK) {
+        inflateEnd(&stream);
+        throw DecompressionError("Compressed file is corrupted");
+      }
+    }
+    out.resize(out.size() - stream.avail_out);
+    if (!pushChunk(out)) {
+      break;
+    }
+  }
+  inflateEnd(&stream);
+  if (input_ended && !member_ended) {
+    throw DecompressionError("Compressed file is truncated");
+  }
+}
+
+/**
+  * Decompress zstd frames, available if built with HAVE_ZSTD
+  */
+void DecompressingBuffer::decompressZstd() {
+#ifdef HAVE_ZSTD
+  ZSTD_DStream *stream = ZSTD_createDStream();
+  ZSTD_initDStream(stream);
+  std::vector<char> in(INPUT_CHUNK), out;
+  ZSTD_inBuffer in_buffer = {in.data(), 0, 0};
+  size_t status = 0;
+  bool input_ended = false, flushed = false;
+  while (!flushed && takeFreeChunk(out)) {
+    ZSTD_outBuffer out_buffer = {out.data(), out.size(), 0};
+    while (out_buffer.pos < out_buffer.size) {
+      if (!input_ended && in_buffer.pos == in_buffer.size) {
+        in_buffer.size = readInput(input, in);
+        in_buffer.pos = 0;
+        input_ended = in_buffer.size == 0;
+      }
+      size_t written = out_buffer.pos;
+      size_t hint = ZSTD_decompressStream(stream, &out_buffer, &in_buffer);
+      if (ZSTD_isError(hint)) {
+        ZSTD_freeDStream(stream);
+        throw DecompressionError(std::string("Compressed file is corrupted: ") + ZSTD_getErrorName(hint));
+      }
+      // The decoder can still hold output of the last block when the
+      // input ends, it is done once a call without input adds nothing.
+      // That call already expects the next frame, so its hint is ignored
+      if (input_ended && out_buffer.pos == written) {
+        flushed = true;
+        break;
+      }
+      status = hint;
+    }
+    out.resize(out_buffer.pos);
+    if (!pushChunk(out)) {
+      break;
+    }
+  }
+  ZSTD_freeDStream(stream);
+  // A non-zero hint after flushing means the last frame is incomplete
+  if (flushed && status != 0) {
+    throw DecompressionError("Compressed file is truncated");
+  }
+#else
+  throw DecompressionError("zstd compressed files are not supported by this build");
+#endif
+}
+
+DecompressingStream::DecompressingStream(const std::string &path, Compression compression)
+  : std::istream(&buffer), buffer(path, compression) {
+  exceptions(std::ios::badbit);
+}
+
+/**
+  * Detect a compressed file by its magic bytes
+  * Input: const QString - path to the file
+  * Output: Compression - the compression format of the file
+  */
+Compression detectCompression(const QString &path){
+  QFile file(path);
+  if(!file.open(QIODevice::ReadOnly)){
+    return NO_COMPRESSION;
+  }
+  QByteArray magic = file.read(4);
+  if(magic.startsWith("\x1f\x8b")){
+    return GZIP_COMPRESSION;
+  }
+  if(magic == QByteArray("\x28\xb5\x2f\xfd", 4)){
+    return ZSTD_COMPRESSION;
+  }
+  return NO_COMPRESSION;
+}
+
+/**
+  * Name of a file without the suffix of its compression
+  * Input: const QString - path to the file, e.g. part.stl.gz
+  * Output: QString - the path without .gz, .zst or .zstd, e.g. part.stl
+  */
+QString uncompressedName(const QString &path){
+  for(const char *suffix : {".gz", ".zst", ".zstd"}){
+    if(path.endsWith(suffix, Qt::CaseInsensitive)){
+      return path.left(path.length() - strlen(suffix));
+    }
+  }
+  return path;
+}
+
+/**
+  * Open a file for reading, decompressing it on the fly if needed
+  * Input: const QString - path to the file
+  * Output: std::unique_ptr<std::istream> - the stream, in a failed state
+  *         if the file can't be opened
+  */
+std::unique_ptr<std::istream> openInputStream(const QString &path){
+  std::string name = path.toUtf8().constData();
+  Compression compression = detectCompression(path);
+  if(compression == NO_COMPRESSION){
+    return std::unique_ptr<std::istream>(new std::ifstream(name.c_str()));
+  }
+  return std::unique_ptr<std::istream>(new DecompressingStream(name, compression));
+}
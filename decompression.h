@@ -0,0 +1,71 @@
+#pragma once
+
+#include <QString>
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <istream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+enum Compression { NO_COMPRESSION, GZIP_COMPRESSION, ZSTD_COMPRESSION };
+
+/**
+  * A compressed file that is corrupted or can't be decompressed
+  */
+class DecompressionError : public std::runtime_error {
+public:
+  DecompressionError(const std::string &message) : std::runtime_error(message) {}
+};
+
+/**
+  * Stream buffer that decompresses a file on a worker thread
+  * The worker fills a few fixed-size chunks ahead of the reader, so
+  * decompression overlaps with parsing and the uncompressed data is
+  * never held as a whole
+  */
+class DecompressingBuffer : public std::streambuf {
+public:
+  DecompressingBuffer(const std::string &path, Compression compression);
+  ~DecompressingBuffer();
+
+protected:
+  int_type underflow() override;
+  void run();
+  void inflateGzip();
+  void decompressZstd();
+  bool pushChunk(std::vector<char> &chunk);
+  bool takeFreeChunk(std::vector<char> &chunk);
+
+  std::ifstream input;
+  Compression compression;
+  std::thread worker;
+  std::mutex mutex;
+  std::condition_variable changed;
+  std::deque<std::vector<char>> ready;
+  std::vector<std::vector<char>> free_chunks;
+  std::vector<char> current;
+  std::string error;
+  bool finished;
+  bool stopping;
+};
+
+/**
+  * Input stream over a compressed file
+  * Decompression errors are thrown as DecompressionError from reads
+  */
+class DecompressingStream : public std::istream {
+public:
+  DecompressingStream(const std::string &path, Compression compression);
+
+protected:
+  DecompressingBuffer buffer;
+};
+
+Compression detectCompression(const QString &path);
+QString uncompressedName(const QString &path);
+std::unique_ptr<std::istream> openInputStream(const QString &path);
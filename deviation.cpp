@@ -0,0 +1,106 @@
+#include "deviation.h"
+#include "parallel.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <limits>
+
+static const size_t DEVIATION_GRAIN = 1 << 12;
+
+/**
+  * Sums over the distances of one chunk
+  */
+struct DeviationSums {
+  DeviationSums()
+    : lowest(std::numeric_limits<double>::max()), highest(-std::numeric_limits<double>::max()), absolute(0),
+      squared(0) {}
+
+  double lowest;
+  double highest;
+  double absolute;
+  double squared;
+};
+
+/**
+  * Measure the signed distance of every vertex or every face of a model
+  * to the nearest point of a reference surface
+  * Both are compared in their own coordinates, instance transforms are
+  * not applied. Faces are measured at the average of their corners.
+  * Queries run on all cores over fixed chunks; consecutive vertices are
+  * usually close to each other, so every query starts from the triangle
+  * the previous one found. The sums are merged in chunk order, so the
+  * statistics don't depend on the number of threads
+  * Input: const FaceCollection - triangulated mesh that is measured
+  *        const TriangleBvh - hierarchy of the reference surface
+  *        bool - one distance per face instead of per vertex
+  *        std::vector<float> - output, by position index or by face
+  *        DeviationStatistics - output
+  * Output: void
+  */
+void computeDeviations(const FaceCollection &mesh, const TriangleBvh &reference, bool per_face,
+                       std::vector<float> &deviations, DeviationStatistics &statistics) {
+  TRACE_SCOPE("deviations");
+  size_t count = per_face ? mesh.faces.size() : mesh.vertexCount();
+  deviations.assign(count, 0.0f);
+  statistics = DeviationStatistics();
+  if (count == 0 || reference.empty()) {
+    return;
+  }
+  std::vector<DeviationSums> chunk_sums(chunkCount(count, DEVIATION_GRAIN));
+  parallelChunks(count, DEVIATION_GRAIN, [&](size_t chunk, size_t begin, size_t end) {
+    DeviationSums &sums = chunk_sums[chunk];
+    unsigned int hint = reference.triangles.size();
+    for (size_t i = begin; i < end; i++) {
+      QVector3D point;
+      if (per_face) {
+        unsigned int first = mesh.face_offsets[i], last = mesh.face_offsets[i + 1];
+        for (unsigned int c = first; c < last; c++) {
+          point += mesh.position(mesh.face_corners[c]);
+        }
+        point /= std::max(1u, last - first);
+      }
+      else {
+        point = mesh.position(i);
+      }
+      float distance = reference.closestPoint(point, hint).distance;
+      deviations[i] = distance;
+      sums.lowest = std::min(sums.lowest, (double)distance);
+      sums.highest = std::max(sums.highest, (double)distance);
+      sums.absolute += std::fabs(distance);
+      sums.squared += (double)distance * distance;
+    }
+  });
+
+  DeviationSums total;
+  for (const DeviationSums &sums : chunk_sums) {
+    total.lowest = std::min(total.lowest, sums.lowest);
+    total.highest = std::max(total.highest, sums.highest);
+    total.absolute += sums.absolute;
+    total.squared += sums.squared;
+  }
+  statistics.samples = count;
+  statistics.lowest = total.lowest;
+  statistics.highest = total.highest;
+  statistics.maximum = std::max(std::fabs(total.lowest), std::fabs(total.highest));
+  statistics.mean = total.absolute / count;
+  statistics.rms = std::sqrt(total.squared / count);
+}
+
+/**
+  * Summary of the deviations of a model
+  * Input: const QString - name of the measured model
+  *        const QString - name of the reference
+  *        bool - the distances were measured per face
+  *        const DeviationStatistics - the statistics
+  * Output: std::string - a few lines of text
+  */
+std::string deviationReport(const QString &name, const QString &reference, bool per_face,
+                            const DeviationStatistics &statistics) {
+  char text[160];
+  std::snprintf(text, sizeof(text), ": %zu %s\n  max %.6g  mean %.6g  RMS %.6g\n  signed range %.6g to %.6g\n",
+                statistics.samples, per_face ? "faces" : "vertices", statistics.maximum, statistics.mean,
+                statistics.rms, statistics.lowest, statistics.highest);
+  return name.toStdString() + " against " + reference.toStdString() + text;
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <QString>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "bvh.h"
+#include "face.h"
+
+/**
+  * Summary of the distances of a model to a reference surface
+  * Distances are signed, positive in front of the reference faces
+  */
+struct DeviationStatistics {
+  DeviationStatistics() : samples(0), lowest(0), highest(0), maximum(0), mean(0), rms(0) {}
+
+  size_t samples;  // vertices or faces measured
+  double lowest;   // most negative distance
+  double highest;  // most positive distance
+  double maximum;  // of the absolute distances
+  double mean;     // of the absolute distances
+  double rms;
+};
+
+void computeDeviations(const FaceCollection &mesh, const TriangleBvh &reference, bool per_face,
+                       std::vector<float> &deviations, DeviationStatistics &statistics);
+std::string deviationReport(const QString &name, const QString &reference, bool per_face,
+                            const DeviationStatistics &statistics);
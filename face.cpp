@@ -1,4 +1,11 @@
 #include "face.h"
+#include "trace.h"
+#include "triangulation.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <unordered_map>
 
 QJsonArray vectorToJson(const QVector3D &vector) {
   QJsonArray result;
@@ -53,6 +60,7 @@ void Face::fromJson(const QJsonObject &json) {
 }
 
 void FaceCollection::fromJson(const QJsonArray &json) {
+  TRACE_SCOPE("fromJson");
   faces.clear();
   for (const QJsonValue &face : json) {
     Face new_face;
@@ -60,3 +68,260 @@ void FaceCollection::fromJson(const QJsonArray &json) {
     faces.push_back(new_face);
   }
 }
+
+namespace {
+struct PositionKey {
+  float x, y, z;
+  bool operator==(const PositionKey &other) const {
+    return x == other.x && y == other.y && z == other.z;
+  }
+};
+
+struct PositionKeyHash {
+  size_t operator()(const PositionKey &key) const {
+    uint32_t bits[3];
+    memcpy(bits, &key, sizeof(bits));
+    return (bits[0] * 73856093u) ^ (bits[1] * 19349663u) ^ (bits[2] * 83492791u);
+  }
+};
+}
+
+/**
+  * Build the triangle mesh of the collection
+  * Identical positions are merged, every face is split into
+  * triangles that keep a reference to their source face
+  * Input: bool - release the vertices of every face once it is split,
+  *        for collections that are compacted and never triangulated again
+  * Output: void
+  */
+void FaceCollection::triangulate(bool release_vertices) {
+  TRACE_SCOPE("triangulate");
+  std::unordered_map<PositionKey, unsigned int, PositionKeyHash> index;
+  std::vector<int> polygon_triangles;
+  positions.clear();
+  face_offsets.clear();
+  face_corners.clear();
+  triangles.clear();
+  triangle_faces.clear();
+  face_offsets.reserve(faces.size() + 1);
+  for (int i = 0; i < (int)faces.size(); i++) {
+    const std::vector<QVector3D> &polygon = faces[i].vertices;
+    unsigned int first = face_corners.size();
+    face_offsets.push_back(first);
+    for (const QVector3D &v : polygon) {
+      // Adding 0 folds -0.0 into 0.0 so that both hash the same
+      PositionKey key = {v.x() + 0.0f, v.y() + 0.0f, v.z() + 0.0f};
+      auto found = index.find(key);
+      if (found == index.end()) {
+        found = index.insert(std::make_pair(key, (unsigned int)positions.size())).first;
+        positions.push_back(v);
+      }
+      face_corners.push_back(found->second);
+    }
+    polygon_triangles.clear();
+    triangulatePolygon(polygon, polygon_triangles);
+    for (int k = 0; k < (int)polygon_triangles.size(); k += 3) {
+      triangles.push_back(face_corners[first + polygon_triangles[k]]);
+      triangles.push_back(face_corners[first + polygon_triangles[k + 1]]);
+      triangles.push_back(face_corners[first + polygon_triangles[k + 2]]);
+      triangle_faces.push_back(i);
+    }
+    if (release_vertices) {
+      std::vector<QVector3D>().swap(faces[i].vertices);
+    }
+  }
+  face_offsets.push_back(face_corners.size());
+}
+
+/**
+  * Switch the collection to compact storage
+  * Positions are quantized to 16 bits per axis inside the bounding box
+  * and face normals are octahedron-encoded into 32 bits, see
+  * PositionQuantizer and encodeOctahedral() for the error bounds.
+  * The full precision positions and the vertices of the faces are released
+  * Input: void
+  * Output: void
+  */
+void FaceCollection::compact() {
+  TRACE_SCOPE("compact");
+  if (compact_storage || positions.empty()) {
+    return;
+  }
+  QVector3D low = positions[0], high = positions[0];
+  for (const QVector3D &p : positions) {
+    for (int dim = 0; dim < 3; dim++) {
+      low[dim] = std::min(low[dim], p[dim]);
+      high[dim] = std::max(high[dim], p[dim]);
+    }
+  }
+  quantizer.fit(low, high);
+  quantized_positions.resize(positions.size());
+  for (int i = 0; i < (int)positions.size(); i++) {
+    quantized_positions[i] = quantizer.encode(positions[i]);
+  }
+  std::vector<QVector3D>().swap(positions);
+
+  face_normals.resize(faces.size());
+  for (int i = 0; i < (int)faces.size(); i++) {
+    Face &face = faces[i];
+    face_normals[i] = face.normals ? encodeOctahedral(face.normal[0]) : 0;
+    std::vector<QVector3D>().swap(face.vertices);
+    std::vector<QVector3D>().swap(face.normal);
+  }
+  compact_vertex_normals.resize(vertex_normals.size());
+  for (int i = 0; i < (int)vertex_normals.size(); i++) {
+    compact_vertex_normals[i] = encodeOctahedral(vertex_normals[i]);
+  }
+  std::vector<QVector3D>().swap(vertex_normals);
+  compact_storage = true;
+}
+
+/**
+  * Heap memory of a face, without the face itself
+  * Input: void
+  * Output: size_t - bytes of its vertices and normals
+  */
+size_t Face::memoryUsage() const {
+  return (vertices.capacity() + normal.capacity()) * sizeof(QVector3D);
+}
+
+template <typename T>
+static size_t vectorBytes(const std::vector<T> &vector) {
+  return vector.capacity() * sizeof(T);
+}
+
+/**
+  * Memory held by the collection
+  * Input: void
+  * Output: size_t - bytes of the faces, the triangle mesh, the normals
+  *         and the compact storage
+  */
+size_t FaceCollection::memoryUsage() const {
+  size_t bytes = vectorBytes(faces);
+  for (const Face &face : faces) {
+    bytes += face.memoryUsage();
+  }
+  bytes += vectorBytes(positions) + vectorBytes(face_offsets) + vectorBytes(face_corners) + vectorBytes(triangles) +
+           vectorBytes(triangle_faces) + vectorBytes(vertex_normals) + vectorBytes(corner_normals) +
+           vectorBytes(quantized_positions) + vectorBytes(face_normals) + vectorBytes(compact_vertex_normals) +
+           vectorBytes(points) + vectorBytes(point_colors);
+  return bytes;
+}
+
+/**
+  * Number of unique vertex positions
+  */
+int FaceCollection::vertexCount() const {
+  return compact_storage ? quantized_positions.size() : positions.size();
+}
+
+/**
+  * Get a vertex position in either storage
+  * Input: unsigned int - index of the position
+  * Output: QVector3D - the position
+  */
+QVector3D FaceCollection::position(unsigned int index) const {
+  if (compact_storage) {
+    return quantizer.decode(quantized_positions[index]);
+  }
+  return positions[index];
+}
+
+/**
+  * Get the normal of a face in either storage
+  * Input: int - index of the face
+  * Output: QVector3D - the normal or a null vector if the face has none
+  */
+QVector3D FaceCollection::faceNormal(int face) const {
+  if (!faces[face].normals) {
+    return QVector3D();
+  }
+  if (compact_storage) {
+    return decodeOctahedral(face_normals[face]);
+  }
+  return faces[face].normal[0];
+}
+
+/**
+  * Get the smooth normal of a triangle corner in either storage
+  * Input: unsigned int - index of the corner, three per triangle
+  * Output: QVector3D - the normal or a null vector if none were generated
+  */
+QVector3D FaceCollection::cornerNormal(unsigned int corner) const {
+  if (corner >= corner_normals.size()) {
+    return QVector3D();
+  }
+  if (compact_storage) {
+    return decodeOctahedral(compact_vertex_normals[corner_normals[corner]]);
+  }
+  return vertex_normals[corner_normals[corner]];
+}
+
+/**
+  * Colorize closed surfaces
+  * Faces sharing an edge get the same label
+  * Input: void
+  * Output: void
+  */
+void FaceCollection::colorize(){
+  TRACE_SCOPE("colorize");
+  FaceCollection &faces = *this;
+  bool all_checked = false;
+  // for each face
+  int label =1;
+  std::vector<int> to_check;
+  while(!all_checked){
+          all_checked = true;
+          // Find a face without a label, assign it a label
+          // And add to the queue
+          for(int i=0; i<(int)faces.faces.size(); i++){
+            if(faces.faces[i].label==0){
+              faces.faces[i].label = label;
+              to_check.push_back(i);
+              break;
+            }
+          }
+
+          while(to_check.size() > 0){
+              // Take a face from the queue
+              int i = to_check[to_check.size()-1];
+              to_check.pop_back();
+
+              // make all possible pairs for the face with this one
+              for(int j=0; j<(int)faces.faces.size(); j++){
+              
+                // check that the pair of the face has also not been assigned a label
+                if(faces.faces[j].label==0){
+                  all_checked=false;
+
+                  // for all edges of the two faces
+                  unsigned int first_i = faces.face_offsets[i];
+                  unsigned int first_j = faces.face_offsets[j];
+                  int size_i = faces.face_offsets[i+1] - first_i;
+                  int size_j = faces.face_offsets[j+1] - first_j;
+                  for(int k=0; k<size_i; k++){
+                    unsigned int a = faces.face_corners[first_i + k];
+                    unsigned int b = faces.face_corners[first_i + (k+1)%size_i];
+                    for(int m=0; m<size_j; m++){
+                      unsigned int c = faces.face_corners[first_j + m];
+                      unsigned int d = faces.face_corners[first_j + (m+1)%size_j];
+
+                      // check if the same edge belongs to both faces,
+                      // positions are merged so comparing indices is enough
+                      if((a==c && b==d) || (a==d && b==c)){
+                        // assign the second face the same label
+                        faces.faces[j].label = faces.faces[i].label;
+                        // add the face to the queue to check its neighbours
+                        to_check.push_back(j);
+                        // Skip the rest of edges in the face
+                        goto face2_loop_end;
+                      }
+                    }
+                  }
+                }
+                face2_loop_end:;
+              }
+            }  
+            label++;
+  }
+}
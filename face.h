@@ -4,6 +4,8 @@
 #include <QJsonObject>
 #include <QVector3D>
 
+#include "quantization.h"
+
 QJsonArray vectorToJson(const QVector3D &vector);
 QVector3D vectorFromJson(const QJsonArray &array);
 
@@ -20,11 +22,45 @@ public:
 
   QJsonObject toJson() const;
   void fromJson(const QJsonObject &json);
+  size_t memoryUsage() const;
 };
 
 class FaceCollection {
 public:
+  FaceCollection() : compact_storage(false) {}
   std::vector<Face> faces;
 
+  // Triangle mesh built from the faces by triangulate()
+  std::vector<QVector3D> positions;          // unique vertex positions
+  std::vector<unsigned int> face_offsets;    // first corner of each face, faces.size()+1 entries
+  std::vector<unsigned int> face_corners;    // position index of each face corner
+  std::vector<unsigned int> triangles;       // three position indices per triangle
+  std::vector<unsigned int> triangle_faces;  // source face of each triangle
+
+  // Smooth normals built by generateNormals()
+  std::vector<QVector3D> vertex_normals;     // split where faces meet at a crease
+  std::vector<unsigned int> corner_normals;  // vertex normal index of each triangle corner
+
+  // Compact storage built by compact(), replaces positions and the
+  // vertices and normals of the faces
+  bool compact_storage;
+  PositionQuantizer quantizer;
+  std::vector<QuantizedPosition> quantized_positions;
+  std::vector<uint32_t> face_normals;        // octahedron-encoded
+  std::vector<uint32_t> compact_vertex_normals;
+
+  // Vertices of a file without faces, drawn as a point cloud
+  std::vector<QVector3D> points;
+  std::vector<float> point_colors;           // gray level per point, empty if the file has none
+
   void fromJson(const QJsonArray &json);
+  void triangulate(bool release_vertices = false);
+  void compact();
+  void colorize();
+  int triangleCount() const { return triangle_faces.size(); }
+  int vertexCount() const;
+  size_t memoryUsage() const;
+  QVector3D position(unsigned int index) const;
+  QVector3D faceNormal(int face) const;
+  QVector3D cornerNormal(unsigned int corner) const;
 };
@@ -1,5 +1,9 @@
 #include <QApplication>
+#include <QElapsedTimer>
+#include <QStringList>
+#include <QSurfaceFormat>
 
+#include <algorithm>
 #include <cstdlib>
 #include <fstream>
 #include <iostream>
@@ -7,23 +11,300 @@
 #include <string>
 #include <vector>
 
+#include "batch_renderer.h"
+#include "deviation.h"
+#include "mass_properties.h"
+#include "memory_budget.h"
+#include "mesh_order.h"
+#include "model_loader.h"
+#include "paged_model.h"
+#include "parallel.h"
+#include "trace.h"
 #include "viewer_widget.h"
 
 void usage(int argc, char **argv) {
   (void)argc;
-  std::cerr << "Usage: " << argv[0] << " <optional: input.json>" << std::endl;
+  std::cerr << "Usage: " << argv[0] << " [--compact] [--software] [--crease-angle <degrees>] [--trace <file>] [--memory-budget <MB>] [--page-cache <MB>] [--point-budget <millions>] [--occlusion-culling] [--optimize-order] [--watch] <optional: input.json>" << std::endl;
+  std::cerr << "       " << argv[0] << " [--compact] [--software] [--crease-angle <degrees>] [--optimize-order] --batch <spec.json> [--jobs <n>] [--trace <file>] [--memory-budget <MB>]" << std::endl;
+  std::cerr << "       " << argv[0] << " --mass-properties <model or scene>" << std::endl;
+  std::cerr << "       " << argv[0] << " --order-report <model>" << std::endl;
+  std::cerr << "       " << argv[0] << " --deviation <reference> [--per-face] <model or scene>" << std::endl;
+  std::cerr << "       " << argv[0] << " [--compact] [--crease-angle <degrees>] [--optimize-order] --build-pages <output.pages> [--chunk-faces <n>] <input>" << std::endl;
+  std::cerr << "  --compact               store models with quantized positions and normals" << std::endl;
+  std::cerr << "  --software              rasterize on the CPU instead of with OpenGL" << std::endl;
+  std::cerr << "  --crease-angle <angle>  split generated vertex normals at sharper edges (default 30)" << std::endl;
+  std::cerr << "  --batch <spec>          render the models and views of a spec file to PNG images" << std::endl;
+  std::cerr << "  --jobs <n>              number of rendering processes (default: number of cores)" << std::endl;
+  std::cerr << "  --trace <file>          record a timeline of loads and frames, written on exit" << std::endl;
+  std::cerr << "  --memory-budget <MB>    fail to load models that don't fit, compact them if that helps" << std::endl;
+  std::cerr << "  --mass-properties       print area, volume, centroid, bounds and watertightness per component" << std::endl;
+  std::cerr << "  --deviation <reference> print the max, mean and RMS distance of each model to a reference" << std::endl;
+  std::cerr << "  --per-face              measure --deviation at the faces instead of the vertices" << std::endl;
+  std::cerr << "  --build-pages <file>     split a model into spatial chunks for out-of-core viewing" << std::endl;
+  std::cerr << "  --chunk-faces <n>       most triangles per chunk of --build-pages (default 65536)" << std::endl;
+  std::cerr << "  --page-cache <MB>       memory of mapped chunks kept by paged models (default 512)" << std::endl;
+  std::cerr << "  --point-budget <n>      millions of points of point clouds drawn per frame (default 5)" << std::endl;
+  std::cerr << "  --occlusion-culling     skip faces hidden behind others while the model is opaque" << std::endl;
+  std::cerr << "  --optimize-order        reorder triangles and vertices for the vertex cache and less overdraw" << std::endl;
+  std::cerr << "  --order-report          print the vertex cache miss ratio of a model before and after --optimize-order" << std::endl;
+  std::cerr << "  --watch                 reload the model or scene when its files change" << std::endl;
   exit(EXIT_FAILURE);
 }
 
 int main(int argc, char **argv) {
+  // Shaders need a 3.3 core profile context, which Mesa's
+  // software renderer provides as well
+  QSurfaceFormat format;
+  format.setVersion(3, 3);
+  format.setProfile(QSurfaceFormat::CoreProfile);
+  format.setDepthBufferSize(24);
+  QSurfaceFormat::setDefaultFormat(format);
+
   QApplication app(argc, argv);
-  if (argc > 2) {
+  bool compact = false;
+  bool software = false;
+  bool watch = false;
+  bool occlusion_culling = false;
+  bool optimize_order = false;
+  bool order_report = false;
+  bool mass_properties = false;
+  bool per_face = false;
+  float crease_angle = 30.0f;
+  std::string batch_spec;
+  std::string trace_path;
+  std::string pages_path;
+  std::string reference_path;
+  int chunk_faces = 1 << 16;
+  double page_cache = 512;
+  double point_budget = 5;
+  double memory_budget = 0;
+  int jobs = workerCount();
+  int slice = -1, slices = 1;
+  std::vector<std::string> inputs;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "--compact")
+      compact = true;
+    else if (arg == "--software")
+      software = true;
+    else if (arg == "--watch")
+      watch = true;
+    else if (arg == "--occlusion-culling")
+      occlusion_culling = true;
+    else if (arg == "--optimize-order")
+      optimize_order = true;
+    else if (arg == "--order-report")
+      order_report = true;
+    else if (arg == "--mass-properties")
+      mass_properties = true;
+    else if (arg == "--per-face")
+      per_face = true;
+    else if (arg == "--crease-angle" && i + 1 < argc)
+      crease_angle = std::atof(argv[++i]);
+    else if (arg == "--batch" && i + 1 < argc)
+      batch_spec = argv[++i];
+    else if (arg == "--trace" && i + 1 < argc)
+      trace_path = argv[++i];
+    else if (arg == "--memory-budget" && i + 1 < argc)
+      memory_budget = std::atof(argv[++i]);
+    else if (arg == "--deviation" && i + 1 < argc)
+      reference_path = argv[++i];
+    else if (arg == "--build-pages" && i + 1 < argc)
+      pages_path = argv[++i];
+    else if (arg == "--chunk-faces" && i + 1 < argc)
+      chunk_faces = std::max(1, std::atoi(argv[++i]));
+    else if (arg == "--page-cache" && i + 1 < argc)
+      page_cache = std::atof(argv[++i]);
+    else if (arg == "--point-budget" && i + 1 < argc)
+      point_budget = std::atof(argv[++i]);
+    else if (arg == "--jobs" && i + 1 < argc)
+      jobs = std::max(1, std::atoi(argv[++i]));
+    else if (arg == "--slice" && i + 1 < argc)
+      slice = std::atoi(argv[++i]);
+    else if (arg == "--slices" && i + 1 < argc)
+      slices = std::max(1, std::atoi(argv[++i]));
+    else if (arg.substr(0, 2) == "--")
+      usage(argc, argv);
+    else
+      inputs.push_back(arg);
+  }
+  if (inputs.size() > 1 || (!batch_spec.empty() && !inputs.empty()) || (!pages_path.empty() && inputs.size() != 1) ||
+      ((mass_properties || order_report || !reference_path.empty()) && inputs.size() != 1)) {
     usage(argc, argv);
   }
+  setMemoryBudget(memory_budget * 1048576);
+  setTraceThreadName("main");
+  if (!trace_path.empty()) {
+    startTracing();
+  }
+
+  if (mass_properties) {
+    ModelLoader loader;
+    loader.interactive = false;
+    loader.upload_buffers = false;
+    Scene scene;
+    QString path = QString::fromStdString(inputs[0]);
+    try {
+      if (path.endsWith(".scene"))
+        loader.loadScene(scene, path);
+      else
+        loader.addModel(scene, path, QMatrix4x4());
+    }
+    catch (const std::exception &e) {
+      std::cerr << e.what() << std::endl;
+      return EXIT_FAILURE;
+    }
+    for (const std::unique_ptr<Model> &model : scene.models)
+      std::cout << massPropertiesReport(model->path, model->component_properties, model->mass_properties) << std::endl;
+    return EXIT_SUCCESS;
+  }
+
+  if (order_report) {
+    ModelLoader loader;
+    loader.interactive = false;
+    loader.upload_buffers = false;
+    loader.crease_angle = crease_angle;
+    loader.optimize_order = true;
+    QString path = QString::fromStdString(inputs[0]);
+    QElapsedTimer timer;
+    timer.start();
+    try {
+      loader.loadModelFile(path);
+    }
+    catch (const std::exception &e) {
+      std::cerr << e.what() << std::endl;
+      return EXIT_FAILURE;
+    }
+    std::cout << meshOrderReport(path, loader.order_statistics);
+    std::cout << "Loaded and reordered in " << timer.nsecsElapsed() / 1e9 << " s" << std::endl;
+    if (!trace_path.empty() && !writeTrace(trace_path)) {
+      std::cerr << "Failed to write the trace to " << trace_path << std::endl;
+      return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+  }
+
+  if (!reference_path.empty()) {
+    ModelLoader loader;
+    loader.interactive = false;
+    loader.upload_buffers = false;
+    Scene scene;
+    std::unique_ptr<TriangleBvh> reference;
+    QString path = QString::fromStdString(inputs[0]);
+    QElapsedTimer timer;
+    timer.start();
+    try {
+      reference = loader.loadReference(QString::fromStdString(reference_path));
+      if (path.endsWith(".scene"))
+        loader.loadScene(scene, path);
+      else
+        loader.addModel(scene, path, QMatrix4x4());
+    }
+    catch (const std::exception &e) {
+      std::cerr << e.what() << std::endl;
+      return EXIT_FAILURE;
+    }
+    for (const std::unique_ptr<Model> &model : scene.models) {
+      std::vector<float> deviations;
+      DeviationStatistics statistics;
+      computeDeviations(model->faces, *reference, per_face, deviations, statistics);
+      std::cout << deviationReport(model->path, QString::fromStdString(reference_path), per_face, statistics);
+    }
+    std::cout << "Loaded and compared in " << timer.nsecsElapsed() / 1e9 << " s" << std::endl;
+    if (!trace_path.empty() && !writeTrace(trace_path)) {
+      std::cerr << "Failed to write the trace to " << trace_path << std::endl;
+      return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+  }
+
+  if (!pages_path.empty()) {
+    ModelLoader loader;
+    loader.interactive = false;
+    loader.upload_buffers = false;
+    loader.crease_angle = crease_angle;
+    loader.optimize_order = optimize_order;
+    try {
+      FaceCollection faces = loader.loadModelFile(QString::fromStdString(inputs[0]));
+      if (compact) {
+        faces.compact();
+      }
+      writePagedModel(faces, QString::fromStdString(pages_path), chunk_faces);
+    }
+    catch (const std::exception &e) {
+      std::cerr << e.what() << std::endl;
+      return EXIT_FAILURE;
+    }
+    if (!trace_path.empty() && !writeTrace(trace_path)) {
+      std::cerr << "Failed to write the trace to " << trace_path << std::endl;
+      return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+  }
+
+  if (!batch_spec.empty()) {
+    BatchRenderer batch;
+    batch.loader.compact_storage = compact;
+    batch.loader.crease_angle = crease_angle;
+    batch.loader.optimize_order = optimize_order;
+    batch.software = software;
+    QElapsedTimer timer;
+    timer.start();
+    int images = 0;
+    try {
+      batch.loadSpec(QString::fromStdString(batch_spec));
+      if (slice >= 0) {
+        images = batch.render(slice, slices);
+      }
+      else if (jobs > 1 && batch.jobs.size() > 1 && !batch.software) {
+        // Every worker process renders a slice of the jobs
+        QStringList arguments;
+        arguments << "--batch" << QString::fromStdString(batch_spec)
+                  << "--crease-angle" << QString::number(crease_angle)
+                  << "--memory-budget" << QString::number(memory_budget);
+        if (compact)
+          arguments << "--compact";
+        if (optimize_order)
+          arguments << "--optimize-order";
+        images = batch.renderParallel(std::min(jobs, (int)batch.jobs.size()),
+                                      app.applicationFilePath(), arguments);
+      }
+      else {
+        images = batch.render(0, 1);
+      }
+    }
+    catch (const std::exception &e) {
+      std::cerr << e.what() << std::endl;
+      return EXIT_FAILURE;
+    }
+    double seconds = timer.nsecsElapsed() / 1e9;
+    // The last line is read by the parent of worker processes
+    std::cout << "Memory of this process:\n" << memoryReport() << std::endl;
+    std::cout << "Rendered " << images << " images in " << seconds << " s ("
+              << images / seconds << " images/s)" << std::endl;
+    if (!trace_path.empty() && !writeTrace(trace_path)) {
+      std::cerr << "Failed to write the trace to " << trace_path << std::endl;
+      return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+  }
 
   ViewerWidget viewer_widget;
-  if (argc == 2)
-    viewer_widget.gl_widget->loadFaces(argv[1]);
+  viewer_widget.gl_widget->enableCompactStorage(compact);
+  viewer_widget.gl_widget->enableSoftwareRendering(software);
+  viewer_widget.gl_widget->setCreaseAngle(crease_angle);
+  viewer_widget.gl_widget->enableOrderOptimization(optimize_order);
+  viewer_widget.gl_widget->setPageCache(page_cache * 1048576);
+  viewer_widget.gl_widget->setPointBudget(point_budget * 1e6);
+  viewer_widget.reload_on_change->setChecked(watch);
+  viewer_widget.enable_occlusion_culling->setChecked(occlusion_culling);
+  if (inputs.size() == 1)
+    viewer_widget.gl_widget->loadFaces(QString::fromStdString(inputs[0]));
   viewer_widget.show();
-  return app.exec();
+  int status = app.exec();
+  if (!trace_path.empty() && !writeTrace(trace_path)) {
+    std::cerr << "Failed to write the trace to " << trace_path << std::endl;
+    return EXIT_FAILURE;
+  }
+  return status;
 }
@@ -1,6 +1,18 @@
 QT_VERSION = 5
 QMAKE_CXXFLAGS += -std=c++11
 
-HEADERS = glwidget.h face.h viewer_widget.h
-SOURCES = faces_viewer.cpp glwidget.cpp face.cpp viewer_widget.cpp
+HEADERS = batch_renderer.h bvh.h decompression.h deviation.h glwidget.h face.h frame_preparer.h mass_properties.h memory_budget.h mesh_order.h model_loader.h normals.h occlusion.h paged_model.h parallel.h ply.h point_cloud.h quantization.h renderer.h scene.h software_renderer.h source_chunks.h trace.h triangulation.h viewer_widget.h
+SOURCES = batch_renderer.cpp bvh.cpp decompression.cpp deviation.cpp faces_viewer.cpp glwidget.cpp face.cpp frame_preparer.cpp mass_properties.cpp memory_budget.cpp mesh_order.cpp model_loader.cpp normals.cpp occlusion.cpp paged_model.cpp parallel.cpp ply.cpp point_cloud.cpp quantization.cpp renderer.cpp scene.cpp software_renderer.cpp source_chunks.cpp trace.cpp triangulation.cpp viewer_widget.cpp
 QT     += opengl widgets
+LIBS   += -lz
+
+# Build with "qmake CONFIG+=zstd" to read zstd compressed models
+zstd {
+  DEFINES += HAVE_ZSTD
+  LIBS += -lzstd
+}
+
+# Build with "qmake CONFIG+=notrace" to remove the trace markers
+notrace {
+  DEFINES += NO_TRACING
+}
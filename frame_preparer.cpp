@@ -0,0 +1,110 @@
+#include "frame_preparer.h"
+#include "trace.h"
+
+#include <utility>
+
+FramePreparer::FramePreparer()
+  : scene(0), version(0), has_request(false), busy(false), has_ready(false), stopping(false) {
+  worker = std::thread(&FramePreparer::run, this);
+}
+
+FramePreparer::~FramePreparer() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  wake.notify_all();
+  worker.join();
+}
+
+/**
+  * Switch to a new scene or a new version of it
+  * Waits until the worker no longer reads the previous one and drops
+  * frames prepared for it. Has to be called before the scene is modified
+  * Input: const Scene - the scene to prepare frames for, or 0
+  *        unsigned int - version of the scene, stored in prepared frames
+  * Output: void
+  */
+void FramePreparer::setScene(const Scene *new_scene, unsigned int new_version) {
+  std::unique_lock<std::mutex> lock(mutex);
+  idle.wait(lock, [this](){ return !busy; });
+  scene = new_scene;
+  version = new_version;
+  has_request = false;
+  has_ready = false;
+}
+
+/**
+  * Set a function called from the worker thread when a frame is ready
+  * Input: std::function - the callback
+  * Output: void
+  */
+void FramePreparer::setReadyCallback(const std::function<void()> &callback) {
+  std::lock_guard<std::mutex> lock(mutex);
+  on_ready = callback;
+}
+
+/**
+  * Ask for a frame seen from a camera
+  * Replaces a request that has not been started yet
+  * Input: const QMatrix4x4 - the view matrix
+  * Output: void
+  */
+void FramePreparer::request(const QMatrix4x4 &view) {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    requested_view = view;
+    has_request = true;
+  }
+  wake.notify_one();
+}
+
+/**
+  * Take the most recently finished frame
+  * The frame passed in is handed back to the worker to reuse its memory
+  * Input: PreparedFrame - receives the finished frame
+  * Output: bool - false if no new frame was ready
+  */
+bool FramePreparer::takeFrame(PreparedFrame &frame) {
+  std::lock_guard<std::mutex> lock(mutex);
+  if (!has_ready) {
+    return false;
+  }
+  std::swap(frame, ready);
+  has_ready = false;
+  return true;
+}
+
+/**
+  * Worker loop, prepares one frame per request
+  */
+void FramePreparer::run() {
+  setTraceThreadName("frame preparer");
+  std::unique_lock<std::mutex> lock(mutex);
+  while (true) {
+    wake.wait(lock, [this](){ return stopping || (has_request && scene); });
+    if (stopping) {
+      return;
+    }
+    QMatrix4x4 view = requested_view;
+    const Scene *current_scene = scene;
+    has_request = false;
+    busy = true;
+    lock.unlock();
+
+    SceneRenderer::prepareFrame(*current_scene, view, working);
+
+    lock.lock();
+    busy = false;
+    working.version = version;
+    std::swap(working, ready);
+    has_ready = true;
+    std::function<void()> callback = on_ready;
+    idle.notify_all();
+    if (callback) {
+      lock.unlock();
+      callback();
+      lock.lock();
+    }
+  }
+}
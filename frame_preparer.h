@@ -0,0 +1,43 @@
+#pragma once
+
+#include <QMatrix4x4>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+#include "renderer.h"
+#include "scene.h"
+
+/**
+  * Prepares the sorted triangles of the next frame on a worker thread
+  * While a frame is drawn, the worker sorts for the latest requested
+  * camera into a second buffer, paintGL then only takes the result
+  */
+class FramePreparer {
+public:
+  FramePreparer();
+  ~FramePreparer();
+  void setScene(const Scene *scene, unsigned int version);
+  void setReadyCallback(const std::function<void()> &callback);
+  void request(const QMatrix4x4 &view);
+  bool takeFrame(PreparedFrame &frame);
+
+protected:
+  void run();
+
+  std::mutex mutex;
+  std::condition_variable wake;
+  std::condition_variable idle;
+  std::thread worker;
+  const Scene *scene;
+  unsigned int version;
+  bool has_request;
+  bool busy;
+  bool has_ready;
+  bool stopping;
+  QMatrix4x4 requested_view;
+  PreparedFrame working;
+  PreparedFrame ready;
+  std::function<void()> on_ready;
+};
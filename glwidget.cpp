@@ -1,4 +1,8 @@
+#include <QDateTime>
+#include <QDir>
 #include <QFile>
+#include <QFileInfo>
+#include <QMessageBox>
 #include <QString>
 #include <QTransform>
 #include <QtGui>
@@ -6,19 +10,23 @@
 #include <QOpenGLWidget>
 #include <QVector3D>
 #include <stdlib.h>
+#include <algorithm>
+#include <cstddef>
 #include <fstream>
 #include <sstream>
+#include <stdexcept>
 #include <string.h>
 #include <clocale>
 #include "viewer_widget.h"
 #include "glwidget.h"
+#include "normals.h"
+#include "trace.h"
 
 #include <iostream>
 
 static const float doublePi = float(M_PI);
 static const float radiansToDegrees = 360.0f / doublePi;
 static const bool DEBUG = false; // Change to true for view debug info
-static const int NUM_COLOLORS = 8;
 
 GLWidget::GLWidget(QWidget *parent) : QOpenGLWidget(parent) {
   x_translation = 0.0;
@@ -32,372 +40,316 @@ GLWidget::GLWidget(QWidget *parent) : QOpenGLWidget(parent) {
   draw_edges = false;
   colorization=false;
   show_axes=false;
+  shading=false;
+  software_rendering=false;
+  deviation_map=false;
+  deviations_per_face=false;
+  watching=false;
+  occlusion_culling=false;
+  point_budget = RenderSettings().point_budget;
   parent_widget = parent;
-  cmap = new QVector3D[NUM_COLOLORS];
-  cmap[0] = QVector3D(1.0, 0.0, 0.0);
-  cmap[1] = QVector3D(0.0, 1.0, 0.0);
-  cmap[2] = QVector3D(0.0, 0.0, 1.0);
-  cmap[3] = QVector3D(1.0, 1.0, 0.0);
-  cmap[4] = QVector3D(1.0, 0.0, 1.0);
-  cmap[5] = QVector3D(0.0, 1.0, 1.0);
-  cmap[6] = QVector3D(0.3, 0.7, 0.2);
-  cmap[7] = QVector3D(0.5, 0.2, 0.9);
+  scene_version = 1;
+  preparer.setScene(&scene, scene_version);
+  // Repaint with the new order once the worker finishes a frame
+  preparer.setReadyCallback([this](){
+    QMetaObject::invokeMethod(this, "update", Qt::QueuedConnection);
+  });
+  // Editors write a file in several steps, it is reloaded
+  // once no more changes arrive for a moment
+  reload_timer.setSingleShot(true);
+  reload_timer.setInterval(300);
+  connect(&reload_timer, &QTimer::timeout, this, &GLWidget::reloadChangedFiles);
+  connect(&watcher, &QFileSystemWatcher::fileChanged, this, [this](const QString &path){
+    changed_paths.insert(path);
+    reload_timer.start();
+  });
   setFocusPolicy(Qt::StrongFocus);
   setlocale(LC_NUMERIC, "C");
 }
 
 GLWidget::~GLWidget() {
-  delete[] vertices;
+  preparer.setScene(0, scene_version);
+  makeCurrent();
+  scene.clear();
+  doneCurrent();
 }
 
 /**
-  * Check if the input string consists of
-  * the following characters only:
-  * /eE-+.,0123456789 \r\n
-  * Input: const std::string - the string to check
-  * Output: boolean
+  * Load a model or a scene from file and render it
+  * Replaces everything that was loaded before once the file has loaded,
+  * a file that fails keeps the previous scene on screen. The previous
+  * scene counts against the memory budget until it is replaced
+  * Input: const QString - path to the file
+  * Output: void
   */
-bool GLWidget::is_digits(const std::string &str)
-{
-    return str.find_first_not_of("/eE-+.,0123456789 \r\n") == std::string::npos;
+void GLWidget::loadFaces(const QString &path) {
+  preparer.setScene(0, scene_version);
+  Scene loaded;
+  QString extension = path.mid(path.lastIndexOf(QString("."))+1, path.length()-1);
+  bool failed = false;
+  // The loader has shown the error
+  try{
+    if(extension == "scene"){
+      loader.loadScene(loaded, path);
+    }
+    else{
+      loader.addModel(loaded, path, QMatrix4x4());
+    }
+  }
+  catch(const std::runtime_error &){
+    failed = true;
+  }
+  if(!failed){
+    std::swap(scene, loaded);
+  }
+  // Either the previous scene or the models loaded before the error
+  makeCurrent();
+  loaded.clear();
+  doneCurrent();
+  if(failed){
+    preparer.setScene(&scene, scene_version);
+    update();
+    return;
+  }
+  loaded_path = path;
+  compareModels();
+  scene_version++;
+  preparer.setScene(&scene, scene_version);
+  scale = scene.depthScale();
+  connectPagedModels();
+  watchFiles();
+  update();
 }
 
 /**
-  * Load a model with .json extension
+  * Add a model from file to the current scene and render it
   * Input: const QString - path to the file
-  * Output: FaceCollection - faces and normals of the model
+  * Output: void
   */
-FaceCollection GLWidget::loadJson(const QString &path){
-  FaceCollection result;
-  QFile json_file(path);
-  if (!json_file.open(QIODevice::ReadOnly)) {
-    qWarning("Failed to open file");
-    exit(-1);
+void GLWidget::addFaces(const QString &path) {
+  preparer.setScene(0, scene_version);
+  try{
+    loader.addModel(scene, path, QMatrix4x4());
+  }
+  catch(const std::runtime_error &){
   }
-  QByteArray json_data = json_file.readAll();
-  QJsonDocument json_document(QJsonDocument::fromJson(json_data));
-  result.fromJson(json_document.array());
-  return result;
+  compareModels();
+  scene_version++;
+  preparer.setScene(&scene, scene_version);
+  scale = scene.depthScale();
+  connectPagedModels();
+  watchFiles();
+  update();
 }
 
 /**
-  * Load a model with .stl extension
-  * Input: const QString - path to the file
-  * Output: FaceCollection - faces and normals of the model
-  */
-FaceCollection GLWidget::loadStl(const QString &path){
-  QMessageBox messageBox;
-  FaceCollection result;
-  double x, y, z;
-  std::string line, token, value;
-  bool end_reached = false; 
-  std::string::size_type sz;
-
-  std::ifstream infile(path.toUtf8().constData());
-  if(!infile){
-    messageBox.critical(0,"Error","File not found");
-    throw std::runtime_error("File not found");
-  }
-
-  /* Read input file */
-  if(DEBUG){
-    qDebug() << "\tReading the file";
-  }
-  std::getline(infile, line); // Read file format line
-
-  if(line != "solid Onshape"){
-    messageBox.critical(0,"Error","File format is not supported (not STL).");
-    throw std::runtime_error("File format is not supported (not STL).");
-  }
-  if(DEBUG){
-    qDebug() << "\tReading the first line";
-  }
-  while(std::getline(infile, line)){
-    Face new_face;
-    new_face.c = 1;
-    if(line.substr(2, 12) != "facet normal"){
-      if(line.substr(0, 16) == "endsolid Onshape"){
-        end_reached = true;
-        break;
-      }
-      else{
-        messageBox.critical(0,"Error","File is corrupted. Unexpected format");
-        throw std::runtime_error("File is corrupted. Unexpected format");
-      }
-    }
-    if(DEBUG){
-      qDebug() << "\tEntered the loop";
-      qDebug() << "\t\tRead \'facet normal\'";
-    }
-    value = line.substr(14, strlen(line.c_str()));
-    if (!is_digits(value)){
-      messageBox.critical(0,"Error","The definition of a normal contains non-digit characters");
-      throw std::runtime_error("The definition of a normal contains non-digit characters");
-    }
-    value = line.substr(15, strlen(line.c_str()));
-    x = std::stod(value,&sz);
-    value = value.substr(sz);
-    y = std::stod(value, &sz);
-    value = value.substr(sz);
-    z = std::stod(value, &sz);
-    value = value.substr(sz);
-    if(DEBUG){
-      qDebug() << "\t\t" << x <<", "<<y<<", "<<z;
-    }
-    new_face.normal.push_back(QVector3D(x,y,z));
-    new_face.normals = true;
-    new_face.label = 0;
-    if (!(value == "\0")){
-      messageBox.critical(0,"Error","Unexpected number of dimensions in a normal vector");
-      throw std::runtime_error("Unexpected number of dimensions in a normal vector");
-    }
-    if(!std::getline(infile, line)){
-      messageBox.critical(0,"Error","Unexpected end of file");
-      throw std::runtime_error("Unexpected end of file");
-    }
-    if(line.substr(4, 10) != "outer loop"){
-      messageBox.critical(0,"Error","File is corrupted. Expected an outer loop after the normal vector");
-      throw std::runtime_error("File is corrupted. Expected an outer loop after the normal vector");
-    }
-    /*Read 3 vertices*/
-    for (int i=0; i<3; i++){
-        if(!std::getline(infile, line)){
-          messageBox.critical(0,"Error","Unexpected end of file");
-          throw std::runtime_error("Unexpected end of file");
-        }
-        if(line.substr(6, 6) != "vertex"){
-          messageBox.critical(0,"Error","File is corrupted. Expected a vertex in the outer loop");
-          throw std::runtime_error("File is corrupted. Expected a vertex in the outer loop");
-        }
-        value = line.substr(13, strlen(line.c_str()));
-        x = std::stod(value,&sz);
-        value = value.substr(sz);
-        y = std::stod(value, &sz);
-        value = value.substr(sz);
-        z = std::stod(value, &sz);
-        value = value.substr(sz);
-        new_face.vertices.push_back(QVector3D(x,y,z));
-        if (!(value == "\0")){
-          messageBox.critical(0,"Error","Unexpected number of dimensions in a vertex");
-          throw std::runtime_error("Unexpected number of dimensions in a vertex");
-        }
-        if(DEBUG){
-          qDebug() << "\t\t\t" << x <<", "<<y<<", "<<z;
-        }
-    }
-    if(!std::getline(infile, line)){
-      messageBox.critical(0,"Error","Unexpected end of file");
-      throw std::runtime_error("Unexpected end of file");
+  * Enable/disable reloading models and scenes when their files change
+  * Input: bool - new state
+  * Output: void
+  */
+void GLWidget::enableWatching(bool state){
+  watching = state;
+  loader.track_changes = state;
+  for(std::unique_ptr<Model> &model : scene.models){
+    if(state){
+      loader.indexModel(*model);
     }
-    if(line.substr(4, 7) != "endloop"){
-      messageBox.critical(0,"Error","File is corrupted. Expected an endloop statement");
-      throw std::runtime_error("File is corrupted. Expected an endloop statement");
+    else{
+      model->source_chunks.clear();
     }
-    if(!std::getline(infile, line)){
-      messageBox.critical(0,"Error","Unexpected end of file");
-      throw std::runtime_error("Unexpected end of file");
+  }
+  watchFiles();
+}
+
+/**
+  * Repaint when a paged model has read in chunks of the current view
+  * Input: void
+  * Output: void
+  */
+void GLWidget::connectPagedModels(){
+  for(std::unique_ptr<PagedModel> &model : scene.paged_models){
+    model->setReadyCallback([this](){
+      QMetaObject::invokeMethod(this, "update", Qt::QueuedConnection);
+    });
+  }
+}
+
+/**
+  * Mass properties of all models for the properties window
+  * Input: void
+  * Output: QString - a table per model
+  */
+QString GLWidget::massPropertiesReport() const{
+  std::string report;
+  for(const std::unique_ptr<Model> &model : scene.models){
+    QString name = QFileInfo(model->path).fileName();
+    if(model->component_properties.empty() && !model->faces.faces.empty()){
+      report += name.toStdString() + ": not computed within the memory budget\n";
     }
-    if(line.substr(2, 8) != "endfacet"){
-      messageBox.critical(0,"Error","File is corrupted. Expected an endfacet statement");
-      throw std::runtime_error("File is corrupted. Expected an endfacet statement");
+    else{
+      report += ::massPropertiesReport(name, model->component_properties, model->mass_properties);
     }
-    result.faces.push_back(new_face);
+    report += "\n";
   }
-  if (!end_reached){
-    messageBox.critical(0,"Error","File is corrupted");
-    throw std::runtime_error("File is corrupted");
+  return report.empty() ? QString("No models loaded") : QString::fromStdString(report);
+}
+
+/**
+  * Compare all models to a reference surface and show the deviations
+  * The reference is kept, so models loaded or reloaded later are
+  * compared to it as well
+  * Input: const QString - path to the reference model file
+  *        bool - one distance per face instead of per vertex
+  * Output: bool - false if the reference failed to load, the loader
+  *         has shown the error then
+  */
+bool GLWidget::compareWith(const QString &path, bool per_face){
+  std::unique_ptr<TriangleBvh> loaded;
+  try{
+    loaded = loader.loadReference(path);
   }
+  catch(const std::runtime_error &){
+    return false;
+  }
+  reference = std::move(loaded);
+  reference_path = path;
+  deviations_per_face = per_face;
+  for(std::unique_ptr<Model> &model : scene.models){
+    model->deviations.clear();
+  }
+  compareModels();
+  deviation_map = true;
+  update();
+  return true;
+}
 
-  return result;
+/**
+  * Measure the models that have no deviations yet against the reference
+  * Input: void
+  * Output: void
+  */
+void GLWidget::compareModels(){
+  if(!reference){
+    return;
+  }
+  for(std::unique_ptr<Model> &model : scene.models){
+    if(!model->deviations.empty() || model->faces.faces.empty()){
+      continue;
+    }
+    computeDeviations(model->faces, *reference, deviations_per_face, model->deviations, model->deviation);
+    model->deviations_per_face = deviations_per_face;
+    model->deviation_memory.update(model->deviations.capacity() * sizeof(float));
+    model->deviations_dirty = true;
+  }
 }
 
 /**
-  * Find the position of the next occurrence of
-  * '/' or ' ' characters
-  * Input: const std::string - string to check
-  * Output: int - position of the next occurrence or -1
+  * Show/hide the deviation colors based on the state of the
+  * according checkbox
+  * Input: bool - new state
+  * Output: void
   */
-int GLWidget::delim(const std::string &str){
-  return std::min(str.find(" "), str.find("/"));
+void GLWidget::showDeviations(bool state){
+  deviation_map = state;
+  update();
 }
 
 /**
-  * Load a model with .obj extension
-  * Input: const QString - path to the file
-  * Output: FaceCollection - faces and normals of the model
-  */
-FaceCollection GLWidget::loadObj(const QString &path){
-  FaceCollection result;
-  double x, y, z;
-  QMessageBox messageBox;
-  std::string line, token, value;
-  std::vector<QVector3D> v;
-  std::vector<QVector3D> vn;
-  std::string::size_type sz;
-  std::ifstream infile(path.toUtf8().constData());
-  if(!infile){
-    messageBox.critical(0,"Error","File not found");
-    throw std::runtime_error("File not found");
-
-  }
-
-  /* Read input file */
-  if(DEBUG){
-    qDebug() << "\tReading the file";
-  }
-  while(!infile.eof() && std::getline(infile, line)){
-    if(line.substr(0,2) == "v "){
-      // Read a vertex
-      value = line.substr(2, strlen(line.c_str()));
-      if (!is_digits(value)){
-        messageBox.critical(0,"Error","The definition of a vertex contains non-digit characters");
-        throw std::runtime_error("The definition of a vertex contains non-digit characters");
-      }
-      x = std::stod(value,&sz);
-      value = value.substr(sz);
-      y = std::stod(value, &sz);
-      value = value.substr(sz);
-      z = std::stod(value, &sz);
-      value = value.substr(sz);
-      v.push_back(QVector3D(x,y,z));
-      if(DEBUG){
-        qDebug() << "\t\t" <<  "v " << x << " " << y << " " << z;
-      }
-    }
-    if(line.substr(0,2) == "vn"){
-      // Read a normal
-      value = line.substr(2, strlen(line.c_str()));
-      if (!is_digits(value)){
-        messageBox.critical(0,"Error","The definition of a normal contains non-digit characters");
-        throw std::runtime_error("The definition of a normal contains non-digit characters");
-      }
-      x = std::stod(value,&sz);
-      value = value.substr(sz);
-      y = std::stod(value, &sz);
-      value = value.substr(sz);
-      z = std::stod(value, &sz);
-      value = value.substr(sz);
-      vn.push_back(QVector3D(x,y,z));
-      if(DEBUG){
-        qDebug() << "\t\t" << "vn " << x << " " << y << " " << z;
-      }
-    }
-    if(line.substr(0,1) == "f"){
-      Face new_face;
-      int a, an;
-      new_face.label=0;
-      new_face.c = 1;
-      line = line.substr(1);
-      if(DEBUG){
-        qDebug() << "\t\t" << "Reading f";
-      }
-      value = line.substr(line.find_first_not_of(" "));
-      if (!is_digits(value)){
-        messageBox.critical(0,"Error","The definition of a face contains non-digit characters");
-        throw std::runtime_error("The definition of a face contains non-digit characters");
-      }
-      while((value.substr(0,1)!="\r") && (strlen(value.c_str())!=0)){
-          // Read a vertex
-          a = std::stoi(value.substr(0, delim(value)), &sz);
-          new_face.vertices.push_back(v[a-1]);
-          value = value.substr(sz);
-          if(DEBUG){
-            qDebug() << "\t\t" << "Vertex" << a << value.c_str();
-          }
-          // Read texture
-          if(value.substr(0,1)=="/"){
-            // Skip texture
-            if(DEBUG){
-              qDebug() << "\t\t" << "Skipping /";
-            } 
-            value = value.substr(1);
-            value = value.substr(value.find("/"));
-            if(DEBUG){
-              qDebug() << "\t\t" << value.c_str();
-            }
-          }
-          // Read normal
-          if(value.substr(0,1)=="/"){
-            value = value.substr(1);
-            an = std::stoi(value.substr(0, delim(value)), &sz);
-            new_face.normal.push_back(vn[an-1]);
-            new_face.normals = true;
-            if(DEBUG){
-              qDebug() << "\t\t" << "Normal";
-            }
-            value = value.substr(sz);
-            if(DEBUG){
-              qDebug() << "\t\t" << an << " " << value.c_str();
-            }
-          }
-          if(strlen(value.c_str())>0 && (int)value.find_first_not_of(" ")!=-1){
-            value = value.substr(value.find_first_not_of(" "));
-          }
-          if(DEBUG){
-            qDebug() << "\t\t Vertex info read\n\n";
-          }
-          if(infile.eof()){
-            break;
-          }
-        }
-        result.faces.push_back(new_face);
-      }      
-  }
-  if(DEBUG){
-    qDebug() << "END OF FILE";
-  }
-  return result;
-}
-
-/**
-  * Load a model from file and render it
-  * Calls loadJson(path), loadStl(path) or loadObj(path)
-  * depending on the file's extension
-  * Input: const QString - path to the file
+  * Deviations of all models from the reference for the report window
+  * Input: void
+  * Output: QString - statistics per model
+  */
+QString GLWidget::deviationReport() const{
+  if(!reference){
+    return QString("No reference loaded");
+  }
+  std::string report;
+  QString reference_name = QFileInfo(reference_path).fileName();
+  for(const std::unique_ptr<Model> &model : scene.models){
+    report += ::deviationReport(QFileInfo(model->path).fileName(), reference_name, model->deviations_per_face,
+                                model->deviation) + "\n";
+  }
+  return report.empty() ? QString("No models loaded") : QString::fromStdString(report);
+}
+
+/**
+  * Watch the loaded scene file and the files of all models
+  * Input: void
   * Output: void
   */
-void GLWidget::loadFaces(const QString &path) {
-  QString extension = path.mid(path.lastIndexOf(QString("."))+1, path.length()-1);
-  if(extension == "json"){
-    if(DEBUG==true){
-      qDebug() << "Reading .json";
-    }
-    face_collection = loadJson(path);
+void GLWidget::watchFiles(){
+  if(!watcher.files().isEmpty()){
+    watcher.removePaths(watcher.files());
   }
-  if(extension == "stl"){
-    if(DEBUG==true){
-      qDebug() << "Reading .stl";
+  if(!watching){
+    return;
+  }
+  QStringList paths;
+  if(!loaded_path.isEmpty()){
+    paths << loaded_path;
+  }
+  for(std::unique_ptr<Model> &model : scene.models){
+    paths << model->path;
+  }
+  paths.removeDuplicates();
+  for(const QString &path : paths){
+    // Files replaced by a rename are watched again once they exist
+    if(QFileInfo::exists(path)){
+      watcher.addPath(path);
     }
-    face_collection = loadStl(path);
   }
-  if(extension == "obj"){
-    if(DEBUG==true){
-      qDebug() << "Reading .obj";
+}
+
+/**
+  * Reload the changed files, keeping the camera and the display settings
+  * A changed scene file is loaded again, changed models are reloaded
+  * in place. Errors, e.g. a file that is still incomplete, keep the
+  * previous version until the next change
+  * Input: void
+  * Output: void
+  */
+void GLWidget::reloadChangedFiles(){
+  preparer.setScene(0, scene_version);
+  bool interactive = loader.interactive;
+  loader.interactive = false;
+  bool changed = false;
+  if(changed_paths.contains(loaded_path) && loaded_path.endsWith(".scene")){
+    Scene loaded;
+    try{
+      loader.loadScene(loaded, loaded_path);
+      std::swap(scene, loaded);
+      changed = true;
     }
-    face_collection = loadObj(path);
-  }
-  n_vertices = face_collection.faces.size() * 4;
-  vertices = new QVector3D[n_vertices];
-  double min_z, max_z;
-  min_z = face_collection.faces[0].vertices[0][2];
-  max_z = face_collection.faces[0].vertices[0][2];
-  for (int i = 0; i < (int)face_collection.faces.size(); i++)
-  {
-    vertices[i*4] = face_collection.faces[i].vertices[0];
-    vertices[i*4+1] = face_collection.faces[i].vertices[1];
-    vertices[i*4+2] = face_collection.faces[i].vertices[2];
-    vertices[i*4+3] = face_collection.faces[i].vertices[3];
-    if(vertices[i*4][2] < min_z){
-      min_z = vertices[i*4][2];
+    catch(const std::runtime_error &e){
+      qWarning() << "Failed to reload" << loaded_path << ":" << e.what();
     }
-    if(vertices[i*4][2] > max_z){
-      max_z = vertices[i*4][2];
+    // Either the previous scene or the models loaded before the error
+    makeCurrent();
+    loaded.clear();
+    doneCurrent();
+  }
+  else{
+    for(std::unique_ptr<Model> &model : scene.models){
+      if(!changed_paths.contains(model->path)){
+        continue;
+      }
+      try{
+        changed |= loader.reloadModel(*model);
+      }
+      catch(const std::runtime_error &e){
+        qWarning() << "Failed to reload" << model->path << ":" << e.what();
+      }
     }
   }
-  scale = 1/std::max(abs(min_z), abs(max_z));
-  if(colorization==true){
-    colorize(face_collection);
+  changed_paths.clear();
+  loader.interactive = interactive;
+  compareModels();
+  connectPagedModels();
+  if(changed){
+    scene_version++;
   }
+  preparer.setScene(&scene, scene_version);
+  watchFiles();
   update();
 }
 
@@ -427,13 +379,7 @@ void GLWidget::setYTranslation(double d)
   * Initialize the scene
   */
 void GLWidget::initializeGL() {
-  glClearColor(0.2f, 0.25f, 0.2f, 1.0f);
-  glEnable(GL_DEPTH_TEST);
-  glDisable(GL_CULL_FACE);
-  glDisable(GL_LIGHTING );
-  glEnable(GL_BLEND);
-  glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-  glBlendEquation(GL_FUNC_ADD);
+  renderer.initialize();
 }
 
 /**
@@ -444,250 +390,76 @@ void GLWidget::initializeGL() {
 void GLWidget::resizeGL(int width, int height)
 {
     int side = qMin(width, height);
-    glViewport((width - side) / 2, (height - side) / 2, side, side);
-    glMatrixMode(GL_PROJECTION);
-    glLoadIdentity();
-    glOrtho(-2.0 + scale, 2.0 - scale, -2.0 + scale, 2.0 - scale, -scale, scale);
-    glMatrixMode(GL_MODELVIEW);
-    glLoadIdentity();
+    context()->functions()->glViewport((width - side) / 2, (height - side) / 2, side, side);
 }
 
 /**
-  * Paint the scene
+  * Collect the camera and display toggles of the next frame
+  * Input: void
+  * Output: RenderSettings - current state of the view
   */
-void GLWidget::paintGL() {
- 
-  // Clear color and depth buffers
-  glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-  // Set the modelview matrix
-  QMatrix4x4 matrix;
-  matrix.translate(x_translation, y_translation, z_translation);
-  matrix.rotate(rotation);
-  glLoadMatrixf(matrix.constData());
-
-  // Set the projection matrix
-  glMatrixMode(GL_PROJECTION);
-  glLoadIdentity();
-  glScalef(scale, scale, scale);
-  glMatrixMode(GL_MODELVIEW);
-
-  // Draw axes
-  if(show_axes){
-    drawAxes();
-  }
-
-  // Perform z-sorting
-  std::vector<std::pair<float, int>> order;
-  for (int i=0;i<(int)face_collection.faces.size();i++)
-  {
-      QVector3D centre = ((vertices[i*4] + vertices[i*4+2])/2);
-      double z = centre.x()*matrix(2,0) + centre.y()*matrix(2,1) + centre.z()*matrix(2,2) + matrix(2,3);
-      double h = centre.x()*matrix(3,0) + centre.y()*matrix(3,1) + centre.z()*matrix(3,2) + matrix(3,3);
-      order.push_back(std::make_pair(abs(z/h),i));
-  }
-  std::sort(order.begin(), order.end());
-  std::reverse(order.begin(),order.end());
-
-  if(zsorting){
-    std::sort(order.begin(), order.end());
-  }
-
-  // Draw faces
-  for (int i = 0; i < n_vertices/4; i++)
-  {
-    Face face = face_collection.faces[order[i].second];
-    if(face_collection.faces[order[i].second].normals==true){
-        face.normal[0] = face.normal[0] * matrix;
-        face.normals=true;
-    }
-
-    if(zsorting){
-        if(isFacingCamera(face)){
-          drawFace(face_collection.faces[order[i].second]);
-        }
-    }
-    else{
-      drawFace(face_collection.faces[i]);
-    }
+RenderSettings GLWidget::renderSettings() const {
+  RenderSettings settings;
+  settings.x_translation = x_translation;
+  settings.y_translation = y_translation;
+  settings.z_translation = z_translation;
+  settings.rotation = rotation;
+  settings.scale = scale;
+  settings.alpha = alpha;
+  settings.zsorting = zsorting;
+  settings.draw_edges = draw_edges;
+  settings.colorization = colorization;
+  settings.show_axes = show_axes;
+  settings.shading = shading;
+  settings.deviation_map = deviation_map;
+  settings.point_budget = point_budget;
+  settings.occlusion_culling = occlusion_culling;
+  // The ramp spans the largest deviation of all models, so
+  // the same color means the same distance everywhere
+  settings.deviation_range = 0.0f;
+  for(const std::unique_ptr<Model> &model : scene.models){
+    settings.deviation_range = std::max(settings.deviation_range, (float)model->deviation.maximum);
   }
+  return settings;
 }
 
 /**
-  * Draw a face
-  * Input: Face - a face to draw
-  * Output: void
+  * Paint the scene
+  * In sorting mode the triangle order comes from the frame preparer:
+  * the last finished frame is drawn and the next one is requested for
+  * the current camera, so sorting overlaps with drawing.
+  * With software rendering the frame is rasterized on the CPU
+  * and drawn as an image
   */
-void GLWidget::drawFace(Face face) {
-    double triangle_color = face.c;
-    // If colorization is on, select a color for the face
-    if(colorization == true){
-      int label = face.label;
-      label = label % NUM_COLOLORS;
-      glColor4f(cmap[label][0], cmap[label][1], cmap[label][2], alpha);
-    }
-    else{
-      glColor4f(triangle_color, triangle_color, triangle_color, alpha); 
-    }
-    // Draw a face
-    glBegin(GL_POLYGON);
-    for(int i=0; i<(int)face.vertices.size(); i++){
-      glVertex3f(face.vertices[i][0], face.vertices[i][1], face.vertices[i][2]);
-      if(face.normals==true && i<(int)face.normal.size()){
-        glBegin(GL_POLYGON);
-        glNormal3f(face.normal[i][0], face.normal[i][1], face.normal[i][2]);  
-      }
+void GLWidget::paintGL() {
+  TRACE_SCOPE("paintGL");
+  RenderSettings settings = renderSettings();
+  const PreparedFrame *sorted = 0;
+  if(settings.zsorting){
+    QMatrix4x4 view = settings.viewMatrix();
+    preparer.takeFrame(frame);
+    if(frame.version != scene_version){
+      // Nothing prepared for this scene yet
+      SceneRenderer::prepareFrame(scene, view, frame);
+      frame.version = scene_version;
     }
-    glEnd();
-    // If draw_edges is true, display them
-    if(draw_edges==true){
-        QVector3D last_vertex = face.vertices[0];
-        QVector3D current_vertex;
-        glColor4f(0.0f, 0.0f, 0.0f, alpha);
-        glEnable(GL_LINE_SMOOTH);
-        glLineWidth(10.0f);
-        glBegin(GL_LINES); 
-        for(int i=1; i<(int)face.vertices.size(); i++){
-          current_vertex = face.vertices[i];
-          glVertex3f(last_vertex[0], last_vertex[1], last_vertex[2]);
-          glVertex3f(current_vertex[0], current_vertex[1], current_vertex[2]);
-          last_vertex = face.vertices[i];
-        }
-        glEnd();
+    if(!(frame.view == view)){
+      preparer.request(view);
     }
-}
-
-
-/**
-  * Colorize closed surfaces
-  * Input: FaceCollection - a collection of faces
-  * Output: void
-  */
-void GLWidget::colorize(FaceCollection &faces){
-  bool all_checked = false;
-  // for each face
-  int label =1;
-  std::vector<int> to_check;
-  while(!all_checked){
-          all_checked = true;
-          // Find a face without a label, assign it a label
-          // And add to the queue
-          for(int i=0; i<(int)faces.faces.size(); i++){
-            if(faces.faces[i].label==0){
-              faces.faces[i].label = label;
-              to_check.push_back(i);
-              break;
-            }
-          }
-
-          while(to_check.size() > 0){
-              // Take a face from the queue
-              int i = to_check[to_check.size()-1];
-              to_check.pop_back();
-
-              // make all possible pairs for the face with this one
-              for(int j=0; j<(int)faces.faces.size(); j++){
-              
-                // check that the pair of the face has also not been assigned a label
-                if(faces.faces[j].label==0){
-                  all_checked=false;
-
-                  // for all edges of the two faces
-                  for(int k=0; k<(int)faces.faces[i].vertices.size(); k++){
-                    for(int m=0; m<(int)faces.faces[j].vertices.size(); m++){
-
-                      // check if the same edge belongs to both faces
-                      if(faces.faces[i].vertices[k]==faces.faces[j].vertices[m] &&
-                          faces.faces[i].vertices[(k+1)%(int)faces.faces[i].vertices.size()]==
-                          faces.faces[i].vertices[(m+1)%(int)faces.faces[j].vertices.size()]){
-                        // assign the second face the same label
-                        faces.faces[j].label = faces.faces[i].label;
-                        // add the face to the queue to check its neighbours
-                        to_check.push_back(j);
-                        // Skip the rest of edges in the face
-                        goto face2_loop_end;
-                      }
-                    }
-                  }
-                }
-                face2_loop_end:;
-              }
-            }  
-            label++;
-  }
-}
-
-
-/**
-  * Draw x, y and z axes
-  * Input: void
-  * Output: void
-  */
-void GLWidget::drawAxes(){
-    glColor3f(1.0,0.0,0.0); // red x
-    glBegin(GL_LINES);
-    // x aix
- 
-    glVertex3f(-10000.0f, 0.0f, 0.0f);
-    glVertex3f(20.0f, 0.0f, 0.0f);
- 
-    glVertex3f(4.0, 0.0f, 0.0f);
-    glVertex3f(3.0, 1.0f, 0.0f);
- 
-    glVertex3f(4.0, 0.0f, 0.0f);
-    glVertex3f(3.0, -1.0f, 0.0f);
-    glEnd();
- 
-    // y 
-    glColor3f(0.0,1.0,0.0); // green y
-    glBegin(GL_LINES);
-    glVertex3f(0.0f, -10000.0f, 0.0f);
-    glVertex3f(0.0f, 20.0f, 0.0f);
- 
-    glVertex3f(0.0, 4.0f, 0.0f);
-    glVertex3f(1.0, 3.0f, 0.0f);
- 
-    glVertex3f(0.0, 4.0f, 0.0f);
-    glVertex3f(-1.0, 3.0f, 0.0f);
-    glEnd();
- 
-    // z 
-    glColor3f(0.0,0.0,1.0); // blue z
-    glBegin(GL_LINES);
-    glVertex3f(0.0, 0.0f ,-10000.0f);
-    glVertex3f(0.0, 0.0f ,20.0f);
- 
- 
-    glVertex3f(0.0, 0.0f ,4.0f );
-    glVertex3f(0.0, 1.0f ,3.0f );
- 
-    glVertex3f(0.0, 0.0f ,4.0f );
-    glVertex3f(0.0, -1.0f ,3.0f );
-    glEnd();
-}
-
-
-/**
-  * Check if the normal vector of a face is in a direction 
-  * of the camera
-  * Input: Face - a face whose normal is being checked
-  * Output: bool - true if the normal is facing the camera
-  */
-bool GLWidget::isFacingCamera(Face face){
-  if (face.normals==false){
-    return true;
+    sorted = &frame;
   }
-  else{
-    QVector3D camera = QVector3D(0,0,-1);
-    double dot = QVector3D::dotProduct(camera, face.normal[0]);
-    double angle = acos(dot) * 180 / doublePi;
-    if (angle <= 90)
-      return true;
-    else
-      return false;
+  if(software_rendering){
+    qreal ratio = devicePixelRatio();
+    QImage image = software_renderer.render(scene, settings, width() * ratio, height() * ratio, sorted);
+    TRACE_SCOPE("present");
+    QPainter painter(this);
+    painter.drawImage(rect(), image);
+    return;
   }
+  renderer.render(scene, settings, sorted);
 }
 
+
 /**
   * Enable/disable sorting based on the state of the
   * according checkbox
@@ -721,6 +493,121 @@ void GLWidget::showAxes(bool state){
   update();
 }
 
+/**
+  * Enable/disable shading by the vertex normals based on the state
+  * of the according checkbox
+  * Input: bool - new state
+  * Output: void
+  */
+void GLWidget::enableShading(bool state){
+  shading = state;
+  update();
+}
+
+/**
+  * Switch between drawing with OpenGL and the CPU rasterizer
+  * Input: bool - true to rasterize on the CPU
+  * Output: void
+  */
+void GLWidget::enableSoftwareRendering(bool state){
+  software_rendering = state;
+  loader.upload_buffers = !state;
+  update();
+}
+
+/**
+  * Enable/disable compact storage of models loaded from now on
+  * Input: bool - new state
+  * Output: void
+  */
+void GLWidget::enableCompactStorage(bool state){
+  loader.compact_storage = state;
+}
+
+/**
+  * Set the crease angle of normals generated for models loaded from now on
+  * Input: float - angle in degrees, faces meeting at a larger angle
+  *        don't share vertex normals
+  * Output: void
+  */
+void GLWidget::setCreaseAngle(float angle){
+  loader.crease_angle = angle;
+}
+
+/**
+  * Enable/disable reordering the triangles and vertices of models
+  * loaded from now on for the vertex cache and less overdraw
+  * Input: bool - new state
+  * Output: void
+  */
+void GLWidget::enableOrderOptimization(bool state){
+  loader.optimize_order = state;
+}
+
+/**
+  * Set the memory of mapped chunks of paged models loaded from now on
+  * Input: size_t - limit in bytes
+  * Output: void
+  */
+void GLWidget::setPageCache(size_t bytes){
+  loader.page_cache = bytes;
+}
+
+/**
+  * Enable/disable skipping faces hidden behind others, it
+  * takes effect while the model is opaque and not sorted
+  * Input: bool - new state
+  * Output: void
+  */
+void GLWidget::enableOcclusionCulling(bool state){
+  occlusion_culling = state;
+  update();
+}
+
+/**
+  * Culled and drawn clusters of the last frame
+  * Input: void
+  * Output: QString - a line of text
+  */
+QString GLWidget::occlusionReport() const{
+  if(!occlusion_culling){
+    return "Occlusion culling off";
+  }
+  if(alpha < 1.0 || zsorting || software_rendering){
+    return "Occlusion culling only applies to opaque, unsorted OpenGL rendering";
+  }
+  const OcclusionStatistics &statistics = renderer.occlusionStatistics();
+  double percent = statistics.triangles > 0 ? 100.0 * statistics.drawn_triangles / statistics.triangles : 0.0;
+  return QString("Clusters - %1 drawn, %2 occluded, %3 outside the view, %4 occluders; %5% of the faces drawn")
+    .arg(statistics.drawn).arg(statistics.occluded).arg(statistics.outside).arg(statistics.occluders)
+    .arg(percent, 0, 'f', 1);
+}
+
+/**
+  * State of tracing with F12
+  * Input: void
+  * Output: QString - a line of text
+  */
+QString GLWidget::traceReport() const{
+  if(tracingEnabled()){
+    return "Tracing - press F12 to save the trace";
+  }
+  if(!trace_path.isEmpty()){
+    return "Trace saved to " + trace_path;
+  }
+  return "Press F12 to record a trace";
+}
+
+/**
+  * Set the most points of point clouds drawn in a frame
+  * Input: size_t - number of points
+  * Output: void
+  */
+void GLWidget::setPointBudget(size_t points){
+  point_budget = points;
+  update();
+}
+
 /**
   * Enable/disable colorization based on the state of the
   * according checkbox
@@ -729,8 +616,15 @@ void GLWidget::showAxes(bool state){
   */
 void GLWidget::enableColorization(bool state){
   colorization = state;
-  if(colorization == true){
-    colorize(face_collection);
+  loader.colorization = state;
+  // Labels are computed and uploaded once, toggling only switches
+  // the palette on and off in the shaders
+  for(std::unique_ptr<Model> &model : scene.models){
+    if(colorization == true && !model->labelled){
+      model->faces.colorize();
+      model->labelled = true;
+      model->labels_dirty = true;
+    }
   }
   update();
 }
@@ -781,7 +675,9 @@ void GLWidget::mousePressEvent(QMouseEvent *event){
 }
 
 /**
-  * Key press event handler - implements acceleration of translation and rotation
+  * Key press event handler - implements acceleration of translation and rotation,
+  * F12 starts recording a trace and saves it when pressed again,
+  * see traceReport()
   * Input: QKeyEvent - a mouse event
   * Output: void
   */
@@ -789,6 +685,20 @@ void GLWidget::keyPressEvent(QKeyEvent *event){
   if (event->key() == Qt::Key::Key_Shift){
     accelerated = true;
   }
+  if (event->key() == Qt::Key::Key_F12){
+    if (!tracingEnabled()){
+      startTracing();
+      return;
+    }
+    stopTracing();
+    QString path = QDateTime::currentDateTime().toString("'trace_'yyyyMMdd_hhmmss'.json'");
+    if (writeTrace(path.toStdString())){
+      trace_path = QDir::current().absoluteFilePath(path);
+    }
+    else{
+      QMessageBox::critical(this, "Error", "Failed to save the trace to " + path);
+    }
+  }
 }
 
 /**
@@ -1,14 +1,24 @@
 #pragma once
 
+#include <QFileSystemWatcher>
 #include <QMatrix4x4>
 #include <QOpenGLWidget>
+#include <QSet>
 #include <QString>
+#include <QTimer>
 #include <QMatrix4x4>
 #include <QVector2D>
 #include <QVector4D>
 #include <QOpenGLBuffer>
+#include <memory>
 
+#include "bvh.h"
 #include "face.h"
+#include "frame_preparer.h"
+#include "model_loader.h"
+#include "renderer.h"
+#include "scene.h"
+#include "software_renderer.h"
 
 class GLWidget : public QOpenGLWidget {
 public:
@@ -19,22 +29,33 @@ public:
   QSize sizeHint() const { return QSize(1200, 1200); }
 
   void loadFaces(const QString &path);
+  void addFaces(const QString &path);
   void updateAlpha(double new_alpha);
   void enableSorting(bool state);
   void enableDrawingEdges(bool state);
   void enableColorization(bool state);
   void showAxes(bool state);
+  void enableShading(bool state);
+  void enableSoftwareRendering(bool state);
+  void enableCompactStorage(bool state);
+  void setCreaseAngle(float angle);
+  void enableOrderOptimization(bool state);
+  void setPageCache(size_t bytes);
+  void setPointBudget(size_t points);
+  void enableOcclusionCulling(bool state);
+  QString occlusionReport() const;
+  QString traceReport() const;
+  void enableWatching(bool state);
+  QString massPropertiesReport() const;
+  bool compareWith(const QString &path, bool per_face);
+  void showDeviations(bool state);
+  QString deviationReport() const;
 
 protected:
   void initializeGL() override;
-  FaceCollection loadJson(const QString &path);
-  FaceCollection loadStl(const QString &path);
-  FaceCollection loadObj(const QString &path);
-  int delim(const std::string &str);
-  bool is_digits(const std::string &str);
+  RenderSettings renderSettings() const;
   void paintGL() override;
   void resizeGL(int width, int height) override;
-  void drawFace(Face face);
   void wheelEvent(QWheelEvent *event) override;
   void mouseMoveEvent(QMouseEvent *event) override;
   void mousePressEvent(QMouseEvent *event) override;
@@ -42,11 +63,18 @@ protected:
   void keyReleaseEvent(QKeyEvent *event) override;
   void setXTranslation(double d);
   void setYTranslation(double d);
-  void drawAxes();
-  bool isFacingCamera(Face face);
-  void colorize(FaceCollection &faces);
+  void watchFiles();
+  void connectPagedModels();
+  void reloadChangedFiles();
+  void compareModels();
 
-  FaceCollection face_collection;
+  Scene scene;
+  ModelLoader loader;
+  unsigned int scene_version;
+  SceneRenderer renderer;
+  SoftwareRenderer software_renderer;
+  PreparedFrame frame;
+  FramePreparer preparer;
   double x_translation;
   double y_translation;
   double z_translation;
@@ -54,17 +82,28 @@ protected:
   double acc_factor;
   bool accelerated;
   double alpha;
-  int n_vertices;
 
   QVector2D mousePressPosition;
   QVector3D rotationAxis;
   qreal angularSpeed;
   QQuaternion rotation;
-  QVector3D * vertices;
-  QVector3D * cmap;
   bool zsorting;
   bool draw_edges;
   bool colorization;
   bool show_axes;
+  bool shading;
+  bool software_rendering;
+  bool deviation_map;
+  bool deviations_per_face;
+  bool occlusion_culling;
+  size_t point_budget;  // points of point clouds drawn per frame
+  std::unique_ptr<TriangleBvh> reference;  // surface the models are compared to
+  QString reference_path;
+  bool watching;
+  QString loaded_path;
+  QString trace_path;  // of the last trace saved with F12
+  QFileSystemWatcher watcher;
+  QTimer reload_timer;  // waits until the writes to a file are done
+  QSet<QString> changed_paths;
   QWidget *parent_widget;
 };
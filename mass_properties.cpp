@@ -0,0 +1,356 @@
+#include "mass_properties.h"
+#include "memory_budget.h"
+#include "parallel.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <limits>
+
+static const size_t MASS_GRAIN = 1 << 16;
+
+/**
+  * Root of the set of a face, halving the path on the way
+  * Faces are always linked below faces with a smaller index, so the
+  * root of a set is its first face, whatever order the links came in
+  */
+static unsigned int findRoot(std::vector<std::atomic<unsigned int>> &parent, unsigned int face) {
+  while (true) {
+    unsigned int next = parent[face].load();
+    if (next == face) {
+      return face;
+    }
+    unsigned int grandparent = parent[next].load();
+    if (grandparent != next) {
+      parent[face].compare_exchange_weak(next, grandparent);
+    }
+    face = grandparent;
+  }
+}
+
+/**
+  * Join the sets of two faces, safe to call from several threads
+  */
+static void uniteFaces(std::vector<std::atomic<unsigned int>> &parent, unsigned int a, unsigned int b) {
+  while (true) {
+    a = findRoot(parent, a);
+    b = findRoot(parent, b);
+    if (a == b) {
+      return;
+    }
+    if (a < b) {
+      std::swap(a, b);
+    }
+    // Fails if another thread linked the root meanwhile, then retry
+    unsigned int expected = a;
+    if (parent[a].compare_exchange_strong(expected, b)) {
+      return;
+    }
+  }
+}
+
+/**
+  * An edge seen from its endpoint with the smaller index
+  */
+struct EdgeEnd {
+  unsigned int other;
+  unsigned int face;
+  bool forward;  // the face goes from the smaller endpoint to the other one
+
+  bool operator<(const EdgeEnd &edge) const {
+    return other != edge.other ? other < edge.other : (face != edge.face ? face < edge.face : forward < edge.forward);
+  }
+};
+
+/**
+  * An edge that keeps its component from being watertight
+  */
+struct EdgeDefect {
+  unsigned int face;
+  bool boundary;
+};
+
+/**
+  * Sums over the consecutive triangles of one component
+  * Moments are relative to an origin near the model, so large
+  * coordinates don't cancel out
+  */
+struct PartialSums {
+  PartialSums(int label) : label(label), area(0), volume(0) {
+    for (int dim = 0; dim < 3; dim++) {
+      area_moment[dim] = volume_moment[dim] = 0;
+      low[dim] = std::numeric_limits<double>::max();
+      high[dim] = -std::numeric_limits<double>::max();
+    }
+  }
+  void add(const PartialSums &sums) {
+    area += sums.area;
+    volume += sums.volume;
+    for (int dim = 0; dim < 3; dim++) {
+      area_moment[dim] += sums.area_moment[dim];
+      volume_moment[dim] += sums.volume_moment[dim];
+      low[dim] = std::min(low[dim], sums.low[dim]);
+      high[dim] = std::max(high[dim], sums.high[dim]);
+    }
+  }
+
+  int label;
+  double area;
+  double volume;
+  double area_moment[3];    // area times the triangle centroid
+  double volume_moment[3];  // signed volume times the tetrahedron centroid
+  double low[3];
+  double high[3];
+};
+
+/**
+  * Fill the properties of a component from its sums
+  */
+static void finish(const PartialSums &sums, const QVector3D &origin, MassProperties &properties) {
+  properties.area = sums.area;
+  properties.volume = sums.volume;
+  double centroid[3];
+  for (int dim = 0; dim < 3; dim++) {
+    if (sums.low[dim] > sums.high[dim]) {
+      centroid[dim] = 0;
+      properties.low[dim] = properties.high[dim] = origin[dim];
+      continue;
+    }
+    if (properties.watertight() && sums.volume != 0) {
+      centroid[dim] = sums.volume_moment[dim] / sums.volume;
+    }
+    else if (sums.area > 0) {
+      centroid[dim] = sums.area_moment[dim] / sums.area;
+    }
+    else {
+      centroid[dim] = (sums.low[dim] + sums.high[dim]) / 2;
+    }
+    properties.low[dim] = sums.low[dim] + origin[dim];
+    properties.high[dim] = sums.high[dim] + origin[dim];
+  }
+  properties.centroid = QVector3D(centroid[0], centroid[1], centroid[2]) + origin;
+}
+
+/**
+  * Compute area, volume, centroid, bounds and watertightness of every
+  * connected component and of the whole model
+  * Components are the faces connected by shared edges, numbered like
+  * colorize() numbers them. An edge is fine when exactly two faces share
+  * it in opposite directions. Every pass runs on all cores over fixed
+  * chunks whose results are merged in order, so the sums don't depend
+  * on the number of threads
+  * Input: const FaceCollection - triangulated mesh
+  *        std::vector<MassProperties> - output, one entry per component
+  *        MassProperties - output, the whole model
+  * Output: void, throws MemoryBudgetExceeded
+  */
+void computeMassProperties(const FaceCollection &mesh, std::vector<MassProperties> &components,
+                           MassProperties &total) {
+  TRACE_SCOPE("mass properties");
+  const std::vector<unsigned int> &corners = mesh.face_corners;
+  const std::vector<unsigned int> &offsets = mesh.face_offsets;
+  size_t n_faces = mesh.faces.size();
+  size_t n_vertices = mesh.vertexCount();
+  size_t n_triangles = mesh.triangleCount();
+  MemoryReservation memory(ACCELERATION_MEMORY);
+  memory.resize(n_faces * (sizeof(std::atomic<unsigned int>) + sizeof(int)) +
+                corners.size() * 2 * sizeof(unsigned int) + (n_vertices + 1) * 2 * sizeof(unsigned int));
+
+  std::vector<unsigned int> corner_faces(corners.size());
+  std::vector<std::atomic<unsigned int>> parent(n_faces);
+  parallelChunks(n_faces, MASS_GRAIN, [&](size_t, size_t begin, size_t end) {
+    for (size_t f = begin; f < end; f++) {
+      parent[f] = f;
+      std::fill(corner_faces.begin() + offsets[f], corner_faces.begin() + offsets[f + 1], f);
+    }
+  });
+
+  // Face corners around every vertex, in compressed rows
+  std::vector<std::atomic<unsigned int>> counts(n_vertices + 1);
+  parallelChunks(corners.size(), MASS_GRAIN, [&](size_t, size_t begin, size_t end) {
+    for (size_t c = begin; c < end; c++) {
+      counts[corners[c] + 1]++;
+    }
+  });
+  std::vector<unsigned int> row(n_vertices + 1, 0);
+  for (size_t v = 0; v < n_vertices; v++) {
+    row[v + 1] = row[v] + counts[v + 1];
+    counts[v] = row[v];
+  }
+  std::vector<unsigned int> vertex_corners(corners.size());
+  parallelChunks(corners.size(), MASS_GRAIN, [&](size_t, size_t begin, size_t end) {
+    for (size_t c = begin; c < end; c++) {
+      vertex_corners[counts[corners[c]]++] = c;
+    }
+  });
+  std::vector<std::atomic<unsigned int>>().swap(counts);
+
+  // Every edge is handled at its endpoint with the smaller index,
+  // the faces sharing it are joined into one component
+  std::vector<std::vector<EdgeDefect>> chunk_defects(chunkCount(n_vertices, MASS_GRAIN));
+  parallelChunks(n_vertices, MASS_GRAIN, [&](size_t chunk, size_t begin, size_t end) {
+    std::vector<EdgeEnd> edges;
+    for (size_t v = begin; v < end; v++) {
+      edges.clear();
+      for (unsigned int i = row[v]; i < row[v + 1]; i++) {
+        unsigned int c = vertex_corners[i];
+        unsigned int f = corner_faces[c];
+        unsigned int first = offsets[f];
+        unsigned int size = offsets[f + 1] - first;
+        unsigned int next = corners[first + (c - first + 1) % size];
+        unsigned int previous = corners[first + (c - first + size - 1) % size];
+        if (next > v) {
+          EdgeEnd edge = {next, f, true};
+          edges.push_back(edge);
+        }
+        if (previous > v) {
+          EdgeEnd edge = {previous, f, false};
+          edges.push_back(edge);
+        }
+      }
+      std::sort(edges.begin(), edges.end());
+      for (size_t i = 0, j; i < edges.size(); i = j) {
+        for (j = i + 1; j < edges.size() && edges[j].other == edges[i].other; j++) {
+          uniteFaces(parent, edges[i].face, edges[j].face);
+        }
+        if (j - i == 1 || j - i > 2 || edges[i].forward == edges[i + 1].forward) {
+          EdgeDefect defect = {edges[i].face, j - i == 1};
+          chunk_defects[chunk].push_back(defect);
+        }
+      }
+    }
+  });
+  std::vector<unsigned int>().swap(vertex_corners);
+  std::vector<unsigned int>().swap(corner_faces);
+
+  // Components are numbered in the order of their first face
+  std::vector<int> labels(n_faces);
+  components.clear();
+  for (size_t f = 0; f < n_faces; f++) {
+    unsigned int root = findRoot(parent, f);
+    if (root == f) {
+      components.push_back(MassProperties());
+      components.back().label = components.size();
+    }
+    labels[f] = root == f ? (int)components.size() : labels[root];
+    components[labels[f] - 1].faces++;
+  }
+  std::vector<std::atomic<unsigned int>>().swap(parent);
+  for (const std::vector<EdgeDefect> &defects : chunk_defects) {
+    for (const EdgeDefect &defect : defects) {
+      MassProperties &component = components[labels[defect.face] - 1];
+      if (defect.boundary) {
+        component.boundary_edges++;
+      }
+      else {
+        component.non_manifold_edges++;
+      }
+    }
+  }
+
+  // Sums over runs of triangles of the same component
+  QVector3D origin = n_vertices > 0 ? mesh.position(0) : QVector3D();
+  std::vector<std::vector<PartialSums>> chunk_sums(chunkCount(n_triangles, MASS_GRAIN));
+  parallelChunks(n_triangles, MASS_GRAIN, [&](size_t chunk, size_t begin, size_t end) {
+    std::vector<PartialSums> &runs = chunk_sums[chunk];
+    for (size_t t = begin; t < end; t++) {
+      int label = labels[mesh.triangle_faces[t]];
+      if (runs.empty() || runs.back().label != label) {
+        runs.push_back(PartialSums(label));
+      }
+      PartialSums &sums = runs.back();
+      double p[3][3];
+      for (int k = 0; k < 3; k++) {
+        QVector3D position = mesh.position(mesh.triangles[t * 3 + k]) - origin;
+        for (int dim = 0; dim < 3; dim++) {
+          p[k][dim] = position[dim];
+          sums.low[dim] = std::min(sums.low[dim], p[k][dim]);
+          sums.high[dim] = std::max(sums.high[dim], p[k][dim]);
+        }
+      }
+      double e1[3], e2[3];
+      for (int dim = 0; dim < 3; dim++) {
+        e1[dim] = p[1][dim] - p[0][dim];
+        e2[dim] = p[2][dim] - p[0][dim];
+      }
+      double cross[3] = {e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0]};
+      double area = std::sqrt(cross[0] * cross[0] + cross[1] * cross[1] + cross[2] * cross[2]) / 2;
+      // Signed volume of the tetrahedron of the triangle and the origin
+      double volume = (p[0][0] * (p[1][1] * p[2][2] - p[1][2] * p[2][1]) +
+                       p[0][1] * (p[1][2] * p[2][0] - p[1][0] * p[2][2]) +
+                       p[0][2] * (p[1][0] * p[2][1] - p[1][1] * p[2][0])) / 6;
+      sums.area += area;
+      sums.volume += volume;
+      for (int dim = 0; dim < 3; dim++) {
+        double corner_sum = p[0][dim] + p[1][dim] + p[2][dim];
+        sums.area_moment[dim] += area * corner_sum / 3;
+        sums.volume_moment[dim] += volume * corner_sum / 4;
+      }
+    }
+  });
+
+  std::vector<PartialSums> component_sums;
+  for (size_t i = 0; i < components.size(); i++) {
+    component_sums.push_back(PartialSums(i + 1));
+  }
+  for (const std::vector<PartialSums> &runs : chunk_sums) {
+    for (const PartialSums &sums : runs) {
+      component_sums[sums.label - 1].add(sums);
+    }
+  }
+  total = MassProperties();
+  PartialSums total_sums(0);
+  for (size_t i = 0; i < components.size(); i++) {
+    finish(component_sums[i], origin, components[i]);
+    total_sums.add(component_sums[i]);
+    total.faces += components[i].faces;
+    total.boundary_edges += components[i].boundary_edges;
+    total.non_manifold_edges += components[i].non_manifold_edges;
+  }
+  finish(total_sums, origin, total);
+}
+
+static std::string formatVector(const QVector3D &vector) {
+  char text[96];
+  std::snprintf(text, sizeof(text), "(%.6g, %.6g, %.6g)", vector.x(), vector.y(), vector.z());
+  return text;
+}
+
+static std::string formatRow(const std::string &name, const MassProperties &properties) {
+  char text[128];
+  std::snprintf(text, sizeof(text), "%-10s %10zu %14.6g %14.6g  ", name.c_str(), properties.faces,
+                properties.area, properties.volume);
+  std::string row = text;
+  if (properties.watertight()) {
+    row += "yes";
+  }
+  else {
+    std::snprintf(text, sizeof(text), "no (%zu open, %zu non-manifold edges)", properties.boundary_edges,
+                  properties.non_manifold_edges);
+    row += text;
+  }
+  return row + "  centroid " + formatVector(properties.centroid) + "  bounds " + formatVector(properties.low) +
+         " - " + formatVector(properties.high) + "\n";
+}
+
+/**
+  * Table of the mass properties of a model
+  * Input: const QString - name of the model
+  *        const std::vector<MassProperties> - its components
+  *        const MassProperties - the whole model
+  * Output: std::string - one line per component and a total
+  */
+std::string massPropertiesReport(const QString &name, const std::vector<MassProperties> &components,
+                                 const MassProperties &total) {
+  std::string report = name.toStdString() + ": " + std::to_string(components.size()) + " components\n";
+  char text[128];
+  std::snprintf(text, sizeof(text), "%-10s %10s %14s %14s  %s\n", "component", "faces", "area", "volume",
+                "watertight");
+  report += text;
+  for (const MassProperties &component : components) {
+    report += formatRow(std::to_string(component.label), component);
+  }
+  return report + formatRow("total", total);
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <QString>
+#include <QVector3D>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "face.h"
+
+/**
+  * Surface and solid properties of a connected component or a whole model
+  * The volume is signed, positive when the faces are wound counterclockwise
+  * seen from outside. The centroid is the one of the solid for watertight
+  * surfaces and the one of the surface otherwise
+  */
+struct MassProperties {
+  MassProperties() : label(0), faces(0), area(0), volume(0), boundary_edges(0), non_manifold_edges(0) {}
+  bool watertight() const { return faces > 0 && boundary_edges == 0 && non_manifold_edges == 0; }
+
+  int label;                  // as assigned by colorize(), 0 for the whole model
+  size_t faces;
+  double area;
+  double volume;
+  QVector3D centroid;
+  QVector3D low, high;        // bounding box
+  size_t boundary_edges;      // edges of a single face
+  size_t non_manifold_edges;  // edges of more than two faces or of two faces wound the same way
+};
+
+void computeMassProperties(const FaceCollection &mesh, std::vector<MassProperties> &components,
+                           MassProperties &total);
+std::string massPropertiesReport(const QString &name, const std::vector<MassProperties> &components,
+                                 const MassProperties &total);
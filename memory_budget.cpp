@@ -0,0 +1,156 @@
+#include "memory_budget.h"
+
+#include <atomic>
+#include <cstdio>
+#include <limits>
+
+static std::atomic<size_t> usage[MEMORY_CATEGORIES];
+static std::atomic<size_t> peaks[MEMORY_CATEGORIES];
+static std::atomic<size_t> total_usage(0);
+static std::atomic<size_t> total_peak(0);
+static std::atomic<size_t> budget(std::numeric_limits<size_t>::max());
+
+/**
+  * Raise a peak to a new value if it is higher
+  */
+static void raisePeak(std::atomic<size_t> &peak, size_t value) {
+  size_t current = peak.load();
+  while (value > current && !peak.compare_exchange_weak(current, value)) {
+  }
+}
+
+/**
+  * Add to the usage of a category, or subtract if bytes is negative
+  * Input: MemoryCategory - the category
+  *        ptrdiff_t - change in bytes
+  *        bool - fail if the budget would be exceeded
+  * Output: bool - false if the change was refused
+  */
+static bool account(MemoryCategory category, ptrdiff_t bytes, bool checked) {
+  size_t total = total_usage.load();
+  if (bytes > 0 && checked) {
+    do {
+      if (total + bytes > budget.load()) {
+        return false;
+      }
+    } while (!total_usage.compare_exchange_weak(total, total + bytes));
+  }
+  else {
+    total = total_usage.fetch_add(bytes);
+  }
+  size_t category_usage = usage[category].fetch_add(bytes) + bytes;
+  raisePeak(peaks[category], category_usage);
+  raisePeak(total_peak, total + bytes);
+  return true;
+}
+
+static std::string megabytes(size_t bytes) {
+  char text[32];
+  std::snprintf(text, sizeof(text), "%.1f MB", bytes / 1048576.0);
+  return text;
+}
+
+MemoryReservation::MemoryReservation(MemoryReservation &&other) : category(other.category), bytes(other.bytes) {
+  other.bytes = 0;
+}
+
+MemoryReservation &MemoryReservation::operator=(MemoryReservation &&other) {
+  if (this != &other) {
+    release();
+    category = other.category;
+    bytes = other.bytes;
+    other.bytes = 0;
+  }
+  return *this;
+}
+
+/**
+  * Change the size of the reservation, failing if it would exceed the budget
+  * Input: size_t - new size in bytes
+  * Output: void, throws MemoryBudgetExceeded
+  */
+void MemoryReservation::resize(size_t new_bytes) {
+  if (!account(category, (ptrdiff_t)new_bytes - (ptrdiff_t)bytes, true)) {
+    throw MemoryBudgetExceeded("Not enough memory: " + megabytes(new_bytes - bytes) + " more for " +
+                               memoryCategoryName(category) + " would exceed the budget of " +
+                               megabytes(memoryBudget()) + " (" + megabytes(totalMemoryUsage()) + " in use)");
+  }
+  bytes = new_bytes;
+}
+
+/**
+  * Change the size of the reservation for memory that is already allocated
+  * Input: size_t - new size in bytes
+  * Output: void
+  */
+void MemoryReservation::update(size_t new_bytes) {
+  account(category, (ptrdiff_t)new_bytes - (ptrdiff_t)bytes, false);
+  bytes = new_bytes;
+}
+
+/**
+  * Name of a category in reports
+  * Input: MemoryCategory - the category
+  * Output: const char * - the name
+  */
+const char *memoryCategoryName(MemoryCategory category) {
+  static const char *names[MEMORY_CATEGORIES] = {"mesh", "acceleration", "caches", "gpu", "loader"};
+  return names[category];
+}
+
+size_t memoryUsage(MemoryCategory category) {
+  return usage[category].load();
+}
+
+size_t memoryPeak(MemoryCategory category) {
+  return peaks[category].load();
+}
+
+size_t totalMemoryUsage() {
+  return total_usage.load();
+}
+
+size_t totalMemoryPeak() {
+  return total_peak.load();
+}
+
+/**
+  * Limit the accounted memory, 0 removes the limit
+  * Input: size_t - the budget in bytes
+  * Output: void
+  */
+void setMemoryBudget(size_t bytes) {
+  budget = bytes > 0 ? bytes : std::numeric_limits<size_t>::max();
+}
+
+size_t memoryBudget() {
+  return budget.load();
+}
+
+/**
+  * Check if more memory can be reserved
+  * Input: size_t - bytes to add to the current usage
+  * Output: bool - true if the total stays within the budget
+  */
+bool memoryFits(size_t bytes) {
+  return totalMemoryUsage() + bytes <= memoryBudget();
+}
+
+/**
+  * Current and peak usage of every category
+  * Input: void
+  * Output: std::string - one line per category and the total
+  */
+std::string memoryReport() {
+  std::string report;
+  for (int c = 0; c < MEMORY_CATEGORIES; c++) {
+    MemoryCategory category = (MemoryCategory)c;
+    report += std::string(memoryCategoryName(category)) + ": " + megabytes(memoryUsage(category)) +
+              " (peak " + megabytes(memoryPeak(category)) + ")\n";
+  }
+  report += "total: " + megabytes(totalMemoryUsage()) + " (peak " + megabytes(totalMemoryPeak()) + ")";
+  if (memoryBudget() != std::numeric_limits<size_t>::max()) {
+    report += ", budget " + megabytes(memoryBudget());
+  }
+  return report;
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstddef>
+#include <stdexcept>
+#include <string>
+
+/**
+  * Subsystems whose memory is accounted
+  * MESH_MEMORY - faces, positions and normals of loaded models
+  * ACCELERATION_MEMORY - depth-sorted frames and the tile bins of the software renderer
+  * CACHE_MEMORY - buffers kept between frames, like the software render targets
+  * GPU_MEMORY - vertex, label, instance and edge buffers
+  * LOADER_MEMORY - file contents and faces of a model that is being loaded
+  */
+enum MemoryCategory {
+  MESH_MEMORY,
+  ACCELERATION_MEMORY,
+  CACHE_MEMORY,
+  GPU_MEMORY,
+  LOADER_MEMORY,
+  MEMORY_CATEGORIES
+};
+
+/**
+  * A reservation that would exceed the memory budget
+  */
+class MemoryBudgetExceeded : public std::runtime_error {
+public:
+  MemoryBudgetExceeded(const std::string &message) : std::runtime_error(message) {}
+};
+
+/**
+  * Bytes accounted to a category, released on destruction
+  * Growing a reservation throws MemoryBudgetExceeded if the total of all
+  * categories would exceed the budget, the reservation is unchanged then
+  */
+class MemoryReservation {
+public:
+  MemoryReservation(MemoryCategory category = MESH_MEMORY) : category(category), bytes(0) {}
+  MemoryReservation(MemoryReservation &&other);
+  MemoryReservation &operator=(MemoryReservation &&other);
+  MemoryReservation(const MemoryReservation &) = delete;
+  MemoryReservation &operator=(const MemoryReservation &) = delete;
+  ~MemoryReservation() { release(); }
+
+  void resize(size_t new_bytes);
+  void update(size_t new_bytes);
+  void release() { update(0); }
+  size_t size() const { return bytes; }
+
+protected:
+  MemoryCategory category;
+  size_t bytes;
+};
+
+const char *memoryCategoryName(MemoryCategory category);
+size_t memoryUsage(MemoryCategory category);
+size_t memoryPeak(MemoryCategory category);
+size_t totalMemoryUsage();
+size_t totalMemoryPeak();
+void setMemoryBudget(size_t bytes);
+size_t memoryBudget();
+bool memoryFits(size_t bytes);
+std::string memoryReport();
@@ -0,0 +1,422 @@
+#include "mesh_order.h"
+#include "memory_budget.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <cstdio>
+
+static const unsigned int CACHE_SIZE = 16;
+// A cluster ends once its vertex reuse is this close to that of the run it is cut from
+static const double OVERDRAW_THRESHOLD = 1.05;
+
+/**
+  * FIFO post-transform cache, a vertex is cached while fewer than
+  * CACHE_SIZE misses happened since it was loaded
+  */
+class VertexCache {
+public:
+  VertexCache(size_t vertex_count) : time(CACHE_SIZE + 1), loaded(vertex_count, 0) {}
+
+  bool contains(unsigned int vertex) const { return time - loaded[vertex] <= CACHE_SIZE; }
+  unsigned int age(unsigned int vertex) const { return time - loaded[vertex]; }
+  // Number of misses of a triangle
+  unsigned int draw(const unsigned int *corners) {
+    unsigned int misses = 0;
+    for (int k = 0; k < 3; k++) {
+      if (!contains(corners[k])) {
+        loaded[corners[k]] = time++;
+        misses++;
+      }
+    }
+    return misses;
+  }
+  void flush() { time += CACHE_SIZE + 1; }
+
+protected:
+  unsigned int time;
+  std::vector<unsigned int> loaded;
+};
+
+/**
+  * Average cache miss ratio of drawing triangles in order
+  * Input: const std::vector<unsigned int> - three vertex indices per triangle
+  *        size_t - number of vertices
+  * Output: double - misses of a 16 entry FIFO cache per triangle
+  */
+double averageCacheMissRatio(const std::vector<unsigned int> &triangles, size_t vertex_count) {
+  size_t n_triangles = triangles.size() / 3;
+  if (n_triangles == 0) {
+    return 0;
+  }
+  VertexCache cache(vertex_count);
+  size_t misses = 0;
+  for (size_t t = 0; t < n_triangles; t++) {
+    misses += cache.draw(&triangles[t * 3]);
+  }
+  return (double)misses / n_triangles;
+}
+
+/**
+  * Order the triangles for the vertex cache with Tipsify (Sander et al.
+  * 2007): emit all remaining triangles around a vertex, then continue
+  * at the vertex of those that stays in the cache the longest while its
+  * remaining triangles still fit, else at the last vertex with triangles left
+  * Input: const std::vector<unsigned int> - three vertex indices per triangle
+  *        size_t - number of vertices
+  *        std::vector<unsigned int> - gets the triangles in their new order
+  *        std::vector<unsigned int> - gets the positions in that order where
+  *                                    the walk jumped to an unconnected vertex
+  */
+static void tipsify(const std::vector<unsigned int> &triangles, size_t vertex_count,
+                    std::vector<unsigned int> &order, std::vector<unsigned int> &restarts) {
+  size_t n_triangles = triangles.size() / 3;
+  // Triangles around every vertex
+  std::vector<unsigned int> offsets(vertex_count + 1, 0);
+  for (unsigned int vertex : triangles) {
+    offsets[vertex + 1]++;
+  }
+  for (size_t v = 0; v < vertex_count; v++) {
+    offsets[v + 1] += offsets[v];
+  }
+  std::vector<unsigned int> adjacency(triangles.size());
+  std::vector<unsigned int> live(vertex_count);  // corners of triangles not emitted yet
+  for (size_t v = 0; v < vertex_count; v++) {
+    live[v] = offsets[v + 1] - offsets[v];
+  }
+  {
+    std::vector<unsigned int> fill(offsets.begin(), offsets.end() - 1);
+    for (size_t i = 0; i < triangles.size(); i++) {
+      adjacency[fill[triangles[i]]++] = i / 3;
+    }
+  }
+
+  std::vector<char> emitted(n_triangles, 0);
+  std::vector<unsigned int> dead_end;
+  std::vector<unsigned int> candidates;
+  VertexCache cache(vertex_count);
+  order.clear();
+  order.reserve(n_triangles);
+  restarts.clear();
+  size_t cursor = 0;
+  long fan = -1;
+  while (true) {
+    if (fan < 0) {
+      while (cursor < vertex_count && live[cursor] == 0) {
+        cursor++;
+      }
+      if (cursor == vertex_count) {
+        break;
+      }
+      fan = cursor;
+      restarts.push_back(order.size());
+    }
+    candidates.clear();
+    for (unsigned int i = offsets[fan]; i < offsets[fan + 1]; i++) {
+      unsigned int t = adjacency[i];
+      if (emitted[t]) {
+        continue;
+      }
+      emitted[t] = 1;
+      order.push_back(t);
+      cache.draw(&triangles[t * 3]);
+      for (int k = 0; k < 3; k++) {
+        unsigned int vertex = triangles[t * 3 + k];
+        live[vertex]--;
+        dead_end.push_back(vertex);
+        candidates.push_back(vertex);
+      }
+    }
+
+    fan = -1;
+    long best_priority = -1;
+    for (unsigned int vertex : candidates) {
+      if (live[vertex] == 0) {
+        continue;
+      }
+      // A vertex whose triangles would push it out of the cache is a last resort
+      long priority = 0;
+      if (cache.age(vertex) + 2 * live[vertex] <= CACHE_SIZE) {
+        priority = cache.age(vertex);
+      }
+      if (priority > best_priority) {
+        best_priority = priority;
+        fan = vertex;
+      }
+    }
+    while (fan < 0 && !dead_end.empty()) {
+      unsigned int vertex = dead_end.back();
+      dead_end.pop_back();
+      if (live[vertex] > 0) {
+        fan = vertex;
+      }
+    }
+  }
+}
+
+/**
+  * Area weighted centroid and normal of triangles
+  */
+static void triangleSums(const FaceCollection &mesh, const unsigned int *order, size_t count, QVector3D &centroid,
+                         QVector3D &area) {
+  centroid = QVector3D();
+  area = QVector3D();
+  double weight = 0;
+  for (size_t i = 0; i < count; i++) {
+    const unsigned int *corners = &mesh.triangles[order[i] * 3];
+    QVector3D a = mesh.position(corners[0]);
+    QVector3D b = mesh.position(corners[1]);
+    QVector3D c = mesh.position(corners[2]);
+    QVector3D cross = QVector3D::crossProduct(b - a, c - a);
+    float length = cross.length();
+    centroid += (a + b + c) * (length / 3);
+    area += cross;
+    weight += length;
+  }
+  if (weight > 0) {
+    centroid /= weight;
+  }
+}
+
+/**
+  * Split the vertex cache order into clusters and draw those facing
+  * away from the center of the model first (Sander et al. 2007): they
+  * are on the outside, so they are in front of the others for most
+  * views and the hidden fragments behind them fail the depth test.
+  * Runs between restarts of the walk are split where the vertex reuse
+  * since the last split is nearly that of the whole run, so
+  * the clusters are small but cost the cache little
+  * Input: const FaceCollection - the mesh
+  *        const std::vector<unsigned int> - the vertex of every triangle corner
+  *        size_t - number of vertices
+  *        std::vector<unsigned int> - triangles in vertex cache order, sorted in place
+  *        const std::vector<unsigned int> - restarts of the walk
+  * Output: size_t - number of clusters
+  */
+static size_t sortClusters(const FaceCollection &mesh, const std::vector<unsigned int> &corner_vertices,
+                           size_t vertex_count, std::vector<unsigned int> &order,
+                           const std::vector<unsigned int> &restarts) {
+  std::vector<unsigned int> bounds;
+  VertexCache cache(vertex_count);
+  for (size_t r = 0; r < restarts.size(); r++) {
+    size_t first = restarts[r];
+    size_t last = r + 1 < restarts.size() ? restarts[r + 1] : order.size();
+    size_t misses = 0;
+    cache.flush();
+    for (size_t i = first; i < last; i++) {
+      misses += cache.draw(&corner_vertices[order[i] * 3]);
+    }
+    double threshold = OVERDRAW_THRESHOLD * misses / (last - first);
+
+    bounds.push_back(first);
+    size_t start = first;
+    misses = 0;
+    cache.flush();
+    for (size_t i = first; i + 1 < last; i++) {
+      misses += cache.draw(&corner_vertices[order[i] * 3]);
+      if (misses <= threshold * (i + 1 - start)) {
+        bounds.push_back(i + 1);
+        start = i + 1;
+        misses = 0;
+        cache.flush();
+      }
+    }
+  }
+  bounds.push_back(order.size());
+  size_t n_clusters = bounds.size() - 1;
+
+  QVector3D center, area;
+  triangleSums(mesh, order.data(), order.size(), center, area);
+  std::vector<std::pair<float, unsigned int>> keys(n_clusters);
+  for (size_t c = 0; c < n_clusters; c++) {
+    QVector3D centroid;
+    triangleSums(mesh, &order[bounds[c]], bounds[c + 1] - bounds[c], centroid, area);
+    keys[c] = std::make_pair(-QVector3D::dotProduct(centroid - center, area.normalized()), (unsigned int)c);
+  }
+  std::stable_sort(keys.begin(), keys.end());
+
+  std::vector<unsigned int> sorted;
+  sorted.reserve(order.size());
+  for (const std::pair<float, unsigned int> &key : keys) {
+    sorted.insert(sorted.end(), order.begin() + bounds[key.second], order.begin() + bounds[key.second + 1]);
+  }
+  order.swap(sorted);
+  return n_clusters;
+}
+
+/**
+  * Find the vertices the renderer draws a mesh with: corners share a
+  * vertex if they have the same position, vertex normal and face gray
+  * level, and optionally the same face label or the same face. Vertices
+  * are numbered in the order the triangles first use them
+  * Input: const FaceCollection - triangulated mesh with normals in either storage
+  *        bool - corners of faces with different labels don't share
+  *        bool - corners of different faces don't share
+  *        std::vector<unsigned int> - output, the vertex of every corner
+  *        std::vector<unsigned int> - output, the first corner of every vertex
+  * Output: void
+  */
+void shareVertices(const FaceCollection &mesh, bool by_label, bool by_face, std::vector<unsigned int> &corner_vertices,
+                   std::vector<unsigned int> &vertex_corners) {
+  const unsigned int none = ~0u;
+  size_t n_corners = mesh.triangles.size();
+  size_t n_positions = mesh.compact_storage ? mesh.quantized_positions.size() : mesh.positions.size();
+  bool normals = mesh.corner_normals.size() == n_corners;
+  // The vertices of a position are chained, there are more than one only at creases
+  std::vector<unsigned int> first(n_positions, none);
+  std::vector<unsigned int> next;
+  corner_vertices.resize(n_corners);
+  vertex_corners.clear();
+  for (size_t corner = 0; corner < n_corners; corner++) {
+    unsigned int face = mesh.triangle_faces[corner / 3];
+    unsigned int vertex = first[mesh.triangles[corner]];
+    for (; vertex != none; vertex = next[vertex]) {
+      unsigned int other = vertex_corners[vertex];
+      unsigned int other_face = mesh.triangle_faces[other / 3];
+      if ((!normals || mesh.corner_normals[other] == mesh.corner_normals[corner]) &&
+          mesh.faces[other_face].c == mesh.faces[face].c &&
+          (!by_label || mesh.faces[other_face].label == mesh.faces[face].label) && (!by_face || other_face == face)) {
+        break;
+      }
+    }
+    if (vertex == none) {
+      vertex = vertex_corners.size();
+      vertex_corners.push_back(corner);
+      next.push_back(first[mesh.triangles[corner]]);
+      first[mesh.triangles[corner]] = vertex;
+    }
+    corner_vertices[corner] = vertex;
+  }
+}
+
+/**
+  * Permute groups of elements, group i of the result is group order[i]
+  */
+template <typename T>
+static void permuteGroups(std::vector<T> &values, const std::vector<unsigned int> &order, size_t group) {
+  std::vector<T> permuted(values.size());
+  for (size_t i = 0; i < order.size(); i++) {
+    std::copy(values.begin() + order[i] * group, values.begin() + (order[i] + 1) * group,
+              permuted.begin() + i * group);
+  }
+  values.swap(permuted);
+}
+
+/**
+  * Number elements in the order they are first used, unused ones last
+  * Input: std::vector<unsigned int> - indices, renumbered in place
+  *        size_t - number of elements
+  * Output: std::vector<unsigned int> - old index of every new index
+  */
+static std::vector<unsigned int> renumberByFirstUse(std::vector<unsigned int> &indices, size_t count) {
+  const unsigned int unused = ~0u;
+  std::vector<unsigned int> remap(count, unused);
+  std::vector<unsigned int> old_index;
+  old_index.reserve(count);
+  for (unsigned int &index : indices) {
+    if (remap[index] == unused) {
+      remap[index] = old_index.size();
+      old_index.push_back(index);
+    }
+    index = remap[index];
+  }
+  for (size_t i = 0; i < count; i++) {
+    if (remap[i] == unused) {
+      remap[i] = old_index.size();
+      old_index.push_back(i);
+    }
+  }
+  return old_index;
+}
+
+template <typename T>
+static void gather(std::vector<T> &values, const std::vector<unsigned int> &old_index) {
+  std::vector<T> gathered(values.size());
+  for (size_t i = 0; i < old_index.size(); i++) {
+    gathered[i] = values[old_index[i]];
+  }
+  values.swap(gathered);
+}
+
+/**
+  * Reorder the triangles of a mesh for the post-transform vertex cache
+  * and for less overdraw, then the positions and vertex normals in the
+  * order the triangles first use them, so drawing walks the vertex
+  * data front to back. The order is optimized for the vertices of
+  * shareVertices(), which the renderer draws models with that were
+  * reordered. The faces, their corners and the geometry are unchanged,
+  * only the triangles of a face are no longer consecutive
+  * Input: FaceCollection - triangulated mesh with normals in either storage
+  * Output: MeshOrderStatistics - the cache miss ratios of the shared
+  *         vertices before and after, throws MemoryBudgetExceeded
+  */
+MeshOrderStatistics optimizeMeshOrder(FaceCollection &mesh) {
+  TRACE_SCOPE("optimize mesh order");
+  MeshOrderStatistics statistics;
+  size_t n_triangles = mesh.triangleCount();
+  size_t n_positions = mesh.compact_storage ? mesh.quantized_positions.size() : mesh.positions.size();
+  statistics.triangles = n_triangles;
+  if (n_triangles == 0) {
+    return statistics;
+  }
+  // The shared vertices, the adjacency, the walk and a copy of the largest array being permuted
+  MemoryReservation memory(LOADER_MEMORY);
+  memory.resize(n_triangles * 3 * (4 * sizeof(unsigned int) + sizeof(QVector3D)) + n_positions * 16);
+
+  std::vector<unsigned int> corner_vertices, vertex_corners;
+  shareVertices(mesh, false, false, corner_vertices, vertex_corners);
+  statistics.acmr_before = averageCacheMissRatio(corner_vertices, vertex_corners.size());
+  std::vector<unsigned int> order, restarts;
+  tipsify(corner_vertices, vertex_corners.size(), order, restarts);
+  statistics.clusters = sortClusters(mesh, corner_vertices, vertex_corners.size(), order, restarts);
+
+  permuteGroups(mesh.triangles, order, 3);
+  permuteGroups(mesh.triangle_faces, order, 1);
+  if (mesh.corner_normals.size() == mesh.triangles.size()) {
+    permuteGroups(mesh.corner_normals, order, 3);
+  }
+
+  std::vector<unsigned int> old_position = renumberByFirstUse(mesh.triangles, n_positions);
+  std::vector<unsigned int> new_position(n_positions);
+  for (size_t i = 0; i < n_positions; i++) {
+    new_position[old_position[i]] = i;
+  }
+  for (unsigned int &corner : mesh.face_corners) {
+    corner = new_position[corner];
+  }
+  if (mesh.compact_storage) {
+    gather(mesh.quantized_positions, old_position);
+  }
+  else {
+    gather(mesh.positions, old_position);
+  }
+
+  size_t n_normals = mesh.compact_storage ? mesh.compact_vertex_normals.size() : mesh.vertex_normals.size();
+  std::vector<unsigned int> old_normal = renumberByFirstUse(mesh.corner_normals, n_normals);
+  if (mesh.compact_storage) {
+    gather(mesh.compact_vertex_normals, old_normal);
+  }
+  else {
+    gather(mesh.vertex_normals, old_normal);
+  }
+
+  shareVertices(mesh, false, false, corner_vertices, vertex_corners);
+  statistics.vertices = vertex_corners.size();
+  statistics.acmr_after = averageCacheMissRatio(corner_vertices, vertex_corners.size());
+  return statistics;
+}
+
+/**
+  * Summary of the reordering of a model
+  * Input: const QString - name of the model
+  *        const MeshOrderStatistics - the statistics
+  * Output: std::string - two lines of text
+  */
+std::string meshOrderReport(const QString &name, const MeshOrderStatistics &statistics) {
+  char text[224];
+  std::snprintf(text, sizeof(text),
+                ": %zu triangles, %zu vertices, %zu clusters\n"
+                "  ACMR 3.000 unoptimized (a vertex per corner), %.3f shared in file order, %.3f reordered\n",
+                statistics.triangles, statistics.vertices, statistics.clusters, statistics.acmr_before,
+                statistics.acmr_after);
+  return name.toStdString() + text;
+}
@@ -0,0 +1,917 @@
+#include <QFile>
+#include <QDir>
+#include <QFileInfo>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QMessageBox>
+#include <QString>
+#include <QtDebug>
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <sstream>
+#include <stdexcept>
+#include <string.h>
+#include <utility>
+
+#include "decompression.h"
+#include "model_loader.h"
+#include "normals.h"
+#include "ply.h"
+#include "renderer.h"
+#include "trace.h"
+
+static const bool DEBUG = false; // Change to true for view debug info
+
+static const size_t ACCOUNTING_INTERVAL = 4096;  // faces between budget checks
+static const size_t DEFAULT_PAGE_CACHE = (size_t)512 << 20;
+
+ModelLoader::ModelLoader() : loading(LOADER_MEMORY) {
+  interactive = true;
+  colorization = false;
+  compact_storage = false;
+  upload_buffers = true;
+  crease_angle = 30.0f;
+  track_changes = false;
+  page_cache = DEFAULT_PAGE_CACHE;
+  optimize_order = false;
+}
+
+/**
+  * Report a loading error and abort loading
+  * Shows a message box when running interactively,
+  * the memory of the model is released
+  * Input: const std::string - the message
+  * Output: void, always throws std::runtime_error
+  */
+void ModelLoader::error(const std::string &message){
+  loading.release();
+  if(interactive){
+    QMessageBox messageBox;
+    messageBox.critical(0, "Error", QString::fromStdString(message));
+  }
+  throw std::runtime_error(message);
+}
+
+/**
+  * Account the faces read so far, the budget is checked
+  * every few thousand faces
+  * Input: const FaceCollection - the faces, the last one was just added
+  *        size_t - bytes of the earlier faces, updated
+  *        size_t - other memory of the loader, e.g. vertex lists
+  * Output: void, throws MemoryBudgetExceeded
+  */
+void ModelLoader::accountFaces(const FaceCollection &result, size_t &face_bytes, size_t other_bytes){
+  face_bytes += result.faces.back().memoryUsage();
+  if(result.faces.size() % ACCOUNTING_INTERVAL == 0){
+    loading.resize(result.faces.capacity() * sizeof(Face) + face_bytes + other_bytes);
+  }
+}
+
+/**
+  * Check if the input string consists of
+  * the following characters only:
+  * /eE-+.,0123456789 \r\n
+  * Input: const std::string - the string to check
+  * Output: boolean
+  */
+bool ModelLoader::is_digits(const std::string &str)
+{
+    return str.find_first_not_of("/eE-+.,0123456789 \r\n") == std::string::npos;
+}
+
+/**
+  * Read a whole stream into memory
+  * Input: std::istream - the stream
+  *        MemoryReservation - grows with the contents
+  * Output: QByteArray - the contents, throws MemoryBudgetExceeded
+  */
+static QByteArray readContents(std::istream &input, MemoryReservation &reservation){
+  QByteArray contents;
+  char block[1 << 16];
+  while(input.read(block, sizeof(block)) || input.gcount() > 0){
+    reservation.resize(contents.size() + input.gcount());
+    contents.append(block, input.gcount());
+  }
+  return contents;
+}
+
+/**
+  * Load a model with .json extension
+  * Input: const QString - path to the file
+  * Output: FaceCollection - faces and normals of the model
+  */
+FaceCollection ModelLoader::loadJson(const QString &path){
+  TRACE_SCOPE("loadJson");
+  FaceCollection result;
+  std::unique_ptr<std::istream> input = openInputStream(path);
+  if (!*input) {
+    error("Failed to open file");
+  }
+  // The json parser needs the whole document
+  MemoryReservation contents(LOADER_MEMORY);
+  QByteArray json_data = readContents(*input, contents);
+  // The parsed document takes about as much memory as the text
+  MemoryReservation document(LOADER_MEMORY);
+  document.resize(json_data.size());
+  QJsonDocument json_document;
+  {
+    TRACE_SCOPE("parse json");
+    json_document = QJsonDocument::fromJson(json_data);
+  }
+  json_data.clear();
+  contents.release();
+  result.fromJson(json_document.array());
+  loading.resize(result.memoryUsage());
+  return result;
+}
+
+/**
+  * Load a model with .stl extension
+  * Input: const QString - path to the file
+  * Output: FaceCollection - faces and normals of the model
+  */
+FaceCollection ModelLoader::loadStl(const QString &path){
+  TRACE_SCOPE("loadStl");
+  FaceCollection result;
+  std::unique_ptr<std::istream> input = openInputStream(path);
+  if(!*input){
+    error("File not found");
+  }
+  readStl(*input, result, true, true);
+  return result;
+}
+
+/**
+  * Read the facets of an STL file, or of a part of it
+  * Input: std::istream - the text
+  *        FaceCollection - output, the facets are appended
+  *        bool - the text starts with the header line
+  *        bool - the text ends with the endsolid line
+  * Output: void
+  */
+void ModelLoader::readStl(std::istream &infile, FaceCollection &result, bool header, bool footer){
+  double x, y, z;
+  std::string line, token, value;
+  bool end_reached = false;
+  std::string::size_type sz;
+  size_t face_bytes = 0;
+
+  /* Read input file */
+  if(DEBUG){
+    qDebug() << "\tReading the file";
+  }
+  if(header){
+    std::getline(infile, line); // Read file format line
+    if(line != "solid Onshape"){
+      error("File format is not supported (not STL).");
+    }
+    if(DEBUG){
+      qDebug() << "\tReading the first line";
+    }
+  }
+  while(std::getline(infile, line)){
+    Face new_face;
+    new_face.c = 1;
+    if(line.substr(2, 12) != "facet normal"){
+      if(line.substr(0, 16) == "endsolid Onshape"){
+        end_reached = true;
+        break;
+      }
+      else{
+        error("File is corrupted. Unexpected format");
+      }
+    }
+    if(DEBUG){
+      qDebug() << "\tEntered the loop";
+      qDebug() << "\t\tRead \'facet normal\'";
+    }
+    value = line.substr(14, strlen(line.c_str()));
+    if (!is_digits(value)){
+      error("The definition of a normal contains non-digit characters");
+    }
+    value = line.substr(15, strlen(line.c_str()));
+    x = std::stod(value,&sz);
+    value = value.substr(sz);
+    y = std::stod(value, &sz);
+    value = value.substr(sz);
+    z = std::stod(value, &sz);
+    value = value.substr(sz);
+    if(DEBUG){
+      qDebug() << "\t\t" << x <<", "<<y<<", "<<z;
+    }
+    new_face.normal.push_back(QVector3D(x,y,z));
+    new_face.normals = true;
+    new_face.label = 0;
+    if (!(value == "\0")){
+      error("Unexpected number of dimensions in a normal vector");
+    }
+    if(!std::getline(infile, line)){
+      error("Unexpected end of file");
+    }
+    if(line.substr(4, 10) != "outer loop"){
+      error("File is corrupted. Expected an outer loop after the normal vector");
+    }
+    /*Read 3 vertices*/
+    for (int i=0; i<3; i++){
+        if(!std::getline(infile, line)){
+          error("Unexpected end of file");
+        }
+        if(line.substr(6, 6) != "vertex"){
+          error("File is corrupted. Expected a vertex in the outer loop");
+        }
+        value = line.substr(13, strlen(line.c_str()));
+        x = std::stod(value,&sz);
+        value = value.substr(sz);
+        y = std::stod(value, &sz);
+        value = value.substr(sz);
+        z = std::stod(value, &sz);
+        value = value.substr(sz);
+        new_face.vertices.push_back(QVector3D(x,y,z));
+        if (!(value == "\0")){
+          error("Unexpected number of dimensions in a vertex");
+        }
+        if(DEBUG){
+          qDebug() << "\t\t\t" << x <<", "<<y<<", "<<z;
+        }
+    }
+    if(!std::getline(infile, line)){
+      error("Unexpected end of file");
+    }
+    if(line.substr(4, 7) != "endloop"){
+      error("File is corrupted. Expected an endloop statement");
+    }
+    if(!std::getline(infile, line)){
+      error("Unexpected end of file");
+    }
+    if(line.substr(2, 8) != "endfacet"){
+      error("File is corrupted. Expected an endfacet statement");
+    }
+    result.faces.push_back(new_face);
+    accountFaces(result, face_bytes);
+  }
+  if (end_reached != footer){
+    error("File is corrupted");
+  }
+}
+
+/**
+  * Compute the mass properties of a loaded model
+  * They are left empty if the temporary buffers don't fit into the
+  * memory budget, the model is still loaded
+  * Input: const FaceCollection - triangulated faces
+  *        std::vector<MassProperties> - output, per component
+  *        MassProperties - output, the whole model
+  * Output: void
+  */
+void ModelLoader::measureFaces(const FaceCollection &faces, std::vector<MassProperties> &components, MassProperties &total){
+  try{
+    computeMassProperties(faces, components, total);
+  }
+  catch(const MemoryBudgetExceeded &e){
+    qWarning() << "Mass properties skipped:" << e.what();
+    components.clear();
+    total = MassProperties();
+  }
+}
+
+/**
+  * Find the position of the next occurrence of
+  * '/' or ' ' characters
+  * Input: const std::string - string to check
+  * Output: int - position of the next occurrence or -1
+  */
+int ModelLoader::delim(const std::string &str){
+  return std::min(str.find(" "), str.find("/"));
+}
+
+/**
+  * Load a model with .obj extension
+  * Input: const QString - path to the file
+  * Output: FaceCollection - faces and normals of the model,
+  *         or the points of a file without faces
+  */
+FaceCollection ModelLoader::loadObj(const QString &path){
+  TRACE_SCOPE("loadObj");
+  FaceCollection result;
+  double x, y, z;
+  std::string line, token, value;
+  std::vector<QVector3D> v;
+  std::vector<QVector3D> vn;
+  std::string::size_type sz;
+  size_t face_bytes = 0;
+  std::unique_ptr<std::istream> input = openInputStream(path);
+  std::istream &infile = *input;
+  if(!infile){
+    error("File not found");
+
+  }
+
+  /* Read input file */
+  if(DEBUG){
+    qDebug() << "\tReading the file";
+  }
+  while(!infile.eof() && std::getline(infile, line)){
+    if(line.substr(0,2) == "v "){
+      // Read a vertex
+      value = line.substr(2, strlen(line.c_str()));
+      if (!is_digits(value)){
+        error("The definition of a vertex contains non-digit characters");
+      }
+      x = std::stod(value,&sz);
+      value = value.substr(sz);
+      y = std::stod(value, &sz);
+      value = value.substr(sz);
+      z = std::stod(value, &sz);
+      value = value.substr(sz);
+      v.push_back(QVector3D(x,y,z));
+      // Files of vertices only can hold millions of points
+      if(v.size() % ACCOUNTING_INTERVAL == 0){
+        loading.resize(result.faces.capacity() * sizeof(Face) + face_bytes +
+                       (v.capacity() + vn.capacity()) * sizeof(QVector3D));
+      }
+      if(DEBUG){
+        qDebug() << "\t\t" <<  "v " << x << " " << y << " " << z;
+      }
+    }
+    if(line.substr(0,2) == "vn"){
+      // Read a normal
+      value = line.substr(2, strlen(line.c_str()));
+      if (!is_digits(value)){
+        error("The definition of a normal contains non-digit characters");
+      }
+      x = std::stod(value,&sz);
+      value = value.substr(sz);
+      y = std::stod(value, &sz);
+      value = value.substr(sz);
+      z = std::stod(value, &sz);
+      value = value.substr(sz);
+      vn.push_back(QVector3D(x,y,z));
+      if(DEBUG){
+        qDebug() << "\t\t" << "vn " << x << " " << y << " " << z;
+      }
+    }
+    if(line.substr(0,1) == "f"){
+      Face new_face;
+      int a, an;
+      new_face.label=0;
+      new_face.c = 1;
+      line = line.substr(1);
+      if(DEBUG){
+        qDebug() << "\t\t" << "Reading f";
+      }
+      value = line.substr(line.find_first_not_of(" "));
+      if (!is_digits(value)){
+        error("The definition of a face contains non-digit characters");
+      }
+      while((value.substr(0,1)!="\r") && (strlen(value.c_str())!=0)){
+          // Read a vertex
+          a = std::stoi(value.substr(0, delim(value)), &sz);
+          new_face.vertices.push_back(v[a-1]);
+          value = value.substr(sz);
+          if(DEBUG){
+            qDebug() << "\t\t" << "Vertex" << a << value.c_str();
+          }
+          // Read texture
+          if(value.substr(0,1)=="/"){
+            // Skip texture
+            if(DEBUG){
+              qDebug() << "\t\t" << "Skipping /";
+            } 
+            value = value.substr(1);
+            value = value.substr(value.find("/"));
+            if(DEBUG){
+              qDebug() << "\t\t" << value.c_str();
+            }
+          }
+          // Read normal
+          if(value.substr(0,1)=="/"){
+            value = value.substr(1);
+            an = std::stoi(value.substr(0, delim(value)), &sz);
+            new_face.normal.push_back(vn[an-1]);
+            new_face.normals = true;
+            if(DEBUG){
+              qDebug() << "\t\t" << "Normal";
+            }
+            value = value.substr(sz);
+            if(DEBUG){
+              qDebug() << "\t\t" << an << " " << value.c_str();
+            }
+          }
+          if(strlen(value.c_str())>0 && (int)value.find_first_not_of(" ")!=-1){
+            value = value.substr(value.find_first_not_of(" "));
+          }
+          if(DEBUG){
+            qDebug() << "\t\t Vertex info read\n\n";
+          }
+          if(infile.eof()){
+            break;
+          }
+        }
+        result.faces.push_back(new_face);
+        accountFaces(result, face_bytes, (v.capacity() + vn.capacity()) * sizeof(QVector3D));
+      }      
+  }
+  if(DEBUG){
+    qDebug() << "END OF FILE";
+  }
+  // Files of vertices only are point clouds
+  if(result.faces.empty()){
+    result.points.swap(v);
+  }
+  return result;
+}
+
+/**
+  * Load a model with .ply extension
+  * The file is mapped and binary blocks are decoded in place,
+  * ASCII files are parsed value by value
+  * Input: const QString - path to the file
+  * Output: FaceCollection - faces and normals of the model,
+  *         or the points of a file without faces
+  */
+FaceCollection ModelLoader::loadPly(const QString &path){
+  TRACE_SCOPE("loadPly");
+  QFile ply_file(path);
+  if(!ply_file.open(QIODevice::ReadOnly)){
+    error("File not found");
+  }
+  PlyMesh mesh;
+  MemoryReservation mesh_memory(LOADER_MEMORY);
+  bool compressed = detectCompression(path) != NO_COMPRESSION;
+  const char *data = compressed ? 0 : (const char *)ply_file.map(0, ply_file.size());
+  try{
+    if(data){
+      readPly(data, ply_file.size(), mesh);
+    }
+    else{
+      // Compressed files and files that can't be mapped are read into memory
+      std::unique_ptr<std::istream> input = openInputStream(path);
+      MemoryReservation contents_memory(LOADER_MEMORY);
+      QByteArray contents = readContents(*input, contents_memory);
+      readPly(contents.constData(), contents.size(), mesh);
+    }
+    mesh_memory.resize((mesh.positions.capacity() + mesh.normals.capacity() + mesh.colors.capacity()) * sizeof(float) +
+                       (mesh.face_offsets.capacity() + mesh.face_indices.capacity()) * sizeof(unsigned int));
+  }
+  catch(const std::runtime_error &e){
+    error(e.what());
+  }
+
+  FaceCollection result;
+  int n_faces = mesh.face_offsets.size() - 1;
+  if(n_faces == 0){
+    // Files of vertices only are point clouds
+    size_t n_points = mesh.positions.size() / 3;
+    loading.resize(n_points * sizeof(QVector3D) + mesh.colors.size() * sizeof(float));
+    result.points.resize(n_points);
+    for(size_t i=0; i<n_points; i++){
+      result.points[i] = QVector3D(mesh.positions[i * 3], mesh.positions[i * 3 + 1], mesh.positions[i * 3 + 2]);
+    }
+    result.point_colors.swap(mesh.colors);
+    return result;
+  }
+
+  TRACE_SCOPE("build faces");
+  size_t face_bytes = 0;
+  loading.resize(n_faces * sizeof(Face));
+  result.faces.resize(n_faces);
+  for(int f=0; f<n_faces; f++){
+    if(f % ACCOUNTING_INTERVAL == 0){
+      loading.resize(n_faces * sizeof(Face) + face_bytes);
+    }
+    Face &face = result.faces[f];
+    QVector3D normal;
+    float c = 0;
+    for(unsigned int i=mesh.face_offsets[f]; i<mesh.face_offsets[f+1]; i++){
+      const float *p = &mesh.positions[mesh.face_indices[i] * 3];
+      face.vertices.push_back(QVector3D(p[0], p[1], p[2]));
+      if(!mesh.normals.empty()){
+        const float *n = &mesh.normals[mesh.face_indices[i] * 3];
+        normal += QVector3D(n[0], n[1], n[2]);
+      }
+      c += mesh.colors.empty() ? 1.0f : mesh.colors[mesh.face_indices[i]];
+    }
+    // Faces without normals get them from generateNormals()
+    if(!normal.isNull()){
+      face.normal.push_back(normal.normalized());
+      face.normals = true;
+    }
+    face.c = face.vertices.empty() ? 1.0f : c / face.vertices.size();
+    face.label = 0;
+    face_bytes += face.memoryUsage();
+  }
+  return result;
+}
+
+/**
+  * Load the faces of a single model file
+  * Calls loadJson(path), loadStl(path), loadObj(path) or loadPly(path)
+  * depending on the file's extension. Files compressed with gzip or
+  * zstd are recognized by their contents and decompressed while loading,
+  * the extension is then taken from the name without .gz or .zst
+  * Input: const QString - path to the file
+  * Output: FaceCollection - triangulated faces of the model
+  */
+FaceCollection ModelLoader::loadModelFile(const QString &path) {
+  TRACE_SCOPE("loadModelFile");
+  FaceCollection result;
+  loading.release();
+  QString name = uncompressedName(path);
+  QString extension = name.mid(name.lastIndexOf(QString("."))+1, name.length()-1);
+  try{
+    if(extension == "json"){
+      if(DEBUG==true){
+        qDebug() << "Reading .json";
+      }
+      result = loadJson(path);
+    }
+    if(extension == "stl"){
+      if(DEBUG==true){
+        qDebug() << "Reading .stl";
+      }
+      result = loadStl(path);
+    }
+    if(extension == "obj"){
+      if(DEBUG==true){
+        qDebug() << "Reading .obj";
+      }
+      result = loadObj(path);
+    }
+    if(extension == "ply"){
+      if(DEBUG==true){
+        qDebug() << "Reading .ply";
+      }
+      result = loadPly(path);
+    }
+    // The faces of a compact model aren't needed after triangulation,
+    // so the mesh grows while they are released
+    result.triangulate(compact_storage);
+    generateNormals(result, crease_angle);
+    if(optimize_order){
+      order_statistics = optimizeMeshOrder(result);
+    }
+    loading.resize(result.memoryUsage());
+  }
+  catch(const DecompressionError &e){
+    error(e.what());
+  }
+  catch(const MemoryBudgetExceeded &e){
+    error(e.what());
+  }
+  catch(const std::bad_alloc &){
+    error("Not enough memory to load the file");
+  }
+  return result;
+}
+
+/**
+  * Load a scene description with .scene extension
+  * The file is a json object listing model files and their transforms:
+  * {"instances": [{"file": "bolt.stl", "transform": [16 numbers, row-major]}]}
+  * Relative paths are resolved against the folder of the scene file
+  * Input: Scene - the scene to add the instances to
+  *        const QString - path to the file
+  * Output: void
+  */
+void ModelLoader::loadScene(Scene &scene, const QString &path) {
+  QFile scene_file(path);
+  if (!scene_file.open(QIODevice::ReadOnly)) {
+    error("File not found");
+  }
+  QJsonDocument scene_document(QJsonDocument::fromJson(scene_file.readAll()));
+  if (!scene_document.isObject() || !scene_document.object()["instances"].isArray()) {
+    error("Scene file has no list of instances");
+  }
+  QDir folder = QFileInfo(path).absoluteDir();
+  for (const QJsonValue &value : scene_document.object()["instances"].toArray()) {
+    QJsonObject instance = value.toObject();
+    if (!instance["file"].isString()) {
+      error("Missing field 'file' in scene instance");
+    }
+    QMatrix4x4 transform;
+    if (instance.contains("transform")) {
+      QJsonArray values = instance["transform"].toArray();
+      if (values.count() != 16) {
+        error("Instance transform must have 16 values");
+      }
+      float matrix[16];
+      for (int i = 0; i < 16; i++) {
+        matrix[i] = values.at(i).toDouble();
+      }
+      transform = QMatrix4x4(matrix);
+    }
+    addModel(scene, folder.absoluteFilePath(instance["file"].toString()), transform);
+  }
+}
+
+/**
+  * Add an instance of a model file to the scene
+  * Files with identical contents are loaded only once,
+  * .pages files are added as paged models and files
+  * without faces as point clouds
+  * Input: Scene - the scene to add the instance to
+  *        const QString - path to the file
+  *        const QMatrix4x4 - model to world transform
+  * Output: void
+  */
+void ModelLoader::addModel(Scene &scene, const QString &path, const QMatrix4x4 &transform) {
+  if(path.endsWith(".pages")){
+    addPagedModel(scene, path, transform);
+    return;
+  }
+  QByteArray hash = Scene::fileHash(path);
+  int model = scene.findModel(hash);
+  if(model < 0){
+    FaceCollection faces = loadModelFile(path);
+    if(faces.faces.empty()){
+      addPointCloud(scene, path, faces, transform);
+      return;
+    }
+    std::vector<MassProperties> components;
+    MassProperties mass_properties;
+    measureFaces(faces, components, mass_properties);
+    if(colorization==true){
+      faces.colorize();
+    }
+    // Compact storage is also picked when the full precision
+    // model and its buffers wouldn't fit into the memory budget
+    size_t buffers = upload_buffers ? SceneRenderer::bufferSize(faces, colorization) : 0;
+    if(compact_storage==true || !memoryFits(buffers)){
+      faces.compact();
+      loading.update(faces.memoryUsage());
+      buffers = upload_buffers ? SceneRenderer::bufferSize(faces, colorization) : 0;
+    }
+    if(!memoryFits(buffers)){
+      error("Not enough memory for the model and its buffers within the budget of " +
+            std::to_string(memoryBudget() >> 20) + " MB");
+    }
+    loading.release();
+    model = scene.addModel(path, hash, std::move(faces));
+    scene.models[model]->component_properties.swap(components);
+    scene.models[model]->mass_properties = mass_properties;
+    scene.models[model]->labelled = colorization;
+    scene.models[model]->labels_dirty = colorization;
+    scene.models[model]->shared_vertices = optimize_order;
+    if(track_changes){
+      indexModel(*scene.models[model]);
+    }
+  }
+  scene.addInstance(model, transform);
+}
+
+/**
+  * Add a model that is drawn from a paged file, see writePagedModel()
+  * Only the chunk table and the proxies are read here
+  * Input: Scene - the scene to add the model to
+  *        const QString - path to the .pages file
+  *        const QMatrix4x4 - model to world transform
+  * Output: void
+  */
+void ModelLoader::addPagedModel(Scene &scene, const QString &path, const QMatrix4x4 &transform) {
+  TRACE_SCOPE("addPagedModel");
+  std::unique_ptr<PagedModel> model;
+  try {
+    model.reset(new PagedModel(path, page_cache));
+  }
+  catch (const std::runtime_error &e) {
+    error(e.what());
+  }
+  model->transform = transform;
+  scene.paged_models.push_back(std::move(model));
+}
+
+/**
+  * Add the points of a file without faces to the scene
+  * Input: Scene - the scene to add the point cloud to
+  *        const QString - path to the file
+  *        FaceCollection - the loaded file, its points are moved
+  *        const QMatrix4x4 - model to world transform
+  * Output: void
+  */
+void ModelLoader::addPointCloud(Scene &scene, const QString &path, FaceCollection &faces, const QMatrix4x4 &transform) {
+  if (faces.points.empty()) {
+    error("The file has no faces or points");
+  }
+  std::unique_ptr<PointCloud> cloud;
+  try {
+    cloud.reset(new PointCloud(faces.points, faces.point_colors, compact_storage));
+  }
+  catch (const std::runtime_error &e) {  // over the budget or too many points
+    error(e.what());
+  }
+  catch (const std::bad_alloc &) {
+    error("Not enough memory for the point cloud");
+  }
+  loading.release();
+  cloud->path = path;
+  cloud->transform = transform;
+  scene.point_clouds.push_back(std::move(cloud));
+}
+
+/**
+  * Split the source file of a model into chunks, so reloadModel() can
+  * reparse only the chunks that changed. Only uncompressed ASCII STL
+  * files are indexed, other models are reloaded as a whole
+  * Input: Model - a loaded model
+  * Output: void
+  */
+void ModelLoader::indexModel(Model &model) {
+  model.source_chunks.clear();
+  if (!model.path.endsWith(".stl", Qt::CaseInsensitive) || detectCompression(model.path) != NO_COMPRESSION ||
+      model.faces.compact_storage) {
+    return;
+  }
+  QFile file(model.path);
+  uchar *data = file.open(QIODevice::ReadOnly) ? file.map(0, file.size()) : 0;
+  if (!data) {
+    return;
+  }
+  splitStlChunks((const char *)data, file.size(), model.source_chunks);
+  file.unmap(data);
+  size_t faces = 0;
+  for (const SourceChunk &chunk : model.source_chunks) {
+    faces += chunk.faces;
+  }
+  if (faces != model.faces.faces.size()) {
+    model.source_chunks.clear();
+  }
+}
+
+/**
+  * Parse the chunks of a changed STL file that differ from the indexed
+  * ones, the faces of the unchanged chunks at the start and at the end
+  * of the file are copied from the model
+  * Input: Model - an indexed model
+  *        FaceCollection - output, the faces of the new file
+  *        std::vector<SourceChunk> - output, the chunks of the new file
+  * Output: bool - false if the file has to be loaded as a whole
+  */
+bool ModelLoader::readChangedChunks(Model &model, FaceCollection &result, std::vector<SourceChunk> &chunks) {
+  TRACE_SCOPE("read changed chunks");
+  QFile file(model.path);
+  uchar *data = file.open(QIODevice::ReadOnly) ? file.map(0, file.size()) : 0;
+  if (!data) {
+    return false;
+  }
+  splitStlChunks((const char *)data, file.size(), chunks);
+  const std::vector<SourceChunk> &old = model.source_chunks;
+  size_t prefix = 0, suffix = 0;
+  while (prefix < old.size() && prefix < chunks.size() && old[prefix].sameContents(chunks[prefix])) {
+    prefix++;
+  }
+  while (suffix < old.size() - prefix && suffix < chunks.size() - prefix &&
+         old[old.size() - 1 - suffix].sameContents(chunks[chunks.size() - 1 - suffix])) {
+    suffix++;
+  }
+  size_t front_faces = 0, back_faces = 0, middle_faces = 0;
+  for (size_t i = 0; i < prefix; i++) {
+    front_faces += old[i].faces;
+  }
+  for (size_t i = 0; i < suffix; i++) {
+    back_faces += old[old.size() - 1 - i].faces;
+  }
+  for (size_t i = prefix; i < chunks.size() - suffix; i++) {
+    middle_faces += chunks[i].faces;
+  }
+  size_t begin = prefix < chunks.size() ? chunks[prefix].offset : file.size();
+  size_t end = suffix > 0 ? chunks[chunks.size() - suffix].offset : file.size();
+  FaceCollection middle;
+  {
+    std::istringstream text(std::string((const char *)data + begin, end - begin));
+    file.unmap(data);
+    readStl(text, middle, begin == 0, suffix == 0);
+  }
+  if (middle.faces.size() != middle_faces || front_faces + back_faces > model.faces.faces.size()) {
+    return false;
+  }
+  const std::vector<Face> &faces = model.faces.faces;
+  result.faces.reserve(front_faces + middle_faces + back_faces);
+  result.faces.insert(result.faces.end(), faces.begin(), faces.begin() + front_faces);
+  result.faces.insert(result.faces.end(), std::make_move_iterator(middle.faces.begin()),
+                      std::make_move_iterator(middle.faces.end()));
+  result.faces.insert(result.faces.end(), faces.end() - back_faces, faces.end());
+  if (DEBUG) {
+    qDebug() << "Reparsed" << middle_faces << "of" << result.faces.size() << "faces";
+  }
+  return true;
+}
+
+/**
+  * Reload a model after its file changed
+  * Indexed models only reparse the changed chunks, the vertex buffer
+  * keeps the unchanged corners at its start and end. Instances, the
+  * camera and the display settings stay as they are. On errors the
+  * model is left unchanged
+  * Input: Model - the model to reload
+  * Output: bool - false if the contents didn't change
+  */
+bool ModelLoader::reloadModel(Model &model) {
+  TRACE_SCOPE("reloadModel");
+  QByteArray hash = Scene::fileHash(model.path);
+  if (hash.isEmpty()) {
+    error("File not found");
+  }
+  if (hash == model.hash) {
+    return false;
+  }
+  FaceCollection faces;
+  std::vector<SourceChunk> chunks;
+  loading.release();
+  bool incremental = false;
+  try {
+    incremental = !model.source_chunks.empty() && readChangedChunks(model, faces, chunks);
+    if (incremental) {
+      faces.triangulate();
+      generateNormals(faces, crease_angle);
+      if (optimize_order) {
+        order_statistics = optimizeMeshOrder(faces);
+      }
+      loading.resize(faces.memoryUsage());
+    }
+  }
+  catch (const MemoryBudgetExceeded &e) {
+    error(e.what());
+  }
+  catch (const std::bad_alloc &) {
+    error("Not enough memory to load the file");
+  }
+  if (!incremental) {
+    faces = loadModelFile(model.path);
+  }
+  if (faces.faces.empty()) {
+    error("The file has no faces");
+  }
+  std::vector<MassProperties> components;
+  MassProperties mass_properties;
+  measureFaces(faces, components, mass_properties);
+  if (model.labelled) {
+    faces.colorize();
+  }
+  if (model.faces.compact_storage) {
+    faces.compact();
+  }
+  // Buffers of shared vertices are uploaded as a whole
+  if (!model.buffer_dirty && model.vertex_count > 0 && !model.shared_vertices && !optimize_order) {
+    model.patch_front = SceneRenderer::matchingCorners(model.faces, faces, false);
+    model.patch_back = SceneRenderer::matchingCorners(model.faces, faces, true);
+    size_t corners = std::min(model.faces.triangles.size(), faces.triangles.size());
+    model.patch_back = std::min(model.patch_back, corners - model.patch_front);
+    model.buffer_patch = true;
+  }
+  loading.release();
+  model.faces = std::move(faces);
+  model.updateBounds();
+  model.mesh_memory.update(model.faces.memoryUsage());
+  model.hash = hash;
+  model.component_properties.swap(components);
+  model.mass_properties = mass_properties;
+  model.buffer_dirty = true;
+  model.labels_dirty = model.labelled;
+  model.shared_vertices = optimize_order;
+  // The distances to a reference belong to the previous version
+  std::vector<float>().swap(model.deviations);
+  model.deviation = DeviationStatistics();
+  model.deviation_memory.release();
+  model.deviations_dirty = true;
+  if (incremental) {
+    model.source_chunks.swap(chunks);
+  }
+  else {
+    model.source_chunks.clear();
+    if (track_changes) {
+      indexModel(model);
+    }
+  }
+  return true;
+}
+
+/**
+  * Load a reference surface that models are compared to
+  * Only its bounding volume hierarchy is kept, the faces are
+  * released once it is built
+  * Input: const QString - path to the model file
+  * Output: std::unique_ptr<TriangleBvh> - hierarchy of its triangles
+  */
+std::unique_ptr<TriangleBvh> ModelLoader::loadReference(const QString &path) {
+  TRACE_SCOPE("loadReference");
+  FaceCollection faces = loadModelFile(path);
+  if (faces.faces.empty()) {
+    error("The reference has no faces");
+  }
+  std::unique_ptr<TriangleBvh> reference;
+  try {
+    reference.reset(new TriangleBvh(faces));
+  }
+  catch (const MemoryBudgetExceeded &e) {
+    error(e.what());
+  }
+  catch (const std::bad_alloc &) {
+    error("Not enough memory for the reference");
+  }
+  loading.release();
+  return reference;
+}
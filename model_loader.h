@@ -0,0 +1,59 @@
+#pragma once
+
+#include <QMatrix4x4>
+#include <QString>
+#include <istream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "bvh.h"
+#include "face.h"
+#include "memory_budget.h"
+#include "mesh_order.h"
+#include "scene.h"
+
+/**
+  * Reads model and scene files into scenes
+  * Errors throw std::runtime_error, interactive loaders
+  * also show them in a message box. Models that don't fit
+  * into the memory budget fail to load or are stored compactly
+  */
+class ModelLoader {
+public:
+  ModelLoader();
+
+  FaceCollection loadModelFile(const QString &path);
+  void loadScene(Scene &scene, const QString &path);
+  void addModel(Scene &scene, const QString &path, const QMatrix4x4 &transform);
+  void addPagedModel(Scene &scene, const QString &path, const QMatrix4x4 &transform);
+  void addPointCloud(Scene &scene, const QString &path, FaceCollection &faces, const QMatrix4x4 &transform);
+  FaceCollection loadJson(const QString &path);
+  FaceCollection loadStl(const QString &path);
+  FaceCollection loadObj(const QString &path);
+  FaceCollection loadPly(const QString &path);
+  void indexModel(Model &model);
+  bool reloadModel(Model &model);
+  std::unique_ptr<TriangleBvh> loadReference(const QString &path);
+
+  bool interactive;
+  bool colorization;
+  bool compact_storage;
+  bool upload_buffers;  // models get vertex buffers, counted against the memory budget
+  float crease_angle;
+  bool track_changes;  // new models are indexed for reloadModel()
+  size_t page_cache;   // bytes of chunks a paged model keeps mapped
+  bool optimize_order;  // triangles and vertices are reordered by optimizeMeshOrder()
+  MeshOrderStatistics order_statistics;  // of the last model loaded with optimize_order
+
+protected:
+  [[noreturn]] void error(const std::string &message);
+  void readStl(std::istream &infile, FaceCollection &result, bool header, bool footer);
+  bool readChangedChunks(Model &model, FaceCollection &result, std::vector<SourceChunk> &chunks);
+  void measureFaces(const FaceCollection &faces, std::vector<MassProperties> &components, MassProperties &total);
+  void accountFaces(const FaceCollection &result, size_t &face_bytes, size_t other_bytes = 0);
+  int delim(const std::string &str);
+  bool is_digits(const std::string &str);
+
+  MemoryReservation loading;  // the model that is being loaded
+};
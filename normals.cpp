@@ -0,0 +1,287 @@
+#include "normals.h"
+#include "parallel.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+
+static const size_t NORMALS_GRAIN = 1 << 16;
+static const float doublePi = float(M_PI);
+static const float DIRECTION_STEPS = 1 << 16;  // per unit of a direction's coordinates
+static const int GROUPED_VALENCE = 16;          // corners of a vertex compared pairwise
+
+/**
+  * A triangle corner around a vertex, ordered by its quantized direction
+  */
+struct CornerDirection {
+  int key[3];
+  unsigned int corner;
+  QVector3D direction;
+  float weight;
+  bool operator<(const CornerDirection &other) const {
+    for(int k=0; k<3; k++){
+      if(key[k] != other.key[k]){
+        return key[k] < other.key[k];
+      }
+    }
+    return corner < other.corner;
+  }
+};
+
+static bool lessVector(const QVector3D &a, const QVector3D &b){
+  for(int k=0; k<3; k++){
+    if(a[k] != b[k]){
+      return a[k] < b[k];
+    }
+  }
+  return false;
+}
+
+/**
+  * Compute the unnormalized normal of every triangle
+  * The length of a normal is twice the area of its triangle.
+  * With SSE four cross products are computed at once
+  * Input: const FaceCollection - triangulated mesh with full precision positions
+  *        std::vector<QVector3D> - output, one normal per triangle
+  * Output: void
+  */
+void computeTriangleNormals(const FaceCollection &mesh, std::vector<QVector3D> &normals){
+  const std::vector<QVector3D> &p = mesh.positions;
+  const std::vector<unsigned int> &tri = mesh.triangles;
+  normals.resize(mesh.triangleCount());
+  parallelChunks(normals.size(), NORMALS_GRAIN, [&](size_t, size_t begin, size_t end){
+    size_t t = begin;
+#ifdef __SSE__
+    for(; t + 4 <= end; t += 4){
+      // Gather four triangles into one lane each
+      const QVector3D &a0 = p[tri[t*3]], &a1 = p[tri[t*3+3]], &a2 = p[tri[t*3+6]], &a3 = p[tri[t*3+9]];
+      const QVector3D &b0 = p[tri[t*3+1]], &b1 = p[tri[t*3+4]], &b2 = p[tri[t*3+7]], &b3 = p[tri[t*3+10]];
+      const QVector3D &c0 = p[tri[t*3+2]], &c1 = p[tri[t*3+5]], &c2 = p[tri[t*3+8]], &c3 = p[tri[t*3+11]];
+      __m128 ax = _mm_setr_ps(a0.x(), a1.x(), a2.x(), a3.x());
+      __m128 ay = _mm_setr_ps(a0.y(), a1.y(), a2.y(), a3.y());
+      __m128 az = _mm_setr_ps(a0.z(), a1.z(), a2.z(), a3.z());
+      __m128 e1x = _mm_sub_ps(_mm_setr_ps(b0.x(), b1.x(), b2.x(), b3.x()), ax);
+      __m128 e1y = _mm_sub_ps(_mm_setr_ps(b0.y(), b1.y(), b2.y(), b3.y()), ay);
+      __m128 e1z = _mm_sub_ps(_mm_setr_ps(b0.z(), b1.z(), b2.z(), b3.z()), az);
+      __m128 e2x = _mm_sub_ps(_mm_setr_ps(c0.x(), c1.x(), c2.x(), c3.x()), ax);
+      __m128 e2y = _mm_sub_ps(_mm_setr_ps(c0.y(), c1.y(), c2.y(), c3.y()), ay);
+      __m128 e2z = _mm_sub_ps(_mm_setr_ps(c0.z(), c1.z(), c2.z(), c3.z()), az);
+      float nx[4], ny[4], nz[4];
+      _mm_storeu_ps(nx, _mm_sub_ps(_mm_mul_ps(e1y, e2z), _mm_mul_ps(e1z, e2y)));
+      _mm_storeu_ps(ny, _mm_sub_ps(_mm_mul_ps(e1z, e2x), _mm_mul_ps(e1x, e2z)));
+      _mm_storeu_ps(nz, _mm_sub_ps(_mm_mul_ps(e1x, e2y), _mm_mul_ps(e1y, e2x)));
+      for(int k=0; k<4; k++){
+        normals[t+k] = QVector3D(nx[k], ny[k], nz[k]);
+      }
+    }
+#endif
+    for(; t < end; t++){
+      const QVector3D &a = p[tri[t*3]];
+      normals[t] = QVector3D::crossProduct(p[tri[t*3+1]] - a, p[tri[t*3+2]] - a);
+    }
+  });
+}
+
+/**
+  * Angle of a triangle at one of its corners
+  */
+static float cornerAngle(const QVector3D &corner, const QVector3D &next, const QVector3D &previous){
+  QVector3D e1 = next - corner;
+  QVector3D e2 = previous - corner;
+  float length = e1.length() * e2.length();
+  if(length == 0){
+    return 0;
+  }
+  float cosine = QVector3D::dotProduct(e1, e2) / length;
+  return std::acos(std::max(-1.0f, std::min(1.0f, cosine)));
+}
+
+/**
+  * Generate face normals and smooth vertex normals from the geometry
+  * Faces without a usable normal get the normal of their polygon.
+  * Every triangle corner gets the weighted average of the normals of the
+  * triangles around its vertex, leaving out triangles that meet it at more
+  * than the crease angle, so hard edges keep separate normals. Around
+  * vertices with more than 16 corners, corners whose directions agree to
+  * 2^-16 are smoothed as one group, so the hubs of large fans compare a
+  * few groups instead of every pair of corners.
+  * Identical normals of a vertex are stored once. Has to run before compact()
+  * Input: FaceCollection - triangulated mesh, gets face and vertex normals
+  *        float - crease angle in degrees
+  *        NormalWeighting - weight triangles by their angle at the vertex or by their area
+  * Output: void
+  */
+void generateNormals(FaceCollection &mesh, float crease_angle, NormalWeighting weighting){
+  TRACE_SCOPE("generateNormals");
+  if(mesh.compact_storage){
+    return;
+  }
+  const std::vector<QVector3D> &p = mesh.positions;
+  const std::vector<unsigned int> &tri = mesh.triangles;
+  size_t n_vertices = p.size();
+
+  std::vector<QVector3D> triangle_normals;
+  computeTriangleNormals(mesh, triangle_normals);
+
+  // Newell normal for faces that came without one or with a zero normal
+  parallelChunks(mesh.faces.size(), NORMALS_GRAIN, [&](size_t, size_t begin, size_t end){
+    for(size_t f = begin; f < end; f++){
+      Face &face = mesh.faces[f];
+      if(face.normals && !face.normal.empty() && !face.normal[0].isNull()){
+        continue;
+      }
+      QVector3D normal(0, 0, 0);
+      unsigned int first = mesh.face_offsets[f];
+      int size = mesh.face_offsets[f+1] - first;
+      for(int i=0; i<size; i++){
+        const QVector3D &current = p[mesh.face_corners[first + i]];
+        const QVector3D &next = p[mesh.face_corners[first + (i+1)%size]];
+        normal[0] += (current.y() - next.y()) * (current.z() + next.z());
+        normal[1] += (current.z() - next.z()) * (current.x() + next.x());
+        normal[2] += (current.x() - next.x()) * (current.y() + next.y());
+      }
+      face.normal.assign(1, normal.normalized());
+      face.normals = true;
+    }
+  });
+
+  // Corners around every vertex, in compressed rows
+  std::vector<std::atomic<unsigned int>> counts(n_vertices + 1);
+  parallelChunks(tri.size(), NORMALS_GRAIN, [&](size_t, size_t begin, size_t end){
+    for(size_t c = begin; c < end; c++){
+      counts[tri[c] + 1]++;
+    }
+  });
+  std::vector<unsigned int> row(n_vertices + 1, 0);
+  for(size_t v = 0; v < n_vertices; v++){
+    row[v + 1] = row[v] + counts[v + 1];
+    counts[v] = row[v];
+  }
+  std::vector<unsigned int> corners(tri.size());
+  parallelChunks(tri.size(), NORMALS_GRAIN, [&](size_t, size_t begin, size_t end){
+    for(size_t c = begin; c < end; c++){
+      corners[counts[tri[c]]++] = c;
+    }
+  });
+
+  // Smooth normal of every corner, identical normals of a vertex shared.
+  // Vertex chunks collect their normals separately and are joined in order
+  float min_cosine = std::cos(crease_angle * doublePi / 180);
+  size_t n_chunks = chunkCount(n_vertices, NORMALS_GRAIN);
+  std::vector<std::vector<QVector3D>> chunk_normals(n_chunks);
+  mesh.corner_normals.assign(tri.size(), 0);
+  parallelChunks(n_vertices, NORMALS_GRAIN, [&](size_t chunk, size_t begin, size_t end){
+    std::vector<QVector3D> &unique = chunk_normals[chunk];
+    std::vector<CornerDirection> order;
+    std::vector<QVector3D> directions, weighted, normals;
+    std::vector<int> groups, by_normal;
+    std::vector<unsigned int> group_normals;
+    for(size_t v = begin; v < end; v++){
+      unsigned int *first = corners.data() + row[v];
+      unsigned int *last = corners.data() + row[v + 1];
+      // Fixed order keeps the sums deterministic
+      std::sort(first, last);
+      bool grouped = last - first > GROUPED_VALENCE;
+      order.clear();
+      for(unsigned int *corner = first; corner < last; corner++){
+        unsigned int c = *corner;
+        unsigned int t = c / 3;
+        CornerDirection item;
+        item.corner = c;
+        item.direction = triangle_normals[t].normalized();
+        for(int k=0; k<3; k++){
+          item.key[k] = grouped ? (int)std::floor(item.direction[k] * DIRECTION_STEPS + 0.5f) : 0;
+        }
+        if(weighting == AREA_WEIGHTED){
+          item.weight = triangle_normals[t].length() / 2;
+        }
+        else{
+          item.weight = cornerAngle(p[tri[c]], p[tri[t*3 + (c+1)%3]], p[tri[t*3 + (c+2)%3]]);
+        }
+        order.push_back(item);
+      }
+      // Around busy vertices, a group has the direction of its first
+      // corner and the weights of all, elsewhere every corner is a group
+      if(grouped){
+        std::sort(order.begin(), order.end());
+      }
+      directions.clear();
+      weighted.clear();
+      groups.resize(order.size());
+      for(size_t i=0; i<order.size(); i++){
+        if(!grouped || i == 0 || memcmp(order[i].key, order[i-1].key, sizeof(order[i].key)) != 0){
+          directions.push_back(order[i].direction);
+          weighted.push_back(QVector3D(0, 0, 0));
+        }
+        weighted.back() += order[i].direction * order[i].weight;
+        groups[i] = directions.size() - 1;
+      }
+      int n_groups = directions.size();
+      normals.resize(n_groups);
+      for(int g=0; g<n_groups; g++){
+        QVector3D normal(0, 0, 0);
+        for(int h=0; h<n_groups; h++){
+          if(g == h || QVector3D::dotProduct(directions[g], directions[h]) >= min_cosine){
+            normal += weighted[h];
+          }
+        }
+        normals[g] = normal.isNull() ? directions[g] : normal.normalized();
+      }
+      // Groups with identical normals share one, many groups are sorted
+      // to find them
+      group_normals.resize(n_groups);
+      size_t vertex_first = unique.size();
+      if(n_groups <= GROUPED_VALENCE){
+        for(int g=0; g<n_groups; g++){
+          size_t index = vertex_first;
+          while(index < unique.size() && unique[index] != normals[g]){
+            index++;
+          }
+          if(index == unique.size()){
+            unique.push_back(normals[g]);
+          }
+          group_normals[g] = index;
+        }
+      }
+      else{
+        by_normal.resize(n_groups);
+        for(int g=0; g<n_groups; g++){
+          by_normal[g] = g;
+        }
+        std::sort(by_normal.begin(), by_normal.end(), [&](int a, int b){
+          return lessVector(normals[a], normals[b]) || (normals[a] == normals[b] && a < b);
+        });
+        for(int k=0; k<n_groups; k++){
+          int g = by_normal[k];
+          if(k == 0 || normals[g] != normals[by_normal[k-1]]){
+            unique.push_back(normals[g]);
+          }
+          group_normals[g] = unique.size() - 1;
+        }
+      }
+      for(size_t i=0; i<order.size(); i++){
+        mesh.corner_normals[order[i].corner] = group_normals[groups[i]];
+      }
+    }
+  });
+
+  std::vector<unsigned int> chunk_base(n_chunks + 1, 0);
+  for(size_t chunk = 0; chunk < n_chunks; chunk++){
+    chunk_base[chunk + 1] = chunk_base[chunk] + chunk_normals[chunk].size();
+  }
+  mesh.vertex_normals.resize(chunk_base[n_chunks]);
+  parallelChunks(n_vertices, NORMALS_GRAIN, [&](size_t chunk, size_t begin, size_t end){
+    std::copy(chunk_normals[chunk].begin(), chunk_normals[chunk].end(),
+              mesh.vertex_normals.begin() + chunk_base[chunk]);
+    for(size_t v = begin; v < end; v++){
+      for(unsigned int i = row[v]; i < row[v + 1]; i++){
+        mesh.corner_normals[corners[i]] += chunk_base[chunk];
+      }
+    }
+  });
+}
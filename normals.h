@@ -0,0 +1,15 @@
+#pragma once
+
+#include <QVector3D>
+#include <vector>
+
+#include "face.h"
+
+enum NormalWeighting {
+  ANGLE_WEIGHTED,
+  AREA_WEIGHTED
+};
+
+void computeTriangleNormals(const FaceCollection &mesh, std::vector<QVector3D> &normals);
+void generateNormals(FaceCollection &mesh, float crease_angle,
+                     NormalWeighting weighting = ANGLE_WEIGHTED);
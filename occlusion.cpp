@@ -0,0 +1,527 @@
+#include "occlusion.h"
+#include "parallel.h"
+#include "scene.h"
+#include "trace.h"
+
+#include <QVector4D>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <numeric>
+#include <utility>
+
+static const unsigned int CLUSTER_TRIANGLES = 256;
+static const int PYRAMID_WIDTH = 256;               // texels, the height follows the viewport
+static const size_t OCCLUDER_TRIANGLES = 1 << 16;   // rasterized on the CPU per frame
+static const size_t CLUSTER_GRAIN = 1 << 14;
+static const size_t CULL_GRAIN = 1 << 10;
+// Texel states while an occluder surface is drawn
+static const unsigned char COVERED = 1;  // the centre is inside a triangle of the surface
+static const unsigned char CROSSED = 2;  // an outline edge of the surface passes through
+
+/**
+  * Split the triangles of a model into clusters at the median of their
+  * centres along the longest axis, like the chunks of paged models
+  * Clusters are stored in tree order, so neighbouring clusters are
+  * close to each other in space as well
+  * Input: const FaceCollection - triangulated mesh in either storage
+  *        std::vector<unsigned int> - output, triangles in cluster order
+  *        std::vector<TriangleCluster> - output
+  * Output: void
+  */
+void buildClusters(const FaceCollection &mesh, std::vector<unsigned int> &triangles,
+                   std::vector<TriangleCluster> &clusters) {
+  TRACE_SCOPE("build clusters");
+  size_t count = mesh.triangleCount();
+  std::vector<QVector3D> centres(count);
+  parallelChunks(count, CLUSTER_GRAIN, [&](size_t, size_t begin, size_t end) {
+    for (size_t t = begin; t < end; t++) {
+      centres[t] = (mesh.position(mesh.triangles[t * 3]) + mesh.position(mesh.triangles[t * 3 + 1]) +
+                    mesh.position(mesh.triangles[t * 3 + 2])) / 3;
+    }
+  });
+  triangles.resize(count);
+  std::iota(triangles.begin(), triangles.end(), 0u);
+  clusters.clear();
+  // Ranges of triangles that form the clusters, left before right
+  std::vector<std::pair<unsigned int, unsigned int>> ranges(1, std::make_pair(0u, (unsigned int)count));
+  while (!ranges.empty()) {
+    std::pair<unsigned int, unsigned int> range = ranges.back();
+    ranges.pop_back();
+    if (range.second - range.first <= CLUSTER_TRIANGLES) {
+      if (range.second == range.first) {
+        continue;
+      }
+      TriangleCluster cluster;
+      cluster.first = range.first;
+      cluster.count = range.second - range.first;
+      for (int dim = 0; dim < 3; dim++) {
+        cluster.low[dim] = std::numeric_limits<float>::max();
+        cluster.high[dim] = -std::numeric_limits<float>::max();
+      }
+      QVector3D area;
+      for (unsigned int i = range.first; i < range.second; i++) {
+        QVector3D corners[3];
+        for (int k = 0; k < 3; k++) {
+          corners[k] = mesh.position(mesh.triangles[triangles[i] * 3 + k]);
+          for (int dim = 0; dim < 3; dim++) {
+            cluster.low[dim] = std::min(cluster.low[dim], corners[k][dim]);
+            cluster.high[dim] = std::max(cluster.high[dim], corners[k][dim]);
+          }
+        }
+        area += QVector3D::crossProduct(corners[1] - corners[0], corners[2] - corners[0]) / 2;
+      }
+      for (int dim = 0; dim < 3; dim++) {
+        cluster.area[dim] = area[dim];
+      }
+      clusters.push_back(cluster);
+      continue;
+    }
+    QVector3D low = centres[triangles[range.first]], high = low;
+    for (unsigned int i = range.first; i < range.second; i++) {
+      for (int dim = 0; dim < 3; dim++) {
+        low[dim] = std::min(low[dim], centres[triangles[i]][dim]);
+        high[dim] = std::max(high[dim], centres[triangles[i]][dim]);
+      }
+    }
+    int axis = 0;
+    for (int dim = 1; dim < 3; dim++) {
+      if (high[dim] - low[dim] > high[axis] - low[axis]) {
+        axis = dim;
+      }
+    }
+    unsigned int middle = range.first + (range.second - range.first) / 2;
+    std::nth_element(triangles.begin() + range.first, triangles.begin() + middle, triangles.begin() + range.second,
+                     [&](unsigned int a, unsigned int b) { return centres[a][axis] < centres[b][axis]; });
+    ranges.push_back(std::make_pair(middle, range.second));
+    ranges.push_back(std::make_pair(range.first, middle));
+  }
+}
+
+/**
+  * Allocate the levels for a viewport and clear them to the far end
+  * Input: int, int - size of the full resolution level in texels
+  * Output: void
+  */
+void DepthPyramid::reset(int new_width, int new_height) {
+  width = std::max(new_width, 1);
+  height = std::max(new_height, 1);
+  widths.assign(1, width);
+  heights.assign(1, height);
+  while (widths.back() > 1 || heights.back() > 1) {
+    widths.push_back((widths.back() + 1) / 2);
+    heights.push_back((heights.back() + 1) / 2);
+  }
+  levels.resize(widths.size());
+  size_t texels = 0;
+  for (size_t level = 0; level < levels.size(); level++) {
+    levels[level].resize((size_t)widths[level] * heights[level]);
+    texels += levels[level].size();
+  }
+  std::fill(levels[0].begin(), levels[0].end(), std::numeric_limits<float>::max());
+  surface_depths.assign(levels[0].size(), -std::numeric_limits<float>::max());
+  states.assign(levels[0].size(), 0);
+  touched_low[0] = width;
+  touched_low[1] = height;
+  touched_high[0] = touched_high[1] = -1;
+  memory.update(texels * sizeof(float) + states.size() * (sizeof(float) + 1));
+}
+
+/**
+  * Draw a triangle of the current occluder surface
+  * Every texel it touches gets the farthest depth the triangle can have
+  * inside the texel, and the texels whose centres it covers are marked.
+  * The triangle has to face the camera and lie between the near and
+  * the far plane
+  * Input: const QVector3D - the corners in normalized device coordinates
+  * Output: void
+  */
+void DepthPyramid::drawTriangle(const QVector3D &a, const QVector3D &b, const QVector3D &c) {
+  float ax = (a.x() + 1) * 0.5f * width, ay = (a.y() + 1) * 0.5f * height;
+  float bx = (b.x() + 1) * 0.5f * width, by = (b.y() + 1) * 0.5f * height;
+  float cx = (c.x() + 1) * 0.5f * width, cy = (c.y() + 1) * 0.5f * height;
+  float area = (bx - ax) * (cy - ay) - (by - ay) * (cx - ax);
+  if (!(std::fabs(area) > 0)) {
+    return;  // degenerate
+  }
+  // Texels touching the bounds, clamped before the conversion
+  float x_begin = std::max(std::floor(std::min(std::min(ax, bx), cx)), 0.0f);
+  float x_end = std::min(std::floor(std::max(std::max(ax, bx), cx)), width - 1.0f);
+  float y_begin = std::max(std::floor(std::min(std::min(ay, by), cy)), 0.0f);
+  float y_end = std::min(std::floor(std::max(std::max(ay, by), cy)), height - 1.0f);
+  if (!(x_begin <= x_end && y_begin <= y_end)) {
+    return;
+  }
+  float inverse = 1 / area;
+  float nearest_far = std::max(std::max(a.z(), b.z()), c.z());
+  // Barycentric weights, the depth on the plane of the triangle
+  auto weights = [&](float px, float py, float &wa, float &wb, float &wc) {
+    wa = ((bx - px) * (cy - py) - (by - py) * (cx - px)) * inverse;
+    wb = ((cx - px) * (ay - py) - (cy - py) * (ax - px)) * inverse;
+    wc = 1 - wa - wb;
+    return wa * a.z() + wb * b.z() + wc * c.z();
+  };
+  touched_low[0] = std::min(touched_low[0], (int)x_begin);
+  touched_low[1] = std::min(touched_low[1], (int)y_begin);
+  touched_high[0] = std::max(touched_high[0], (int)x_end);
+  touched_high[1] = std::max(touched_high[1], (int)y_end);
+  for (int y = (int)y_begin; y <= (int)y_end; y++) {
+    for (int x = (int)x_begin; x <= (int)x_end; x++) {
+      // Weights and depth are linear, so their extremes over the texel are at its corners
+      float w[4][3], farthest = -std::numeric_limits<float>::max();
+      for (int corner = 0; corner < 4; corner++) {
+        float z = weights(x + (corner & 1), y + (corner >> 1), w[corner][0], w[corner][1], w[corner][2]);
+        farthest = std::max(farthest, z);
+      }
+      bool outside = false;
+      for (int k = 0; k < 3; k++) {
+        outside = outside || (w[0][k] < 0 && w[1][k] < 0 && w[2][k] < 0 && w[3][k] < 0);
+      }
+      if (outside) {
+        continue;
+      }
+      size_t texel = (size_t)y * width + x;
+      surface_depths[texel] = std::max(surface_depths[texel], std::min(farthest, nearest_far));
+      float wa, wb, wc;
+      weights(x + 0.5f, y + 0.5f, wa, wb, wc);
+      if (wa >= 0 && wb >= 0 && wc >= 0) {
+        states[texel] |= COVERED;
+      }
+    }
+  }
+}
+
+/**
+  * Mark the texels an outline edge of the current occluder surface
+  * passes through, the surface may end anywhere inside them
+  * Input: const QVector3D - the ends in normalized device coordinates
+  * Output: void
+  */
+void DepthPyramid::drawEdge(const QVector3D &a, const QVector3D &b) {
+  const float margin = 1e-3f;  // texels, for rounding
+  float ax = (a.x() + 1) * 0.5f * width, ay = (a.y() + 1) * 0.5f * height;
+  float bx = (b.x() + 1) * 0.5f * width, by = (b.y() + 1) * 0.5f * height;
+  if (ay > by) {
+    std::swap(ax, bx);
+    std::swap(ay, by);
+  }
+  float y_begin = std::max(std::floor(ay - margin), 0.0f);
+  float y_end = std::min(std::floor(by + margin), height - 1.0f);
+  if (!(y_begin <= y_end)) {
+    return;
+  }
+  for (int y = (int)y_begin; y <= (int)y_end; y++) {
+    // The part of the edge inside the row
+    float x0 = ax, x1 = bx;
+    if (by > ay) {
+      float t0 = std::max((y - ay) / (by - ay), 0.0f), t1 = std::min((y + 1 - ay) / (by - ay), 1.0f);
+      x0 = ax + (bx - ax) * t0;
+      x1 = ax + (bx - ax) * t1;
+    }
+    float x_begin = std::max(std::floor(std::min(x0, x1) - margin), 0.0f);
+    float x_end = std::min(std::floor(std::max(x0, x1) + margin), width - 1.0f);
+    if (!(x_begin <= x_end)) {
+      continue;
+    }
+    for (int x = (int)x_begin; x <= (int)x_end; x++) {
+      states[(size_t)y * width + x] |= CROSSED;
+    }
+  }
+}
+
+/**
+  * Keep the depths of the texels the current occluder surface covers
+  * entirely, where it is nearer than the surfaces drawn before, and
+  * start the next surface
+  * Input: void
+  * Output: void
+  */
+void DepthPyramid::finishSurface() {
+  for (int y = touched_low[1]; y <= touched_high[1]; y++) {
+    for (int x = touched_low[0]; x <= touched_high[0]; x++) {
+      size_t texel = (size_t)y * width + x;
+      if (states[texel] == COVERED) {
+        levels[0][texel] = std::min(levels[0][texel], surface_depths[texel]);
+      }
+      surface_depths[texel] = -std::numeric_limits<float>::max();
+      states[texel] = 0;
+    }
+  }
+  touched_low[0] = width;
+  touched_low[1] = height;
+  touched_high[0] = touched_high[1] = -1;
+}
+
+/**
+  * Fill the coarser levels with the farthest depth of 2x2 texels
+  * Input: void
+  * Output: void
+  */
+void DepthPyramid::build() {
+  for (size_t level = 1; level < levels.size(); level++) {
+    const std::vector<float> &below = levels[level - 1];
+    int below_width = widths[level - 1], below_height = heights[level - 1];
+    for (int y = 0; y < heights[level]; y++) {
+      int y0 = 2 * y, y1 = std::min(2 * y + 1, below_height - 1);
+      for (int x = 0; x < widths[level]; x++) {
+        int x0 = 2 * x, x1 = std::min(2 * x + 1, below_width - 1);
+        levels[level][(size_t)y * widths[level] + x] =
+          std::max(std::max(below[(size_t)y0 * below_width + x0], below[(size_t)y0 * below_width + x1]),
+                   std::max(below[(size_t)y1 * below_width + x0], below[(size_t)y1 * below_width + x1]));
+      }
+    }
+  }
+}
+
+/**
+  * Check if a box is behind the occluders everywhere on screen
+  * Input: const QVector3D, const QVector3D - bounds of the box in
+  *        normalized device coordinates
+  * Output: bool - true if it is hidden
+  */
+bool DepthPyramid::isOccluded(const QVector3D &low, const QVector3D &high) const {
+  if (levels.empty()) {
+    return false;
+  }
+  auto texel = [](float ndc, int size) {
+    return (int)std::max(0.0f, std::min(size - 1.0f, std::floor((ndc + 1) * 0.5f * size)));
+  };
+  int x0 = texel(low.x(), width), x1 = texel(high.x(), width);
+  int y0 = texel(low.y(), height), y1 = texel(high.y(), height);
+  size_t level = 0;
+  while ((x1 - x0 > 1 || y1 - y0 > 1) && level + 1 < levels.size()) {
+    x0 >>= 1;
+    x1 >>= 1;
+    y0 >>= 1;
+    y1 >>= 1;
+    level++;
+  }
+  float farthest = -std::numeric_limits<float>::max();
+  for (int y = y0; y <= y1; y++) {
+    for (int x = x0; x <= x1; x++) {
+      farthest = std::max(farthest, levels[level][(size_t)y * widths[level] + x]);
+    }
+  }
+  return low.z() > farthest;
+}
+
+/**
+  * Bounds of a cluster of an instance on screen
+  */
+struct ProjectedCluster {
+  enum State { OUTSIDE, INSIDE, CROSSING };  // crossing the eye plane
+  QVector3D low;
+  QVector3D high;
+  float coverage;  // screen area of the triangles facing the camera, estimated from their area vectors
+  State state;
+};
+
+/**
+  * An edge of an occluder triangle of an instance, keyed by its vertices
+  */
+struct OccluderEdge {
+  unsigned int low, high;  // vertex indices
+  bool forward;            // runs from low to high
+  unsigned int corner;     // projected start, the end is the next corner of its triangle
+
+  bool operator<(const OccluderEdge &edge) const {
+    return low != edge.low ? low < edge.low : (high != edge.high ? high < edge.high : corner < edge.corner);
+  }
+};
+
+/**
+  * Choose the clusters of a frame
+  * The bounds of all clusters of all instances are projected on all
+  * cores. The clusters in the view that cover the most of the screen
+  * become the occluders, up to a number of triangles, and are drawn
+  * into the depth pyramid, then all of them are tested against it. An
+  * occluder is never hidden by its own triangles, they are not nearer
+  * than its bounds, but it can be hidden by other occluders. The
+  * screen area of a cluster is that of its summed area vector, exact
+  * for flat clusters and small for folded ones, which make poor
+  * occluders. Clusters turned away from the camera are hidden by the
+  * front of their model and never occlude. Both lists are in instance
+  * and cluster order. Every model needs its clusters
+  * Input: const Scene - models with clusters and instances
+  *        const QMatrix4x4 - world to clip space transform
+  *        int, int - size of the viewport in pixels
+  *        std::vector<ClusterDraw> - output, the occluders
+  *        std::vector<ClusterDraw> - output, the other visible clusters
+  * Output: void
+  */
+void OcclusionCuller::cull(const Scene &scene, const QMatrix4x4 &view_projection, int viewport_width,
+                           int viewport_height, std::vector<ClusterDraw> &occluders,
+                           std::vector<ClusterDraw> &visible) {
+  TRACE_SCOPE("occlusion culling");
+  occluders.clear();
+  visible.clear();
+  statistics = OcclusionStatistics();
+  // The clusters of instance i are numbered from offsets[i]
+  std::vector<size_t> offsets(scene.instances.size() + 1, 0);
+  for (size_t i = 0; i < scene.instances.size(); i++) {
+    const Model &model = *scene.models[scene.instances[i].model];
+    offsets[i + 1] = offsets[i] + model.clusters.size();
+    statistics.triangles += model.faces.triangleCount();
+  }
+  size_t count = offsets.back();
+  statistics.clusters = count;
+  auto instanceOf = [&](size_t index) {
+    return (unsigned int)(std::upper_bound(offsets.begin(), offsets.end(), index) - offsets.begin() - 1);
+  };
+
+  std::vector<ProjectedCluster> projected(count);
+  parallelChunks(count, CULL_GRAIN, [&](size_t, size_t begin, size_t end) {
+    unsigned int instance = instanceOf(begin);
+    QMatrix4x4 transform = view_projection * scene.instances[instance].transform;
+    // Maps area vectors to their area on screen
+    QVector3D screen_normal = QVector3D::crossProduct(transform.row(0).toVector3D(), transform.row(1).toVector3D());
+    for (size_t index = begin; index < end; index++) {
+      if (index >= offsets[instance + 1]) {
+        instance = instanceOf(index);
+        transform = view_projection * scene.instances[instance].transform;
+        screen_normal = QVector3D::crossProduct(transform.row(0).toVector3D(), transform.row(1).toVector3D());
+      }
+      const TriangleCluster &cluster = scene.models[scene.instances[instance].model]->clusters[index - offsets[instance]];
+      ProjectedCluster &result = projected[index];
+      result.state = ProjectedCluster::INSIDE;
+      for (int corner = 0; corner < 8 && result.state == ProjectedCluster::INSIDE; corner++) {
+        QVector4D point = transform * QVector4D((corner & 1) ? cluster.high[0] : cluster.low[0],
+                                                (corner & 2) ? cluster.high[1] : cluster.low[1],
+                                                (corner & 4) ? cluster.high[2] : cluster.low[2], 1.0f);
+        if (point.w() <= 0) {
+          result.state = ProjectedCluster::CROSSING;
+          break;
+        }
+        QVector3D ndc = point.toVector3DAffine();
+        for (int dim = 0; dim < 3; dim++) {
+          result.low[dim] = corner == 0 ? ndc[dim] : std::min(result.low[dim], ndc[dim]);
+          result.high[dim] = corner == 0 ? ndc[dim] : std::max(result.high[dim], ndc[dim]);
+        }
+      }
+      result.coverage = 0;
+      if (result.state == ProjectedCluster::INSIDE) {
+        for (int dim = 0; dim < 3; dim++) {
+          if (result.low[dim] > 1 || result.high[dim] < -1) {
+            result.state = ProjectedCluster::OUTSIDE;
+          }
+        }
+        // Perspective shrinks the area by the square of the depth
+        float w = (transform * QVector4D((cluster.low[0] + cluster.high[0]) / 2, (cluster.low[1] + cluster.high[1]) / 2,
+                                         (cluster.low[2] + cluster.high[2]) / 2, 1.0f)).w();
+        QVector3D area(cluster.area[0], cluster.area[1], cluster.area[2]);
+        // Faces turned to the camera have normals towards -z
+        result.coverage = -QVector3D::dotProduct(screen_normal, area) / std::max(w * w, 1e-30f);
+      }
+    }
+  });
+
+  // Largest on screen first, ties in cluster order
+  std::vector<unsigned int> candidates;
+  for (size_t index = 0; index < count; index++) {
+    if (projected[index].state == ProjectedCluster::INSIDE && projected[index].coverage > 0) {
+      candidates.push_back(index);
+    }
+  }
+  std::sort(candidates.begin(), candidates.end(), [&](unsigned int a, unsigned int b) {
+    return projected[a].coverage > projected[b].coverage ||
+           (projected[a].coverage == projected[b].coverage && a < b);
+  });
+  std::vector<char> occluder(count, 0);
+  size_t occluder_triangles = 0;
+  for (size_t i = 0; i < candidates.size() && occluder_triangles < OCCLUDER_TRIANGLES; i++) {
+    unsigned int instance = instanceOf(candidates[i]);
+    const Model &model = *scene.models[scene.instances[instance].model];
+    occluder[candidates[i]] = 1;
+    statistics.occluders++;
+    occluder_triangles += model.clusters[candidates[i] - offsets[instance]].count;
+  }
+
+  {
+    TRACE_SCOPE("rasterize occluders");
+    int pyramid_height = (int)std::lround((double)PYRAMID_WIDTH * viewport_height / std::max(viewport_width, 1));
+    pyramid.reset(PYRAMID_WIDTH, std::min(std::max(pyramid_height, 1), 4 * PYRAMID_WIDTH));
+    // The occluder triangles of an instance facing the camera between the
+    // near and the far plane make up its surface. Edges shared by two of
+    // them running in opposite directions are inside it, the others on its outline
+    std::vector<QVector3D> corners;
+    std::vector<OccluderEdge> edges;
+    for (size_t instance = 0; instance < scene.instances.size(); instance++) {
+      const Model &model = *scene.models[scene.instances[instance].model];
+      QMatrix4x4 transform = view_projection * scene.instances[instance].transform;
+      corners.clear();
+      edges.clear();
+      for (size_t index = offsets[instance]; index < offsets[instance + 1]; index++) {
+        if (!occluder[index]) {
+          continue;
+        }
+        const TriangleCluster &cluster = model.clusters[index - offsets[instance]];
+        for (unsigned int i = cluster.first; i < cluster.first + cluster.count; i++) {
+          const unsigned int *vertices = &model.faces.triangles[model.cluster_triangles[i] * 3];
+          QVector3D ndc[3];
+          bool inside = true;
+          for (int k = 0; k < 3 && inside; k++) {
+            QVector4D point = transform * QVector4D(model.faces.position(vertices[k]), 1.0f);
+            ndc[k] = point.toVector3DAffine();
+            inside = point.w() > 0 && ndc[k].z() >= -1 && ndc[k].z() <= 1;
+          }
+          // Facing the camera is clockwise on screen, as normals towards -z face it
+          if (!inside || QVector3D::crossProduct(ndc[1] - ndc[0], ndc[2] - ndc[0]).z() >= 0) {
+            continue;
+          }
+          pyramid.drawTriangle(ndc[0], ndc[1], ndc[2]);
+          for (int k = 0; k < 3; k++) {
+            unsigned int from = vertices[k], to = vertices[(k + 1) % 3];
+            OccluderEdge edge = {std::min(from, to), std::max(from, to), from < to,
+                                 (unsigned int)(corners.size() + k)};
+            edges.push_back(edge);
+          }
+          corners.insert(corners.end(), ndc, ndc + 3);
+        }
+      }
+      if (corners.empty()) {
+        continue;
+      }
+      std::sort(edges.begin(), edges.end());
+      for (size_t i = 0; i < edges.size();) {
+        size_t j = i + 1;
+        while (j < edges.size() && edges[j].low == edges[i].low && edges[j].high == edges[i].high) {
+          j++;
+        }
+        if (j - i != 2 || edges[i].forward == edges[i + 1].forward) {
+          for (size_t e = i; e < j; e++) {
+            unsigned int corner = edges[e].corner;
+            pyramid.drawEdge(corners[corner], corners[corner - corner % 3 + (corner % 3 + 1) % 3]);
+          }
+        }
+        i = j;
+      }
+      pyramid.finishSurface();
+    }
+    pyramid.build();
+  }
+
+  std::vector<char> hidden(count, 0);
+  parallelChunks(count, CULL_GRAIN, [&](size_t, size_t begin, size_t end) {
+    for (size_t index = begin; index < end; index++) {
+      hidden[index] = projected[index].state == ProjectedCluster::INSIDE &&
+                      pyramid.isOccluded(projected[index].low, projected[index].high);
+    }
+  });
+  for (size_t i = 0; i < scene.instances.size(); i++) {
+    const Model &model = *scene.models[scene.instances[i].model];
+    for (size_t index = offsets[i]; index < offsets[i + 1]; index++) {
+      ClusterDraw draw = {(unsigned int)i, (unsigned int)(index - offsets[i])};
+      if (projected[index].state == ProjectedCluster::OUTSIDE) {
+        statistics.outside++;
+        continue;
+      }
+      if (hidden[index]) {
+        statistics.occluded++;
+        continue;
+      }
+      (occluder[index] ? occluders : visible).push_back(draw);
+      statistics.drawn_triangles += model.clusters[draw.cluster].count;
+    }
+  }
+  statistics.drawn = occluders.size() + visible.size();
+}
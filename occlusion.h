@@ -0,0 +1,103 @@
+#pragma once
+
+#include <QMatrix4x4>
+#include <QVector3D>
+#include <cstddef>
+#include <vector>
+
+#include "face.h"
+#include "memory_budget.h"
+
+class Scene;
+
+/**
+  * A spatially compact group of triangles of a model,
+  * the unit that is tested for occlusion
+  */
+struct TriangleCluster {
+  float low[3];
+  float high[3];
+  float area[3];       // sum of the area vectors of the triangles
+  unsigned int first;  // first triangle in cluster order
+  unsigned int count;
+};
+
+void buildClusters(const FaceCollection &mesh, std::vector<unsigned int> &triangles,
+                   std::vector<TriangleCluster> &clusters);
+
+/**
+  * A cluster of an instance that is drawn in a frame
+  */
+struct ClusterDraw {
+  unsigned int instance;
+  unsigned int cluster;
+};
+
+/**
+  * Counts of the last culled frame, clusters of all instances
+  */
+struct OcclusionStatistics {
+  OcclusionStatistics()
+    : clusters(0), outside(0), occluders(0), occluded(0), drawn(0), triangles(0), drawn_triangles(0) {}
+
+  size_t clusters;
+  size_t outside;    // out of the view
+  size_t occluders;  // rasterized into the depth pyramid, drawn first unless hidden
+  size_t occluded;   // hidden behind the occluders
+  size_t drawn;      // including the visible occluders
+  size_t triangles;
+  size_t drawn_triangles;
+};
+
+/**
+  * Low resolution depth buffer of the occluders with its mip chain
+  * Every texel of a level holds the farthest depth of the texels it
+  * covers on the level below, so a box is hidden if it is behind the
+  * few texels of the level where it covers at most 2x2 of them.
+  * Occluders are drawn conservatively, one surface at a time: a texel
+  * gets the depth of a surface only if the surface covers all of it,
+  * which is the case when its centre is covered and none of the outline
+  * edges of the surface crosses it
+  * Depths are normalized device z, smaller is nearer
+  */
+class DepthPyramid {
+public:
+  DepthPyramid() : width(0), height(0), memory(ACCELERATION_MEMORY) {}
+
+  void reset(int new_width, int new_height);
+  void drawTriangle(const QVector3D &a, const QVector3D &b, const QVector3D &c);
+  void drawEdge(const QVector3D &a, const QVector3D &b);
+  void finishSurface();
+  void build();
+  bool isOccluded(const QVector3D &low, const QVector3D &high) const;
+
+  int width;
+  int height;
+
+protected:
+  std::vector<std::vector<float>> levels;  // full resolution first
+  // The surface that is being drawn at full resolution
+  std::vector<float> surface_depths;        // farthest depth of its triangles touching a texel
+  std::vector<unsigned char> states;        // COVERED and CROSSED flags
+  int touched_low[2], touched_high[2];      // texels it touched, empty if low > high
+  std::vector<int> widths;
+  std::vector<int> heights;
+  MemoryReservation memory;
+};
+
+/**
+  * Chooses the clusters of a frame: the clusters covering the most of
+  * the screen are occluders, they are drawn first and rasterized into a depth pyramid
+  * on the CPU, the other clusters in the view are drawn unless their
+  * bounds are behind it
+  */
+class OcclusionCuller {
+public:
+  void cull(const Scene &scene, const QMatrix4x4 &view_projection, int viewport_width, int viewport_height,
+            std::vector<ClusterDraw> &occluders, std::vector<ClusterDraw> &visible);
+
+  OcclusionStatistics statistics;
+
+protected:
+  DepthPyramid pyramid;
+};
@@ -0,0 +1,483 @@
+#include "paged_model.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <cstring>
+#include <numeric>
+#include <stdexcept>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+
+static const char PAGED_MAGIC[8] = {'F', 'V', 'P', 'A', 'G', 'E', 'D', '\n'};
+static const uint32_t PAGED_VERSION = 1;
+static const uint64_t PAGE_ALIGNMENT = 4096;  // chunks start on page boundaries
+static const int PROXY_CELLS = 8;             // per axis of a chunk
+// A chunk is drawn in full detail once a proxy cell would cover more than 8 pixels
+static const float DETAIL_PIXELS = PROXY_CELLS * 8.0f;
+
+/**
+  * Start of a paged model file, followed by the chunk table,
+  * the proxies of all chunks and the corners of the chunks
+  */
+struct PagedHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t chunk_count;
+  uint32_t proxy_corners;
+  uint32_t reserved;
+  float low[3];
+  float high[3];
+};
+
+static_assert(sizeof(PagedVertex) == 7 * sizeof(float), "PagedVertex must have no padding");
+static_assert(sizeof(PageChunk) == 48, "PageChunk must have no padding");
+static_assert(sizeof(PagedHeader) == 48, "PagedHeader must have no padding");
+
+static uint64_t alignOffset(uint64_t offset) {
+  return (offset + PAGE_ALIGNMENT - 1) / PAGE_ALIGNMENT * PAGE_ALIGNMENT;
+}
+
+static void setVertex(PagedVertex &vertex, const QVector3D &position, const QVector3D &normal, float c) {
+  for (int dim = 0; dim < 3; dim++) {
+    vertex.position[dim] = position[dim];
+    vertex.normal[dim] = normal[dim];
+  }
+  vertex.c = c;
+}
+
+/**
+  * Simplify the triangles of a chunk by clustering their vertices
+  * The corners in a cell of a coarse grid over the chunk are merged
+  * into their average, triangles that collapse or repeat are dropped
+  * Input: const FaceCollection - triangulated mesh
+  *        const unsigned int *, size_t - triangles of the chunk
+  *        const PageChunk - chunk with its bounds
+  *        std::vector<PagedVertex> - output, corners are appended
+  * Output: void
+  */
+static void buildProxy(const FaceCollection &mesh, const unsigned int *triangles, size_t count,
+                       const PageChunk &chunk, std::vector<PagedVertex> &proxy) {
+  std::unordered_map<unsigned int, unsigned int> cell_index;
+  std::vector<QVector3D> sums;
+  std::vector<int> counts;
+  std::vector<unsigned int> corner_cells(count * 3);
+  for (size_t i = 0; i < count * 3; i++) {
+    QVector3D p = mesh.position(mesh.triangles[triangles[i / 3] * 3 + i % 3]);
+    unsigned int cell = 0;
+    for (int dim = 0; dim < 3; dim++) {
+      float extent = chunk.high[dim] - chunk.low[dim];
+      int index = extent > 0 ? (int)((p[dim] - chunk.low[dim]) / extent * PROXY_CELLS) : 0;
+      cell = cell * PROXY_CELLS + std::min(std::max(index, 0), PROXY_CELLS - 1);
+    }
+    auto found = cell_index.insert(std::make_pair(cell, (unsigned int)sums.size())).first;
+    if (found->second == sums.size()) {
+      sums.push_back(QVector3D());
+      counts.push_back(0);
+    }
+    sums[found->second] += p;
+    counts[found->second]++;
+    corner_cells[i] = found->second;
+  }
+  std::unordered_set<uint64_t> seen;
+  for (size_t t = 0; t < count; t++) {
+    unsigned int cells[3] = {corner_cells[t * 3], corner_cells[t * 3 + 1], corner_cells[t * 3 + 2]};
+    if (cells[0] == cells[1] || cells[1] == cells[2] || cells[0] == cells[2]) {
+      continue;
+    }
+    unsigned int sorted[3] = {cells[0], cells[1], cells[2]};
+    std::sort(sorted, sorted + 3);
+    if (!seen.insert((uint64_t)sorted[0] << 40 | (uint64_t)sorted[1] << 20 | sorted[2]).second) {
+      continue;
+    }
+    QVector3D points[3];
+    for (int k = 0; k < 3; k++) {
+      points[k] = sums[cells[k]] / counts[cells[k]];
+    }
+    QVector3D normal = QVector3D::crossProduct(points[1] - points[0], points[2] - points[0]).normalized();
+    float c = mesh.faces[mesh.triangle_faces[triangles[t]]].c;
+    for (int k = 0; k < 3; k++) {
+      PagedVertex vertex;
+      setVertex(vertex, points[k], normal, c);
+      proxy.push_back(vertex);
+    }
+  }
+}
+
+static void writeData(QFile &file, const void *data, qint64 size) {
+  if (file.write((const char *)data, size) != size) {
+    throw std::runtime_error("Failed to write " + file.fileName().toStdString());
+  }
+}
+
+/**
+  * Write a model as a paged file for out-of-core rendering
+  * The triangles are split at the median of the longest axis of their
+  * centres until every chunk is small enough, so chunks are compact in
+  * space. Each chunk gets its bounds and a coarse proxy. The model has to
+  * fit into memory once, e.g. with compact storage, but the viewer then
+  * only keeps the chunks it needs
+  * Input: const FaceCollection - triangulated mesh with normals
+  *        const QString - path of the .pages file
+  *        unsigned int - the most triangles per chunk
+  * Output: void, throws std::runtime_error
+  */
+void writePagedModel(const FaceCollection &mesh, const QString &path, unsigned int chunk_triangles) {
+  TRACE_SCOPE("writePagedModel");
+  size_t count = mesh.triangleCount();
+  std::vector<QVector3D> centres(count);
+  for (size_t t = 0; t < count; t++) {
+    centres[t] = (mesh.position(mesh.triangles[t * 3]) + mesh.position(mesh.triangles[t * 3 + 1]) +
+                  mesh.position(mesh.triangles[t * 3 + 2])) / 3;
+  }
+  std::vector<unsigned int> order(count);
+  std::iota(order.begin(), order.end(), 0);
+  // Ranges of order that form the chunks, left before right
+  std::vector<std::pair<size_t, size_t>> leaves, ranges(1, std::make_pair((size_t)0, count));
+  while (!ranges.empty()) {
+    std::pair<size_t, size_t> range = ranges.back();
+    ranges.pop_back();
+    if (range.second - range.first <= std::max(chunk_triangles, 1u)) {
+      if (range.second > range.first) {
+        leaves.push_back(range);
+      }
+      continue;
+    }
+    QVector3D low = centres[order[range.first]], high = low;
+    for (size_t i = range.first; i < range.second; i++) {
+      for (int dim = 0; dim < 3; dim++) {
+        low[dim] = std::min(low[dim], centres[order[i]][dim]);
+        high[dim] = std::max(high[dim], centres[order[i]][dim]);
+      }
+    }
+    QVector3D extent = high - low;
+    int axis = extent.x() >= extent.y() && extent.x() >= extent.z() ? 0 : (extent.y() >= extent.z() ? 1 : 2);
+    size_t middle = range.first + (range.second - range.first) / 2;
+    std::nth_element(order.begin() + range.first, order.begin() + middle, order.begin() + range.second,
+                     [&](unsigned int a, unsigned int b) { return centres[a][axis] < centres[b][axis]; });
+    ranges.push_back(std::make_pair(middle, range.second));
+    ranges.push_back(std::make_pair(range.first, middle));
+  }
+  std::vector<QVector3D>().swap(centres);
+
+  PagedHeader header;
+  memcpy(header.magic, PAGED_MAGIC, sizeof(header.magic));
+  header.version = PAGED_VERSION;
+  header.chunk_count = leaves.size();
+  header.reserved = 0;
+  std::vector<PageChunk> chunks(leaves.size());
+  std::vector<PagedVertex> proxies;
+  for (size_t c = 0; c < leaves.size(); c++) {
+    PageChunk &chunk = chunks[c];
+    const unsigned int *triangles = order.data() + leaves[c].first;
+    size_t chunk_count = leaves[c].second - leaves[c].first;
+    QVector3D low = mesh.position(mesh.triangles[triangles[0] * 3]), high = low;
+    for (size_t t = 0; t < chunk_count; t++) {
+      for (int k = 0; k < 3; k++) {
+        QVector3D p = mesh.position(mesh.triangles[triangles[t] * 3 + k]);
+        for (int dim = 0; dim < 3; dim++) {
+          low[dim] = std::min(low[dim], p[dim]);
+          high[dim] = std::max(high[dim], p[dim]);
+        }
+      }
+    }
+    for (int dim = 0; dim < 3; dim++) {
+      chunk.low[dim] = low[dim];
+      chunk.high[dim] = high[dim];
+      header.low[dim] = c == 0 ? low[dim] : std::min(header.low[dim], low[dim]);
+      header.high[dim] = c == 0 ? high[dim] : std::max(header.high[dim], high[dim]);
+    }
+    chunk.corners = chunk_count * 3;
+    chunk.proxy_first = proxies.size();
+    buildProxy(mesh, triangles, chunk_count, chunk, proxies);
+    chunk.proxy_corners = proxies.size() - chunk.proxy_first;
+    chunk.reserved = 0;
+  }
+  if (chunks.empty()) {
+    for (int dim = 0; dim < 3; dim++) {
+      header.low[dim] = header.high[dim] = 0;
+    }
+  }
+  header.proxy_corners = proxies.size();
+  uint64_t offset = sizeof(PagedHeader) + chunks.size() * sizeof(PageChunk) + proxies.size() * sizeof(PagedVertex);
+  for (PageChunk &chunk : chunks) {
+    offset = alignOffset(offset);
+    chunk.offset = offset;
+    offset += chunk.corners * sizeof(PagedVertex);
+  }
+
+  QFile file(path);
+  if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+    throw std::runtime_error("Failed to open " + path.toStdString() + " for writing");
+  }
+  writeData(file, &header, sizeof(header));
+  writeData(file, chunks.data(), chunks.size() * sizeof(PageChunk));
+  writeData(file, proxies.data(), proxies.size() * sizeof(PagedVertex));
+  std::vector<PagedVertex> corners;
+  for (size_t c = 0; c < chunks.size(); c++) {
+    const unsigned int *triangles = order.data() + leaves[c].first;
+    corners.resize(chunks[c].corners);
+    for (size_t i = 0; i < corners.size(); i++) {
+      unsigned int corner = triangles[i / 3] * 3 + i % 3;
+      setVertex(corners[i], mesh.position(mesh.triangles[corner]), mesh.cornerNormal(corner),
+                mesh.faces[mesh.triangle_faces[triangles[i / 3]]].c);
+    }
+    std::vector<char> padding(chunks[c].offset - file.pos(), 0);
+    writeData(file, padding.data(), padding.size());
+    writeData(file, corners.data(), corners.size() * sizeof(PagedVertex));
+  }
+  if (!file.flush()) {
+    throw std::runtime_error("Failed to write " + path.toStdString());
+  }
+}
+
+/**
+  * Open a paged model file and read its chunk table and proxies
+  * Input: const QString - path to the .pages file
+  *        size_t - the most bytes of chunks kept mapped
+  * Output: throws std::runtime_error
+  */
+PagedModel::PagedModel(const QString &path, size_t cache_limit)
+  : path(path), proxy_buffer(QOpenGLBuffer::VertexBuffer), proxy_memory(MESH_MEMORY),
+    proxy_gpu_memory(GPU_MEMORY), cache_limit(cache_limit),
+    resident_bytes(0), file(path), stopping(false) {
+  if (!file.open(QIODevice::ReadOnly)) {
+    throw std::runtime_error("File not found");
+  }
+  PagedHeader header;
+  if (file.read((char *)&header, sizeof(header)) != sizeof(header) ||
+      memcmp(header.magic, PAGED_MAGIC, sizeof(header.magic)) != 0) {
+    throw std::runtime_error("File is not a paged model");
+  }
+  if (header.version != PAGED_VERSION) {
+    throw std::runtime_error("Unsupported version of the paged model format");
+  }
+  uint64_t table_bytes = (uint64_t)header.chunk_count * sizeof(PageChunk);
+  uint64_t proxy_bytes = (uint64_t)header.proxy_corners * sizeof(PagedVertex);
+  if (sizeof(header) + table_bytes + proxy_bytes > (uint64_t)file.size()) {
+    throw std::runtime_error("Paged model is truncated");
+  }
+  proxy_memory.resize(table_bytes + proxy_bytes);
+  chunks.resize(header.chunk_count);
+  proxies.resize(header.proxy_corners);
+  if (file.read((char *)chunks.data(), table_bytes) != (qint64)table_bytes ||
+      file.read((char *)proxies.data(), proxy_bytes) != (qint64)proxy_bytes) {
+    throw std::runtime_error("Failed to read the paged model");
+  }
+  for (const PageChunk &chunk : chunks) {
+    if (chunk.offset + (uint64_t)chunk.corners * sizeof(PagedVertex) > (uint64_t)file.size() ||
+        (uint64_t)chunk.proxy_first + chunk.proxy_corners > proxies.size()) {
+      throw std::runtime_error("Paged model is corrupted");
+    }
+  }
+  low = QVector3D(header.low[0], header.low[1], header.low[2]);
+  high = QVector3D(header.high[0], header.high[1], header.high[2]);
+  pages.resize(chunks.size());
+  worker = std::thread(&PagedModel::run, this);
+}
+
+PagedModel::~PagedModel() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  wake.notify_all();
+  worker.join();
+  // Closing the file unmaps the chunks
+}
+
+/**
+  * Set a function called from the worker thread when a chunk is read in
+  * Input: std::function - the callback
+  * Output: void
+  */
+void PagedModel::setReadyCallback(const std::function<void()> &callback) {
+  std::lock_guard<std::mutex> lock(mutex);
+  on_ready = callback;
+}
+
+/**
+  * Find the chunks in the view and the ones that need their full detail
+  * Chunks are detailed when they cover enough pixels, the largest on
+  * screen first, as long as all of them fit into the cache
+  * Input: const QMatrix4x4 - model to clip space transform
+  *        float - size of the viewport in pixels
+  *        std::vector<unsigned int> - output, chunks inside the view
+  *        std::vector<unsigned int> - output, detailed chunks, most important first
+  * Output: void
+  */
+void PagedModel::selectChunks(const QMatrix4x4 &view_projection, float viewport_size,
+                              std::vector<unsigned int> &visible, std::vector<unsigned int> &detailed) const {
+  visible.clear();
+  detailed.clear();
+  std::vector<std::pair<float, unsigned int>> sizes;
+  for (unsigned int c = 0; c < chunks.size(); c++) {
+    const PageChunk &chunk = chunks[c];
+    QVector3D low, high;
+    bool behind = false;
+    for (int corner = 0; corner < 8; corner++) {
+      QVector4D point = view_projection * QVector4D((corner & 1) ? chunk.high[0] : chunk.low[0],
+                                                    (corner & 2) ? chunk.high[1] : chunk.low[1],
+                                                    (corner & 4) ? chunk.high[2] : chunk.low[2], 1.0f);
+      if (point.w() <= 0) {
+        behind = true;
+        break;
+      }
+      QVector3D ndc = point.toVector3DAffine();
+      for (int dim = 0; dim < 3; dim++) {
+        low[dim] = corner == 0 ? ndc[dim] : std::min(low[dim], ndc[dim]);
+        high[dim] = corner == 0 ? ndc[dim] : std::max(high[dim], ndc[dim]);
+      }
+    }
+    // Chunks crossing the eye plane are kept in the view
+    if (!behind && (low.x() > 1 || high.x() < -1 || low.y() > 1 || high.y() < -1 || low.z() > 1 || high.z() < -1)) {
+      continue;
+    }
+    visible.push_back(c);
+    float pixels = behind ? viewport_size : std::max(high.x() - low.x(), high.y() - low.y()) * 0.5f * viewport_size;
+    if (pixels >= DETAIL_PIXELS) {
+      sizes.push_back(std::make_pair(pixels, c));
+    }
+  }
+  std::sort(sizes.begin(), sizes.end(), [](const std::pair<float, unsigned int> &a,
+                                           const std::pair<float, unsigned int> &b) { return a.first > b.first; });
+  size_t bytes = 0;
+  for (const std::pair<float, unsigned int> &size : sizes) {
+    if (bytes + chunkBytes(size.second) <= cache_limit) {
+      bytes += chunkBytes(size.second);
+      detailed.push_back(size.second);
+    }
+  }
+}
+
+/**
+  * Ask for the detailed chunks of a frame
+  * Resident chunks become the most recently used, the others replace the
+  * chunks still waiting for the worker, in the order of importance
+  * Input: const std::vector<unsigned int> - chunks, most important first
+  * Output: void
+  */
+void PagedModel::request(const std::vector<unsigned int> &detailed) {
+  for (auto chunk = detailed.rbegin(); chunk != detailed.rend(); ++chunk) {
+    Page &page = pages[*chunk];
+    if (page.data) {
+      lru.splice(lru.begin(), lru, page.lru_position);
+    }
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (unsigned int chunk : queue) {
+      pages[chunk].queued = false;
+    }
+    queue.clear();
+    for (unsigned int chunk : detailed) {
+      Page &page = pages[chunk];
+      if (!page.data && !page.queued) {
+        page.queued = true;
+        queue.push_back(chunk);
+      }
+    }
+  }
+  wake.notify_one();
+}
+
+/**
+  * Add the chunks read in by the worker to the cache
+  * Input: std::vector<unsigned int> - output, the new resident chunks
+  * Output: bool - false if no chunk was read in
+  */
+bool PagedModel::takeLoaded(std::vector<unsigned int> &new_chunks) {
+  new_chunks.clear();
+  std::lock_guard<std::mutex> lock(mutex);
+  for (const std::pair<unsigned int, const PagedVertex *> &chunk : loaded) {
+    Page &page = pages[chunk.first];
+    page.queued = false;
+    page.data = chunk.second;
+    page.memory.update(chunkBytes(chunk.first));
+    resident_bytes += chunkBytes(chunk.first);
+    lru.push_front(chunk.first);
+    page.lru_position = lru.begin();
+    new_chunks.push_back(chunk.first);
+  }
+  loaded.clear();
+  return !new_chunks.empty();
+}
+
+/**
+  * Drop the least recently used chunks until the cache is within its limit
+  * The GL context of the buffers has to be current
+  * Input: void
+  * Output: void
+  */
+void PagedModel::evict() {
+  while (resident_bytes > cache_limit && !lru.empty()) {
+    unsigned int chunk = lru.back();
+    lru.pop_back();
+    Page &page = pages[chunk];
+    page.buffer.destroy();
+    page.gpu_memory.release();
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      file.unmap((uchar *)page.data);
+    }
+    page.data = 0;
+    page.memory.release();
+    resident_bytes -= chunkBytes(chunk);
+  }
+}
+
+/**
+  * Destroy the buffers of the proxies and of all resident chunks
+  * The GL context of the buffers has to be current
+  * Input: void
+  * Output: void
+  */
+void PagedModel::releaseBuffers() {
+  proxy_buffer.destroy();
+  proxy_gpu_memory.release();
+  for (Page &page : pages) {
+    page.buffer.destroy();
+    page.gpu_memory.release();
+  }
+}
+
+/**
+  * Worker loop, maps the queued chunks and reads them in
+  */
+void PagedModel::run() {
+  setTraceThreadName("pager");
+  std::unique_lock<std::mutex> lock(mutex);
+  while (true) {
+    wake.wait(lock, [this]() { return stopping || !queue.empty(); });
+    if (stopping) {
+      return;
+    }
+    unsigned int chunk = queue.front();
+    queue.pop_front();
+    size_t bytes = chunkBytes(chunk);
+    uchar *data = file.map(chunks[chunk].offset, bytes);
+    lock.unlock();
+    if (data) {
+      TRACE_SCOPE("page in");
+      // Touch every page, so uploading the chunk doesn't wait for the disk
+      volatile unsigned char sum = 0;
+      for (size_t i = 0; i < bytes; i += PAGE_ALIGNMENT) {
+        sum += data[i];
+      }
+    }
+    lock.lock();
+    // A chunk that can't be mapped is drawn as its proxy,
+    // the next frame that needs it requests it again
+    if (!data) {
+      pages[chunk].queued = false;
+      continue;
+    }
+    loaded.push_back(std::make_pair(chunk, (const PagedVertex *)data));
+    std::function<void()> callback = on_ready;
+    if (callback) {
+      lock.unlock();
+      callback();
+      lock.lock();
+    }
+  }
+}
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <QFile>
+#include <QMatrix4x4>
+#include <QOpenGLBuffer>
+#include <QString>
+#include <QVector3D>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "face.h"
+#include "memory_budget.h"
+
+/**
+  * A triangle corner in a paged model file, the layout of GpuVertex
+  */
+struct PagedVertex {
+  float position[3];
+  float normal[3];
+  float c;
+};
+
+/**
+  * A spatially coherent run of triangles of a paged model file
+  */
+struct PageChunk {
+  float low[3];
+  float high[3];
+  uint64_t offset;          // of the first corner in the file
+  uint32_t corners;         // three per triangle
+  uint32_t proxy_first;     // first corner of the coarse proxy
+  uint32_t proxy_corners;
+  uint32_t reserved;
+};
+
+void writePagedModel(const FaceCollection &mesh, const QString &path, unsigned int chunk_triangles = 1 << 16);
+
+/**
+  * A model that is drawn from a paged file without loading it as a whole
+  * The chunk table and the coarse proxies of all chunks stay in memory.
+  * The chunks seen close enough to need their full detail are mapped and
+  * read in by a worker thread, and kept in an LRU cache whose mapped
+  * memory stays below a limit. Chunks that aren't resident yet are
+  * drawn as their proxies
+  */
+class PagedModel {
+public:
+  PagedModel(const QString &path, size_t cache_limit);
+  ~PagedModel();
+
+  void setReadyCallback(const std::function<void()> &callback);
+  void selectChunks(const QMatrix4x4 &view_projection, float viewport_size, std::vector<unsigned int> &visible,
+                    std::vector<unsigned int> &detailed) const;
+  void request(const std::vector<unsigned int> &detailed);
+  bool takeLoaded(std::vector<unsigned int> &chunks);
+  const PagedVertex *chunkVertices(unsigned int chunk) const { return pages[chunk].data; }
+  void evict();
+  void releaseBuffers();
+  size_t residentBytes() const { return resident_bytes; }
+
+  QString path;
+  QMatrix4x4 transform;  // model to world
+  QVector3D low, high;
+  std::vector<PageChunk> chunks;
+  std::vector<PagedVertex> proxies;
+  QOpenGLBuffer proxy_buffer;
+  MemoryReservation proxy_memory;      // the chunk table and the proxies
+  MemoryReservation proxy_gpu_memory;
+
+  /**
+    * Runtime state of a chunk, only used by the rendering thread
+    * except for queued, which is guarded by the mutex
+    */
+  struct Page {
+    Page() : data(0), queued(false), buffer(QOpenGLBuffer::VertexBuffer), memory(CACHE_MEMORY), gpu_memory(GPU_MEMORY) {}
+    const PagedVertex *data;  // mapped corners, 0 if not resident
+    bool queued;
+    std::list<unsigned int>::iterator lru_position;
+    QOpenGLBuffer buffer;
+    MemoryReservation memory;
+    MemoryReservation gpu_memory;
+  };
+  std::vector<Page> pages;
+
+protected:
+  void run();
+  size_t chunkBytes(unsigned int chunk) const { return chunks[chunk].corners * sizeof(PagedVertex); }
+
+  size_t cache_limit;
+  size_t resident_bytes;
+  std::list<unsigned int> lru;  // resident chunks, most recently used first
+
+  // Shared with the worker
+  std::mutex mutex;
+  std::condition_variable wake;
+  std::thread worker;
+  QFile file;
+  std::deque<unsigned int> queue;
+  std::vector<std::pair<unsigned int, const PagedVertex *>> loaded;
+  std::function<void()> on_ready;
+  bool stopping;
+};
@@ -0,0 +1,155 @@
+#include "parallel.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+typedef std::function<void(size_t chunk, size_t begin, size_t end)> ChunkBody;
+
+/**
+  * A range split into chunks, taken one at a time by the threads of a pool
+  */
+struct ChunkJob {
+  const ChunkBody *body;
+  size_t count;
+  size_t grain;
+  size_t chunks;
+  std::atomic<size_t> next;
+
+  void run() {
+    TRACE_SCOPE("chunks");
+    for(size_t chunk = next++; chunk < chunks; chunk = next++){
+      (*body)(chunk, chunk * grain, std::min(count, (chunk + 1) * grain));
+    }
+  }
+};
+
+// Set while a thread works on a job, nested loops then run inline
+static thread_local bool inside_job = false;
+
+/**
+  * Threads that are started once and run one job at a time
+  * together with the thread that submitted it
+  */
+class ThreadPool {
+public:
+  ThreadPool(int threads) : job(0), generation(0), active(0), stopping(false) {
+    for(int i=0; i<threads; i++){
+      workers.push_back(std::thread(&ThreadPool::work, this));
+    }
+  }
+
+  ~ThreadPool() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    wake.notify_all();
+    for(std::thread &thread : workers){
+      thread.join();
+    }
+  }
+
+  void run(ChunkJob &new_job) {
+    std::lock_guard<std::mutex> submit_lock(submit_mutex);
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      job = &new_job;
+      generation++;
+    }
+    wake.notify_all();
+    inside_job = true;
+    new_job.run();
+    inside_job = false;
+    // Workers that have not picked up the job yet won't see it anymore
+    std::unique_lock<std::mutex> lock(mutex);
+    job = 0;
+    done.wait(lock, [this](){ return active == 0; });
+  }
+
+protected:
+  void work() {
+    setTraceThreadName("worker");
+    inside_job = true;
+    unsigned int seen = 0;
+    std::unique_lock<std::mutex> lock(mutex);
+    while(true){
+      wake.wait(lock, [&](){ return stopping || generation != seen; });
+      if(stopping){
+        return;
+      }
+      seen = generation;
+      if(!job){
+        continue;
+      }
+      ChunkJob *current = job;
+      active++;
+      lock.unlock();
+      current->run();
+      lock.lock();
+      if(--active == 0){
+        done.notify_all();
+      }
+    }
+  }
+
+  std::vector<std::thread> workers;
+  std::mutex submit_mutex;
+  std::mutex mutex;
+  std::condition_variable wake;
+  std::condition_variable done;
+  ChunkJob *job;
+  unsigned int generation;
+  int active;
+  bool stopping;
+};
+
+/**
+  * Number of threads used by parallel loops
+  * Input: void
+  * Output: int - number of hardware threads, at least 1
+  */
+int workerCount(){
+  static const int count = std::max(1, (int)std::thread::hardware_concurrency());
+  return count;
+}
+
+/**
+  * Number of chunks a range is split into by parallelChunks()
+  * Input: size_t - number of items
+  *        size_t - number of items per chunk
+  * Output: size_t - number of chunks
+  */
+size_t chunkCount(size_t count, size_t grain){
+  return (count + grain - 1) / grain;
+}
+
+/**
+  * Run a function over fixed-size chunks of a range on all cores
+  * Chunk boundaries depend only on the count and the grain, so results
+  * stored per chunk and merged in chunk order are deterministic.
+  * The threads are started on the first call and reused afterwards,
+  * loops started from inside a loop body run on the calling thread
+  * Input: size_t - number of items
+  *        size_t - number of items per chunk
+  *        std::function - called with the chunk index and its item range
+  * Output: void
+  */
+void parallelChunks(size_t count, size_t grain, const ChunkBody &body){
+  ChunkJob job;
+  job.body = &body;
+  job.count = count;
+  job.grain = grain;
+  job.chunks = chunkCount(count, grain);
+  job.next = 0;
+  if(workerCount() <= 1 || job.chunks <= 1 || inside_job){
+    job.run();
+    return;
+  }
+  static ThreadPool pool(workerCount() - 1);
+  pool.run(job);
+}
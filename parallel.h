@@ -0,0 +1,9 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+
+int workerCount();
+size_t chunkCount(size_t count, size_t grain);
+void parallelChunks(size_t count, size_t grain,
+                    const std::function<void(size_t chunk, size_t begin, size_t end)> &body);
@@ -0,0 +1,525 @@
+#include "ply.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+
+/**
+  * Size of a binary value in bytes
+  */
+static size_t typeSize(PlyType type){
+  switch(type){
+    case PLY_INT8: case PLY_UINT8: return 1;
+    case PLY_INT16: case PLY_UINT16: return 2;
+    case PLY_INT32: case PLY_UINT32: case PLY_FLOAT32: return 4;
+    case PLY_FLOAT64: return 8;
+  }
+  return 0;
+}
+
+/**
+  * Parse a type name, both the old and the sized names are accepted
+  */
+static PlyType parseType(const std::string &name){
+  if(name == "char" || name == "int8") return PLY_INT8;
+  if(name == "uchar" || name == "uint8") return PLY_UINT8;
+  if(name == "short" || name == "int16") return PLY_INT16;
+  if(name == "ushort" || name == "uint16") return PLY_UINT16;
+  if(name == "int" || name == "int32") return PLY_INT32;
+  if(name == "uint" || name == "uint32") return PLY_UINT32;
+  if(name == "float" || name == "float32") return PLY_FLOAT32;
+  if(name == "double" || name == "float64") return PLY_FLOAT64;
+  throw std::runtime_error("Unknown PLY property type '" + name + "'");
+}
+
+/**
+  * Scale of a color channel of the given type to [0, 1]
+  */
+static float colorScale(PlyType type){
+  switch(type){
+    case PLY_UINT8: return 1.0f / 255;
+    case PLY_UINT16: return 1.0f / 65535;
+    default: return 1.0f;
+  }
+}
+
+template <typename T>
+static T loadValue(const char *data, bool swap){
+  T value;
+  if(swap){
+    char bytes[sizeof(T)];
+    for(size_t i=0; i<sizeof(T); i++){
+      bytes[i] = data[sizeof(T) - 1 - i];
+    }
+    memcpy(&value, bytes, sizeof(T));
+  }
+  else{
+    memcpy(&value, data, sizeof(T));
+  }
+  return value;
+}
+
+/**
+  * Decode a binary value of any type
+  */
+static double loadScalar(const char *data, PlyType type, bool swap){
+  switch(type){
+    case PLY_INT8: return (int8_t)data[0];
+    case PLY_UINT8: return (uint8_t)data[0];
+    case PLY_INT16: return loadValue<int16_t>(data, swap);
+    case PLY_UINT16: return loadValue<uint16_t>(data, swap);
+    case PLY_INT32: return loadValue<int32_t>(data, swap);
+    case PLY_UINT32: return loadValue<uint32_t>(data, swap);
+    case PLY_FLOAT32: return loadValue<float>(data, swap);
+    case PLY_FLOAT64: return loadValue<double>(data, swap);
+  }
+  return 0;
+}
+
+/**
+  * Convert one property of every item of a fixed-size block to float
+  * The type is resolved once per column so the loop has no branches
+  */
+template <typename T>
+static void convertColumn(const char *data, size_t stride, size_t count, bool swap, float *output, size_t step){
+  for(size_t i=0; i<count; i++){
+    output[i * step] = (float)loadValue<T>(data + i * stride, swap);
+  }
+}
+
+static void convertColumn(const char *data, PlyType type, size_t stride, size_t count, bool swap,
+                          float *output, size_t step){
+  switch(type){
+    case PLY_INT8: convertColumn<int8_t>(data, stride, count, swap, output, step); break;
+    case PLY_UINT8: convertColumn<uint8_t>(data, stride, count, swap, output, step); break;
+    case PLY_INT16: convertColumn<int16_t>(data, stride, count, swap, output, step); break;
+    case PLY_UINT16: convertColumn<uint16_t>(data, stride, count, swap, output, step); break;
+    case PLY_INT32: convertColumn<int32_t>(data, stride, count, swap, output, step); break;
+    case PLY_UINT32: convertColumn<uint32_t>(data, stride, count, swap, output, step); break;
+    case PLY_FLOAT32: convertColumn<float>(data, stride, count, swap, output, step); break;
+    case PLY_FLOAT64: convertColumn<double>(data, stride, count, swap, output, step); break;
+  }
+}
+
+static bool hostIsLittleEndian(){
+  const uint16_t one = 1;
+  return *(const char *)&one == 1;
+}
+
+/**
+  * Reads values from the binary body, checking the end of the data
+  */
+class BinaryReader {
+public:
+  BinaryReader(const char *begin, const char *end, bool swap) : cursor(begin), end(end), swap(swap) {}
+
+  const char *take(size_t bytes){
+    if((size_t)(end - cursor) < bytes){
+      throw std::runtime_error("Unexpected end of PLY file");
+    }
+    const char *data = cursor;
+    cursor += bytes;
+    return data;
+  }
+
+  double scalar(PlyType type){
+    return loadScalar(take(typeSize(type)), type, swap);
+  }
+
+  const char *cursor;
+  const char *end;
+  bool swap;
+};
+
+/**
+  * Reads whitespace separated values from the ASCII body
+  */
+class AsciiReader {
+public:
+  AsciiReader(const char *begin, const char *end) : cursor(begin), end(end) {}
+
+  double scalar(PlyType){
+    while(cursor < end && isspace((unsigned char)*cursor)){
+      cursor++;
+    }
+    const char *start = cursor;
+    while(cursor < end && !isspace((unsigned char)*cursor)){
+      cursor++;
+    }
+    // The mapped data isn't terminated, copy the token for strtod
+    char token[64];
+    size_t length = cursor - start;
+    if(length == 0 || length >= sizeof(token)){
+      throw std::runtime_error(length == 0 ? "Unexpected end of PLY file" : "Invalid value in PLY file");
+    }
+    memcpy(token, start, length);
+    token[length] = '\0';
+    char *parsed;
+    double value = strtod(token, &parsed);
+    if(parsed != token + length){
+      throw std::runtime_error("Invalid value in PLY file");
+    }
+    return value;
+  }
+
+  const char *cursor;
+  const char *end;
+};
+
+/**
+  * Indices of the vertex properties the viewer uses, -1 if absent
+  */
+struct VertexLayout {
+  int position[3];
+  int normal[3];
+  int color[3];
+
+  VertexLayout(const PlyElement &element){
+    const char *names[9] = {"x", "y", "z", "nx", "ny", "nz", "red", "green", "blue"};
+    int *fields[9] = {&position[0], &position[1], &position[2], &normal[0], &normal[1], &normal[2],
+                      &color[0], &color[1], &color[2]};
+    for(int k=0; k<9; k++){
+      *fields[k] = -1;
+      for(int p=0; p<(int)element.properties.size(); p++){
+        if(!element.properties[p].list && element.properties[p].name == names[k]){
+          *fields[k] = p;
+        }
+      }
+    }
+    if(position[0] < 0 || position[1] < 0 || position[2] < 0){
+      throw std::runtime_error("PLY vertices have no x, y and z properties");
+    }
+  }
+
+  bool hasNormals() const { return normal[0] >= 0 && normal[1] >= 0 && normal[2] >= 0; }
+  bool hasColors() const { return color[0] >= 0 && color[1] >= 0 && color[2] >= 0; }
+};
+
+/**
+  * Gray level of a color with the luma weights of Rec. 601
+  */
+static float grayLevel(float r, float g, float b){
+  return 0.299f * r + 0.587f * g + 0.114f * b;
+}
+
+/**
+  * Check the item count of an element from the header against the rest
+  * of the file before anything is reserved for it. A binary item takes
+  * at least its scalars and list counts, an ASCII value at least a
+  * character and a separator
+  * Input: const PlyElement - the element
+  *        bool - true for ASCII files
+  *        size_t - bytes after the elements before it
+  * Output: void, throws std::runtime_error if the items can't fit
+  */
+static void checkElementCount(const PlyElement &element, bool ascii, size_t remaining){
+  size_t item_bytes = 0;
+  for(const PlyProperty &property : element.properties){
+    item_bytes += ascii ? 2 : typeSize(property.list ? property.count_type : property.type);
+  }
+  // The last value of an ASCII file may end without a separator
+  if(ascii){
+    remaining++;
+  }
+  if(item_bytes > 0 && element.count > remaining / item_bytes){
+    throw std::runtime_error("PLY element '" + element.name + "' has more items than the file holds");
+  }
+}
+
+static void reserveVertices(PlyMesh &mesh, const PlyElement &element, const VertexLayout &layout){
+  mesh.positions.resize(element.count * 3);
+  mesh.normals.resize(layout.hasNormals() ? element.count * 3 : 0);
+  mesh.colors.resize(layout.hasColors() ? element.count : 0);
+}
+
+/**
+  * Decode vertices with a fixed size straight from the binary data
+  * Float triples stored next to each other are copied without conversion
+  * Input: const char - first vertex
+  *        const PlyElement - the vertex element without list properties
+  *        bool - true if the byte order differs from the host's
+  *        PlyMesh - output
+  * Output: void
+  */
+static void readFixedVertices(const char *data, const PlyElement &element, bool swap, PlyMesh &mesh){
+  VertexLayout layout(element);
+  std::vector<size_t> offsets;
+  size_t stride = 0;
+  for(const PlyProperty &property : element.properties){
+    offsets.push_back(stride);
+    stride += typeSize(property.type);
+  }
+  reserveVertices(mesh, element, layout);
+
+  // Copies three floats per vertex if they are packed, converts otherwise
+  auto readTriple = [&](const int fields[3], std::vector<float> &output){
+    const PlyProperty &first = element.properties[fields[0]];
+    bool packed = !swap && first.type == PLY_FLOAT32 &&
+                  element.properties[fields[1]].type == PLY_FLOAT32 && offsets[fields[1]] == offsets[fields[0]] + 4 &&
+                  element.properties[fields[2]].type == PLY_FLOAT32 && offsets[fields[2]] == offsets[fields[0]] + 8;
+    if(packed && stride == 12){
+      memcpy(output.data(), data, element.count * 12);
+    }
+    else if(packed){
+      const char *source = data + offsets[fields[0]];
+      for(size_t i=0; i<element.count; i++){
+        memcpy(&output[i * 3], source + i * stride, 12);
+      }
+    }
+    else{
+      for(int k=0; k<3; k++){
+        convertColumn(data + offsets[fields[k]], element.properties[fields[k]].type, stride, element.count, swap,
+                      output.data() + k, 3);
+      }
+    }
+  };
+  readTriple(layout.position, mesh.positions);
+  if(layout.hasNormals()){
+    readTriple(layout.normal, mesh.normals);
+  }
+  if(layout.hasColors()){
+    std::vector<float> rgb;
+    rgb.resize(element.count * 3);
+    readTriple(layout.color, rgb);
+    float scale[3];
+    for(int k=0; k<3; k++){
+      scale[k] = colorScale(element.properties[layout.color[k]].type);
+    }
+    for(size_t i=0; i<element.count; i++){
+      mesh.colors[i] = grayLevel(rgb[i * 3] * scale[0], rgb[i * 3 + 1] * scale[1], rgb[i * 3 + 2] * scale[2]);
+    }
+  }
+}
+
+/**
+  * Decode face lists of the common "uchar count, int indices" layout
+  * Input: BinaryReader - positioned at the first face
+  *        const PlyElement - the face element with a single list property
+  *        PlyMesh - output
+  * Output: void
+  */
+static void readPackedFaces(BinaryReader &reader, const PlyElement &element, PlyMesh &mesh){
+  for(size_t f=0; f<element.count; f++){
+    size_t n = (uint8_t)*reader.take(1);
+    const char *indices = reader.take(n * 4);
+    size_t first = mesh.face_indices.size();
+    mesh.face_indices.resize(first + n);
+    memcpy(&mesh.face_indices[first], indices, n * 4);
+    mesh.face_offsets.push_back(mesh.face_indices.size());
+  }
+}
+
+/**
+  * Decode one element block value by value
+  * Works for any property layout and for both encodings
+  * Input: Reader - positioned at the first item of the element
+  *        const PlyElement - the element
+  *        PlyMesh - output, vertices and faces are stored, other elements skipped
+  * Output: void
+  */
+template <class Reader>
+static void readElement(Reader &reader, const PlyElement &element, PlyMesh &mesh){
+  bool vertices = element.name == "vertex";
+  bool faces = element.name == "face";
+  int index_property = -1;
+  if(faces){
+    for(int p=0; p<(int)element.properties.size(); p++){
+      const PlyProperty &property = element.properties[p];
+      if(property.list && (property.name == "vertex_indices" || property.name == "vertex_index")){
+        index_property = p;
+      }
+    }
+    if(index_property < 0){
+      throw std::runtime_error("PLY faces have no vertex_indices property");
+    }
+  }
+  std::unique_ptr<VertexLayout> layout;
+  if(vertices){
+    layout.reset(new VertexLayout(element));
+    reserveVertices(mesh, element, *layout);
+  }
+  std::vector<double> values(element.properties.size());
+  for(size_t i=0; i<element.count; i++){
+    for(int p=0; p<(int)element.properties.size(); p++){
+      const PlyProperty &property = element.properties[p];
+      if(!property.list){
+        values[p] = reader.scalar(property.type);
+        continue;
+      }
+      size_t n = (size_t)reader.scalar(property.count_type);
+      for(size_t k=0; k<n; k++){
+        double value = reader.scalar(property.type);
+        if(p == index_property){
+          mesh.face_indices.push_back((unsigned int)value);
+        }
+      }
+      if(p == index_property){
+        mesh.face_offsets.push_back(mesh.face_indices.size());
+      }
+    }
+    if(vertices){
+      for(int k=0; k<3; k++){
+        mesh.positions[i * 3 + k] = values[layout->position[k]];
+      }
+      if(layout->hasNormals()){
+        for(int k=0; k<3; k++){
+          mesh.normals[i * 3 + k] = values[layout->normal[k]];
+        }
+      }
+      if(layout->hasColors()){
+        float rgb[3];
+        for(int k=0; k<3; k++){
+          rgb[k] = values[layout->color[k]] * colorScale(element.properties[layout->color[k]].type);
+        }
+        mesh.colors[i] = grayLevel(rgb[0], rgb[1], rgb[2]);
+      }
+    }
+  }
+}
+
+/**
+  * Parse the header of a PLY file
+  * Input: const char - start of the file
+  *        size_t - size of the file in bytes
+  *        PlyHeader - output
+  * Output: void, throws std::runtime_error if the header is invalid
+  */
+void parsePlyHeader(const char *data, size_t size, PlyHeader &header){
+  const char *end_marker = "end_header";
+  const char *found = std::search(data, data + size, end_marker, end_marker + strlen(end_marker));
+  if(size < 4 || memcmp(data, "ply", 3) != 0 || found == data + size){
+    throw std::runtime_error("File format is not supported (not PLY).");
+  }
+  const char *body = (const char *)memchr(found, '\n', data + size - found);
+  header.size = body ? body - data + 1 : size;
+  header.elements.clear();
+
+  std::istringstream lines(std::string(data, found - data));
+  std::string line;
+  bool has_format = false;
+  std::getline(lines, line);  // "ply"
+  while(std::getline(lines, line)){
+    std::istringstream words(line);
+    std::string keyword;
+    words >> keyword;
+    if(keyword.empty() || keyword == "comment" || keyword == "obj_info"){
+      continue;
+    }
+    if(keyword == "format"){
+      std::string format;
+      words >> format;
+      if(format == "ascii") header.format = PLY_ASCII;
+      else if(format == "binary_little_endian") header.format = PLY_BINARY_LITTLE_ENDIAN;
+      else if(format == "binary_big_endian") header.format = PLY_BINARY_BIG_ENDIAN;
+      else throw std::runtime_error("Unknown PLY format '" + format + "'");
+      has_format = true;
+    }
+    else if(keyword == "element"){
+      PlyElement element;
+      if(!(words >> element.name >> element.count)){
+        throw std::runtime_error("Invalid PLY element: " + line);
+      }
+      header.elements.push_back(element);
+    }
+    else if(keyword == "property"){
+      if(header.elements.empty()){
+        throw std::runtime_error("PLY property outside of an element");
+      }
+      PlyProperty property;
+      std::string type;
+      words >> type;
+      property.list = type == "list";
+      property.count_type = PLY_UINT8;
+      if(property.list){
+        std::string count_type;
+        words >> count_type >> type;
+        property.count_type = parseType(count_type);
+      }
+      property.type = parseType(type);
+      if(!(words >> property.name)){
+        throw std::runtime_error("Invalid PLY property: " + line);
+      }
+      header.elements.back().properties.push_back(property);
+    }
+    else{
+      throw std::runtime_error("Unknown PLY header line: " + line);
+    }
+  }
+  if(!has_format){
+    throw std::runtime_error("PLY header has no format");
+  }
+}
+
+/**
+  * Read the vertices and faces of a PLY file held in memory
+  * Binary vertex blocks without lists are decoded in place, faces with
+  * the common list layout are copied directly, everything else is
+  * decoded value by value. Element counts that don't fit into the
+  * file are rejected before any memory is reserved for them
+  * Input: const char - start of the file, e.g. a mapped file
+  *        size_t - size of the file in bytes
+  *        PlyMesh - output
+  * Output: void, throws std::runtime_error if the file is invalid
+  */
+void readPly(const char *data, size_t size, PlyMesh &mesh){
+  TRACE_SCOPE("readPly");
+  PlyHeader header;
+  parsePlyHeader(data, size, header);
+  mesh = PlyMesh();
+  mesh.face_offsets.push_back(0);
+  bool has_vertices = false;
+
+  if(header.format == PLY_ASCII){
+    AsciiReader reader(data + header.size, data + size);
+    for(const PlyElement &element : header.elements){
+      has_vertices = has_vertices || element.name == "vertex";
+      checkElementCount(element, true, reader.end - reader.cursor);
+      readElement(reader, element, mesh);
+    }
+  }
+  else{
+    bool swap = (header.format == PLY_BINARY_LITTLE_ENDIAN) != hostIsLittleEndian();
+    BinaryReader reader(data + header.size, data + size, swap);
+    for(const PlyElement &element : header.elements){
+      checkElementCount(element, false, reader.end - reader.cursor);
+      bool lists = false;
+      size_t stride = 0;
+      for(const PlyProperty &property : element.properties){
+        lists = lists || property.list;
+        stride += typeSize(property.type);
+      }
+      if(element.name == "vertex" && !lists){
+        const char *vertices = reader.take(element.count * stride);
+        readFixedVertices(vertices, element, swap, mesh);
+      }
+      else if(element.name == "face" && element.properties.size() == 1 && !swap &&
+              element.properties[0].count_type == PLY_UINT8 &&
+              (element.properties[0].type == PLY_INT32 || element.properties[0].type == PLY_UINT32) &&
+              (element.properties[0].name == "vertex_indices" || element.properties[0].name == "vertex_index")){
+        readPackedFaces(reader, element, mesh);
+      }
+      else if(!lists && element.name != "face"){
+        // Skip unused fixed-size elements at once
+        reader.take(element.count * stride);
+      }
+      else{
+        readElement(reader, element, mesh);
+      }
+      has_vertices = has_vertices || element.name == "vertex";
+    }
+  }
+  if(!has_vertices){
+    throw std::runtime_error("PLY file has no vertices");
+  }
+  size_t n_vertices = mesh.positions.size() / 3;
+  for(unsigned int index : mesh.face_indices){
+    if(index >= n_vertices){
+      throw std::runtime_error("PLY face refers to a missing vertex");
+    }
+  }
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+enum PlyFormat { PLY_ASCII, PLY_BINARY_LITTLE_ENDIAN, PLY_BINARY_BIG_ENDIAN };
+
+enum PlyType { PLY_INT8, PLY_UINT8, PLY_INT16, PLY_UINT16, PLY_INT32, PLY_UINT32, PLY_FLOAT32, PLY_FLOAT64 };
+
+/**
+  * A scalar or list property of a PLY element
+  */
+struct PlyProperty {
+  std::string name;
+  PlyType type;        // type of the value or of the list items
+  bool list;
+  PlyType count_type;  // type of the list length
+};
+
+/**
+  * An element block declared in a PLY header
+  */
+struct PlyElement {
+  std::string name;
+  size_t count;
+  std::vector<PlyProperty> properties;
+};
+
+struct PlyHeader {
+  PlyFormat format;
+  std::vector<PlyElement> elements;
+  size_t size;  // bytes up to and including "end_header\n"
+};
+
+/**
+  * Indexed polygon mesh read from a PLY file
+  * Normals and colors are empty if the vertices don't have them
+  */
+struct PlyMesh {
+  std::vector<float> positions;  // x, y, z per vertex
+  std::vector<float> normals;    // nx, ny, nz per vertex
+  std::vector<float> colors;     // gray level in [0, 1] per vertex
+  std::vector<unsigned int> face_offsets;
+  std::vector<unsigned int> face_indices;
+};
+
+void parsePlyHeader(const char *data, size_t size, PlyHeader &header);
+void readPly(const char *data, size_t size, PlyMesh &mesh);
@@ -0,0 +1,329 @@
+#include "point_cloud.h"
+#include "parallel.h"
+#include "trace.h"
+
+#include <QVector4D>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <queue>
+#include <stdexcept>
+#include <utility>
+
+static const int SAMPLE_GRID = 64;             // cells per axis of the sample of a node
+static const unsigned int LEAF_POINTS = 4096;  // nodes with fewer points keep all of them
+static const int MAX_LEVELS = 24;              // below this, repeated points stay in a leaf
+static const float MAX_POINT_SIZE = 16.0f;     // pixels
+static const size_t POINT_GRAIN = 1 << 16;
+
+/**
+  * A range of points that becomes a node and its subtree
+  */
+struct NodeTask {
+  unsigned int node;
+  unsigned int begin, end;
+  int level;
+};
+
+/**
+  * The points of an octant that weren't taken by the sample of a node
+  */
+struct ChildRange {
+  int octant;
+  unsigned int begin, end;
+};
+
+/**
+  * Typical distance between the points of a node
+  * Sampled points are at least a cell apart, the points of a surface
+  * are spread over the square of the count
+  */
+static float pointSpacing(float size, unsigned int count) {
+  return std::max(size / SAMPLE_GRID, size / std::sqrt((float)std::max(count, 1u)));
+}
+
+/**
+  * Take the first point of every occupied cell of the sample grid into a
+  * node and sort the other points by octant, behind the sample
+  * Input: PointNode - the node, its cube is set
+  *        const NodeTask - its range of points
+  *        std::vector<PointVertex> - the points, sorted in place
+  *        std::vector<PointVertex> - scratch space of the same size
+  *        std::vector<unsigned char> - scratch space of the same size
+  *        std::vector<uint64_t> - bits of the occupied cells
+  *        std::vector<ChildRange> - output, non-empty octants in order
+  * Output: void
+  */
+static void splitNode(PointNode &node, const NodeTask &task, std::vector<PointVertex> &vertices,
+                      std::vector<PointVertex> &scratch, std::vector<unsigned char> &slots,
+                      std::vector<uint64_t> &taken, std::vector<ChildRange> &children) {
+  unsigned int count = task.end - task.begin;
+  node.first = task.begin;
+  if (count <= LEAF_POINTS || task.level >= MAX_LEVELS) {
+    node.count = count;
+    node.spacing = pointSpacing(node.size, count);
+    return;
+  }
+  std::fill(taken.begin(), taken.end(), 0);
+  unsigned int counts[9] = {0};
+  float cells = SAMPLE_GRID / node.size;
+  float centre[3];
+  for (int dim = 0; dim < 3; dim++) {
+    centre[dim] = node.low[dim] + node.size / 2;
+  }
+  for (unsigned int i = task.begin; i < task.end; i++) {
+    const float *p = vertices[i].position;
+    unsigned int cell = 0;
+    for (int dim = 0; dim < 3; dim++) {
+      int index = std::max(0, std::min(SAMPLE_GRID - 1, (int)((p[dim] - node.low[dim]) * cells)));
+      cell = cell * SAMPLE_GRID + index;
+    }
+    unsigned char slot;
+    if (!(taken[cell / 64] & (1ULL << (cell % 64)))) {
+      taken[cell / 64] |= 1ULL << (cell % 64);
+      slot = 8;
+    }
+    else {
+      slot = (p[0] >= centre[0]) | (p[1] >= centre[1]) << 1 | (p[2] >= centre[2]) << 2;
+    }
+    slots[i] = slot;
+    counts[slot]++;
+  }
+  // The sample comes first, then the octants in order
+  unsigned int offsets[9];
+  offsets[8] = task.begin;
+  unsigned int offset = task.begin + counts[8];
+  for (int octant = 0; octant < 8; octant++) {
+    offsets[octant] = offset;
+    if (counts[octant] > 0) {
+      ChildRange child = {octant, offset, offset + counts[octant]};
+      children.push_back(child);
+    }
+    offset += counts[octant];
+  }
+  for (unsigned int i = task.begin; i < task.end; i++) {
+    scratch[offsets[slots[i]]++] = vertices[i];
+  }
+  std::copy(scratch.begin() + task.begin, scratch.begin() + task.end, vertices.begin() + task.begin);
+  node.count = counts[8];
+  node.spacing = pointSpacing(node.size, counts[8]);
+}
+
+/**
+  * Build the octree of a point cloud
+  * The tree is built level by level, the nodes of a level are split on
+  * all cores. Every node only moves the points of its own range, so the
+  * result doesn't depend on the number of threads
+  * Input: std::vector<QVector3D> - the points, released here
+  *        std::vector<float> - gray level of every point or empty for
+  *        white points, released here
+  *        bool - quantize the positions to 16 bits
+  * Output: throws MemoryBudgetExceeded or std::runtime_error
+  */
+PointCloud::PointCloud(std::vector<QVector3D> &points, std::vector<float> &colors, bool compact)
+  : compact_storage(compact), buffer(QOpenGLBuffer::VertexBuffer), memory(MESH_MEMORY), gpu_memory(GPU_MEMORY) {
+  TRACE_SCOPE("build point cloud");
+  size_t n_points = points.size();
+  if (n_points >= std::numeric_limits<uint32_t>::max()) {
+    throw std::runtime_error("Point clouds are limited to 4 billion points");
+  }
+  memory.resize(n_points * sizeof(PointVertex));
+  MemoryReservation build_memory(ACCELERATION_MEMORY);
+  build_memory.resize(n_points * (sizeof(PointVertex) + 1));
+  vertices.resize(n_points);
+  std::vector<std::pair<QVector3D, QVector3D>> chunk_bounds(chunkCount(n_points, POINT_GRAIN));
+  parallelChunks(n_points, POINT_GRAIN, [&](size_t chunk, size_t begin, size_t end) {
+    QVector3D chunk_low = points[begin], chunk_high = points[begin];
+    for (size_t i = begin; i < end; i++) {
+      for (int dim = 0; dim < 3; dim++) {
+        vertices[i].position[dim] = points[i][dim];
+        chunk_low[dim] = std::min(chunk_low[dim], points[i][dim]);
+        chunk_high[dim] = std::max(chunk_high[dim], points[i][dim]);
+      }
+      vertices[i].c = colors.empty() ? 1.0f : colors[i];
+    }
+    chunk_bounds[chunk] = std::make_pair(chunk_low, chunk_high);
+  });
+  std::vector<QVector3D>().swap(points);
+  std::vector<float>().swap(colors);
+  if (n_points == 0) {
+    return;
+  }
+  low = chunk_bounds[0].first;
+  high = chunk_bounds[0].second;
+  for (const std::pair<QVector3D, QVector3D> &bounds : chunk_bounds) {
+    for (int dim = 0; dim < 3; dim++) {
+      low[dim] = std::min(low[dim], bounds.first[dim]);
+      high[dim] = std::max(high[dim], bounds.second[dim]);
+    }
+  }
+
+  PointNode root;
+  for (int dim = 0; dim < 3; dim++) {
+    root.low[dim] = low[dim];
+  }
+  // Slightly larger than the bounds, so the highest points fall into the last cell
+  root.size = std::max(std::max(high.x() - low.x(), high.y() - low.y()), high.z() - low.z()) * 1.0001f;
+  root.size = std::max(root.size, std::numeric_limits<float>::min());
+  std::fill(root.children, root.children + 8, -1);
+  nodes.push_back(root);
+  std::vector<PointVertex> scratch(n_points);
+  std::vector<unsigned char> slots(n_points);
+  std::vector<NodeTask> tasks(1, NodeTask{0, 0, (unsigned int)n_points, 0});
+  while (!tasks.empty()) {
+    std::vector<std::vector<ChildRange>> children(tasks.size());
+    parallelChunks(tasks.size(), 1, [&](size_t, size_t begin, size_t end) {
+      std::vector<uint64_t> taken(SAMPLE_GRID * SAMPLE_GRID * SAMPLE_GRID / 64);
+      for (size_t t = begin; t < end; t++) {
+        splitNode(nodes[tasks[t].node], tasks[t], vertices, scratch, slots, taken, children[t]);
+      }
+    });
+    std::vector<NodeTask> next;
+    for (size_t t = 0; t < tasks.size(); t++) {
+      for (const ChildRange &range : children[t]) {
+        PointNode child;
+        const PointNode &parent = nodes[tasks[t].node];
+        child.size = parent.size / 2;
+        for (int dim = 0; dim < 3; dim++) {
+          child.low[dim] = parent.low[dim] + ((range.octant >> dim) & 1) * child.size;
+        }
+        std::fill(child.children, child.children + 8, -1);
+        nodes[tasks[t].node].children[range.octant] = nodes.size();
+        next.push_back(NodeTask{(unsigned int)nodes.size(), range.begin, range.end, tasks[t].level + 1});
+        nodes.push_back(child);
+      }
+    }
+    tasks.swap(next);
+  }
+  std::vector<PointVertex>().swap(scratch);
+  std::vector<unsigned char>().swap(slots);
+
+  if (compact_storage) {
+    quantizer.fit(low, high);
+    compact_vertices.resize(n_points);
+    parallelChunks(n_points, POINT_GRAIN, [&](size_t, size_t begin, size_t end) {
+      for (size_t i = begin; i < end; i++) {
+        const float *p = vertices[i].position;
+        QuantizedPosition q = quantizer.encode(QVector3D(p[0], p[1], p[2]));
+        CompactPointVertex &vertex = compact_vertices[i];
+        vertex.position[0] = q.x;
+        vertex.position[1] = q.y;
+        vertex.position[2] = q.z;
+        vertex.c = (unsigned char)(std::max(0.0f, std::min(1.0f, vertices[i].c)) * 255.0f + 0.5f);
+        vertex.padding = 0;
+      }
+    });
+    std::vector<PointVertex>().swap(vertices);
+  }
+  memory.update(pointCount() * vertexSize() + nodes.capacity() * sizeof(PointNode));
+}
+
+/**
+  * Choose the nodes of a frame
+  * Nodes in the view are taken largest on screen first, as long as the
+  * budget allows. The children of a node are only considered while its
+  * points are more than a pixel apart. Points are drawn as large as
+  * their spacing, or as large as the spacing of the children where all
+  * children of a node are drawn, so there are no holes between them
+  * Input: const QMatrix4x4 - model to clip space transform
+  *        float - size of the viewport in pixels
+  *        size_t - most points to draw
+  *        std::vector<PointDraw> - output, coarse to fine
+  * Output: void
+  */
+void PointCloud::selectNodes(const QMatrix4x4 &view_projection, float viewport_size, size_t budget,
+                             std::vector<PointDraw> &draws) const {
+  draws.clear();
+  if (nodes.empty()) {
+    return;
+  }
+  // Pixels a node covers, negative if it is outside the view
+  auto projectedSize = [&](const PointNode &node) {
+    QVector3D ndc_low, ndc_high;
+    for (int corner = 0; corner < 8; corner++) {
+      QVector4D point = view_projection * QVector4D(node.low[0] + ((corner & 1) ? node.size : 0),
+                                                    node.low[1] + ((corner & 2) ? node.size : 0),
+                                                    node.low[2] + ((corner & 4) ? node.size : 0), 1.0f);
+      if (point.w() <= 0) {
+        return viewport_size;  // crosses the eye plane
+      }
+      QVector3D ndc = point.toVector3DAffine();
+      for (int dim = 0; dim < 3; dim++) {
+        ndc_low[dim] = corner == 0 ? ndc[dim] : std::min(ndc_low[dim], ndc[dim]);
+        ndc_high[dim] = corner == 0 ? ndc[dim] : std::max(ndc_high[dim], ndc[dim]);
+      }
+    }
+    for (int dim = 0; dim < 3; dim++) {
+      if (ndc_low[dim] > 1 || ndc_high[dim] < -1) {
+        return -1.0f;
+      }
+    }
+    return std::max(ndc_high.x() - ndc_low.x(), ndc_high.y() - ndc_low.y()) * 0.5f * viewport_size;
+  };
+
+  std::priority_queue<std::pair<float, unsigned int>> queue;
+  std::vector<float> sizes(nodes.size(), 0.0f);
+  std::vector<int> drawn(nodes.size(), -1);
+  float root_size = projectedSize(nodes[0]);
+  if (root_size >= 0) {
+    queue.push(std::make_pair(root_size, 0u));
+  }
+  size_t points = 0;
+  while (!queue.empty()) {
+    float pixels = queue.top().first;
+    unsigned int index = queue.top().second;
+    queue.pop();
+    const PointNode &node = nodes[index];
+    if (points + node.count > budget) {
+      break;
+    }
+    points += node.count;
+    float spacing = node.spacing / node.size * pixels;
+    sizes[index] = std::max(1.0f, std::min(MAX_POINT_SIZE, spacing));
+    drawn[index] = draws.size();
+    PointDraw draw = {index, sizes[index]};
+    draws.push_back(draw);
+    if (spacing <= 1.0f) {
+      continue;
+    }
+    for (int octant = 0; octant < 8; octant++) {
+      if (node.children[octant] >= 0) {
+        float child_pixels = projectedSize(nodes[node.children[octant]]);
+        if (child_pixels >= 0) {
+          queue.push(std::make_pair(child_pixels, (unsigned int)node.children[octant]));
+        }
+      }
+    }
+  }
+  // Children are drawn after their parents, so sizes are final when the parent is reached
+  for (size_t i = draws.size(); i-- > 0;) {
+    const PointNode &node = nodes[draws[i].node];
+    float children_size = 0;
+    bool covered = false;
+    for (int octant = 0; octant < 8; octant++) {
+      int child = node.children[octant];
+      if (child < 0) {
+        continue;
+      }
+      covered = drawn[child] >= 0;
+      if (!covered) {
+        break;
+      }
+      children_size = std::max(children_size, sizes[child]);
+    }
+    if (covered) {
+      sizes[draws[i].node] = draws[i].point_size = children_size;
+    }
+  }
+}
+
+/**
+  * Destroy the vertex buffer
+  * The GL context of the buffer has to be current
+  * Input: void
+  * Output: void
+  */
+void PointCloud::releaseBuffers() {
+  buffer.destroy();
+  gpu_memory.release();
+}
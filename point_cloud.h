@@ -0,0 +1,82 @@
+#pragma once
+
+#include <QMatrix4x4>
+#include <QOpenGLBuffer>
+#include <QString>
+#include <QVector3D>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "memory_budget.h"
+#include "quantization.h"
+
+/**
+  * A point of a point cloud vertex buffer
+  */
+struct PointVertex {
+  float position[3];
+  float c;
+};
+
+/**
+  * A point with compact storage, the position is quantized
+  */
+struct CompactPointVertex {
+  int16_t position[3];
+  unsigned char c;
+  unsigned char padding;
+};
+
+/**
+  * A cube of the octree of a point cloud
+  * Its points are an even sample of the points inside the cube, at most
+  * one per cell of a grid, the others are passed on to its children
+  */
+struct PointNode {
+  float low[3];
+  float size;           // edge length of the cube
+  float spacing;        // typical distance between its points
+  uint32_t first;       // first point in the vertex buffer
+  uint32_t count;
+  int32_t children[8];  // -1 for empty octants
+};
+
+/**
+  * A node drawn in a frame with the size of its points in pixels
+  */
+struct PointDraw {
+  unsigned int node;
+  float point_size;
+};
+
+/**
+  * Vertices of a file without faces, drawn as points
+  * The points are sorted into an octree whose nodes are contiguous
+  * ranges of a single vertex buffer. Coarse nodes hold a sparse sample
+  * of the whole cloud and every level adds the points between those of
+  * the levels above, so a frame draws the nodes that are large enough
+  * on screen, coarse to fine, until a budget of points is reached
+  */
+class PointCloud {
+public:
+  PointCloud(std::vector<QVector3D> &points, std::vector<float> &colors, bool compact);
+
+  void selectNodes(const QMatrix4x4 &view_projection, float viewport_size, size_t budget,
+                   std::vector<PointDraw> &draws) const;
+  size_t pointCount() const { return compact_storage ? compact_vertices.size() : vertices.size(); }
+  size_t vertexSize() const { return compact_storage ? sizeof(CompactPointVertex) : sizeof(PointVertex); }
+  void releaseBuffers();
+
+  QString path;
+  QMatrix4x4 transform;  // model to world
+  QVector3D low, high;
+  std::vector<PointNode> nodes;  // the root first
+  bool compact_storage;
+  PositionQuantizer quantizer;
+  std::vector<PointVertex> vertices;  // in node order, empty with compact storage
+  std::vector<CompactPointVertex> compact_vertices;
+  QOpenGLBuffer buffer;
+  MemoryReservation memory;      // the vertices
+  MemoryReservation gpu_memory;  // the vertex buffer
+};
@@ -0,0 +1,120 @@
+#include "quantization.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+static const float QUANTIZATION_RANGE = 32767.0f;
+
+PositionQuantizer::PositionQuantizer() : centre(0, 0, 0), step(1, 1, 1) {}
+
+/**
+  * Fit the quantization grid to a bounding box
+  * Input: const QVector3D, const QVector3D - lower and upper corner of the box
+  * Output: void
+  */
+void PositionQuantizer::fit(const QVector3D &low, const QVector3D &high){
+  centre = (low + high) / 2;
+  for(int dim=0; dim<3; dim++){
+    float extent = high[dim] - low[dim];
+    step[dim] = extent > 0 ? extent / (2 * QUANTIZATION_RANGE) : 0.0f;
+  }
+}
+
+/**
+  * Quantize a position inside the fitted box
+  * Input: const QVector3D - position to encode
+  * Output: QuantizedPosition - nearest point of the grid
+  */
+QuantizedPosition PositionQuantizer::encode(const QVector3D &position) const{
+  int16_t q[3];
+  for(int dim=0; dim<3; dim++){
+    // Everything on a flat axis sits at the centre
+    float value = step[dim] > 0 ? std::round((position[dim] - centre[dim]) / step[dim]) : 0.0f;
+    q[dim] = (int16_t)std::max(-QUANTIZATION_RANGE, std::min(QUANTIZATION_RANGE, value));
+  }
+  QuantizedPosition result = {q[0], q[1], q[2]};
+  return result;
+}
+
+/**
+  * Restore a quantized position
+  * Input: const QuantizedPosition - encoded position
+  * Output: QVector3D - decoded position
+  */
+QVector3D PositionQuantizer::decode(const QuantizedPosition &position) const{
+  return QVector3D(centre.x() + position.x * step.x(),
+                   centre.y() + position.y * step.y(),
+                   centre.z() + position.z * step.z());
+}
+
+/**
+  * Matrix that decodes quantized positions on the GPU
+  * Input: void
+  * Output: QMatrix4x4 - scale by the step, then shift to the centre
+  */
+QMatrix4x4 PositionQuantizer::decodeMatrix() const{
+  QMatrix4x4 matrix;
+  matrix.translate(centre);
+  matrix.scale(step);
+  return matrix;
+}
+
+/**
+  * Largest distance between a position in the box and its decoded value
+  * Half a grid step plus the rounding of single precision decoding
+  * Input: void
+  * Output: float - error bound in model units
+  */
+float PositionQuantizer::maxError() const{
+  float magnitude = centre.length() + step.length() * QUANTIZATION_RANGE;
+  return step.length() / 2 + magnitude * std::numeric_limits<float>::epsilon();
+}
+
+static float signNotZero(float value){
+  return value < 0 ? -1.0f : 1.0f;
+}
+
+/**
+  * Encode a unit vector into 32 bits
+  * The sphere is projected onto an octahedron that is unfolded into
+  * a square, both coordinates are stored as signed 16-bit values.
+  * The angle between the vector and its decoded value is below 0.01 degrees
+  * Input: const QVector3D - vector to encode, normalized by the function
+  * Output: uint32_t - two packed 16-bit coordinates
+  */
+uint32_t encodeOctahedral(const QVector3D &normal){
+  float l1 = std::fabs(normal.x()) + std::fabs(normal.y()) + std::fabs(normal.z());
+  if(l1 == 0){
+    return 0;
+  }
+  float u = normal.x() / l1;
+  float v = normal.y() / l1;
+  if(normal.z() < 0){
+    float folded_u = (1 - std::fabs(v)) * signNotZero(u);
+    float folded_v = (1 - std::fabs(u)) * signNotZero(v);
+    u = folded_u;
+    v = folded_v;
+  }
+  int16_t qu = (int16_t)std::round(std::max(-1.0f, std::min(1.0f, u)) * QUANTIZATION_RANGE);
+  int16_t qv = (int16_t)std::round(std::max(-1.0f, std::min(1.0f, v)) * QUANTIZATION_RANGE);
+  return (uint32_t)(uint16_t)qu | ((uint32_t)(uint16_t)qv << 16);
+}
+
+/**
+  * Decode a unit vector packed by encodeOctahedral()
+  * Input: uint32_t - packed coordinates
+  * Output: QVector3D - normalized vector
+  */
+QVector3D decodeOctahedral(uint32_t packed){
+  float u = (int16_t)(packed & 0xffff) / QUANTIZATION_RANGE;
+  float v = (int16_t)(packed >> 16) / QUANTIZATION_RANGE;
+  float z = 1 - std::fabs(u) - std::fabs(v);
+  if(z < 0){
+    float unfolded_u = (1 - std::fabs(v)) * signNotZero(u);
+    float unfolded_v = (1 - std::fabs(u)) * signNotZero(v);
+    u = unfolded_u;
+    v = unfolded_v;
+  }
+  return QVector3D(u, v, z).normalized();
+}
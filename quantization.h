@@ -0,0 +1,35 @@
+#pragma once
+
+#include <QMatrix4x4>
+#include <QVector3D>
+#include <cstdint>
+
+/**
+  * A position stored as three signed 16-bit offsets
+  * from the centre of the model's bounding box
+  */
+struct QuantizedPosition {
+  int16_t x, y, z;
+};
+
+/**
+  * Maps positions inside a bounding box to 16-bit integers and back
+  * Every axis of the box is split into 65534 steps, so a decoded
+  * position differs from the original by at most half a step
+  * (extent / 131068) along each axis
+  */
+class PositionQuantizer {
+public:
+  PositionQuantizer();
+  void fit(const QVector3D &low, const QVector3D &high);
+  QuantizedPosition encode(const QVector3D &position) const;
+  QVector3D decode(const QuantizedPosition &position) const;
+  QMatrix4x4 decodeMatrix() const;
+  float maxError() const;
+
+  QVector3D centre;
+  QVector3D step;
+};
+
+uint32_t encodeOctahedral(const QVector3D &normal);
+QVector3D decodeOctahedral(uint32_t packed);
@@ -0,0 +1,1167 @@
+#include "renderer.h"
+#include "mesh_order.h"
+#include "parallel.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <stdexcept>
+
+static const float doublePi = float(M_PI);
+static const int NUM_COLOLORS = 8;
+static const size_t SORT_GRAIN = 1 << 15;
+
+#ifndef GL_PROGRAM_POINT_SIZE
+#define GL_PROGRAM_POINT_SIZE 0x8642
+#endif
+
+static_assert(sizeof(PagedVertex) == sizeof(GpuVertex), "paged model files hold GPU vertices");
+
+// Attribute locations, the instance transform takes four of them
+static const int POSITION_ATTRIBUTE = 0;
+static const int NORMAL_ATTRIBUTE = 1;
+static const int COLOR_ATTRIBUTE = 2;
+static const int LABEL_ATTRIBUTE = 3;
+static const int INSTANCE_ATTRIBUTE = 4;
+static const int DEVIATION_ATTRIBUTE = 8;
+
+static const char *VERTEX_SHADER =
+  "#version 330 core\n"
+  "layout(location = 0) in vec3 position;\n"
+  "layout(location = 1) in vec3 normal;\n"
+  "layout(location = 2) in float c;\n"
+  "layout(location = 3) in uint label;\n"
+  "layout(location = 4) in mat4 instance;\n"
+  "layout(location = 8) in float deviation;\n"
+  "uniform mat4 view;\n"
+  "uniform mat4 projection;\n"
+  "uniform mat4 decode;\n"
+  "uniform bool octahedral_normals;\n"
+  "uniform bool colorization;\n"
+  "uniform bool shading;\n"
+  "uniform bool flat_color_enabled;\n"
+  "uniform vec4 flat_color;\n"
+  "uniform float alpha;\n"
+  "uniform vec3 palette[8];\n"
+  "uniform bool deviation_map;\n"
+  "uniform float deviation_range;\n"
+  "uniform float point_size;\n"
+  "out vec4 color;\n"
+  "vec3 decodeOctahedral(vec2 e) {\n"
+  "  vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));\n"
+  "  if (n.z < 0.0)\n"
+  "    n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);\n"
+  "  return normalize(n);\n"
+  "}\n"
+  "vec3 deviationColor(float d) {\n"
+  "  float t = clamp(d / deviation_range, -1.0, 1.0);\n"
+  "  return t < 0.0 ? mix(vec3(0.0, 1.0, 0.0), vec3(0.0, 0.0, 1.0), -t)\n"
+  "                 : mix(vec3(0.0, 1.0, 0.0), vec3(1.0, 0.0, 0.0), t);\n"
+  "}\n"
+  "void main() {\n"
+  "  mat4 model_view = view * instance;\n"
+  "  gl_Position = projection * model_view * decode * vec4(position, 1.0);\n"
+  "  gl_PointSize = point_size;\n"
+  "  if (flat_color_enabled) {\n"
+  "    color = flat_color;\n"
+  "    return;\n"
+  "  }\n"
+  "  vec3 base = deviation_map ? deviationColor(deviation) : colorization ? palette[label % 8u] : vec3(c);\n"
+  "  if (shading) {\n"
+  "    vec3 n = octahedral_normals ? decodeOctahedral(normal.xy) : normal;\n"
+  "    n = normalize(mat3(model_view) * n);\n"
+  "    base *= 0.3 + 0.7 * abs(n.z);\n"
+  "  }\n"
+  "  color = vec4(base, alpha);\n"
+  "}\n";
+
+static const char *FRAGMENT_SHADER =
+  "#version 330 core\n"
+  "in vec4 color;\n"
+  "uniform bool round_points;\n"
+  "out vec4 fragment_color;\n"
+  "void main() {\n"
+  "  if (round_points && length(gl_PointCoord - vec2(0.5)) > 0.5)\n"
+  "    discard;\n"
+  "  fragment_color = color;\n"
+  "}\n";
+
+RenderSettings::RenderSettings() {
+  x_translation = 0.0;
+  y_translation = 0.0;
+  z_translation = 0.0;
+  scale = 1.0f;
+  alpha = 1.0;
+  zsorting = false;
+  draw_edges = false;
+  colorization = false;
+  show_axes = false;
+  shading = false;
+  deviation_map = false;
+  deviation_range = 1.0f;
+  point_budget = 5000000;
+  occlusion_culling = false;
+}
+
+/**
+  * The modelview matrix of the camera
+  * Input: void
+  * Output: QMatrix4x4 - translation followed by rotation
+  */
+QMatrix4x4 RenderSettings::viewMatrix() const{
+  QMatrix4x4 matrix;
+  matrix.translate(x_translation, y_translation, z_translation);
+  matrix.rotate(rotation);
+  return matrix;
+}
+
+/**
+  * The projection matrix of the camera
+  * Input: void
+  * Output: QMatrix4x4 - uniform scaling by the zoom factor
+  */
+QMatrix4x4 RenderSettings::projectionMatrix() const{
+  QMatrix4x4 matrix;
+  matrix.scale(scale, scale, scale);
+  return matrix;
+}
+
+SceneRenderer::SceneRenderer()
+  : axes_buffer(QOpenGLBuffer::VertexBuffer), sorted_buffer(QOpenGLBuffer::IndexBuffer), deviation_map(false) {}
+
+/**
+  * Compile the shaders and set up the fixed state
+  * The context of the renderer has to be current
+  * Input: void
+  * Output: void
+  */
+void SceneRenderer::initialize(){
+  initializeOpenGLFunctions();
+  if(!program.addShaderFromSourceCode(QOpenGLShader::Vertex, VERTEX_SHADER) ||
+     !program.addShaderFromSourceCode(QOpenGLShader::Fragment, FRAGMENT_SHADER) ||
+     !program.link()){
+    throw std::runtime_error("Failed to build the shader program: " + program.log().toStdString());
+  }
+  vao.create();
+
+  QVector3D palette[NUM_COLOLORS] = {
+    QVector3D(1.0, 0.0, 0.0), QVector3D(0.0, 1.0, 0.0),
+    QVector3D(0.0, 0.0, 1.0), QVector3D(1.0, 1.0, 0.0),
+    QVector3D(1.0, 0.0, 1.0), QVector3D(0.0, 1.0, 1.0),
+    QVector3D(0.3, 0.7, 0.2), QVector3D(0.5, 0.2, 0.9)
+  };
+  program.bind();
+  program.setUniformValueArray("palette", palette, NUM_COLOLORS);
+  program.release();
+
+  // x, y and z axes with arrow heads
+  const float axes[] = {
+    -10000.0f, 0.0f, 0.0f,  20.0f, 0.0f, 0.0f,
+    4.0f, 0.0f, 0.0f,  3.0f, 1.0f, 0.0f,
+    4.0f, 0.0f, 0.0f,  3.0f, -1.0f, 0.0f,
+    0.0f, -10000.0f, 0.0f,  0.0f, 20.0f, 0.0f,
+    0.0f, 4.0f, 0.0f,  1.0f, 3.0f, 0.0f,
+    0.0f, 4.0f, 0.0f,  -1.0f, 3.0f, 0.0f,
+    0.0f, 0.0f, -10000.0f,  0.0f, 0.0f, 20.0f,
+    0.0f, 0.0f, 4.0f,  0.0f, 1.0f, 3.0f,
+    0.0f, 0.0f, 4.0f,  0.0f, -1.0f, 3.0f
+  };
+  axes_buffer.create();
+  axes_buffer.bind();
+  axes_buffer.allocate(axes, sizeof(axes));
+  axes_buffer.release();
+  sorted_buffer.create();
+  sorted_buffer.setUsagePattern(QOpenGLBuffer::StreamDraw);
+
+  glClearColor(0.2f, 0.25f, 0.2f, 1.0f);
+  glEnable(GL_DEPTH_TEST);
+  glDisable(GL_CULL_FACE);
+  glEnable(GL_BLEND);
+  glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+  glBlendEquation(GL_FUNC_ADD);
+  glEnable(GL_PROGRAM_POINT_SIZE);
+}
+
+/**
+  * Draw the scene into the current framebuffer
+  * Input: Scene - models and instances, buffers are uploaded when needed
+  *        const RenderSettings - camera and display toggles
+  *        const PreparedFrame - sorted triangles for the sorting mode,
+  *        prepared here when not given
+  * Output: void
+  */
+void SceneRenderer::render(Scene &scene, const RenderSettings &settings, const PreparedFrame *frame){
+  TRACE_SCOPE("render");
+  glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+  QMatrix4x4 view = settings.viewMatrix();
+  QOpenGLVertexArrayObject::Binder vao_binder(&vao);
+  program.bind();
+  program.setUniformValue("view", view);
+  program.setUniformValue("projection", settings.projectionMatrix());
+  program.setUniformValue("decode", QMatrix4x4());
+  program.setUniformValue("alpha", (float)settings.alpha);
+  program.setUniformValue("colorization", settings.colorization);
+  program.setUniformValue("shading", settings.shading);
+  program.setUniformValue("flat_color_enabled", false);
+  program.setUniformValue("deviation_range", std::max(settings.deviation_range, 1e-30f));
+  program.setUniformValue("point_size", 1.0f);
+  program.setUniformValue("round_points", false);
+  deviation_map = settings.deviation_map;
+
+  // Draw axes
+  if(settings.show_axes){
+    drawAxes();
+  }
+
+  for(std::unique_ptr<Model> &model : scene.models){
+    // Labels and deviations decide which corners share a vertex
+    if(model->shared_vertices && (model->labels_dirty || model->deviations_dirty)){
+      model->buffer_dirty = true;
+    }
+    if(model->buffer_dirty){
+      uploadModel(*model);
+    }
+    if(model->labels_dirty){
+      uploadLabels(*model);
+    }
+    if(model->deviations_dirty){
+      uploadDeviations(*model);
+    }
+  }
+  if(scene.instances_dirty){
+    uploadInstances(scene);
+  }
+
+  if(settings.zsorting){
+    if(frame){
+      drawSortedTriangles(scene, *frame);
+    }
+    else{
+      PreparedFrame own_frame;
+      prepareFrame(scene, view, own_frame);
+      drawSortedTriangles(scene, own_frame);
+    }
+  }
+  else if(settings.occlusion_culling && settings.alpha >= 1.0){
+    // Hidden faces only stay invisible without blending
+    drawUnoccluded(scene, settings.projectionMatrix() * view);
+  }
+  else{
+    occlusion.statistics = OcclusionStatistics();
+    drawInstances(scene);
+  }
+  if(!scene.paged_models.empty()){
+    program.setUniformValue("colorization", false);
+    drawPagedModels(scene, settings.projectionMatrix() * view);
+    program.setUniformValue("colorization", settings.colorization);
+  }
+  if(!scene.point_clouds.empty()){
+    drawPointClouds(scene, settings.projectionMatrix() * view, settings.point_budget);
+    program.setUniformValue("colorization", settings.colorization);
+    program.setUniformValue("shading", settings.shading);
+    program.setUniformValue("point_size", 1.0f);
+    program.setUniformValue("round_points", false);
+  }
+
+  // Draw edges
+  if(settings.draw_edges){
+    drawEdges(scene, settings.alpha);
+  }
+  program.release();
+}
+
+/**
+  * Size of the vertex, edge and label buffers of a mesh
+  * Input: const FaceCollection - triangulated mesh
+  *        bool - include the label buffer
+  * Output: size_t - bytes uploaded for the mesh
+  */
+size_t SceneRenderer::bufferSize(const FaceCollection &mesh, bool labels){
+  size_t corners = mesh.triangles.size();
+  // Every face outline has a line for each corner except the first
+  size_t edge_corners = (mesh.face_corners.size() - std::min(mesh.face_corners.size(), mesh.faces.size())) * 2;
+  size_t bytes = mesh.compact_storage ? corners * sizeof(CompactVertex) + edge_corners * sizeof(QuantizedPosition)
+                                      : corners * sizeof(GpuVertex) + edge_corners * sizeof(QVector3D);
+  if(labels){
+    bytes += corners * sizeof(uint32_t);
+  }
+  return bytes;
+}
+
+/**
+  * Account the buffers of a model after an upload
+  * Input: Model - a model with uploaded buffers
+  * Output: void
+  */
+static void accountBuffers(Model &model){
+  size_t corners = model.faces.triangles.size();
+  size_t vertices = model.shared_vertices ? model.vertex_corners.size() : corners;
+  bool labels = model.label_buffer.isCreated();
+  // bufferSize() counts a vertex and a label per corner
+  size_t vertex_bytes = (model.faces.compact_storage ? sizeof(CompactVertex) : sizeof(GpuVertex)) +
+                        (labels ? sizeof(uint32_t) : 0);
+  size_t deviations = model.deviation_buffer.isCreated() ? vertices * sizeof(float) : 0;
+  size_t clusters = model.cluster_buffer.isCreated() ? corners * sizeof(unsigned int) : 0;
+  size_t elements = model.element_buffer.isCreated() ? corners * sizeof(unsigned int) : 0;
+  model.gpu_memory.update(SceneRenderer::bufferSize(model.faces, labels) - (corners - vertices) * vertex_bytes +
+                          deviations + clusters + elements + model.instance_count * 16 * sizeof(float));
+}
+
+/**
+  * Build the vertex buffer contents of a range of triangle corners
+  * Input: const FaceCollection - triangulated mesh
+  *        size_t, size_t - the first corner and the end of the range
+  *        GpuVertex - output, one vertex per corner
+  * Output: void
+  */
+static void fillVertices(const FaceCollection &mesh, size_t begin, size_t end, GpuVertex *data){
+  for(size_t i=begin; i<end; i++){
+    const QVector3D &p = mesh.positions[mesh.triangles[i]];
+    QVector3D n = mesh.cornerNormal(i);
+    GpuVertex &vertex = data[i - begin];
+    for(int dim=0; dim<3; dim++){
+      vertex.position[dim] = p[dim];
+      vertex.normal[dim] = n[dim];
+    }
+    vertex.c = mesh.faces[mesh.triangle_faces[i/3]].c;
+  }
+}
+
+/**
+  * Build the compact vertex buffer contents of a range of triangle corners
+  * Input: const FaceCollection - triangulated mesh with compact storage
+  *        size_t, size_t - the first corner and the end of the range
+  *        CompactVertex - output, one vertex per corner
+  * Output: void
+  */
+static void fillVertices(const FaceCollection &mesh, size_t begin, size_t end, CompactVertex *data){
+  for(size_t i=begin; i<end; i++){
+    const QuantizedPosition &p = mesh.quantized_positions[mesh.triangles[i]];
+    CompactVertex &vertex = data[i - begin];
+    vertex.position[0] = p.x;
+    vertex.position[1] = p.y;
+    vertex.position[2] = p.z;
+    vertex.position[3] = 1;
+    uint32_t normal = i < mesh.corner_normals.size() ?
+      mesh.compact_vertex_normals[mesh.corner_normals[i]] : 0;
+    vertex.normal[0] = (int16_t)(normal & 0xffff);
+    vertex.normal[1] = (int16_t)(normal >> 16);
+    vertex.c = (unsigned char)(mesh.faces[mesh.triangle_faces[i/3]].c * 255.0f + 0.5f);
+    memset(vertex.padding, 0, sizeof(vertex.padding));
+  }
+}
+
+template <typename Vertex>
+static size_t countMatchingCorners(const FaceCollection &before, const FaceCollection &after, bool from_back){
+  size_t count = std::min(before.triangles.size(), after.triangles.size());
+  size_t matching = 0;
+  for(; matching<count; matching++){
+    size_t a = from_back ? before.triangles.size() - 1 - matching : matching;
+    size_t b = from_back ? after.triangles.size() - 1 - matching : matching;
+    Vertex va, vb;
+    fillVertices(before, a, a + 1, &va);
+    fillVertices(after, b, b + 1, &vb);
+    if(memcmp(&va, &vb, sizeof(Vertex)) != 0){
+      break;
+    }
+  }
+  return matching;
+}
+
+/**
+  * Count the triangle corners whose vertices are the same in two
+  * versions of a mesh, at the start or at the end of the vertex buffer
+  * Input: const FaceCollection - the uploaded mesh
+  *        const FaceCollection - its new version
+  *        bool - count from the end instead of the start
+  * Output: size_t - number of identical corners
+  */
+size_t SceneRenderer::matchingCorners(const FaceCollection &before, const FaceCollection &after, bool from_back){
+  if(before.compact_storage != after.compact_storage){
+    return 0;
+  }
+  return before.compact_storage ? countMatchingCorners<CompactVertex>(before, after, from_back)
+                                : countMatchingCorners<GpuVertex>(before, after, from_back);
+}
+
+/**
+  * Upload the vertices of a model
+  * After a reload the unchanged corners at the start and the end are
+  * kept: the buffer is written in place if the size didn't change,
+  * otherwise they are copied into the new buffer on the GPU
+  * Input: Model - a model whose buffers are rebuilt
+  * Output: void
+  */
+template <typename Vertex>
+void SceneRenderer::uploadVertices(Model &model){
+  const FaceCollection &mesh = model.faces;
+  if(model.shared_vertices){
+    // A vertex is filled from its first corner
+    std::vector<Vertex> data(model.vertex_corners.size());
+    for(size_t v=0; v<data.size(); v++){
+      fillVertices(mesh, model.vertex_corners[v], model.vertex_corners[v] + 1, &data[v]);
+    }
+    if(!model.vertex_buffer.isCreated()){
+      model.vertex_buffer.create();
+    }
+    model.vertex_buffer.bind();
+    model.vertex_buffer.allocate(data.data(), data.size() * sizeof(Vertex));
+    model.vertex_buffer.release();
+    model.vertex_count = data.size();
+    model.buffer_patch = false;
+    return;
+  }
+  size_t n_corners = mesh.triangles.size();
+  size_t front = 0, back = 0;
+  bool patch = model.buffer_patch && model.vertex_buffer.isCreated() &&
+               model.patch_front + model.patch_back <= std::min(n_corners, (size_t)model.vertex_count);
+  if(patch){
+    front = model.patch_front;
+    back = model.patch_back;
+  }
+  std::vector<Vertex> data(n_corners - front - back);
+  fillVertices(mesh, front, n_corners - back, data.data());
+  if(!patch){
+    if(!model.vertex_buffer.isCreated()){
+      model.vertex_buffer.create();
+    }
+    model.vertex_buffer.bind();
+    model.vertex_buffer.allocate(data.data(), data.size() * sizeof(Vertex));
+  }
+  else if(n_corners == (size_t)model.vertex_count){
+    model.vertex_buffer.bind();
+    model.vertex_buffer.write(front * sizeof(Vertex), data.data(), data.size() * sizeof(Vertex));
+  }
+  else{
+    QOpenGLBuffer buffer(QOpenGLBuffer::VertexBuffer);
+    buffer.create();
+    buffer.bind();
+    buffer.allocate(n_corners * sizeof(Vertex));
+    glBindBuffer(GL_COPY_READ_BUFFER, model.vertex_buffer.bufferId());
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_ARRAY_BUFFER, 0, 0, front * sizeof(Vertex));
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_ARRAY_BUFFER, (model.vertex_count - back) * sizeof(Vertex),
+                        (n_corners - back) * sizeof(Vertex), back * sizeof(Vertex));
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    buffer.write(front * sizeof(Vertex), data.data(), data.size() * sizeof(Vertex));
+    model.vertex_buffer.destroy();
+    model.vertex_buffer = buffer;
+  }
+  model.vertex_buffer.release();
+  model.vertex_count = n_corners;
+  model.buffer_patch = false;
+}
+
+/**
+  * Upload the triangle corners and the face outlines of a model
+  * Compact models keep their quantized positions and encoded normals.
+  * Models with shared vertices get the vertices of shareVertices() and
+  * an element buffer, so the post-transform cache of the GPU reuses the
+  * vertices of neighbouring triangles. Corners of faces with different
+  * labels or, when measured per face, deviations can't share, so the
+  * labels and deviations are uploaded again with them
+  * Input: Model - a model whose buffers are rebuilt
+  * Output: void
+  */
+void SceneRenderer::uploadModel(Model &model){
+  TRACE_SCOPE("upload model");
+  const FaceCollection &mesh = model.faces;
+  if(model.shared_vertices){
+    shareVertices(mesh, model.labelled, model.deviations_per_face && !model.deviations.empty(),
+                  model.corner_vertices, model.vertex_corners);
+    model.sharing_memory.update((model.corner_vertices.capacity() + model.vertex_corners.capacity()) *
+                                sizeof(unsigned int));
+    if(!model.element_buffer.isCreated()){
+      model.element_buffer.create();
+    }
+    model.element_buffer.bind();
+    model.element_buffer.allocate(model.corner_vertices.data(), model.corner_vertices.size() * sizeof(unsigned int));
+    model.element_buffer.release();
+    model.labels_dirty = model.labelled;
+    model.deviations_dirty = true;
+  }
+  else{
+    model.element_buffer.destroy();
+    std::vector<unsigned int>().swap(model.corner_vertices);
+    std::vector<unsigned int>().swap(model.vertex_corners);
+    model.sharing_memory.release();
+  }
+  if(mesh.compact_storage){
+    uploadVertices<CompactVertex>(model);
+  }
+  else{
+    uploadVertices<GpuVertex>(model);
+  }
+
+  // Outlines connect consecutive corners of every face
+  std::vector<unsigned int> edge_corners;
+  for(int f=0; f<(int)mesh.faces.size(); f++){
+    for(unsigned int i=mesh.face_offsets[f]+1; i<mesh.face_offsets[f+1]; i++){
+      edge_corners.push_back(mesh.face_corners[i-1]);
+      edge_corners.push_back(mesh.face_corners[i]);
+    }
+  }
+  if(!model.edge_buffer.isCreated()){
+    model.edge_buffer.create();
+  }
+  model.edge_buffer.bind();
+  if(mesh.compact_storage){
+    std::vector<QuantizedPosition> data(edge_corners.size());
+    for(int i=0; i<(int)edge_corners.size(); i++){
+      data[i] = mesh.quantized_positions[edge_corners[i]];
+    }
+    model.edge_buffer.allocate(data.data(), data.size() * sizeof(QuantizedPosition));
+  }
+  else{
+    std::vector<QVector3D> data(edge_corners.size());
+    for(int i=0; i<(int)edge_corners.size(); i++){
+      data[i] = mesh.positions[edge_corners[i]];
+    }
+    model.edge_buffer.allocate(data.data(), data.size() * sizeof(QVector3D));
+  }
+  model.edge_buffer.release();
+  model.edge_count = edge_corners.size();
+  model.buffer_dirty = false;
+  model.clusters_dirty = true;
+  accountBuffers(model);
+}
+
+/**
+  * Upload the component label of every triangle corner, or of every
+  * vertex with shared vertices
+  * Input: Model - a model whose labels changed
+  * Output: void
+  */
+void SceneRenderer::uploadLabels(Model &model){
+  const FaceCollection &mesh = model.faces;
+  std::vector<uint32_t> labels(model.shared_vertices ? model.vertex_corners.size() : mesh.triangles.size());
+  for(int i=0; i<(int)labels.size(); i++){
+    unsigned int corner = model.shared_vertices ? model.vertex_corners[i] : i;
+    labels[i] = mesh.faces[mesh.triangle_faces[corner/3]].label;
+  }
+  if(!model.label_buffer.isCreated()){
+    model.label_buffer.create();
+  }
+  model.label_buffer.bind();
+  model.label_buffer.allocate(labels.data(), labels.size() * sizeof(uint32_t));
+  model.label_buffer.release();
+  model.labels_dirty = false;
+  accountBuffers(model);
+}
+
+/**
+  * Upload the distance of every triangle corner, or of every vertex with
+  * shared vertices, to the reference, or drop the buffer of a model that
+  * isn't compared anymore
+  * Input: Model - a model whose deviations changed
+  * Output: void
+  */
+void SceneRenderer::uploadDeviations(Model &model){
+  if(model.deviations.empty()){
+    model.deviation_buffer.destroy();
+  }
+  else{
+    std::vector<float> deviations(model.shared_vertices ? model.vertex_corners.size() : model.faces.triangles.size());
+    for(int i=0; i<(int)deviations.size(); i++){
+      deviations[i] = model.cornerDeviation(model.shared_vertices ? model.vertex_corners[i] : i);
+    }
+    if(!model.deviation_buffer.isCreated()){
+      model.deviation_buffer.create();
+    }
+    model.deviation_buffer.bind();
+    model.deviation_buffer.allocate(deviations.data(), deviations.size() * sizeof(float));
+    model.deviation_buffer.release();
+  }
+  model.deviations_dirty = false;
+  accountBuffers(model);
+}
+
+/**
+  * Split a model into clusters for occlusion culling and upload
+  * the corners, or shared vertices, of its triangles in cluster order
+  * Input: Model - a model whose faces changed
+  * Output: void
+  */
+void SceneRenderer::uploadClusters(Model &model){
+  buildClusters(model.faces, model.cluster_triangles, model.clusters);
+  model.cluster_memory.update(model.clusters.capacity() * sizeof(TriangleCluster) +
+                              model.cluster_triangles.capacity() * sizeof(unsigned int));
+  std::vector<unsigned int> indices(model.cluster_triangles.size() * 3);
+  for(int i=0; i<(int)model.cluster_triangles.size(); i++){
+    for(int k=0; k<3; k++){
+      unsigned int corner = model.cluster_triangles[i] * 3 + k;
+      indices[i * 3 + k] = model.shared_vertices ? model.corner_vertices[corner] : corner;
+    }
+  }
+  if(!model.cluster_buffer.isCreated()){
+    model.cluster_buffer.create();
+  }
+  model.cluster_buffer.bind();
+  model.cluster_buffer.allocate(indices.data(), indices.size() * sizeof(unsigned int));
+  model.cluster_buffer.release();
+  model.clusters_dirty = false;
+  accountBuffers(model);
+}
+
+/**
+  * Upload the transforms of the instances of every model
+  * Input: Scene - a scene whose instances changed
+  * Output: void
+  */
+void SceneRenderer::uploadInstances(Scene &scene){
+  for(int m=0; m<(int)scene.models.size(); m++){
+    Model &model = *scene.models[m];
+    std::vector<float> transforms;
+    for(const Instance &instance : scene.instances){
+      if(instance.model == m){
+        transforms.insert(transforms.end(), instance.transform.constData(), instance.transform.constData() + 16);
+      }
+    }
+    if(!model.instance_buffer.isCreated()){
+      model.instance_buffer.create();
+    }
+    model.instance_buffer.bind();
+    model.instance_buffer.allocate(transforms.data(), transforms.size() * sizeof(float));
+    model.instance_buffer.release();
+    model.instance_count = transforms.size() / 16;
+    accountBuffers(model);
+  }
+  scene.instances_dirty = false;
+}
+
+/**
+  * Point the per-vertex attributes at the buffers of a model
+  * Input: Model - a model with uploaded buffers
+  * Output: void
+  */
+void SceneRenderer::bindModel(Model &model){
+  const FaceCollection &mesh = model.faces;
+  program.setUniformValue("octahedral_normals", mesh.compact_storage);
+  program.setUniformValue("decode", mesh.compact_storage ? mesh.quantizer.decodeMatrix() : QMatrix4x4());
+  model.vertex_buffer.bind();
+  glEnableVertexAttribArray(POSITION_ATTRIBUTE);
+  glEnableVertexAttribArray(NORMAL_ATTRIBUTE);
+  glEnableVertexAttribArray(COLOR_ATTRIBUTE);
+  if(mesh.compact_storage){
+    glVertexAttribPointer(POSITION_ATTRIBUTE, 3, GL_SHORT, GL_FALSE, sizeof(CompactVertex),
+                          (const void *)offsetof(CompactVertex, position));
+    glVertexAttribPointer(NORMAL_ATTRIBUTE, 2, GL_SHORT, GL_TRUE, sizeof(CompactVertex),
+                          (const void *)offsetof(CompactVertex, normal));
+    glVertexAttribPointer(COLOR_ATTRIBUTE, 1, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(CompactVertex),
+                          (const void *)offsetof(CompactVertex, c));
+  }
+  else{
+    glVertexAttribPointer(POSITION_ATTRIBUTE, 3, GL_FLOAT, GL_FALSE, sizeof(GpuVertex),
+                          (const void *)offsetof(GpuVertex, position));
+    glVertexAttribPointer(NORMAL_ATTRIBUTE, 3, GL_FLOAT, GL_FALSE, sizeof(GpuVertex),
+                          (const void *)offsetof(GpuVertex, normal));
+    glVertexAttribPointer(COLOR_ATTRIBUTE, 1, GL_FLOAT, GL_FALSE, sizeof(GpuVertex),
+                          (const void *)offsetof(GpuVertex, c));
+  }
+  model.vertex_buffer.release();
+  if(model.label_buffer.isCreated()){
+    model.label_buffer.bind();
+    glEnableVertexAttribArray(LABEL_ATTRIBUTE);
+    glVertexAttribIPointer(LABEL_ATTRIBUTE, 1, GL_UNSIGNED_INT, 0, 0);
+    model.label_buffer.release();
+  }
+  else{
+    glDisableVertexAttribArray(LABEL_ATTRIBUTE);
+    glVertexAttribI4ui(LABEL_ATTRIBUTE, 0, 0, 0, 0);
+  }
+  // Models without a comparison keep their usual colors
+  bool deviations = deviation_map && model.deviation_buffer.isCreated();
+  program.setUniformValue("deviation_map", deviations);
+  if(deviations){
+    model.deviation_buffer.bind();
+    glEnableVertexAttribArray(DEVIATION_ATTRIBUTE);
+    glVertexAttribPointer(DEVIATION_ATTRIBUTE, 1, GL_FLOAT, GL_FALSE, 0, 0);
+    model.deviation_buffer.release();
+  }
+  else{
+    glDisableVertexAttribArray(DEVIATION_ATTRIBUTE);
+  }
+}
+
+/**
+  * Read the instance transform from the instance buffer of a model,
+  * advancing once per instance
+  * Input: Model - a model with uploaded instances
+  * Output: void
+  */
+void SceneRenderer::bindInstances(Model &model){
+  model.instance_buffer.bind();
+  for(int column=0; column<4; column++){
+    glEnableVertexAttribArray(INSTANCE_ATTRIBUTE + column);
+    glVertexAttribPointer(INSTANCE_ATTRIBUTE + column, 4, GL_FLOAT, GL_FALSE, 16 * sizeof(float),
+                          (const void *)(column * 4 * sizeof(float)));
+    glVertexAttribDivisor(INSTANCE_ATTRIBUTE + column, 1);
+  }
+  model.instance_buffer.release();
+}
+
+/**
+  * Use the same instance transform for all following vertices
+  * Input: const QMatrix4x4 - model to world transform
+  * Output: void
+  */
+void SceneRenderer::setInstanceTransform(const QMatrix4x4 &transform){
+  for(int column=0; column<4; column++){
+    glDisableVertexAttribArray(INSTANCE_ATTRIBUTE + column);
+    glVertexAttrib4fv(INSTANCE_ATTRIBUTE + column, transform.constData() + column * 4);
+  }
+}
+
+/**
+  * Draw all instances in file order
+  * Each unique model is drawn with a single instanced draw call
+  * Input: Scene - a scene with uploaded buffers
+  * Output: void
+  */
+void SceneRenderer::drawInstances(Scene &scene){
+  TRACE_SCOPE("draw instances");
+  for(std::unique_ptr<Model> &model : scene.models){
+    if(model->instance_count == 0){
+      continue;
+    }
+    bindModel(*model);
+    bindInstances(*model);
+    if(model->shared_vertices){
+      model->element_buffer.bind();
+      glDrawElementsInstanced(GL_TRIANGLES, model->faces.triangles.size(), GL_UNSIGNED_INT, 0, model->instance_count);
+      model->element_buffer.release();
+    }
+    else{
+      glDrawArraysInstanced(GL_TRIANGLES, 0, model->faces.triangles.size(), model->instance_count);
+    }
+  }
+}
+
+/**
+  * Draw clusters of instances, consecutive clusters of an instance
+  * with a single draw call
+  * Input: Scene - a scene with uploaded clusters
+  *        const std::vector<ClusterDraw> - clusters in instance and cluster order
+  * Output: void
+  */
+void SceneRenderer::drawClusters(Scene &scene, const std::vector<ClusterDraw> &draws){
+  int current_model = -1;
+  size_t run_start = 0;
+  for(size_t i=1; i<=draws.size(); i++){
+    if(i < draws.size() && draws[i].instance == draws[i - 1].instance && draws[i].cluster == draws[i - 1].cluster + 1){
+      continue;
+    }
+    const Instance &instance = scene.instances[draws[run_start].instance];
+    Model &model = *scene.models[instance.model];
+    if(instance.model != current_model){
+      if(current_model >= 0){
+        scene.models[current_model]->cluster_buffer.release();
+      }
+      current_model = instance.model;
+      bindModel(model);
+      model.cluster_buffer.bind();
+    }
+    setInstanceTransform(instance.transform);
+    const TriangleCluster &first = model.clusters[draws[run_start].cluster];
+    const TriangleCluster &last = model.clusters[draws[i - 1].cluster];
+    glDrawElements(GL_TRIANGLES, (last.first + last.count - first.first) * 3, GL_UNSIGNED_INT,
+                   (const void *)(first.first * 3 * sizeof(unsigned int)));
+    run_start = i;
+  }
+  if(current_model >= 0){
+    scene.models[current_model]->cluster_buffer.release();
+  }
+}
+
+/**
+  * Draw the instances without the clusters hidden behind others
+  * The occluders are drawn first, so the depth test rejects
+  * the fragments of the other clusters behind them as well
+  * Input: Scene - a scene with uploaded buffers
+  *        const QMatrix4x4 - world to clip space transform
+  * Output: void
+  */
+void SceneRenderer::drawUnoccluded(Scene &scene, const QMatrix4x4 &view_projection){
+  TRACE_SCOPE("draw unoccluded");
+  for(std::unique_ptr<Model> &model : scene.models){
+    if(model->clusters_dirty){
+      uploadClusters(*model);
+    }
+  }
+  GLint viewport[4];
+  glGetIntegerv(GL_VIEWPORT, viewport);
+  occlusion.cull(scene, view_projection, viewport[2], viewport[3], occluders, unoccluded);
+  drawClusters(scene, occluders);
+  drawClusters(scene, unoccluded);
+}
+
+/**
+  * Point the per-vertex attributes at a buffer of paged model corners
+  * Input: QOpenGLBuffer - corners of a chunk or the proxies
+  * Output: void
+  */
+void SceneRenderer::bindPagedVertices(QOpenGLBuffer &buffer){
+  buffer.bind();
+  glEnableVertexAttribArray(POSITION_ATTRIBUTE);
+  glEnableVertexAttribArray(NORMAL_ATTRIBUTE);
+  glEnableVertexAttribArray(COLOR_ATTRIBUTE);
+  glVertexAttribPointer(POSITION_ATTRIBUTE, 3, GL_FLOAT, GL_FALSE, sizeof(PagedVertex),
+                        (const void *)offsetof(PagedVertex, position));
+  glVertexAttribPointer(NORMAL_ATTRIBUTE, 3, GL_FLOAT, GL_FALSE, sizeof(PagedVertex),
+                        (const void *)offsetof(PagedVertex, normal));
+  glVertexAttribPointer(COLOR_ATTRIBUTE, 1, GL_FLOAT, GL_FALSE, sizeof(PagedVertex),
+                        (const void *)offsetof(PagedVertex, c));
+  buffer.release();
+}
+
+/**
+  * Draw the paged models, streaming in the chunks the view needs
+  * Resident chunks are drawn in full detail, the other chunks in the
+  * view as their proxies until the worker has read them in
+  * Input: Scene - a scene with paged models
+  *        const QMatrix4x4 - world to clip space transform
+  * Output: void
+  */
+void SceneRenderer::drawPagedModels(Scene &scene, const QMatrix4x4 &view_projection){
+  TRACE_SCOPE("draw paged");
+  GLint viewport[4];
+  glGetIntegerv(GL_VIEWPORT, viewport);
+  float viewport_size = std::max(viewport[2], viewport[3]);
+  program.setUniformValue("octahedral_normals", false);
+  program.setUniformValue("decode", QMatrix4x4());
+  program.setUniformValue("deviation_map", false);
+  glDisableVertexAttribArray(LABEL_ATTRIBUTE);
+  glDisableVertexAttribArray(DEVIATION_ATTRIBUTE);
+  glVertexAttribI4ui(LABEL_ATTRIBUTE, 0, 0, 0, 0);
+  std::vector<unsigned int> visible, detailed, loaded;
+  for(std::unique_ptr<PagedModel> &paged : scene.paged_models){
+    PagedModel &model = *paged;
+    if(!model.proxy_buffer.isCreated()){
+      model.proxy_buffer.create();
+      model.proxy_buffer.bind();
+      model.proxy_buffer.allocate(model.proxies.data(), model.proxies.size() * sizeof(PagedVertex));
+      model.proxy_buffer.release();
+      model.proxy_gpu_memory.update(model.proxies.size() * sizeof(PagedVertex));
+    }
+    model.selectChunks(view_projection * model.transform, viewport_size, visible, detailed);
+    model.request(detailed);
+    if(model.takeLoaded(loaded)){
+      for(unsigned int chunk : loaded){
+        PagedModel::Page &page = model.pages[chunk];
+        size_t bytes = model.chunks[chunk].corners * sizeof(PagedVertex);
+        page.buffer.create();
+        page.buffer.bind();
+        page.buffer.allocate(page.data, bytes);
+        page.buffer.release();
+        page.gpu_memory.update(bytes);
+      }
+    }
+    model.evict();
+    setInstanceTransform(model.transform);
+    bindPagedVertices(model.proxy_buffer);
+    for(unsigned int chunk : visible){
+      if(!model.pages[chunk].buffer.isCreated()){
+        glDrawArrays(GL_TRIANGLES, model.chunks[chunk].proxy_first, model.chunks[chunk].proxy_corners);
+      }
+    }
+    for(unsigned int chunk : visible){
+      PagedModel::Page &page = model.pages[chunk];
+      if(page.buffer.isCreated()){
+        bindPagedVertices(page.buffer);
+        glDrawArrays(GL_TRIANGLES, 0, model.chunks[chunk].corners);
+      }
+    }
+  }
+}
+
+/**
+  * Draw the point clouds as point sprites from their octrees
+  * Every node is a range of the vertex buffer of its cloud, drawn with
+  * the point size chosen for it. The budget is shared by the clouds in
+  * scene order
+  * Input: Scene - a scene with point clouds
+  *        const QMatrix4x4 - world to clip space transform
+  *        size_t - most points to draw in the frame
+  * Output: void
+  */
+void SceneRenderer::drawPointClouds(Scene &scene, const QMatrix4x4 &view_projection, size_t budget){
+  TRACE_SCOPE("draw points");
+  GLint viewport[4];
+  glGetIntegerv(GL_VIEWPORT, viewport);
+  float viewport_size = std::max(viewport[2], viewport[3]);
+  program.setUniformValue("octahedral_normals", false);
+  program.setUniformValue("colorization", false);
+  program.setUniformValue("shading", false);
+  program.setUniformValue("deviation_map", false);
+  program.setUniformValue("round_points", true);
+  glDisableVertexAttribArray(NORMAL_ATTRIBUTE);
+  glDisableVertexAttribArray(LABEL_ATTRIBUTE);
+  glDisableVertexAttribArray(DEVIATION_ATTRIBUTE);
+  glVertexAttribI4ui(LABEL_ATTRIBUTE, 0, 0, 0, 0);
+  std::vector<PointDraw> draws;
+  for(std::unique_ptr<PointCloud> &pointer : scene.point_clouds){
+    PointCloud &cloud = *pointer;
+    if(cloud.pointCount() == 0){
+      continue;
+    }
+    if(!cloud.buffer.isCreated()){
+      size_t bytes = cloud.pointCount() * cloud.vertexSize();
+      cloud.buffer.create();
+      cloud.buffer.bind();
+      cloud.buffer.allocate(cloud.compact_storage ? (const void *)cloud.compact_vertices.data()
+                                                  : (const void *)cloud.vertices.data(), bytes);
+      cloud.buffer.release();
+      cloud.gpu_memory.update(bytes);
+    }
+    cloud.selectNodes(view_projection * cloud.transform, viewport_size, budget, draws);
+    program.setUniformValue("decode", cloud.compact_storage ? cloud.quantizer.decodeMatrix() : QMatrix4x4());
+    cloud.buffer.bind();
+    glEnableVertexAttribArray(POSITION_ATTRIBUTE);
+    glEnableVertexAttribArray(COLOR_ATTRIBUTE);
+    if(cloud.compact_storage){
+      glVertexAttribPointer(POSITION_ATTRIBUTE, 3, GL_SHORT, GL_FALSE, sizeof(CompactPointVertex),
+                            (const void *)offsetof(CompactPointVertex, position));
+      glVertexAttribPointer(COLOR_ATTRIBUTE, 1, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(CompactPointVertex),
+                            (const void *)offsetof(CompactPointVertex, c));
+    }
+    else{
+      glVertexAttribPointer(POSITION_ATTRIBUTE, 3, GL_FLOAT, GL_FALSE, sizeof(PointVertex),
+                            (const void *)offsetof(PointVertex, position));
+      glVertexAttribPointer(COLOR_ATTRIBUTE, 1, GL_FLOAT, GL_FALSE, sizeof(PointVertex),
+                            (const void *)offsetof(PointVertex, c));
+    }
+    cloud.buffer.release();
+    setInstanceTransform(cloud.transform);
+    for(const PointDraw &draw : draws){
+      const PointNode &node = cloud.nodes[draw.node];
+      program.setUniformValue("point_size", draw.point_size);
+      glDrawArrays(GL_POINTS, node.first, node.count);
+      budget -= node.count;
+    }
+  }
+  program.setUniformValue("decode", QMatrix4x4());
+}
+
+/**
+  * Check if the normal vector of a face is in a direction
+  * of the camera
+  * Input: QVector3D - normal of the face in view space, null if the face has none
+  * Output: bool - true if the normal is facing the camera
+  */
+bool SceneRenderer::isFacingCamera(const QVector3D &normal){
+  if (normal.isNull()){
+    return true;
+  }
+  else{
+    QVector3D camera = QVector3D(0,0,-1);
+    double dot = QVector3D::dotProduct(camera, normal);
+    double angle = acos(dot) * 180 / doublePi;
+    if (angle <= 90)
+      return true;
+    else
+      return false;
+  }
+}
+
+/**
+  * Color of a distance to the reference, the ramp of the vertex shader
+  * Input: float - signed distance
+  *        float - distance drawn in full color
+  * Output: QVector3D - blue behind the reference, green on it, red in front
+  */
+QVector3D SceneRenderer::deviationColor(float deviation, float range){
+  float t = std::max(-1.0f, std::min(1.0f, deviation / std::max(range, 1e-30f)));
+  QVector3D green(0.0f, 1.0f, 0.0f);
+  return t < 0 ? green + (QVector3D(0.0f, 0.0f, 1.0f) - green) * -t : green + (QVector3D(1.0f, 0.0f, 0.0f) - green) * t;
+}
+
+/**
+  * Sort the triangles of all instances by depth, leaving out
+  * faces turned away from the camera
+  * Depth keys are computed on all cores
+  * Input: const Scene - models and instances
+  *        const QMatrix4x4 - the view matrix
+  *        std::vector<SortedTriangle> - output, triangles in drawing order
+  * Output: void
+  */
+void SceneRenderer::sortTriangles(const Scene &scene, const QMatrix4x4 &view, std::vector<SortedTriangle> &order){
+  TRACE_SCOPE("sortTriangles");
+  order.clear();
+  std::vector<char> facing;
+  std::vector<SortedTriangle> keys;
+  for (int i=0;i<(int)scene.instances.size();i++)
+  {
+    const FaceCollection &mesh = scene.models[scene.instances[i].model]->faces;
+    QMatrix4x4 model_view = view * scene.instances[i].transform;
+    // Cull faces turned away from the camera once per face
+    facing.resize(mesh.faces.size());
+    {
+      TRACE_SCOPE("cull");
+      parallelChunks(mesh.faces.size(), SORT_GRAIN, [&](size_t, size_t begin, size_t end){
+        for (size_t f=begin;f<end;f++)
+        {
+          facing[f] = isFacingCamera(mesh.faceNormal(f) * model_view);
+        }
+      });
+    }
+    keys.resize(mesh.triangleCount());
+    {
+      TRACE_SCOPE("depth keys");
+      parallelChunks(keys.size(), SORT_GRAIN, [&](size_t, size_t begin, size_t end){
+        for (size_t t=begin;t<end;t++)
+        {
+          QVector3D centre = (mesh.position(mesh.triangles[t*3]) +
+                              mesh.position(mesh.triangles[t*3+1]) +
+                              mesh.position(mesh.triangles[t*3+2]))/3;
+          double z = centre.x()*model_view(2,0) + centre.y()*model_view(2,1) + centre.z()*model_view(2,2) + model_view(2,3);
+          double h = centre.x()*model_view(3,0) + centre.y()*model_view(3,1) + centre.z()*model_view(3,2) + model_view(3,3);
+          SortedTriangle triangle = {(float)std::fabs(z/h), (unsigned int)i, (unsigned int)t};
+          keys[t] = triangle;
+        }
+      });
+    }
+    for (int t=0;t<(int)keys.size();t++)
+    {
+      if(facing[mesh.triangle_faces[t]]){
+        order.push_back(keys[t]);
+      }
+    }
+  }
+  TRACE_SCOPE("sort");
+  std::sort(order.begin(), order.end());
+}
+
+/**
+  * Sort the triangles of a frame and build its index buffer contents
+  * Only reads the scene, so it can run on a worker thread
+  * Input: const Scene - models and instances
+  *        const QMatrix4x4 - the view matrix
+  *        PreparedFrame - output, reuses its memory
+  * Output: void
+  */
+void SceneRenderer::prepareFrame(const Scene &scene, const QMatrix4x4 &view, PreparedFrame &frame){
+  TRACE_SCOPE("prepareFrame");
+  frame.view = view;
+  sortTriangles(scene, view, frame.order);
+  frame.indices.resize(frame.order.size() * 3);
+  for(int i=0; i<(int)frame.order.size(); i++){
+    for(int k=0; k<3; k++){
+      frame.indices[i*3+k] = frame.order[i].triangle * 3 + k;
+    }
+  }
+  frame.memory.update(frame.order.capacity() * sizeof(SortedTriangle) + frame.indices.capacity() * sizeof(unsigned int));
+}
+
+/**
+  * Draw depth-sorted triangles of all instances
+  * The order is uploaded as one index buffer, consecutive triangles
+  * of the same instance are drawn with a single call
+  * Input: Scene - a scene with uploaded buffers
+  *        const PreparedFrame - triangles in drawing order
+  * Output: void
+  */
+void SceneRenderer::drawSortedTriangles(Scene &scene, const PreparedFrame &frame){
+  TRACE_SCOPE("draw sorted");
+  const std::vector<SortedTriangle> &order = frame.order;
+  const std::vector<unsigned int> *indices = &frame.indices;
+  // The frame indexes corners, models with shared vertices need their vertices
+  bool shared = false;
+  for(const std::unique_ptr<Model> &model : scene.models){
+    shared = shared || model->shared_vertices;
+  }
+  if(shared){
+    sorted_indices.resize(frame.indices.size());
+    for(size_t i=0; i<order.size(); i++){
+      const Model &model = *scene.models[scene.instances[order[i].instance].model];
+      for(int k=0; k<3; k++){
+        sorted_indices[i*3+k] = model.shared_vertices ? model.corner_vertices[order[i].triangle*3+k] : frame.indices[i*3+k];
+      }
+    }
+    indices = &sorted_indices;
+  }
+  sorted_buffer.bind();
+  sorted_buffer.allocate(indices->data(), indices->size() * sizeof(unsigned int));
+  int current_model = -1;
+  size_t run_start = 0;
+  for(size_t i=0; i<=order.size(); i++){
+    if(i < order.size() && i > run_start && order[i].instance == order[run_start].instance){
+      continue;
+    }
+    if(i > run_start){
+      const Instance &instance = scene.instances[order[run_start].instance];
+      if(instance.model != current_model){
+        current_model = instance.model;
+        bindModel(*scene.models[current_model]);
+      }
+      setInstanceTransform(instance.transform);
+      glDrawElements(GL_TRIANGLES, (i - run_start) * 3, GL_UNSIGNED_INT,
+                     (const void *)(run_start * 3 * sizeof(unsigned int)));
+    }
+    run_start = i;
+  }
+  sorted_buffer.release();
+}
+
+/**
+  * Draw the outlines of all faces of all instances
+  * Input: Scene - a scene with uploaded buffers
+  *        double - alpha of the lines
+  * Output: void
+  */
+void SceneRenderer::drawEdges(Scene &scene, double alpha){
+  TRACE_SCOPE("draw edges");
+  program.setUniformValue("flat_color_enabled", true);
+  program.setUniformValue("flat_color", QVector4D(0.0f, 0.0f, 0.0f, alpha));
+  glDisableVertexAttribArray(NORMAL_ATTRIBUTE);
+  glDisableVertexAttribArray(COLOR_ATTRIBUTE);
+  glDisableVertexAttribArray(LABEL_ATTRIBUTE);
+  glDisableVertexAttribArray(DEVIATION_ATTRIBUTE);
+  glLineWidth(10.0f);
+  for(std::unique_ptr<Model> &model : scene.models){
+    if(model->instance_count == 0){
+      continue;
+    }
+    const FaceCollection &mesh = model->faces;
+    program.setUniformValue("decode", mesh.compact_storage ? mesh.quantizer.decodeMatrix() : QMatrix4x4());
+    model->edge_buffer.bind();
+    glEnableVertexAttribArray(POSITION_ATTRIBUTE);
+    if(mesh.compact_storage){
+      glVertexAttribPointer(POSITION_ATTRIBUTE, 3, GL_SHORT, GL_FALSE, sizeof(QuantizedPosition), 0);
+    }
+    else{
+      glVertexAttribPointer(POSITION_ATTRIBUTE, 3, GL_FLOAT, GL_FALSE, sizeof(QVector3D), 0);
+    }
+    model->edge_buffer.release();
+    bindInstances(*model);
+    glDrawArraysInstanced(GL_LINES, 0, model->edge_count, model->instance_count);
+  }
+  program.setUniformValue("flat_color_enabled", false);
+}
+
+/**
+  * Draw x, y and z axes
+  * Input: void
+  * Output: void
+  */
+void SceneRenderer::drawAxes(){
+  const QVector4D colors[3] = {
+    QVector4D(1.0, 0.0, 0.0, 1.0), // red x
+    QVector4D(0.0, 1.0, 0.0, 1.0), // green y
+    QVector4D(0.0, 0.0, 1.0, 1.0)  // blue z
+  };
+  program.setUniformValue("flat_color_enabled", true);
+  axes_buffer.bind();
+  glEnableVertexAttribArray(POSITION_ATTRIBUTE);
+  glVertexAttribPointer(POSITION_ATTRIBUTE, 3, GL_FLOAT, GL_FALSE, 0, 0);
+  axes_buffer.release();
+  glDisableVertexAttribArray(NORMAL_ATTRIBUTE);
+  glDisableVertexAttribArray(COLOR_ATTRIBUTE);
+  glDisableVertexAttribArray(LABEL_ATTRIBUTE);
+  glDisableVertexAttribArray(DEVIATION_ATTRIBUTE);
+  setInstanceTransform(QMatrix4x4());
+  for(int axis=0; axis<3; axis++){
+    program.setUniformValue("flat_color", colors[axis]);
+    glDrawArrays(GL_LINES, axis * 6, 6);
+  }
+  program.setUniformValue("flat_color_enabled", false);
+}
@@ -0,0 +1,134 @@
+#pragma once
+
+#include <QMatrix4x4>
+#include <QOpenGLBuffer>
+#include <QOpenGLExtraFunctions>
+#include <QOpenGLShaderProgram>
+#include <QOpenGLVertexArrayObject>
+#include <QQuaternion>
+#include <cstdint>
+#include <vector>
+
+#include "memory_budget.h"
+#include "occlusion.h"
+#include "scene.h"
+
+/**
+  * A triangle of a scene instance with its depth key
+  */
+struct SortedTriangle {
+  float key;
+  unsigned int instance;
+  unsigned int triangle;
+  bool operator<(const SortedTriangle &other) const { return key < other.key; }
+};
+
+/**
+  * Depth-sorted triangles of a frame and the index buffer contents
+  * that draws them
+  */
+class PreparedFrame {
+public:
+  PreparedFrame() : version(0), memory(ACCELERATION_MEMORY) {}
+
+  QMatrix4x4 view;
+  unsigned int version;
+  std::vector<SortedTriangle> order;
+  std::vector<unsigned int> indices;
+  MemoryReservation memory;
+};
+
+/**
+  * Vertex buffer layout of a triangle corner
+  */
+struct GpuVertex {
+  float position[3];
+  float normal[3];
+  float c;
+};
+
+/**
+  * Vertex buffer layout of a triangle corner with compact storage
+  * Positions are quantized, the normal is octahedron-encoded
+  */
+struct CompactVertex {
+  int16_t position[4];
+  int16_t normal[2];
+  unsigned char c;
+  unsigned char padding[3];
+};
+
+/**
+  * Camera and display toggles of a frame
+  */
+class RenderSettings {
+public:
+  RenderSettings();
+  QMatrix4x4 viewMatrix() const;
+  QMatrix4x4 projectionMatrix() const;
+
+  double x_translation;
+  double y_translation;
+  double z_translation;
+  QQuaternion rotation;
+  float scale;
+  double alpha;
+  bool zsorting;
+  bool draw_edges;
+  bool colorization;
+  bool show_axes;
+  bool shading;
+  bool deviation_map;     // color models by their distance to the reference
+  float deviation_range;  // distance drawn in full red or blue
+  size_t point_budget;    // most points of point clouds drawn per frame
+  bool occlusion_culling; // skip hidden clusters of faces when opaque
+};
+
+/**
+  * Draws a scene with a shader program on a core profile context
+  * Geometry is uploaded once per model, colors, alpha and the palette
+  * are applied by the shaders from vertex attributes and uniforms
+  */
+class SceneRenderer : protected QOpenGLExtraFunctions {
+public:
+  SceneRenderer();
+  void initialize();
+  void render(Scene &scene, const RenderSettings &settings, const PreparedFrame *frame = 0);
+  const OcclusionStatistics &occlusionStatistics() const { return occlusion.statistics; }
+  static bool isFacingCamera(const QVector3D &normal);
+  static QVector3D deviationColor(float deviation, float range);
+  static void sortTriangles(const Scene &scene, const QMatrix4x4 &view, std::vector<SortedTriangle> &order);
+  static void prepareFrame(const Scene &scene, const QMatrix4x4 &view, PreparedFrame &frame);
+  static size_t bufferSize(const FaceCollection &mesh, bool labels);
+  static size_t matchingCorners(const FaceCollection &before, const FaceCollection &after, bool from_back);
+
+protected:
+  void uploadModel(Model &model);
+  template <typename Vertex> void uploadVertices(Model &model);
+  void uploadLabels(Model &model);
+  void uploadDeviations(Model &model);
+  void uploadInstances(Scene &scene);
+  void uploadClusters(Model &model);
+  void bindModel(Model &model);
+  void bindInstances(Model &model);
+  void setInstanceTransform(const QMatrix4x4 &transform);
+  void drawInstances(Scene &scene);
+  void drawClusters(Scene &scene, const std::vector<ClusterDraw> &draws);
+  void drawUnoccluded(Scene &scene, const QMatrix4x4 &view_projection);
+  void drawSortedTriangles(Scene &scene, const PreparedFrame &frame);
+  void drawEdges(Scene &scene, double alpha);
+  void bindPagedVertices(QOpenGLBuffer &buffer);
+  void drawPagedModels(Scene &scene, const QMatrix4x4 &view_projection);
+  void drawPointClouds(Scene &scene, const QMatrix4x4 &view_projection, size_t budget);
+  void drawAxes();
+
+  QOpenGLShaderProgram program;
+  QOpenGLVertexArrayObject vao;
+  QOpenGLBuffer axes_buffer;
+  QOpenGLBuffer sorted_buffer;
+  bool deviation_map;
+  OcclusionCuller occlusion;
+  std::vector<ClusterDraw> occluders;
+  std::vector<ClusterDraw> unoccluded;
+  std::vector<unsigned int> sorted_indices;  // of models with shared vertices
+};
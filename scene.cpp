@@ -0,0 +1,191 @@
+#include "scene.h"
+#include "trace.h"
+
+#include <QCryptographicHash>
+#include <QFile>
+#include <algorithm>
+#include <cmath>
+#include <utility>
+
+/**
+  * Hash the contents of a file
+  * The file is read in chunks, so it is never held in memory as a whole
+  * Input: const QString - path to the file
+  * Output: QByteArray - SHA-1 of the contents, empty if the file can't be read
+  */
+QByteArray Scene::fileHash(const QString &path){
+  TRACE_SCOPE("fileHash");
+  QFile file(path);
+  if(!file.open(QIODevice::ReadOnly)){
+    return QByteArray();
+  }
+  QCryptographicHash hash(QCryptographicHash::Sha1);
+  if(!hash.addData(&file)){
+    return QByteArray();
+  }
+  return hash.result();
+}
+
+/**
+  * Find a loaded model by the hash of its source file
+  * Input: const QByteArray - hash of the file contents
+  * Output: int - index of the model or -1
+  */
+int Scene::findModel(const QByteArray &hash) const{
+  if(hash.isEmpty()){
+    return -1;
+  }
+  for(int i=0; i<(int)models.size(); i++){
+    if(models[i]->hash == hash){
+      return i;
+    }
+  }
+  return -1;
+}
+
+/**
+  * Compute the bounding box of the model's positions
+  * Has to be called whenever the faces are replaced
+  * Input: void
+  * Output: void
+  */
+void Model::updateBounds(){
+  low = high = QVector3D();
+  if(faces.vertexCount() > 0){
+    low = high = faces.position(0);
+  }
+  for(int i=0; i<faces.vertexCount(); i++){
+    QVector3D position = faces.position(i);
+    for(int dim=0; dim<3; dim++){
+      low[dim] = std::min(low[dim], position[dim]);
+      high[dim] = std::max(high[dim], position[dim]);
+    }
+  }
+}
+
+/**
+  * Add a unique model to the scene
+  * Input: const QString - path to the source file
+  *        const QByteArray - hash of the file contents
+  *        FaceCollection - triangulated faces of the model, moved into it
+  * Output: int - index of the new model
+  */
+int Scene::addModel(const QString &path, const QByteArray &hash, FaceCollection faces){
+  std::unique_ptr<Model> model(new Model());
+  model->path = path;
+  model->hash = hash;
+  model->faces = std::move(faces);
+  model->updateBounds();
+  model->mesh_memory.update(model->faces.memoryUsage());
+  models.push_back(std::move(model));
+  return models.size() - 1;
+}
+
+/**
+  * Place a model in the scene
+  * Input: int - index of the model
+  *        const QMatrix4x4 - model to world transform
+  * Output: void
+  */
+void Scene::addInstance(int model, const QMatrix4x4 &transform){
+  Instance instance;
+  instance.model = model;
+  instance.transform = transform;
+  instances.push_back(instance);
+  instances_dirty = true;
+}
+
+/**
+  * Remove all models and instances
+  * The GL context of the buffers has to be current
+  * Input: void
+  * Output: void
+  */
+void Scene::clear(){
+  for(std::unique_ptr<Model> &model : models){
+    model->vertex_buffer.destroy();
+    model->label_buffer.destroy();
+    model->instance_buffer.destroy();
+    model->edge_buffer.destroy();
+    model->deviation_buffer.destroy();
+    model->cluster_buffer.destroy();
+    model->element_buffer.destroy();
+  }
+  for(std::unique_ptr<PagedModel> &model : paged_models){
+    model->releaseBuffers();
+  }
+  for(std::unique_ptr<PointCloud> &cloud : point_clouds){
+    cloud->releaseBuffers();
+  }
+  models.clear();
+  instances.clear();
+  paged_models.clear();
+  point_clouds.clear();
+  instances_dirty = true;
+}
+
+/**
+  * Grow a box by the transformed corners of another box
+  * Input: QVector3D, QVector3D - lower and upper corner of the box to add
+  *        const QMatrix4x4 - its model to world transform
+  *        QVector3D, QVector3D - in and output, the grown box
+  *        bool - in and output, true while the grown box is still empty
+  * Output: void
+  */
+static void addBox(const QVector3D &box_low, const QVector3D &box_high, const QMatrix4x4 &transform,
+                   QVector3D &low, QVector3D &high, bool &first){
+  for(int corner=0; corner<8; corner++){
+    QVector3D point((corner & 1) ? box_high.x() : box_low.x(),
+                    (corner & 2) ? box_high.y() : box_low.y(),
+                    (corner & 4) ? box_high.z() : box_low.z());
+    point = transform.map(point);
+    for(int dim=0; dim<3; dim++){
+      if(first || point[dim] < low[dim]){
+        low[dim] = point[dim];
+      }
+      if(first || point[dim] > high[dim]){
+        high[dim] = point[dim];
+      }
+    }
+    first = false;
+  }
+}
+
+/**
+  * Axis-aligned bounding box of all instances in world space
+  * Input: QVector3D, QVector3D - output, lower and upper corner
+  * Output: bool - false if the scene has no vertices
+  */
+bool Scene::bounds(QVector3D &low, QVector3D &high) const{
+  bool first = true;
+  for(const std::unique_ptr<PagedModel> &model : paged_models){
+    if(!model->chunks.empty()){
+      addBox(model->low, model->high, model->transform, low, high, first);
+    }
+  }
+  for(const std::unique_ptr<PointCloud> &cloud : point_clouds){
+    if(cloud->pointCount() > 0){
+      addBox(cloud->low, cloud->high, cloud->transform, low, high, first);
+    }
+  }
+  for(const Instance &instance : instances){
+    const Model &model = *models[instance.model];
+    if(model.faces.vertexCount() > 0){
+      addBox(model.low, model.high, instance.transform, low, high, first);
+    }
+  }
+  return !first;
+}
+
+/**
+  * Zoom factor that fits the depth range of the scene into the view
+  * Input: void
+  * Output: float - inverse of the largest distance from z = 0
+  */
+float Scene::depthScale() const{
+  QVector3D low, high;
+  if(!bounds(low, high)){
+    return 1.0f;
+  }
+  return 1/std::max(std::fabs(low.z()), std::fabs(high.z()));
+}
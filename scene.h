@@ -0,0 +1,110 @@
+#pragma once
+
+#include <QByteArray>
+#include <QMatrix4x4>
+#include <QOpenGLBuffer>
+#include <QString>
+#include <memory>
+#include <vector>
+
+#include "deviation.h"
+#include "face.h"
+#include "mass_properties.h"
+#include "memory_budget.h"
+#include "occlusion.h"
+#include "paged_model.h"
+#include "point_cloud.h"
+#include "source_chunks.h"
+
+/**
+  * A unique model loaded from a file
+  * Identical files share a single model and its GPU buffer
+  */
+class Model {
+public:
+  Model()
+    : vertex_buffer(QOpenGLBuffer::VertexBuffer), label_buffer(QOpenGLBuffer::VertexBuffer),
+      instance_buffer(QOpenGLBuffer::VertexBuffer), edge_buffer(QOpenGLBuffer::VertexBuffer),
+      deviation_buffer(QOpenGLBuffer::VertexBuffer), cluster_buffer(QOpenGLBuffer::IndexBuffer),
+      element_buffer(QOpenGLBuffer::IndexBuffer), shared_vertices(false), buffer_dirty(true),
+      labels_dirty(false), labelled(false), deviations_dirty(false), deviations_per_face(false),
+      clusters_dirty(true), buffer_patch(false), patch_front(0), patch_back(0), instance_count(0), vertex_count(0),
+      edge_count(0), mesh_memory(MESH_MEMORY), gpu_memory(GPU_MEMORY), deviation_memory(MESH_MEMORY),
+      cluster_memory(ACCELERATION_MEMORY), sharing_memory(MESH_MEMORY) {}
+
+  float cornerDeviation(unsigned int corner) const {
+    return deviations_per_face ? deviations[faces.triangle_faces[corner / 3]] : deviations[faces.triangles[corner]];
+  }
+  void updateBounds();
+
+  QString path;
+  QByteArray hash;
+  FaceCollection faces;
+  QVector3D low, high;  // bounding box of the positions, see updateBounds()
+  QOpenGLBuffer vertex_buffer;    // triangle corners
+  QOpenGLBuffer label_buffer;     // component label of every corner
+  QOpenGLBuffer instance_buffer;  // transforms of the instances
+  QOpenGLBuffer edge_buffer;      // face outlines
+  QOpenGLBuffer deviation_buffer; // distance of every corner to the reference
+  QOpenGLBuffer cluster_buffer;   // corners in cluster order
+  QOpenGLBuffer element_buffer;   // the vertex of every corner with shared vertices
+  // The vertex buffer holds vertices shared by corners instead of a
+  // vertex per corner, set for models in vertex cache order
+  bool shared_vertices;
+  bool buffer_dirty;
+  bool labels_dirty;
+  bool labelled;
+  bool deviations_dirty;
+  bool deviations_per_face;
+  bool clusters_dirty;  // the faces changed since the clusters were built
+  // After a reload only the corners between the unchanged
+  // first and last corners of the vertex buffer are uploaded
+  bool buffer_patch;
+  size_t patch_front;
+  size_t patch_back;
+  int instance_count;
+  int vertex_count;
+  int edge_count;
+  MemoryReservation mesh_memory;  // the faces
+  MemoryReservation gpu_memory;   // all buffers
+  MemoryReservation deviation_memory;  // the distances to the reference
+  MemoryReservation cluster_memory;    // the clusters and their triangles
+  MemoryReservation sharing_memory;    // corner_vertices and vertex_corners
+  std::vector<SourceChunk> source_chunks;  // for reloading changed parts of the file
+  std::vector<MassProperties> component_properties;
+  MassProperties mass_properties;  // of the whole model
+  std::vector<float> deviations;   // per vertex or per face, empty if not compared to a reference
+  DeviationStatistics deviation;
+  std::vector<TriangleCluster> clusters;        // built when occlusion culling is used
+  std::vector<unsigned int> cluster_triangles;  // triangles in cluster order
+  std::vector<unsigned int> corner_vertices;    // with shared vertices, the vertex of every corner
+  std::vector<unsigned int> vertex_corners;     // and the first corner of every vertex
+};
+
+/**
+  * A placement of a model in the scene
+  */
+class Instance {
+public:
+  int model;
+  QMatrix4x4 transform;
+};
+
+class Scene {
+public:
+  Scene() : instances_dirty(false) {}
+  std::vector<std::unique_ptr<Model>> models;
+  std::vector<Instance> instances;
+  std::vector<std::unique_ptr<PagedModel>> paged_models;  // drawn from disk, not sorted
+  std::vector<std::unique_ptr<PointCloud>> point_clouds;  // files without faces
+  bool instances_dirty;
+
+  static QByteArray fileHash(const QString &path);
+  int findModel(const QByteArray &hash) const;
+  int addModel(const QString &path, const QByteArray &hash, FaceCollection faces);
+  void addInstance(int model, const QMatrix4x4 &transform);
+  void clear();
+  bool empty() const { return instances.empty() && paged_models.empty() && point_clouds.empty(); }
+  bool bounds(QVector3D &low, QVector3D &high) const;
+  float depthScale() const;
+};
@@ -0,0 +1,522 @@
+#include "software_renderer.h"
+#include "parallel.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <cmath>
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+
+static const int TILE_SIZE = 64;
+static const size_t SETUP_GRAIN = 1 << 14;
+static const float LINE_WIDTH = 10.0f;
+static const float SUBPIXEL = 256.0f;
+static const float CLEAR_COLOR[3] = {0.2f, 0.25f, 0.2f};
+
+static const QVector3D PALETTE[8] = {
+  QVector3D(1.0, 0.0, 0.0), QVector3D(0.0, 1.0, 0.0),
+  QVector3D(0.0, 0.0, 1.0), QVector3D(1.0, 1.0, 0.0),
+  QVector3D(1.0, 0.0, 1.0), QVector3D(0.0, 1.0, 1.0),
+  QVector3D(0.3, 0.7, 0.2), QVector3D(0.5, 0.2, 0.9)
+};
+
+/**
+  * Edge function of a screen triangle, evaluated relative to a tile
+  * The coefficients of an edge shared by two triangles are exact
+  * negatives of each other, and exactly one of the two owns the
+  * pixels lying on it, so no pixel is blended twice
+  */
+struct EdgeFunction {
+  float a;
+  float b;
+  float c;
+  bool owner;
+
+  EdgeFunction(float x0, float y0, float x1, float y1, double origin_x, double origin_y) {
+    double da = (double)y0 - y1;
+    double db = (double)x1 - x0;
+    double dc = (double)x0 * y1 - (double)x1 * y0;
+    a = (float)da;
+    b = (float)db;
+    c = (float)(da * origin_x + db * origin_y + dc);
+    owner = da > 0 || (da == 0 && db < 0);
+  }
+
+  bool inside(float value) const { return owner ? value >= 0 : value > 0; }
+};
+
+/**
+  * Index of the pixel or tile containing a window coordinate,
+  * clamped to a range before converting
+  */
+static int cell(float coordinate, int size, int last) {
+  return (int)std::min((float)last, std::max(0.0f, std::floor(coordinate / size)));
+}
+
+static unsigned char toByte(float value) {
+  return (unsigned char)std::min(255.0f, std::max(0.0f, value * 255.0f + 0.5f));
+}
+
+SoftwareRenderer::SoftwareRenderer()
+  : width(0), height(0), tiles_x(0), tiles_y(0), stride(0),
+    target_memory(CACHE_MEMORY), batch_memory(ACCELERATION_MEMORY) {}
+
+/**
+  * Draw a scene into an image
+  * Input: const Scene - models and instances
+  *        const RenderSettings - camera and display toggles
+  *        int, int - size of the image in pixels
+  *        const PreparedFrame - depth-sorted triangles, prepared here if
+  *                              sorting is on and none is given
+  * Output: QImage - the rendered frame
+  */
+QImage SoftwareRenderer::render(const Scene &scene, const RenderSettings &settings, int new_width, int new_height,
+                                const PreparedFrame *frame){
+  TRACE_SCOPE("software render");
+  resize(new_width, new_height);
+  batches.clear();
+  if(settings.show_axes){
+    setupAxes(settings);
+  }
+  if(settings.zsorting){
+    if(frame){
+      setupTriangles(scene, settings, frame->order);
+    }
+    else{
+      PreparedFrame own_frame;
+      SceneRenderer::prepareFrame(scene, settings.viewMatrix(), own_frame);
+      setupTriangles(scene, settings, own_frame.order);
+    }
+  }
+  else{
+    // Same order as the instanced draws: model by model, then instance by instance
+    std::vector<SortedTriangle> order;
+    for(int m=0; m<(int)scene.models.size(); m++){
+      for(int i=0; i<(int)scene.instances.size(); i++){
+        if(scene.instances[i].model != m){
+          continue;
+        }
+        unsigned int n_triangles = scene.models[m]->faces.triangleCount();
+        for(unsigned int t=0; t<n_triangles; t++){
+          SortedTriangle triangle = {0.0f, (unsigned int)i, t};
+          order.push_back(triangle);
+        }
+      }
+    }
+    setupTriangles(scene, settings, order);
+  }
+  if(settings.draw_edges){
+    setupEdges(scene, settings);
+  }
+  size_t batch_bytes = batches.capacity() * sizeof(RasterBatch);
+  for(const RasterBatch &batch : batches){
+    batch_bytes += batch.triangles.capacity() * sizeof(RasterTriangle);
+    for(const std::vector<unsigned int> &bin : batch.bins){
+      batch_bytes += sizeof(bin) + bin.capacity() * sizeof(unsigned int);
+    }
+  }
+  batch_memory.update(batch_bytes);
+
+  {
+    TRACE_SCOPE("rasterize");
+    parallelChunks(tiles_x * tiles_y, 1, [&](size_t, size_t begin, size_t){
+      rasterizeTile(begin);
+    });
+  }
+
+  TRACE_SCOPE("resolve");
+  QImage image(width, height, QImage::Format_RGB32);
+  const float *r = color.data();
+  const float *g = r + stride * tiles_y * TILE_SIZE;
+  const float *b = g + stride * tiles_y * TILE_SIZE;
+  parallelChunks(height, TILE_SIZE, [&](size_t, size_t begin, size_t end){
+    for(size_t y=begin; y<end; y++){
+      QRgb *line = (QRgb *)image.scanLine(y);
+      for(int x=0; x<width; x++){
+        size_t i = y * stride + x;
+        line[x] = qRgb(toByte(r[i]), toByte(g[i]), toByte(b[i]));
+      }
+    }
+  });
+  return image;
+}
+
+/**
+  * Allocate the depth and color buffers, padded to whole tiles
+  * Input: int, int - size of the image in pixels
+  * Output: void
+  */
+void SoftwareRenderer::resize(int new_width, int new_height){
+  width = std::max(1, new_width);
+  height = std::max(1, new_height);
+  tiles_x = (width + TILE_SIZE - 1) / TILE_SIZE;
+  tiles_y = (height + TILE_SIZE - 1) / TILE_SIZE;
+  stride = tiles_x * TILE_SIZE;
+  size_t pixels = (size_t)stride * tiles_y * TILE_SIZE;
+  depth.resize(pixels);
+  color.resize(pixels * 3);
+  target_memory.update((depth.capacity() + color.capacity()) * sizeof(float));
+}
+
+/**
+  * Map a point to window coordinates and depth
+  * Positions are snapped to a subpixel grid so that edge functions of
+  * neighbouring triangles are computed from identical values
+  * Input: const QMatrix4x4 - model to clip space transform
+  *        const QVector3D - the point
+  *        float, float, float - output, pixel coordinates and depth in [0, 1]
+  * Output: bool - false if the point can't be projected
+  */
+bool SoftwareRenderer::toScreen(const QMatrix4x4 &transform, const QVector3D &position,
+                                float &x, float &y, float &z) const{
+  QVector3D ndc = transform.map(position);
+  x = std::round((ndc.x() + 1) * 0.5f * width * SUBPIXEL) / SUBPIXEL;
+  y = std::round((1 - ndc.y()) * 0.5f * height * SUBPIXEL) / SUBPIXEL;
+  z = (ndc.z() + 1) * 0.5f;
+  return std::isfinite(x) && std::isfinite(y) && std::isfinite(z);
+}
+
+/**
+  * Add a screen triangle to a batch and to the bins of the tiles it covers
+  * Triangles are turned to a positive area, degenerate ones are dropped
+  * Input: RasterBatch - the batch of the calling chunk
+  *        const RasterTriangle - the triangle in window coordinates
+  * Output: void
+  */
+void SoftwareRenderer::addTriangle(RasterBatch &batch, const RasterTriangle &triangle){
+  RasterTriangle t = triangle;
+  double area = ((double)t.y[0] - t.y[1]) * t.x[2] + ((double)t.x[1] - t.x[0]) * t.y[2] +
+                ((double)t.x[0] * t.y[1] - (double)t.x[1] * t.y[0]);
+  if(area == 0){
+    return;
+  }
+  if(area < 0){
+    std::swap(t.x[1], t.x[2]);
+    std::swap(t.y[1], t.y[2]);
+    std::swap(t.z[1], t.z[2]);
+    std::swap(t.r[1], t.r[2]);
+    std::swap(t.g[1], t.g[2]);
+    std::swap(t.b[1], t.b[2]);
+  }
+  float min_x = std::min(t.x[0], std::min(t.x[1], t.x[2]));
+  float max_x = std::max(t.x[0], std::max(t.x[1], t.x[2]));
+  float min_y = std::min(t.y[0], std::min(t.y[1], t.y[2]));
+  float max_y = std::max(t.y[0], std::max(t.y[1], t.y[2]));
+  if(max_x < 0 || max_y < 0 || min_x > width || min_y > height){
+    return;
+  }
+  int first_x = cell(min_x, TILE_SIZE, tiles_x - 1);
+  int last_x = cell(max_x, TILE_SIZE, tiles_x - 1);
+  int first_y = cell(min_y, TILE_SIZE, tiles_y - 1);
+  int last_y = cell(max_y, TILE_SIZE, tiles_y - 1);
+  unsigned int index = batch.triangles.size();
+  batch.triangles.push_back(t);
+  for(int tile_y=first_y; tile_y<=last_y; tile_y++){
+    for(int tile_x=first_x; tile_x<=last_x; tile_x++){
+      batch.bins[tile_y * tiles_x + tile_x].push_back(index);
+    }
+  }
+}
+
+/**
+  * Add a line as a quad of two triangles
+  * Input: RasterBatch - the batch of the calling chunk
+  *        const float[3] - window coordinates and depth of both ends
+  *        const QVector4D - color and alpha of the line
+  * Output: void
+  */
+void SoftwareRenderer::addLine(RasterBatch &batch, const float start[3], const float end[3], const QVector4D &color){
+  float dx = end[0] - start[0], dy = end[1] - start[1];
+  float length = std::sqrt(dx * dx + dy * dy);
+  if(length == 0){
+    return;
+  }
+  float nx = -dy / length * LINE_WIDTH / 2, ny = dx / length * LINE_WIDTH / 2;
+  RasterTriangle triangle;
+  for(int k=0; k<3; k++){
+    triangle.r[k] = color.x();
+    triangle.g[k] = color.y();
+    triangle.b[k] = color.z();
+  }
+  triangle.alpha = color.w();
+  const float corners[4][3] = {
+    {start[0] + nx, start[1] + ny, start[2]}, {start[0] - nx, start[1] - ny, start[2]},
+    {end[0] - nx, end[1] - ny, end[2]}, {end[0] + nx, end[1] + ny, end[2]}
+  };
+  const int quads[2][3] = {{0, 1, 3}, {1, 2, 3}};
+  for(int q=0; q<2; q++){
+    for(int k=0; k<3; k++){
+      triangle.x[k] = std::round(corners[quads[q][k]][0] * SUBPIXEL) / SUBPIXEL;
+      triangle.y[k] = std::round(corners[quads[q][k]][1] * SUBPIXEL) / SUBPIXEL;
+      triangle.z[k] = corners[quads[q][k]][2];
+    }
+    addTriangle(batch, triangle);
+  }
+}
+
+/**
+  * Transform, shade and bin triangles in parallel chunks
+  * Colors follow the vertex shader of SceneRenderer
+  * Input: const Scene - models and instances
+  *        const RenderSettings - camera and display toggles
+  *        const std::vector<SortedTriangle> - triangles in drawing order
+  * Output: void
+  */
+void SoftwareRenderer::setupTriangles(const Scene &scene, const RenderSettings &settings,
+                                      const std::vector<SortedTriangle> &order){
+  TRACE_SCOPE("triangle setup");
+  QMatrix4x4 view = settings.viewMatrix();
+  QMatrix4x4 projection = settings.projectionMatrix();
+  std::vector<QMatrix4x4> model_views, transforms;
+  for(const Instance &instance : scene.instances){
+    model_views.push_back(view * instance.transform);
+    transforms.push_back(projection * model_views.back());
+  }
+  size_t base = batches.size();
+  batches.resize(base + chunkCount(order.size(), SETUP_GRAIN));
+  parallelChunks(order.size(), SETUP_GRAIN, [&](size_t chunk, size_t begin, size_t end){
+    RasterBatch &batch = batches[base + chunk];
+    batch.bins.resize(tiles_x * tiles_y);
+    for(size_t i=begin; i<end; i++){
+      const Instance &instance = scene.instances[order[i].instance];
+      const Model &model = *scene.models[instance.model];
+      const FaceCollection &mesh = model.faces;
+      unsigned int t = order[i].triangle;
+      const Face &face = mesh.faces[mesh.triangle_faces[t]];
+      QVector3D base_color = settings.colorization ? PALETTE[face.label % 8] : QVector3D(face.c, face.c, face.c);
+      bool deviations = settings.deviation_map && !model.deviations.empty();
+      RasterTriangle triangle;
+      bool valid = true;
+      for(int k=0; k<3; k++){
+        valid = valid && toScreen(transforms[order[i].instance], mesh.position(mesh.triangles[t*3+k]),
+                                  triangle.x[k], triangle.y[k], triangle.z[k]);
+        QVector3D corner_color = deviations ? SceneRenderer::deviationColor(model.cornerDeviation(t*3+k),
+                                                                            settings.deviation_range)
+                                            : base_color;
+        QVector3D normal = mesh.cornerNormal(t*3+k);
+        if(settings.shading && !normal.isNull()){
+          normal = model_views[order[i].instance].mapVector(normal).normalized();
+          corner_color *= 0.3f + 0.7f * std::fabs(normal.z());
+        }
+        triangle.r[k] = corner_color.x();
+        triangle.g[k] = corner_color.y();
+        triangle.b[k] = corner_color.z();
+      }
+      triangle.alpha = settings.alpha;
+      if(valid){
+        addTriangle(batch, triangle);
+      }
+    }
+  });
+}
+
+/**
+  * Bin the outlines of all faces, model by model like SceneRenderer
+  * Input: const Scene - models and instances
+  *        const RenderSettings - camera and display toggles
+  * Output: void
+  */
+void SoftwareRenderer::setupEdges(const Scene &scene, const RenderSettings &settings){
+  QMatrix4x4 view_projection = settings.projectionMatrix() * settings.viewMatrix();
+  QVector4D black(0.0f, 0.0f, 0.0f, settings.alpha);
+  for(int m=0; m<(int)scene.models.size(); m++){
+    const FaceCollection &mesh = scene.models[m]->faces;
+    for(const Instance &instance : scene.instances){
+      if(instance.model != m){
+        continue;
+      }
+      QMatrix4x4 transform = view_projection * instance.transform;
+      size_t base = batches.size();
+      batches.resize(base + chunkCount(mesh.faces.size(), SETUP_GRAIN));
+      parallelChunks(mesh.faces.size(), SETUP_GRAIN, [&](size_t chunk, size_t begin, size_t end){
+        RasterBatch &batch = batches[base + chunk];
+        batch.bins.resize(tiles_x * tiles_y);
+        for(size_t f=begin; f<end; f++){
+          for(unsigned int i=mesh.face_offsets[f]+1; i<mesh.face_offsets[f+1]; i++){
+            float first[3], second[3];
+            if(toScreen(transform, mesh.position(mesh.face_corners[i-1]), first[0], first[1], first[2]) &&
+               toScreen(transform, mesh.position(mesh.face_corners[i]), second[0], second[1], second[2])){
+              addLine(batch, first, second, black);
+            }
+          }
+        }
+      });
+    }
+  }
+}
+
+/**
+  * Bin the x, y and z axes with their arrow heads
+  * Input: const RenderSettings - camera
+  * Output: void
+  */
+void SoftwareRenderer::setupAxes(const RenderSettings &settings){
+  const float axes[9][2][3] = {
+    {{-10000.0f, 0.0f, 0.0f}, {20.0f, 0.0f, 0.0f}},
+    {{4.0f, 0.0f, 0.0f}, {3.0f, 1.0f, 0.0f}},
+    {{4.0f, 0.0f, 0.0f}, {3.0f, -1.0f, 0.0f}},
+    {{0.0f, -10000.0f, 0.0f}, {0.0f, 20.0f, 0.0f}},
+    {{0.0f, 4.0f, 0.0f}, {1.0f, 3.0f, 0.0f}},
+    {{0.0f, 4.0f, 0.0f}, {-1.0f, 3.0f, 0.0f}},
+    {{0.0f, 0.0f, -10000.0f}, {0.0f, 0.0f, 20.0f}},
+    {{0.0f, 0.0f, 4.0f}, {0.0f, 1.0f, 3.0f}},
+    {{0.0f, 0.0f, 4.0f}, {0.0f, -1.0f, 3.0f}}
+  };
+  const QVector4D colors[3] = {
+    QVector4D(1.0, 0.0, 0.0, 1.0), // red x
+    QVector4D(0.0, 1.0, 0.0, 1.0), // green y
+    QVector4D(0.0, 0.0, 1.0, 1.0)  // blue z
+  };
+  QMatrix4x4 transform = settings.projectionMatrix() * settings.viewMatrix();
+  batches.resize(batches.size() + 1);
+  RasterBatch &batch = batches.back();
+  batch.bins.resize(tiles_x * tiles_y);
+  for(int line=0; line<9; line++){
+    float ends[2][3];
+    bool valid = true;
+    for(int k=0; k<2; k++){
+      QVector3D point(axes[line][k][0], axes[line][k][1], axes[line][k][2]);
+      valid = valid && toScreen(transform, point, ends[k][0], ends[k][1], ends[k][2]);
+    }
+    if(valid){
+      addLine(batch, ends[0], ends[1], colors[line / 3]);
+    }
+  }
+}
+
+/**
+  * Clear a tile and draw the triangles of all batches binned into it
+  * Input: int - index of the tile
+  * Output: void
+  */
+void SoftwareRenderer::rasterizeTile(int tile){
+  int tile_x = tile % tiles_x, tile_y = tile / tiles_x;
+  size_t plane = (size_t)stride * tiles_y * TILE_SIZE;
+  for(int y=tile_y*TILE_SIZE; y<(tile_y+1)*TILE_SIZE; y++){
+    size_t row = (size_t)y * stride + tile_x * TILE_SIZE;
+    std::fill(depth.begin() + row, depth.begin() + row + TILE_SIZE, 1.0f);
+    for(int k=0; k<3; k++){
+      std::fill(color.begin() + k * plane + row, color.begin() + k * plane + row + TILE_SIZE, CLEAR_COLOR[k]);
+    }
+  }
+  for(const RasterBatch &batch : batches){
+    for(unsigned int index : batch.bins[tile]){
+      rasterizeTriangle(batch.triangles[index], tile_x, tile_y);
+    }
+  }
+}
+
+/**
+  * Rasterize the part of a triangle inside one tile
+  * Four pixels of a row are tested at once with SSE: edge functions give
+  * coverage and barycentric weights, then the depth test and alpha
+  * blending are applied to the covered pixels
+  * Input: const RasterTriangle - triangle with positive area in window coordinates
+  *        int, int - the tile
+  * Output: void
+  */
+void SoftwareRenderer::rasterizeTriangle(const RasterTriangle &t, int tile_x, int tile_y){
+  int origin_x = tile_x * TILE_SIZE, origin_y = tile_y * TILE_SIZE;
+  // Pixel range inside the tile, in tile coordinates
+  int x0 = cell(std::min(t.x[0], std::min(t.x[1], t.x[2])) - origin_x, 1, TILE_SIZE);
+  int x1 = std::min(std::min(TILE_SIZE, width - origin_x) - 1,
+                    cell(std::max(t.x[0], std::max(t.x[1], t.x[2])) - origin_x, 1, TILE_SIZE));
+  int y0 = cell(std::min(t.y[0], std::min(t.y[1], t.y[2])) - origin_y, 1, TILE_SIZE);
+  int y1 = std::min(std::min(TILE_SIZE, height - origin_y) - 1,
+                    cell(std::max(t.y[0], std::max(t.y[1], t.y[2])) - origin_y, 1, TILE_SIZE));
+  if(x0 > x1 || y0 > y1){
+    return;
+  }
+  x0 &= ~3;
+  // Edges opposite to vertex 0, 1 and 2, relative to the first pixel centre of the tile
+  EdgeFunction e0(t.x[1], t.y[1], t.x[2], t.y[2], origin_x + 0.5, origin_y + 0.5);
+  EdgeFunction e1(t.x[2], t.y[2], t.x[0], t.y[0], origin_x + 0.5, origin_y + 0.5);
+  EdgeFunction e2(t.x[0], t.y[0], t.x[1], t.y[1], origin_x + 0.5, origin_y + 0.5);
+  double area = ((double)t.y[0] - t.y[1]) * t.x[2] + ((double)t.x[1] - t.x[0]) * t.y[2] +
+                ((double)t.x[0] * t.y[1] - (double)t.x[1] * t.y[0]);
+  float inverse_area = (float)(1 / area);
+  float alpha = t.alpha, keep = 1 - t.alpha;
+  size_t plane = (size_t)stride * tiles_y * TILE_SIZE;
+  float *depth_row = depth.data() + (size_t)origin_y * stride + origin_x;
+  float *r_row = color.data() + (size_t)origin_y * stride + origin_x;
+  float *g_row = r_row + plane;
+  float *b_row = g_row + plane;
+
+#ifdef __SSE__
+  const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0f);
+  const __m128 all = _mm_cmpeq_ps(zero, zero);
+  const __m128 steps = _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f);
+  const __m128 own0 = e0.owner ? all : zero;
+  const __m128 own1 = e1.owner ? all : zero;
+  const __m128 own2 = e2.owner ? all : zero;
+  const __m128 a0 = _mm_set1_ps(e0.a), a1 = _mm_set1_ps(e1.a), a2 = _mm_set1_ps(e2.a);
+  const __m128 c0 = _mm_set1_ps(e0.c), c1 = _mm_set1_ps(e1.c), c2 = _mm_set1_ps(e2.c);
+  const __m128 inv = _mm_set1_ps(inverse_area);
+  const __m128 src_alpha = _mm_set1_ps(alpha), dst_alpha = _mm_set1_ps(keep);
+  for(int y=y0; y<=y1; y++){
+    size_t row = (size_t)y * stride;
+    __m128 b0 = _mm_mul_ps(_mm_set1_ps(e0.b), _mm_set1_ps((float)y));
+    __m128 b1 = _mm_mul_ps(_mm_set1_ps(e1.b), _mm_set1_ps((float)y));
+    __m128 b2 = _mm_mul_ps(_mm_set1_ps(e2.b), _mm_set1_ps((float)y));
+    for(int x=x0; x<=x1; x+=4){
+      __m128 px = _mm_add_ps(_mm_set1_ps((float)x), steps);
+      __m128 w0 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(a0, px), b0), c0);
+      __m128 w1 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(a1, px), b1), c1);
+      __m128 w2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(a2, px), b2), c2);
+      // Owned edges include their pixels, the others exclude them
+      __m128 mask = _mm_or_ps(_mm_and_ps(own0, _mm_cmpge_ps(w0, zero)), _mm_andnot_ps(own0, _mm_cmpgt_ps(w0, zero)));
+      mask = _mm_and_ps(mask, _mm_or_ps(_mm_and_ps(own1, _mm_cmpge_ps(w1, zero)), _mm_andnot_ps(own1, _mm_cmpgt_ps(w1, zero))));
+      mask = _mm_and_ps(mask, _mm_or_ps(_mm_and_ps(own2, _mm_cmpge_ps(w2, zero)), _mm_andnot_ps(own2, _mm_cmpgt_ps(w2, zero))));
+      if(_mm_movemask_ps(mask) == 0){
+        continue;
+      }
+      w0 = _mm_mul_ps(w0, inv);
+      w1 = _mm_mul_ps(w1, inv);
+      w2 = _mm_mul_ps(w2, inv);
+      __m128 z = _mm_add_ps(_mm_add_ps(_mm_mul_ps(w0, _mm_set1_ps(t.z[0])), _mm_mul_ps(w1, _mm_set1_ps(t.z[1]))),
+                            _mm_mul_ps(w2, _mm_set1_ps(t.z[2])));
+      __m128 old_depth = _mm_loadu_ps(depth_row + row + x);
+      mask = _mm_and_ps(mask, _mm_cmplt_ps(z, old_depth));
+      mask = _mm_and_ps(mask, _mm_and_ps(_mm_cmpge_ps(z, zero), _mm_cmple_ps(z, one)));
+      if(_mm_movemask_ps(mask) == 0){
+        continue;
+      }
+      _mm_storeu_ps(depth_row + row + x, _mm_or_ps(_mm_and_ps(mask, z), _mm_andnot_ps(mask, old_depth)));
+      float *planes[3] = {r_row, g_row, b_row};
+      const float *values[3] = {t.r, t.g, t.b};
+      for(int k=0; k<3; k++){
+        __m128 source = _mm_add_ps(_mm_add_ps(_mm_mul_ps(w0, _mm_set1_ps(values[k][0])),
+                                              _mm_mul_ps(w1, _mm_set1_ps(values[k][1]))),
+                                   _mm_mul_ps(w2, _mm_set1_ps(values[k][2])));
+        __m128 old_color = _mm_loadu_ps(planes[k] + row + x);
+        __m128 blended = _mm_add_ps(_mm_mul_ps(source, src_alpha), _mm_mul_ps(old_color, dst_alpha));
+        _mm_storeu_ps(planes[k] + row + x, _mm_or_ps(_mm_and_ps(mask, blended), _mm_andnot_ps(mask, old_color)));
+      }
+    }
+  }
+#else
+  for(int y=y0; y<=y1; y++){
+    size_t row = (size_t)y * stride;
+    for(int x=x0; x<=x1; x++){
+      float w0 = (e0.a * x + e0.b * y) + e0.c;
+      float w1 = (e1.a * x + e1.b * y) + e1.c;
+      float w2 = (e2.a * x + e2.b * y) + e2.c;
+      if(!e0.inside(w0) || !e1.inside(w1) || !e2.inside(w2)){
+        continue;
+      }
+      w0 *= inverse_area;
+      w1 *= inverse_area;
+      w2 *= inverse_area;
+      float z = w0 * t.z[0] + w1 * t.z[1] + w2 * t.z[2];
+      if(!(z < depth_row[row + x]) || z < 0 || z > 1){
+        continue;
+      }
+      depth_row[row + x] = z;
+      r_row[row + x] = (w0 * t.r[0] + w1 * t.r[1] + w2 * t.r[2]) * alpha + r_row[row + x] * keep;
+      g_row[row + x] = (w0 * t.g[0] + w1 * t.g[1] + w2 * t.g[2]) * alpha + g_row[row + x] * keep;
+      b_row[row + x] = (w0 * t.b[0] + w1 * t.b[1] + w2 * t.b[2]) * alpha + b_row[row + x] * keep;
+    }
+  }
+#endif
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <QImage>
+#include <QMatrix4x4>
+#include <QVector4D>
+#include <vector>
+
+#include "memory_budget.h"
+#include "renderer.h"
+#include "scene.h"
+
+/**
+  * A triangle in screen space, ready for rasterization
+  * Depth and color are interpolated, alpha is constant
+  */
+struct RasterTriangle {
+  float x[3];
+  float y[3];
+  float z[3];
+  float r[3];
+  float g[3];
+  float b[3];
+  float alpha;
+};
+
+/**
+  * Screen triangles set up by one chunk of work and their tile bins
+  * Bins list triangle indices in drawing order
+  */
+class RasterBatch {
+public:
+  std::vector<RasterTriangle> triangles;
+  std::vector<std::vector<unsigned int>> bins;
+};
+
+/**
+  * Draws a scene on the CPU with the same settings as SceneRenderer
+  * Triangles are set up and binned into screen tiles on all cores, then
+  * the tiles are rasterized in parallel with SIMD edge functions and a
+  * depth buffer. Every tile draws its triangles in submission order,
+  * so alpha blending follows the sorted order and the output only
+  * depends on the input, not on the number of threads
+  */
+class SoftwareRenderer {
+public:
+  SoftwareRenderer();
+  QImage render(const Scene &scene, const RenderSettings &settings, int width, int height,
+                const PreparedFrame *frame = 0);
+
+protected:
+  void resize(int new_width, int new_height);
+  void setupTriangles(const Scene &scene, const RenderSettings &settings, const std::vector<SortedTriangle> &order);
+  void setupEdges(const Scene &scene, const RenderSettings &settings);
+  void setupAxes(const RenderSettings &settings);
+  bool toScreen(const QMatrix4x4 &transform, const QVector3D &position, float &x, float &y, float &z) const;
+  void addLine(RasterBatch &batch, const float start[3], const float end[3], const QVector4D &color);
+  void addTriangle(RasterBatch &batch, const RasterTriangle &triangle);
+  void rasterizeTile(int tile);
+  void rasterizeTriangle(const RasterTriangle &triangle, int tile_x, int tile_y);
+
+  int width;
+  int height;
+  int tiles_x;
+  int tiles_y;
+  int stride;
+  std::vector<RasterBatch> batches;
+  std::vector<float> depth;
+  std::vector<float> color;  // r, g and b planes
+  MemoryReservation target_memory;
+  MemoryReservation batch_memory;
+};
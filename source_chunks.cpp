@@ -0,0 +1,63 @@
+#include "source_chunks.h"
+
+#include <cstring>
+
+static const uint64_t FNV_OFFSET = 14695981039346656037ULL;
+static const uint64_t FNV_PRIME = 1099511628211ULL;
+static const unsigned int AVERAGE_FACETS = 64;  // a power of 2
+static const unsigned int MAX_FACETS = 1024;
+
+/**
+  * Check if a line closes a facet
+  */
+static bool isEndFacet(const char *line, size_t length){
+  size_t i = 0;
+  while(i < length && (line[i] == ' ' || line[i] == '\t')){
+    i++;
+  }
+  return length - i >= 8 && memcmp(line + i, "endfacet", 8) == 0;
+}
+
+/**
+  * Split the text of an ASCII STL file into chunks of whole facets
+  * A chunk ends after a facet whose hash has some zero bits, so the
+  * boundaries depend on the facets around them and not on their offsets:
+  * inserting or removing facets only changes the chunks around the edit.
+  * The header belongs to the first chunk, the endsolid line to the last one
+  * Input: const char * - the file contents
+  *        size_t - size of the contents
+  *        std::vector<SourceChunk> - output, the chunks in file order
+  * Output: void
+  */
+void splitStlChunks(const char *data, size_t size, std::vector<SourceChunk> &chunks){
+  chunks.clear();
+  SourceChunk chunk = {0, 0, FNV_OFFSET, 0};
+  uint64_t record = FNV_OFFSET;
+  size_t position = 0;
+  while(position < size){
+    const char *newline = (const char *)memchr(data + position, '\n', size - position);
+    size_t end = newline ? newline - data + 1 : size;
+    for(size_t i = position; i < end; i++){
+      record = (record ^ (unsigned char)data[i]) * FNV_PRIME;
+    }
+    if(isEndFacet(data + position, end - position)){
+      chunk.hash = (chunk.hash ^ record) * FNV_PRIME;
+      chunk.faces++;
+      // The high bits of FNV-1a are mixed better than the low ones
+      bool boundary = ((record >> 40) & (AVERAGE_FACETS - 1)) == 0 || chunk.faces >= MAX_FACETS;
+      record = FNV_OFFSET;
+      if(boundary){
+        chunk.size = end - chunk.offset;
+        chunks.push_back(chunk);
+        SourceChunk next = {end, 0, FNV_OFFSET, 0};
+        chunk = next;
+      }
+    }
+    position = end;
+  }
+  chunk.hash = (chunk.hash ^ record) * FNV_PRIME;
+  chunk.size = size - chunk.offset;
+  if(chunk.size > 0 || chunks.empty()){
+    chunks.push_back(chunk);
+  }
+}
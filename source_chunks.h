@@ -0,0 +1,21 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+  * A run of whole records of a model file and the faces it defines
+  */
+struct SourceChunk {
+  size_t offset;
+  size_t size;
+  uint64_t hash;
+  unsigned int faces;
+
+  bool sameContents(const SourceChunk &other) const {
+    return hash == other.hash && size == other.size && faces == other.faces;
+  }
+};
+
+void splitStlChunks(const char *data, size_t size, std::vector<SourceChunk> &chunks);
@@ -0,0 +1,239 @@
+#include "trace.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+static const uint64_t CAPACITY = 1 << 15;  // events per thread, a power of 2
+
+std::atomic<bool> tracing_enabled(false);
+
+/**
+  * A finished scope, the fields are atomic because
+  * writeTrace() may read a slot while it is overwritten
+  */
+struct TraceEvent {
+  std::atomic<const char *> name;
+  std::atomic<int64_t> begin;
+  std::atomic<int64_t> end;
+};
+
+/**
+  * Ring buffer of a thread, written by that thread only
+  * started counts events begun, written events finished, a reader
+  * throws away slots that may have been reused while it copied them
+  */
+struct TraceBuffer {
+  TraceBuffer(int id) : events(new TraceEvent[CAPACITY]), started(0), written(0), id(id), name(0) {}
+
+  std::unique_ptr<TraceEvent[]> events;
+  std::atomic<uint64_t> started;
+  std::atomic<uint64_t> written;
+  int id;
+  std::atomic<const char *> name;
+};
+
+/**
+  * Buffers of all threads, kept after a thread exits so its events
+  * can still be written, and reused by a new thread once they hold
+  * nothing that would be written
+  */
+struct TraceRegistry {
+  std::mutex mutex;
+  std::vector<std::unique_ptr<TraceBuffer>> buffers;
+  std::vector<TraceBuffer *> free_buffers;
+  int64_t epoch = 0;
+};
+
+static TraceRegistry &registry() {
+  static TraceRegistry instance;
+  return instance;
+}
+
+/**
+  * The buffer of the current thread, taken on its first event
+  */
+struct ThreadTrace {
+  TraceBuffer *buffer = 0;
+  const char *name = 0;
+
+  ~ThreadTrace() {
+    if (buffer) {
+      std::lock_guard<std::mutex> lock(registry().mutex);
+      registry().free_buffers.push_back(buffer);
+    }
+  }
+
+  TraceBuffer &get() {
+    if (!buffer) {
+      TraceRegistry &traces = registry();
+      std::lock_guard<std::mutex> lock(traces.mutex);
+      // Events of an exited thread would be written under the new name
+      // and id, so only buffers whose newest event ended before the
+      // current session are taken over
+      auto stale = std::find_if(traces.free_buffers.begin(), traces.free_buffers.end(), [&](TraceBuffer *free) {
+        uint64_t written = free->written.load();
+        return written == 0 || free->events[(written - 1) & (CAPACITY - 1)].end.load() < traces.epoch;
+      });
+      if (stale != traces.free_buffers.end()) {
+        buffer = *stale;
+        traces.free_buffers.erase(stale);
+      }
+      else {
+        traces.buffers.push_back(std::unique_ptr<TraceBuffer>(new TraceBuffer(traces.buffers.size() + 1)));
+        buffer = traces.buffers.back().get();
+      }
+      buffer->name = name;
+    }
+    return *buffer;
+  }
+};
+
+static thread_local ThreadTrace thread_trace;
+
+/**
+  * Current time of the trace clock
+  * Input: void
+  * Output: int64_t - nanoseconds of a monotonic clock
+  */
+int64_t traceClock() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+           std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/**
+  * Start recording, events from earlier sessions are not written anymore
+  * Input: void
+  * Output: void
+  */
+void startTracing() {
+  {
+    std::lock_guard<std::mutex> lock(registry().mutex);
+    registry().epoch = traceClock();
+  }
+  tracing_enabled.store(true);
+}
+
+/**
+  * Stop recording, the events stay in the buffers
+  * Input: void
+  * Output: void
+  */
+void stopTracing() {
+  tracing_enabled.store(false);
+}
+
+/**
+  * Name the current thread in the trace
+  * Input: const char * - the name, e.g. a string literal
+  * Output: void
+  */
+void setTraceThreadName(const char *name) {
+  thread_trace.name = name;
+  if (thread_trace.buffer) {
+    thread_trace.buffer->name = name;
+  }
+}
+
+/**
+  * Append a finished scope to the buffer of the current thread,
+  * overwriting the oldest event when it is full
+  * Input: const char * - name of the scope
+  *        int64_t, int64_t - trace clock at its start and end
+  * Output: void
+  */
+void recordTraceEvent(const char *name, int64_t begin, int64_t end) {
+  TraceBuffer &buffer = thread_trace.get();
+  uint64_t index = buffer.written.load(std::memory_order_relaxed);
+  buffer.started.store(index + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  TraceEvent &event = buffer.events[index & (CAPACITY - 1)];
+  event.name.store(name, std::memory_order_relaxed);
+  event.begin.store(begin, std::memory_order_relaxed);
+  event.end.store(end, std::memory_order_relaxed);
+  buffer.written.store(index + 1, std::memory_order_release);
+}
+
+struct CopiedEvent {
+  const char *name;
+  int64_t begin;
+  int64_t end;
+};
+
+/**
+  * Copy the finished events of a buffer while its thread keeps recording
+  * Input: TraceBuffer - the buffer
+  *        std::vector<CopiedEvent> - output, events oldest first
+  * Output: void
+  */
+static void copyEvents(TraceBuffer &buffer, std::vector<CopiedEvent> &events) {
+  uint64_t written = buffer.written.load(std::memory_order_acquire);
+  uint64_t first = written > CAPACITY ? written - CAPACITY : 0;
+  events.clear();
+  for (uint64_t i = first; i < written; i++) {
+    const TraceEvent &event = buffer.events[i & (CAPACITY - 1)];
+    CopiedEvent copy = {event.name.load(std::memory_order_relaxed), event.begin.load(std::memory_order_relaxed),
+                        event.end.load(std::memory_order_relaxed)};
+    events.push_back(copy);
+  }
+  // Slots of events started after the copy began may hold newer data
+  std::atomic_thread_fence(std::memory_order_acquire);
+  uint64_t started = buffer.started.load(std::memory_order_relaxed);
+  if (started > CAPACITY && started - CAPACITY > first) {
+    size_t stale = std::min<uint64_t>(started - CAPACITY - first, events.size());
+    events.erase(events.begin(), events.begin() + stale);
+  }
+}
+
+struct CopiedThread {
+  int id;
+  const char *name;
+  std::vector<CopiedEvent> events;
+};
+
+/**
+  * Write the recorded events of all threads as a Chrome trace
+  * The events are copied under the lock of the registry and written
+  * after it is released, so threads can start recording meanwhile
+  * Input: const std::string - path of the JSON file
+  * Output: bool - false if the file can't be written
+  */
+bool writeTrace(const std::string &path) {
+  FILE *file = std::fopen(path.c_str(), "w");
+  if (!file) {
+    return false;
+  }
+  TraceRegistry &traces = registry();
+  std::vector<CopiedThread> threads;
+  int64_t epoch;
+  {
+    std::lock_guard<std::mutex> lock(traces.mutex);
+    epoch = traces.epoch;
+    threads.resize(traces.buffers.size());
+    for (size_t i = 0; i < threads.size(); i++) {
+      TraceBuffer &buffer = *traces.buffers[i];
+      threads[i].id = buffer.id;
+      threads[i].name = buffer.name.load();
+      copyEvents(buffer, threads[i].events);
+    }
+  }
+  std::fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+  bool first = true;
+  for (const CopiedThread &thread : threads) {
+    std::fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+                 first ? "" : ",\n", thread.id, thread.name ? thread.name : "thread");
+    first = false;
+    for (const CopiedEvent &event : thread.events) {
+      if (event.begin < epoch) {
+        continue;
+      }
+      std::fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+                   event.name, thread.id, (event.begin - epoch) / 1e3, (event.end - event.begin) / 1e3);
+    }
+  }
+  std::fprintf(file, "\n]}\n");
+  return std::fclose(file) == 0;
+}
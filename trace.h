@@ -0,0 +1,55 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+/**
+  * Scoped markers for a timeline of loads and frames
+  * Every thread records complete events into its own ring buffer,
+  * only the newest events are kept. The buffers are written in the
+  * Chrome trace-event format, which chrome://tracing and Perfetto open.
+  * A disabled marker costs one relaxed load, building with
+  * NO_TRACING removes the markers entirely
+  */
+
+extern std::atomic<bool> tracing_enabled;
+
+inline bool tracingEnabled() { return tracing_enabled.load(std::memory_order_relaxed); }
+
+void startTracing();
+void stopTracing();
+bool writeTrace(const std::string &path);
+void setTraceThreadName(const char *name);
+int64_t traceClock();
+void recordTraceEvent(const char *name, int64_t begin, int64_t end);
+
+/**
+  * Records the time between its construction and destruction
+  * The name has to outlive the trace, e.g. a string literal
+  */
+class TraceScope {
+public:
+  TraceScope(const char *name) : name(tracingEnabled() ? name : 0), begin(0) {
+    if (this->name)
+      begin = traceClock();
+  }
+  ~TraceScope() {
+    if (name)
+      recordTraceEvent(name, begin, traceClock());
+  }
+  TraceScope(const TraceScope &) = delete;
+  TraceScope &operator=(const TraceScope &) = delete;
+
+protected:
+  const char *name;
+  int64_t begin;
+};
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#ifdef NO_TRACING
+#define TRACE_SCOPE(name)
+#else
+#define TRACE_SCOPE(name) TraceScope TRACE_CONCAT(trace_scope_, __LINE__)(name)
+#endif
@@ -0,0 +1,146 @@
+#include "triangulation.h"
+
+#include <cmath>
+
+/**
+  * Compute the normal of a polygon with Newell's method
+  * Works for non-planar and concave polygons
+  * Input: const std::vector<QVector3D> - vertices of the polygon
+  * Output: QVector3D - unnormalized normal of the polygon
+  */
+QVector3D polygonNormal(const std::vector<QVector3D> &polygon){
+  QVector3D normal(0, 0, 0);
+  int n = polygon.size();
+  for(int i=0; i<n; i++){
+    const QVector3D &current = polygon[i];
+    const QVector3D &next = polygon[(i+1)%n];
+    normal[0] += (current.y() - next.y()) * (current.z() + next.z());
+    normal[1] += (current.z() - next.z()) * (current.x() + next.x());
+    normal[2] += (current.x() - next.x()) * (current.y() + next.y());
+  }
+  return normal;
+}
+
+/**
+  * Check if all corners of a polygon turn in the
+  * direction of its normal
+  * Input: const std::vector<QVector3D> - vertices of the polygon
+  *        const QVector3D - normal of the polygon
+  * Output: bool - true if the polygon is convex
+  */
+bool isConvexPolygon(const std::vector<QVector3D> &polygon, const QVector3D &normal){
+  int n = polygon.size();
+  for(int i=0; i<n; i++){
+    QVector3D edge1 = polygon[(i+1)%n] - polygon[i];
+    QVector3D edge2 = polygon[(i+2)%n] - polygon[(i+1)%n];
+    if(QVector3D::dotProduct(QVector3D::crossProduct(edge1, edge2), normal) < 0){
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+  * Twice the signed area of a 2D triangle
+  */
+static double cross2d(const double *a, const double *b, const double *c){
+  return (b[0] - a[0]) * (c[1] - a[1]) - (b[1] - a[1]) * (c[0] - a[0]);
+}
+
+/**
+  * Check if point p lies inside or on the border of
+  * the counter-clockwise 2D triangle abc
+  */
+static bool insideTriangle(const double *a, const double *b, const double *c, const double *p){
+  return cross2d(a, b, p) >= 0 && cross2d(b, c, p) >= 0 && cross2d(c, a, p) >= 0;
+}
+
+/**
+  * Split a polygon into triangles
+  * Convex polygons are split into a fan, concave polygons
+  * are projected onto their plane and split by ear clipping
+  * Input: const std::vector<QVector3D> - vertices of the polygon
+  *        std::vector<int> - output, three polygon vertex indices per triangle
+  * Output: void
+  */
+void triangulatePolygon(const std::vector<QVector3D> &polygon, std::vector<int> &triangles){
+  int n = polygon.size();
+  if(n < 3){
+    return;
+  }
+  QVector3D normal = polygonNormal(polygon);
+  if(n == 3 || isConvexPolygon(polygon, normal)){
+    for(int i=1; i<n-1; i++){
+      triangles.push_back(0);
+      triangles.push_back(i);
+      triangles.push_back(i+1);
+    }
+    return;
+  }
+
+  // Project onto the plane of the polygon by dropping the dominant axis
+  // of the normal, keeping the projection counter-clockwise
+  int axis = 2;
+  if(std::fabs(normal.x()) > std::fabs(normal.y()) && std::fabs(normal.x()) > std::fabs(normal.z())){
+    axis = 0;
+  }
+  else if(std::fabs(normal.y()) > std::fabs(normal.z())){
+    axis = 1;
+  }
+  int u = (axis + 1) % 3;
+  int v = (axis + 2) % 3;
+  bool flip = normal[axis] < 0;
+  std::vector<double> points(n * 2);
+  for(int i=0; i<n; i++){
+    points[i*2] = polygon[i][u];
+    points[i*2+1] = flip ? -polygon[i][v] : polygon[i][v];
+  }
+
+  std::vector<int> remaining(n);
+  for(int i=0; i<n; i++){
+    remaining[i] = i;
+  }
+  int i = 0;
+  int attempts = 0;
+  while(remaining.size() > 3){
+    int m = remaining.size();
+    int prev = remaining[(i+m-1)%m];
+    int curr = remaining[i%m];
+    int next = remaining[(i+1)%m];
+    const double *a = &points[prev*2];
+    const double *b = &points[curr*2];
+    const double *c = &points[next*2];
+    bool is_ear = cross2d(a, b, c) > 0;
+    for(int k=0; is_ear && k<m; k++){
+      int other = remaining[k];
+      if(other != prev && other != curr && other != next &&
+         insideTriangle(a, b, c, &points[other*2])){
+        is_ear = false;
+      }
+    }
+    if(is_ear){
+      triangles.push_back(prev);
+      triangles.push_back(curr);
+      triangles.push_back(next);
+      remaining.erase(remaining.begin() + i%m);
+      attempts = 0;
+    }
+    else{
+      i++;
+      attempts++;
+    }
+    if(attempts > (int)remaining.size()){
+      // Self-intersecting or degenerate polygon, fall back to a fan
+      // over whatever is left
+      for(int k=1; k<(int)remaining.size()-1; k++){
+        triangles.push_back(remaining[0]);
+        triangles.push_back(remaining[k]);
+        triangles.push_back(remaining[k+1]);
+      }
+      return;
+    }
+  }
+  triangles.push_back(remaining[0]);
+  triangles.push_back(remaining[1]);
+  triangles.push_back(remaining[2]);
+}
@@ -0,0 +1,8 @@
+#pragma once
+
+#include <QVector3D>
+#include <vector>
+
+QVector3D polygonNormal(const std::vector<QVector3D> &polygon);
+bool isConvexPolygon(const std::vector<QVector3D> &polygon, const QVector3D &normal);
+void triangulatePolygon(const std::vector<QVector3D> &polygon, std::vector<int> &triangles);
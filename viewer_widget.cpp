@@ -1,29 +1,72 @@
 #include "viewer_widget.h"
 
+#include <QDialog>
 #include <QFileDialog>
+#include <QFontDatabase>
+#include <QInputDialog>
+#include <QPlainTextEdit>
+#include <QVBoxLayout>
+
+#include "memory_budget.h"
 
 ViewerWidget::ViewerWidget() {
   layout = new QGridLayout(this);
   load_file_button = new QPushButton("Load file");
+  add_file_button = new QPushButton("Add file");
+  mass_properties_button = new QPushButton("Mass properties");
+  compare_button = new QPushButton("Compare with reference");
   enable_sorting_checkbox = new QCheckBox("Sorting");
   enable_drawing_edges = new QCheckBox("Show edges");
   enable_colorization = new QCheckBox("Colorize");
   show_axes = new QCheckBox("Show axes");
+  enable_shading = new QCheckBox("Shading");
+  reload_on_change = new QCheckBox("Reload on change");
+  show_deviations = new QCheckBox("Show deviations");
+  show_deviations->setEnabled(false);
+  enable_occlusion_culling = new QCheckBox("Occlusion culling");
   alpha_slider = new QSlider(Qt::Horizontal);
+  memory_label = new QLabel();
+  occlusion_label = new QLabel();
+  trace_label = new QLabel();
+  memory_timer = new QTimer(this);
   gl_widget = new GLWidget();
   layout->addWidget(load_file_button, 0, 0);
-  layout->addWidget(gl_widget, 1, 0);
-  layout->addWidget(alpha_slider,2,0);
-  layout->addWidget(enable_sorting_checkbox, 3,0);
-  layout->addWidget(enable_drawing_edges, 4,0);
-  layout->addWidget(enable_colorization, 5,0);
-  layout->addWidget(show_axes, 6,0);
+  layout->addWidget(add_file_button, 1, 0);
+  layout->addWidget(gl_widget, 2, 0);
+  layout->addWidget(alpha_slider,3,0);
+  layout->addWidget(enable_sorting_checkbox, 4,0);
+  layout->addWidget(enable_drawing_edges, 5,0);
+  layout->addWidget(enable_colorization, 6,0);
+  layout->addWidget(show_axes, 7,0);
+  layout->addWidget(enable_shading, 8,0);
+  layout->addWidget(reload_on_change, 9,0);
+  layout->addWidget(memory_label, 10,0);
+  layout->addWidget(mass_properties_button, 11,0);
+  layout->addWidget(compare_button, 12,0);
+  layout->addWidget(show_deviations, 13,0);
+  layout->addWidget(enable_occlusion_culling, 14,0);
+  layout->addWidget(occlusion_label, 15,0);
+  layout->addWidget(trace_label, 16,0);
   connect(load_file_button, SIGNAL(released()), this, SLOT(loadFile()));
+  connect(add_file_button, SIGNAL(released()), this, SLOT(addFile()));
+  connect(mass_properties_button, SIGNAL(released()), this, SLOT(showMassProperties()));
+  connect(compare_button, SIGNAL(released()), this, SLOT(compareWithReference()));
   connect(alpha_slider, SIGNAL(valueChanged(int)), this, SLOT(updateAlpha()));
   connect(enable_sorting_checkbox, SIGNAL(stateChanged(int)), this, SLOT(enableSorting()));
   connect(enable_drawing_edges, SIGNAL(stateChanged(int)), this, SLOT(enableDrawingEdges()));
   connect(enable_colorization, SIGNAL(stateChanged(int)), this, SLOT(enableColorization()));
   connect(show_axes, SIGNAL(stateChanged(int)), this, SLOT(showAxes()));
+  connect(enable_shading, SIGNAL(stateChanged(int)), this, SLOT(enableShading()));
+  connect(reload_on_change, SIGNAL(stateChanged(int)), this, SLOT(enableReloading()));
+  connect(show_deviations, SIGNAL(stateChanged(int)), this, SLOT(showDeviations()));
+  connect(enable_occlusion_culling, SIGNAL(stateChanged(int)), this, SLOT(enableOcclusionCulling()));
+  connect(memory_timer, SIGNAL(timeout()), this, SLOT(updateMemoryUsage()));
+  connect(memory_timer, SIGNAL(timeout()), this, SLOT(updateOcclusionStatistics()));
+  connect(memory_timer, SIGNAL(timeout()), this, SLOT(updateTraceStatus()));
+  memory_timer->start(1000);
+  updateMemoryUsage();
+  updateOcclusionStatistics();
+  updateTraceStatus();
   alpha_slider->setValue(100);
   _aspectRatio = 1;
   _min_size = 400;
@@ -33,10 +76,67 @@ void ViewerWidget::loadFile() {
   QString file_name;
   file_name = QFileDialog::getOpenFileName(this,
         tr("Open model"), "",
-        tr("Model files (*.json *.stl *.obj);;All Files (*)"));
+        tr("Model files (*.json *.stl *.obj *.ply *.gz *.zst *.scene *.pages);;All Files (*)"));
   gl_widget->loadFaces(file_name);
 }
 
+void ViewerWidget::addFile() {
+  QString file_name;
+  file_name = QFileDialog::getOpenFileName(this,
+        tr("Add model"), "",
+        tr("Model files (*.json *.stl *.obj *.ply *.gz *.zst *.pages);;All Files (*)"));
+  if(!file_name.isEmpty()){
+    gl_widget->addFaces(file_name);
+  }
+}
+
+void ViewerWidget::showMassProperties() {
+  showReport("Mass properties", gl_widget->massPropertiesReport());
+}
+
+/**
+  * Pick a reference model, color the loaded models by their
+  * distance to it and show the statistics
+  */
+void ViewerWidget::compareWithReference() {
+  QString file_name = QFileDialog::getOpenFileName(this,
+        tr("Open reference"), "",
+        tr("Model files (*.json *.stl *.obj *.ply *.gz *.zst);;All Files (*)"));
+  if(file_name.isEmpty()){
+    return;
+  }
+  QStringList modes;
+  modes << "Per vertex" << "Per face";
+  bool accepted = false;
+  QString mode = QInputDialog::getItem(this, tr("Deviations"), tr("Measure the distance"), modes, 0, false, &accepted);
+  if(!accepted || !gl_widget->compareWith(file_name, mode == modes[1])){
+    return;
+  }
+  show_deviations->setEnabled(true);
+  show_deviations->setChecked(true);
+  showReport("Deviations", gl_widget->deviationReport());
+}
+
+void ViewerWidget::showDeviations(){
+  gl_widget->showDeviations(show_deviations->checkState() == Qt::Checked);
+}
+
+/**
+  * Show a text report in a modal window
+  */
+void ViewerWidget::showReport(const QString &title, const QString &text) {
+  QDialog dialog(this);
+  dialog.setWindowTitle(title);
+  QPlainTextEdit *text_edit = new QPlainTextEdit(text);
+  text_edit->setReadOnly(true);
+  text_edit->setLineWrapMode(QPlainTextEdit::NoWrap);
+  text_edit->setFont(QFontDatabase::systemFont(QFontDatabase::FixedFont));
+  QVBoxLayout *dialog_layout = new QVBoxLayout(&dialog);
+  dialog_layout->addWidget(text_edit);
+  dialog.resize(1000, 400);
+  dialog.exec();
+}
+
 void ViewerWidget::updateAlpha(){
   gl_widget->updateAlpha(alpha_slider->value()/100.0);
 }
@@ -61,6 +161,20 @@ void ViewerWidget::showAxes(){
   }
 }
 
+void ViewerWidget::enableShading(){
+  if(enable_shading->checkState() == Qt::Checked)
+  {
+    gl_widget->enableShading(true);
+  }
+  else{
+    gl_widget->enableShading(false);
+  }
+}
+
+void ViewerWidget::enableReloading(){
+  gl_widget->enableWatching(reload_on_change->checkState() == Qt::Checked);
+}
+
 void ViewerWidget::enableDrawingEdges(){
   if(enable_drawing_edges->checkState() == Qt::Checked)
   {
@@ -81,6 +195,33 @@ void ViewerWidget::enableColorization(){
   }
 }
 
+/**
+  * Show the memory of every subsystem, its peak and the budget
+  */
+void ViewerWidget::updateMemoryUsage(){
+  QString text = QString::fromStdString(memoryReport());
+  memory_label->setText("Memory - " + text.replace("\n", ", "));
+}
+
+void ViewerWidget::enableOcclusionCulling(){
+  gl_widget->enableOcclusionCulling(enable_occlusion_culling->checkState() == Qt::Checked);
+  updateOcclusionStatistics();
+}
+
+/**
+  * Show how many clusters of faces the last frame culled and drew
+  */
+void ViewerWidget::updateOcclusionStatistics(){
+  occlusion_label->setText(gl_widget->occlusionReport());
+}
+
+/**
+  * Show whether a trace is being recorded and where the last one was saved
+  */
+void ViewerWidget::updateTraceStatus(){
+  trace_label->setText(gl_widget->traceReport());
+}
+
 void ViewerWidget::resizeEvent(QResizeEvent *event){
     int containerWidth = this->width();
     int containerHeight = this->height();
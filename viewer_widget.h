@@ -6,6 +6,7 @@
 #include <QCheckBox>
 #include <QLabel>
 #include <QString>
+#include <QTimer>
 
 #include "glwidget.h"
 
@@ -17,18 +18,32 @@ public:
   void resizeEvent(QResizeEvent *event) override;
   void updateParams(QString text);
   QGridLayout *layout;
-  QPushButton *load_file_button;
+  QPushButton *load_file_button, *add_file_button, *mass_properties_button, *compare_button;
   GLWidget *gl_widget;
   QSlider *alpha_slider;
-  QCheckBox *enable_sorting_checkbox, *enable_drawing_edges, *enable_colorization, *show_axes;
+  QLabel *memory_label, *occlusion_label, *trace_label;
+  QTimer *memory_timer;
+  QCheckBox *enable_sorting_checkbox, *enable_drawing_edges, *enable_colorization, *show_axes, *enable_shading,
+            *reload_on_change, *show_deviations, *enable_occlusion_culling;
 public slots:
   void loadFile();
+  void addFile();
   void updateAlpha();
   void enableDrawingEdges();
   void enableSorting();
   void enableColorization();
   void showAxes();
+  void enableShading();
+  void enableReloading();
+  void showMassProperties();
+  void compareWithReference();
+  void showDeviations();
+  void enableOcclusionCulling();
+  void updateMemoryUsage();
+  void updateOcclusionStatistics();
+  void updateTraceStatus();
 private:
+  void showReport(const QString &title, const QString &text);
   double _aspectRatio;
   double _min_size;
 };